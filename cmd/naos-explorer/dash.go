@@ -372,13 +372,22 @@ func (d *dashboard) refreshMetrics() {
 	// get metrics service
 	ms := d.device.MetricsService()
 
+	// read all values at once
+	all, allErr := ms.ReadAll()
+
 	// prepare rows
 	var rows []metricRow
 	for info, layout := range ms.All() {
-		var values []float64
+		var formatted string
 		var err error
-		values, err = ms.Read(info.Name)
-		formatted := formatMetricValues(values)
+		if info.Kind == msg.MetricKindHistogram {
+			var histograms []msg.MetricHistogram
+			histograms, err = ms.ReadHistograms(info.Name)
+			formatted = formatMetricHistograms(histograms)
+		} else {
+			err = allErr
+			formatted = formatMetricValues(all[info.Name])
+		}
 		rows = append(rows, metricRow{
 			info:   info,
 			layout: layout,
@@ -847,13 +856,14 @@ func (d *dashboard) deleteCoredump() {
 }
 
 func (d *dashboard) performTrace() {
-	// build options form with all records enabled by default
+	// build options form with all records but heap allocations enabled by default
 	form := tview.NewForm()
 	form.AddCheckbox("Core 0 switches", true, nil)
 	form.AddCheckbox("Core 1 switches", true, nil)
 	form.AddCheckbox("Events", true, nil)
 	form.AddCheckbox("Values", true, nil)
 	form.AddCheckbox("Spans", true, nil)
+	form.AddCheckbox("Heap", false, nil)
 
 	// helper to read a checkbox state
 	checked := func(label string) bool {
@@ -878,6 +888,9 @@ func (d *dashboard) performTrace() {
 		if checked("Spans") {
 			flags |= msg.TraceSpans
 		}
+		if checked("Heap") {
+			flags |= msg.TraceHeap
+		}
 		d.pages.RemovePage("trace-options")
 		d.recordTrace(flags)
 	})
@@ -1003,21 +1016,31 @@ func (d *dashboard) recordTrace(flags msg.TraceFlags) {
 				dropped = status.Dropped
 			}
 
-			// generate Perfetto JSON
-			jsonData, err := msg.GeneratePerfetto(taskNames, labels, allEvents)
+			// write raw trace file
+			safeID := strings.ReplaceAll(d.device.ID(), "/", "-")
+			base := fmt.Sprintf("trace-%s-%s", safeID, time.Now().Format("20060102-150405"))
+			err = os.WriteFile(base+".ntrace", msg.EncodeTrace(taskNames, labels, allEvents), 0644)
 			if err != nil {
-				return fmt.Errorf("generate json: %w", err)
+				return fmt.Errorf("write file: %w", err)
 			}
 
-			// write file
-			safeID := strings.ReplaceAll(d.device.ID(), "/", "-")
-			filename := fmt.Sprintf("trace-%s-%s.json", safeID, time.Now().Format("20060102-150405"))
-			err = os.WriteFile(filename, jsonData, 0644)
+			// write Perfetto trace file
+			filename := base + ".pftrace"
+			file, err := os.Create(filename)
 			if err != nil {
-				return fmt.Errorf("write file: %w", err)
+				return fmt.Errorf("create file: %w", err)
+			}
+			err = msg.WritePerfetto(file, taskNames, labels, allEvents)
+			if err == nil {
+				err = file.Close()
+			} else {
+				_ = file.Close()
+			}
+			if err != nil {
+				return fmt.Errorf("write perfetto: %w", err)
 			}
 
-			d.log("Trace saved to %s (%d events, %d dropped)", filename, len(allEvents), dropped)
+			d.log("Trace saved to %s.ntrace and %s (%d events, %d dropped)", base, filename, len(allEvents), dropped)
 			return nil
 		}()
 		if err != nil {
@@ -91,6 +91,8 @@ func metricKindString(k msg.MetricKind) string {
 		return "Counter"
 	case msg.MetricKindGauge:
 		return "Gauge"
+	case msg.MetricKindHistogram:
+		return "Histogram"
 	default:
 		return "Unknown"
 	}
@@ -142,6 +144,21 @@ func formatMetricValues(values []float64) string {
 	return strings.Join(parts, ", ")
 }
 
+func formatMetricHistograms(histograms []msg.MetricHistogram) string {
+	if len(histograms) == 0 {
+		return "-"
+	}
+	var parts []string
+	for i, h := range histograms {
+		if i >= 2 {
+			parts = append(parts, "…")
+			break
+		}
+		parts = append(parts, fmt.Sprintf("n=%d p50=%.0f p99=%.0f", h.Count(), h.Quantile(0.5), h.Quantile(0.99)))
+	}
+	return strings.Join(parts, ", ")
+}
+
 func humanDuration(d time.Duration) string {
 	if d < time.Millisecond {
 		return "0s"
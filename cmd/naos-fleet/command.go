@@ -40,14 +40,16 @@ Usage:
   naos-fleet monitor [<pattern>]
   naos-fleet record [<pattern>]
   naos-fleet debug [<pattern>] [--delete] [--jobs=<count>]
-  naos-fleet update <version> <file> [<pattern>] [--jobs=<count>]
+  naos-fleet update <version> <file> [<pattern>] [--jobs=<count> --multicast --interval=<time>]
   naos-fleet help
 
 Options:
   --clear               Remove not available devices from fleet.
   --delete              Delete loaded coredumps from the devices.
   -d --duration=<time>  Operation duration [default: 5s].
+  -i --interval=<time>  Interval between multicast chunks [default: 50ms].
   -j --jobs=<count>     Number of simultaneous jobs [default: 10].
+  --multicast           Publish the firmware once to all devices.
 `
 
 type command struct {
@@ -75,10 +77,12 @@ type command struct {
 	aFile    string
 
 	// options
-	oClear    bool
-	oDelete   bool
-	oDuration time.Duration
-	oJobs     int
+	oClear     bool
+	oDelete    bool
+	oDuration  time.Duration
+	oInterval  time.Duration
+	oJobs      int
+	oMulticast bool
 }
 
 func parseCommand() *command {
@@ -110,10 +114,12 @@ func parseCommand() *command {
 		aFile:    getString(a["<file>"]),
 
 		// options
-		oClear:    getBool(a["--clear"]),
-		oDelete:   getBool(a["--delete"]),
-		oDuration: getDuration(a["--duration"]),
-		oJobs:     getInt(a["--jobs"]),
+		oClear:     getBool(a["--clear"]),
+		oDelete:    getBool(a["--delete"]),
+		oDuration:  getDuration(a["--duration"]),
+		oInterval:  getDuration(a["--interval"]),
+		oJobs:      getInt(a["--jobs"]),
+		oMulticast: getBool(a["--multicast"]),
 	}
 }
 
@@ -348,8 +348,8 @@ func update(cmd *command, f *fleet.Fleet) {
 	// prepare list
 	list := make(map[*fleet.Device]fleet.UpdateStatus)
 
-	// update devices
-	err = f.Update(cmd.aVersion, cmd.aPattern, binary, cmd.oJobs, func(d *fleet.Device, us fleet.UpdateStatus) {
+	// prepare callback
+	callback := func(d *fleet.Device, us fleet.UpdateStatus) {
 		// save status
 		list[d] = us
 
@@ -370,6 +370,13 @@ func update(cmd *command, f *fleet.Fleet) {
 
 		// show table
 		tbl.show(0)
-	})
+	}
+
+	// update devices
+	if cmd.oMulticast {
+		err = f.MulticastUpdate(cmd.aVersion, cmd.aPattern, binary, cmd.oJobs, cmd.oInterval, callback)
+	} else {
+		err = f.Update(cmd.aVersion, cmd.aPattern, binary, cmd.oJobs, callback)
+	}
 	exitIfSet(err)
 }
@@ -24,6 +24,7 @@ Project Management:
 Utilities:
   sdks     List installed SDKs with their versions and location.
   debug    Parse and print a coredump analysis.
+  trace    Analyze a trace file and convert it to Perfetto.
   help     Show this help message.
 
 Usage:
@@ -37,8 +38,9 @@ Usage:
   naos exec [--] <command> [<args>...]
   naos config <file> [<device>] [--baud=<rate>]
   naos format
-  naos bundle [<file>] [--add-debug]
+  naos bundle [<file>] [--add-debug --base=<bundle>]
   naos debug [<file>] [--elf=<file>]
+  naos trace <file> [--perfetto=<file>]
   naos sdks [--remove=<version>]
   naos help
 
@@ -52,7 +54,9 @@ Options:
   --alt              Use alternative esptool.py found in PATH.
   --no-reset         Do not reset the device when attaching.
   --add-debug        Add debug ELF file to bundle.
+  --base=<bundle>    Add a delta update patch against a previous bundle.
   --elf=<file>       The ELF file for coredump analysis.
+  --perfetto=<file>  Write the trace as a Perfetto protobuf file.
   --remove=<version> Remove the SDKs installed for the specified version.
   -b --baud=<rate>   The baud rate.
 `
@@ -71,6 +75,7 @@ type command struct {
 	cFormat  bool
 	cBundle  bool
 	cDebug   bool
+	cTrace   bool
 	cSDKs    bool
 	cHelp    bool
 
@@ -90,8 +95,10 @@ type command struct {
 	oAppOnly     bool
 	oAlt         bool
 	oAddDebug    bool
+	oBase        string
 	oNoReset     bool
 	oELF         string
+	oPerfetto    string
 	oRemove      string
 }
 
@@ -113,6 +120,7 @@ func parseCommand() *command {
 		cFormat:  getBool(a["format"]),
 		cBundle:  getBool(a["bundle"]),
 		cDebug:   getBool(a["debug"]),
+		cTrace:   getBool(a["trace"]),
 		cSDKs:    getBool(a["sdks"]),
 		cHelp:    getBool(a["help"]),
 
@@ -133,7 +141,9 @@ func parseCommand() *command {
 		oAlt:         getBool(a["--alt"]),
 		oNoReset:     getBool(a["--no-reset"]),
 		oAddDebug:    getBool(a["--add-debug"]),
+		oBase:        getString(a["--base"]),
 		oELF:         getString(a["--elf"]),
+		oPerfetto:    getString(a["--perfetto"]),
 		oRemove:      getString(a["--remove"]),
 	}
 }
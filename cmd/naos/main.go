@@ -4,7 +4,10 @@ import (
 	"fmt"
 	"os"
 	"path/filepath"
+	"strconv"
+	"time"
 
+	"github.com/256dpi/naos/pkg/msg"
 	"github.com/256dpi/naos/pkg/naos"
 	"github.com/256dpi/naos/pkg/sdk"
 	"github.com/256dpi/naos/pkg/serial"
@@ -39,6 +42,8 @@ func main() {
 		bundle(cmd, getProject())
 	} else if cmd.cDebug {
 		debug(cmd, getProject())
+	} else if cmd.cTrace {
+		trace(cmd)
 	} else if cmd.cSDKs {
 		sdks(cmd)
 	} else if cmd.cHelp {
@@ -120,7 +125,7 @@ func format(_ *command, p *naos.Project) {
 
 func bundle(cmd *command, p *naos.Project) {
 	// bundle project
-	exitIfSet(p.Bundle(cmd.aFile, cmd.oAddDebug, os.Stdout))
+	exitIfSet(p.Bundle(cmd.aFile, cmd.oAddDebug, cmd.oBase, os.Stdout))
 }
 
 func debug(cmd *command, p *naos.Project) {
@@ -153,6 +158,88 @@ func debug(cmd *command, p *naos.Project) {
 	exitIfSet(err)
 }
 
+func trace(cmd *command) {
+	// read and decode trace file
+	buf, err := os.ReadFile(cmd.aFile)
+	exitIfSet(err)
+	data, err := msg.DecodeTrace(buf)
+	exitIfSet(err)
+
+	// prepare tables
+	tasks := map[uint8]string{}
+	for _, t := range data.Tasks {
+		tasks[t.ID] = t.Name
+	}
+	labels := map[uint8]string{}
+	for _, l := range data.Labels {
+		labels[l.ID] = l.Text
+	}
+
+	// analyze trace
+	analysis := msg.AnalyzeTrace(tasks, labels, data.Events)
+	fmt.Printf("Trace: %d events over %s\n\n", len(data.Events), time.Duration(analysis.End-analysis.Start)*time.Microsecond)
+
+	// show CPU time
+	tbl := newTable("CORE", "TASK", "TIME", "SHARE", "SWITCHES")
+	for _, c := range analysis.CPU {
+		tbl.add(strconv.Itoa(int(c.Core)), c.Name, formatMicros(c.Time), fmt.Sprintf("%.1f%%", c.Share*100), strconv.Itoa(c.Switches))
+	}
+	tbl.show(-1)
+	fmt.Println()
+
+	// show scheduling latencies
+	if len(analysis.Latency) > 0 {
+		tbl = newTable("TASK", "COUNT", "P50", "P90", "P99", "MAX")
+		for _, l := range analysis.Latency {
+			tbl.add(l.Name, strconv.Itoa(l.Count), formatMicros(l.P50), formatMicros(l.P90), formatMicros(l.P99), formatMicros(l.Max))
+		}
+		tbl.show(-1)
+		fmt.Println()
+	}
+
+	// show span durations
+	if len(analysis.Spans) > 0 {
+		tbl = newTable("SPAN", "COUNT", "TOTAL", "MIN", "P50", "P90", "P99", "MAX", "HISTOGRAM")
+		for _, s := range analysis.Spans {
+			tbl.add(s.Category+"/"+s.Name, strconv.Itoa(s.Count), formatMicros(s.Total), formatMicros(s.Min), formatMicros(s.P50), formatMicros(s.P90), formatMicros(s.P99), formatMicros(s.Max), formatHistogram(s.Histogram))
+		}
+		tbl.show(-1)
+		fmt.Println()
+	}
+
+	// show counters
+	if len(analysis.Counters) > 0 {
+		tbl = newTable("COUNTER", "COUNT", "MIN", "MAX", "MEAN", "LAST")
+		for _, c := range analysis.Counters {
+			tbl.add(c.Category+"/"+c.Name, strconv.Itoa(c.Count), strconv.Itoa(int(c.Min)), strconv.Itoa(int(c.Max)), fmt.Sprintf("%.2f", c.Mean), strconv.Itoa(int(c.Last)))
+		}
+		tbl.show(-1)
+		fmt.Println()
+	}
+
+	// show heap hotspots
+	if len(analysis.Hotspots) > 0 {
+		tbl = newTable("CALLER", "COUNT", "BYTES", "LIVE")
+		for _, h := range analysis.Hotspots {
+			tbl.add(fmt.Sprintf("0x%08x", h.Caller), strconv.Itoa(h.Count), strconv.FormatUint(h.Bytes, 10), strconv.FormatInt(h.Live, 10))
+		}
+		tbl.show(-1)
+		fmt.Println()
+	}
+
+	// write Perfetto trace if requested
+	if cmd.oPerfetto != "" {
+		file, err := os.Create(cmd.oPerfetto)
+		exitIfSet(err)
+		err = msg.WritePerfetto(file, tasks, labels, data.Events)
+		if err == nil {
+			err = file.Close()
+		}
+		exitIfSet(err)
+		fmt.Printf("Perfetto trace written to %s\n", cmd.oPerfetto)
+	}
+}
+
 func sdks(cmd *command) {
 	// remove the specified version
 	if cmd.oRemove != "" {
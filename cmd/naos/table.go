@@ -4,6 +4,7 @@ import (
 	"bytes"
 	"fmt"
 	"sort"
+	"unicode/utf8"
 )
 
 type table struct {
@@ -38,7 +39,7 @@ func (t *table) string() string {
 	// get max cell lengths
 	for _, v := range t.data {
 		for i, cell := range v {
-			max(&lengths[i], len(cell))
+			max(&lengths[i], utf8.RuneCountInString(cell))
 		}
 	}
 
@@ -95,7 +96,7 @@ func makeRow(cells []string, lengths []int) string {
 
 		// fill to right
 		if i < len(cells)-1 {
-			buf.Write(bytes.Repeat([]byte(" "), lengths[i]-len(cell)))
+			buf.Write(bytes.Repeat([]byte(" "), lengths[i]-utf8.RuneCountInString(cell)))
 		}
 
 		// add padding
@@ -3,6 +3,8 @@ package main
 import (
 	"fmt"
 	"os"
+	"strings"
+	"time"
 
 	"github.com/256dpi/naos/pkg/naos"
 )
@@ -33,3 +35,23 @@ func getProject() *naos.Project {
 
 	return p
 }
+
+func formatMicros(us uint64) string {
+	return (time.Duration(us) * time.Microsecond).String()
+}
+
+func formatHistogram(buckets []int) string {
+	// list non-empty buckets by their upper bound
+	var list []string
+	for i, count := range buckets {
+		if count == 0 {
+			continue
+		} else if i == 0 {
+			list = append(list, fmt.Sprintf("0:%d", count))
+		} else {
+			list = append(list, fmt.Sprintf("<%s:%d", formatMicros(1<<i), count))
+		}
+	}
+
+	return strings.Join(list, " ")
+}
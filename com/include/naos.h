@@ -218,6 +218,15 @@ typedef struct {
    */
   int loop_interval;
 
+  /**
+   * If set, the loop callback is run at a fixed rate using absolute deadlines instead of waiting the interval after
+   * each run. Runs that miss their deadline are counted in the "loop-overruns" metric, run on the next tick and
+   * restart the schedule. The wake-up lateness is recorded in the "loop-jitter" metric.
+   *
+   * @note The interval is rounded down to the FreeRTOS tick period.
+   */
+  bool loop_fixed_rate;
+
   /**
    * The offline callback is called once the device becomes offline.
    */
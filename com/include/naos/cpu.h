@@ -2,12 +2,19 @@
 #define NAOS_CPU_H
 
 /**
- * Initialize the CPU usage monitor.
+ * Initialize the CPU usage monitor. If CONFIG_NAOS_CPU_TASK_INTERVAL is set,
+ * the CPU usage and free stack of each task are additionally sampled and
+ * exposed as the "task-cpu-usage" and "task-stack-free" metrics. Up to 15
+ * tasks are tracked individually in the slots "slot-0" to "slot-14", the
+ * usage of all other tasks is accounted as "other". Slots are reused when
+ * tasks are deleted, the comma separated task names of the slots are
+ * published by the "task-slots" parameter, with free slots left empty.
  */
 void naos_cpu_init();
 
 /**
- * Get the CPU usage of the two cores.
+ * Get the CPU usage of the two cores. On single-core targets, the usage of
+ * the second core is zero.
  */
 void naos_cpu_get(float *cpu0, float *cpu1);
 
@@ -1,6 +1,10 @@
 #ifndef NAOS_FS_H
 #define NAOS_FS_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
 /**
  * Mount a "data/fat" partition as a FAT filesystem.
  *
@@ -27,7 +31,78 @@ typedef struct {
 
 /**
  * Install the FS endpoint.
+ *
+ * Note: Commands are processed sequentially by a dedicated "naos-fs" task so
+ * that blocking file I/O does not stall other endpoints. Sequential writes are
+ * buffered and flushed in blocks of CONFIG_NAOS_FS_BUFFER_SIZE, which is why
+ * the size reported for an open file may lag behind until it is closed.
+ * Archives are extracted into a "<dir>.extract" staging directory that replaces
+ * the target directory once the upload is closed. Files opened by handle share
+ * a table of CONFIG_NAOS_FS_MAX_FILES entries across all sessions, the
+ * max_files of the mounted filesystem should be at least as large.
  */
 void naos_fs_install(naos_fs_config_t cfg);
 
+typedef struct naos_fs_log naos_fs_log_t;
+
+typedef struct {
+  /**
+   * The log name used by the FS endpoint to fetch records.
+   */
+  const char *name;
+
+  /**
+   * The directory that holds the segment files.
+   */
+  const char *path;
+
+  /**
+   * The size of a segment file in bytes.
+   */
+  size_t segment_size;
+
+  /**
+   * The number of segments in the ring (at least 2).
+   */
+  size_t segments;
+
+  /**
+   * The size of the RAM append buffer in bytes.
+   */
+  size_t buffer_size;
+} naos_fs_log_config_t;
+
+/**
+ * Open an append-only record log. The segment files are preallocated on first
+ * use and reused in a ring, the oldest segment is overwritten once all
+ * segments are full. Records are numbered sequentially and stamped with the
+ * current time in milliseconds since the epoch.
+ *
+ * Note: Logs should be opened during initialization as they cannot be closed.
+ *
+ * @param cfg The log configuration.
+ * @return The log or NULL on failure.
+ */
+naos_fs_log_t *naos_fs_log_open(naos_fs_log_config_t cfg);
+
+/**
+ * Append a record to the log. The record is buffered in RAM and written with
+ * other records once the buffer is full or the log is flushed.
+ *
+ * @param log The log.
+ * @param data The record data.
+ * @param len The record length (at most 65535 bytes).
+ * @return The record sequence number or zero on failure.
+ */
+uint32_t naos_fs_log_append(naos_fs_log_t *log, const void *data, size_t len);
+
+/**
+ * Write all buffered records to the log. If writing fails, the records stay
+ * buffered and are written by the next flush or append.
+ *
+ * @param log The log.
+ * @return Whether the records have been written.
+ */
+bool naos_fs_log_flush(naos_fs_log_t *log);
+
 #endif // NAOS_FS_H
@@ -12,6 +12,10 @@ typedef struct {
   // enabled so a client that vanishes without a clean close is detected and its
   // socket reclaimed; set this to keep the previous always-persist behaviour.
   bool no_keep_alive;
+
+  // Serve all metrics in the OpenMetrics text format at "/metrics" for direct
+  // scraping by Prometheus. The route takes precedence over served files.
+  bool metrics;
 } naos_http_config_t;
 
 /**
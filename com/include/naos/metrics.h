@@ -2,15 +2,16 @@
 #define NAOS_METRICS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * NAOS METRICS SYSTEM
  * ===================
  *
  * The metrics system provides a mechanism for collecting device metrics.
- * Metrics are defined by a name, kind, and type. Supported are counters and
- * gauges, with long and double values as types. Metrics can be collected via
- * the exposed control plane endpoint.
+ * Metrics are defined by a name, kind, and type. Supported are counters,
+ * gauges and histograms, with long and double values as types. Metrics can be
+ * collected via the exposed control plane endpoint.
  *
  * Metrics define either a single scalar value or a set of values. The set
  * is defined by a list of keys with a corresponding list of values. That way
@@ -40,14 +41,60 @@
  *      "rx", "tx"
  *    },
  *  }
+ *
+ * Values may be written directly by a single task. Values that are updated
+ * from multiple tasks or cores should be updated using `naos_metric_add()`
+ * and `naos_metric_set()`, which are atomic and may also be called from
+ * interrupts. Long and float values are updated lock-free, double values
+ * briefly enter a critical section. Reads snapshot the values so that they
+ * are never torn.
+ *
+ * Histograms record the distribution of long values in fixed exponential
+ * buckets. Bucket 0 counts values below one and bucket i counts values in
+ * the range [2^(i-1), 2^i). Along with the buckets, the sum of all observed
+ * values is recorded. Each value of a histogram metric is a
+ * `naos_metric_histogram_t` that is updated using `naos_metric_observe()`,
+ * which briefly enters a critical section to update the 64-bit sum and may be
+ * called from any task or core:
+ *
+ *  static naos_metric_histogram_t handler_time = {0};
+ *  static naos_metric_t metric = {
+ *    .name = "handler-time",
+ *    .kind = NAOS_METRIC_HISTOGRAM,
+ *    .type = NAOS_METRIC_LONG,
+ *    .data = &handler_time,
+ *  };
+ *
+ *  naos_metric_observe(&metric, 0, elapsed_us);
+ *
+ * Counters and gauges may optionally keep a history in memory (PSRAM if
+ * available) that can be fetched later via the endpoint. The history is
+ * defined by up to `NAOS_METRIC_TIERS` tiers of increasing periods. The first
+ * tier samples the values and each following tier downsamples the samples of
+ * the first tier. Gauges are averaged, counters keep the last value. The
+ * periods of the following tiers must be multiples of the first period:
+ *
+ *  static naos_metric_t metric = {
+ *    .name = "temperature",
+ *    .kind = NAOS_METRIC_GAUGE,
+ *    .type = NAOS_METRIC_DOUBLE,
+ *    .data = &temperature,
+ *    .history = {
+ *      {.period = 1000, .samples = 300},     // 1s for 5 min
+ *      {.period = 60000, .samples = 1440},   // 1 min for 24 h
+ *    },
+ *  };
  */
 
 #define NAOS_METRIC_KEYS 4
 #define NAOS_METRIC_VALUES 16
+#define NAOS_METRIC_BUCKETS 32
+#define NAOS_METRIC_TIERS 3
 
 typedef enum {
   NAOS_METRIC_COUNTER = 0,
   NAOS_METRIC_GAUGE,
+  NAOS_METRIC_HISTOGRAM,
 } naos_metric_kind_t;
 
 typedef enum {
@@ -56,6 +103,16 @@ typedef enum {
   NAOS_METRIC_DOUBLE,
 } naos_metric_type_t;
 
+typedef struct {
+  uint32_t buckets[NAOS_METRIC_BUCKETS];
+  uint32_t sum[2];  // low and high word
+} naos_metric_histogram_t;
+
+typedef struct {
+  uint32_t period;   // milliseconds
+  uint16_t samples;  // retained samples
+} naos_metric_tier_t;
+
 typedef struct {
   const char *name;
   naos_metric_kind_t kind;
@@ -63,13 +120,42 @@ typedef struct {
   void * data;
   const char *keys[NAOS_METRIC_KEYS + 1];
   const char *values[NAOS_METRIC_VALUES + NAOS_METRIC_KEYS];
+  naos_metric_tier_t history[NAOS_METRIC_TIERS];
   // internal
   int num_keys;
   int num_values[NAOS_METRIC_KEYS];
   int first_value[NAOS_METRIC_KEYS];
   size_t size;
+  void *state;
 } naos_metric_t;
 
 void naos_metrics_add(naos_metric_t * metric);
 
+/**
+ * Atomically add a value to a counter or gauge metric.
+ *
+ * @param metric The metric.
+ * @param index The index of the value within the metric.
+ * @param value The value to add.
+ */
+void naos_metric_add(naos_metric_t *metric, size_t index, double value);
+
+/**
+ * Atomically set a value of a counter or gauge metric.
+ *
+ * @param metric The metric.
+ * @param index The index of the value within the metric.
+ * @param value The new value.
+ */
+void naos_metric_set(naos_metric_t *metric, size_t index, double value);
+
+/**
+ * Observe a value in a histogram metric. Negative values are recorded as zero.
+ *
+ * @param metric The histogram metric.
+ * @param index The index of the histogram within the metric.
+ * @param value The observed value.
+ */
+void naos_metric_observe(naos_metric_t *metric, size_t index, int32_t value);
+
 #endif // NAOS_METRICS_H
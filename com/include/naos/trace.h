@@ -8,35 +8,82 @@
  * ====================
  *
  * The trace subsystem provides real-time FreeRTOS task activity recording. It
- * hooks into FreeRTOS via the traceTASK_SWITCHED_IN macro to record context
- * switches, and provides APIs for application-level span and event tracing.
+ * hooks into FreeRTOS via the traceTASK_SWITCHED_IN and
+ * traceMOVED_TASK_TO_READY_STATE macros to record context switches and task
+ * wakeups, and provides APIs for application-level span and event tracing.
  *
- * Events are written to a circular byte buffer and streamed to clients via the
- * message endpoint (0x08). The buffer uses variable-length records with zero
- * byte padding at wrap boundaries. Records are never split across the buffer
- * end. If the buffer is full, new events are dropped and counted.
+ * Events are written to per-core circular byte buffers and streamed to clients
+ * via the message endpoint (0x08). Each buffer is only written by its core
+ * with interrupts masked, so recording never contends across cores. The
+ * buffers use variable-length records with zero byte padding at wrap
+ * boundaries. Records are never split across the buffer end.
+ *
+ * The START command selects one of three modes:
+ * - BUFFER (0): If a buffer is full, new events are dropped and counted.
+ * - STREAM (1): Like BUFFER, but records are pushed to the starting session as
+ *   they arrive. The client grants chunks with CREDIT commands and the device
+ *   never sends more chunks than granted. Streaming ends with STOP or when the
+ *   session closes.
+ * - RECORDER (2): The oldest records are overwritten to make room for new
+ *   ones. The recording is frozen by a trigger, naos_trace_freeze() or a READ.
+ *   A trigger is armed after START with the TRIGGER command and fires when the
+ *   named event is recorded (KIND 1) or the named value reaches (KIND 2) or
+ *   falls to (KIND 3) the threshold; KIND 0 disarms it. With
+ *   CONFIG_NAOS_TRACE_PANIC, the buffers are kept in uninitialized memory and a
+ *   recording interrupted by a panic or watchdog reset is available frozen
+ *   after reboot.
  *
  * The record types and their wire format are:
- * - SWITCH (1): TYPE(1) TS(4) CORE(1) ID(1) = 7 bytes
- * - EVENT  (2): TYPE(1) TS(4) CAT(1) NAME(1) ARG(2) = 9 bytes
- * - BEGIN  (3): TYPE(1) TS(4) CAT(1) NAME(1) ARG(2) ID(1) = 10 bytes
- * - END    (4): TYPE(1) TS(4) ID(1) = 6 bytes
- * - VALUE  (5): TYPE(1) TS(4) CAT(1) NAME(1) VAL(4) = 11 bytes
- * - LABEL  (6): TYPE(1) ID(1) TEXT(*) NUL(1) = 3+ bytes
- * - TASK   (7): TYPE(1) ID(1) NAME(*) NUL(1) = 3+ bytes
+ * - LABEL  (6):  TYPE(1) ID(1) TEXT(*) NUL(1) = 3+ bytes
+ * - TASK   (7):  TYPE(1) ID(1) NAME(*) NUL(1) = 3+ bytes
+ * - SYNC   (8):  TYPE(1) CORE(1) TIME(8) = 10 bytes
+ * - SWITCH (9):  TYPE(1) DELTA(v) ID(1) = 3+ bytes
+ * - EVENT  (10): TYPE(1) DELTA(v) CAT(1) NAME(1) ARG(v) = 5+ bytes
+ * - BEGIN  (11): TYPE(1) DELTA(v) CAT(1) NAME(1) ARG(v) ID(1) = 6+ bytes
+ * - END    (12): TYPE(1) DELTA(v) ID(1) = 3+ bytes
+ * - VALUE  (13): TYPE(1) DELTA(v) CAT(1) NAME(1) VAL(zv) = 5+ bytes
+ * - ALLOC  (14): TYPE(1) DELTA(v) PTR(4) SIZE(v) CAPS(v) CALLER(4) TASK(1) = 12+ bytes
+ * - FREE   (15): TYPE(1) DELTA(v) PTR(4) = 6+ bytes
+ * - READY  (16): TYPE(1) DELTA(v) ID(1) = 3+ bytes
+ *
+ * Fields marked (v) are unsigned LEB128 varints and (zv) zigzag encoded signed
+ * varints. The DELTA of a record is the number of microseconds since the
+ * previous record of the same core. SYNC records are not stored but inserted
+ * by the reader at the start of each chunk and whenever the core changes
+ * within a chunk. They carry the core and the microseconds since trace start
+ * (uint64) that the following deltas are relative to, so every chunk can be
+ * decoded on its own. SWITCH records belong to the core of the last SYNC.
+ * READY records mark a task becoming ready to run and are written by the core
+ * that readied it whenever task switches are traced on any core, clients use
+ * them to derive scheduling latencies.
+ * Types 1-5 were used by older firmware for fixed-size records with absolute
+ * 32-bit timestamps.
  *
- * Timestamps are microseconds since trace start (uint32, ~71min overflow).
  * Labels map string pointers to IDs and are written on first use. EVENT and
  * BEGIN reference two label IDs (category and name) and carry a user argument.
  * BEGIN also carries a span instance ID that is matched by END. VALUE records
  * a named counter/gauge as a signed int32. Task names are written inline in
- * TASK records. The read command streams raw buffer records.
+ * TASK records. Task and label IDs are shared across cores.
+ *
+ * With CONFIG_NAOS_TRACE_HEAP (which requires CONFIG_HEAP_USE_HOOKS), the heap
+ * hooks record ALLOC and FREE records while the heap flag (bit 7) is set. ALLOC
+ * carries the allocated pointer, size and capabilities, the first return
+ * address outside of IRAM (the allocation site) and the allocating task (255
+ * if none). FREE carries the freed pointer only. Clients attribute it to the
+ * matching allocation.
+ *
+ * The read command streams the records of each core buffer in turn, clients
+ * merge them by timestamp. In recorder mode, it first replays the LABEL and
+ * TASK records of all known IDs, as their original records may have been
+ * overwritten.
  *
  * Endpoint commands:
- * > START (0): - => ACK
- * > STOP  (1): - => ACK
- * > READ  (2): - => DATA(*) + ACK
- * > STATUS(3): - => ACTIVE(1) BUF_SIZE(4) BUF_USED(4) DROPPED(4)
+ * > START  (0): FLAGS(1)? MODE(1)? => ACK
+ * > STOP   (1): - => ACK
+ * > READ   (2): - => DATA(*) + ACK
+ * > STATUS (3): - => ACTIVE(1) BUF_SIZE(4) BUF_USED(4) DROPPED(4) MODE(1) FROZEN(1)
+ * > CREDIT (4): CHUNKS(2) => -
+ * > TRIGGER(5): KIND(1) THRESHOLD(4) NAME(*) => ACK
  */
 
 /**
@@ -44,6 +91,12 @@
  */
 void naos_trace_install();
 
+/**
+ * Freeze an active recording. Intended to capture the history leading up to
+ * an application-detected fault in recorder mode.
+ */
+void naos_trace_freeze();
+
 /**
  * Record an instant trace event. Both strings are used for label dedup
  * (by pointer identity) and must be static.
@@ -5,6 +5,22 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/**
+ * The supported update stream encodings.
+ *
+ * The heatshrink encoding is an LZSS stream with a 2 KB window (11 bits) and
+ * a 16 byte lookahead (4 bits) as produced by `heatshrink -w 11 -l 4`.
+ *
+ * The delta encoding is a patch against the running partition as produced by
+ * `msg.Diff` and may be combined with the heatshrink encoding. Delta updates
+ * require a hash to verify the reconstructed image.
+ */
+typedef enum {
+  NAOS_UPDATE_RAW = 0,
+  NAOS_UPDATE_HEATSHRINK = 1 << 0,
+  NAOS_UPDATE_DELTA = 1 << 1,
+} naos_update_encoding_t;
+
 /**
  * Begin a new update. Any previously started update will be aborted.
  *
@@ -14,9 +30,37 @@
 bool naos_update_begin(size_t size);
 
 /**
- * Write a chunk of data to the update at the expected offset.
+ * Begin a new encoded update. Any previously started update will be aborted.
+ * Written chunks are decoded on the fly and, if a hash is provided, the
+ * decoded image is verified before the update is activated.
+ *
+ * @param size The size of the decoded update.
+ * @param encoding The encoding of the written stream.
+ * @param hash The optional SHA-256 hash of the decoded update.
+ * @return True if the update was started successfully, false otherwise.
+ */
+bool naos_update_begin_encoded(size_t size, naos_update_encoding_t encoding, const uint8_t *hash);
+
+/**
+ * Resume a matching verified update or begin a new one. Verified updates
+ * periodically persist their progress, which is also persisted when the
+ * session is lost, so they can be continued from the returned stream offset,
+ * also after a reboot. Updates are not resumable if flash encryption is enabled.
+ *
+ * @param size The size of the decoded update.
+ * @param encoding The encoding of the written stream.
+ * @param hash The SHA-256 hash of the decoded update.
+ * @param offset Set to the stream offset at which writing must continue.
+ * @return True if the update was resumed or started successfully, false otherwise.
+ */
+bool naos_update_resume(size_t size, naos_update_encoding_t encoding, const uint8_t *hash, uint32_t *offset);
+
+/**
+ * Write a chunk of data to the update at the expected offset. The chunk is
+ * staged and written to flash by a background task. The call only blocks if
+ * all buffers are in use, and write errors are reported by subsequent calls.
  *
- * @param offset The offset of the chunk within the update.
+ * @param offset The offset of the chunk within the update stream.
  * @param chunk The chunk of data.
  * @param len The length of the chunk.
  * @return True if the chunk was written successfully, false otherwise.
@@ -4,21 +4,38 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define URT configRUN_TIME_COUNTER_TYPE
+#define NAOS_CPU_TASKS NAOS_METRIC_VALUES
 
-static TaskHandle_t naos_cpu_handles[2] = {0};
+typedef struct {
+  TaskHandle_t handle;
+  URT run_time;
+} naos_cpu_task_t;
+
+static TaskHandle_t naos_cpu_handles[portNUM_PROCESSORS] = {0};
 static URT naos_cpu_system_run_time = 0;
-static URT naos_cpu_task_run_time[2] = {0};
-static float naos_cpu_usage[2] = {0};
+static URT naos_cpu_task_run_time[portNUM_PROCESSORS] = {0};
+static float naos_cpu_usage[portNUM_PROCESSORS] = {0};
+
+#if CONFIG_NAOS_CPU_TASK_INTERVAL > 0
+static naos_cpu_task_t naos_cpu_tasks[NAOS_CPU_TASKS - 1] = {0};
+static char naos_cpu_task_names[NAOS_CPU_TASKS - 1][configMAX_TASK_NAME_LEN] = {0};
+static bool naos_cpu_task_changed = false;
+static URT naos_cpu_tasks_run_time = 0;
+static float naos_cpu_task_usage[NAOS_CPU_TASKS] = {0};
+static int32_t naos_cpu_task_stack[NAOS_CPU_TASKS] = {0};
+#endif
 
 static void naos_cpu_update() {
   // get total system run time
   URT total_system_rt = portGET_RUN_TIME_COUNTER_VALUE();
 
   // get total idle run times
-  URT total_idle_rt[2] = {0};
-  for (size_t i = 0; i < 2; i++) {
+  URT total_idle_rt[portNUM_PROCESSORS] = {0};
+  for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
     TaskStatus_t status;
     vTaskGetInfo(naos_cpu_handles[i], &status, pdFALSE, eRunning);
     total_idle_rt[i] = status.ulRunTimeCounter;
@@ -26,19 +43,19 @@ static void naos_cpu_update() {
 
   // calculate differences
   URT system_rtd = total_system_rt - naos_cpu_system_run_time;
-  URT idle_rtd[2] = {0};
-  for (size_t i = 0; i < 2; i++) {
+  URT idle_rtd[portNUM_PROCESSORS] = {0};
+  for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
     idle_rtd[i] = total_idle_rt[i] - naos_cpu_task_run_time[i];
   }
 
   // calculate CPU usages
-  for (size_t i = 0; i < 2; i++) {
+  for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
     naos_cpu_usage[i] = 1 - (float)idle_rtd[i] / (float)system_rtd;
   }
 
   // update values
   naos_cpu_system_run_time = total_system_rt;
-  for (size_t i = 0; i < 2; i++) {
+  for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
     naos_cpu_task_run_time[i] = total_idle_rt[i];
   }
 }
@@ -49,29 +66,203 @@ static naos_metric_t naos_cpu_metrics[] = {{
     .type = NAOS_METRIC_FLOAT,
     .data = naos_cpu_usage,
     .keys = {"cpu"},
+#if portNUM_PROCESSORS > 1
     .values = {"0", "1"},
+#else
+    .values = {"0"},
+#endif
 }};
 
+#if CONFIG_NAOS_CPU_TASK_INTERVAL > 0
+
+// the values are stable slot labels, the tasks currently assigned to the
+// slots are published by the "task-slots" parameter
+static const char *naos_cpu_task_slots[NAOS_CPU_TASKS] = {
+    "slot-0", "slot-1", "slot-2",  "slot-3",  "slot-4",  "slot-5",  "slot-6", "slot-7",
+    "slot-8", "slot-9", "slot-10", "slot-11", "slot-12", "slot-13", "slot-14", "other",
+};
+
+static naos_param_t naos_cpu_task_param = {
+    .name = "task-slots",
+    .type = NAOS_STRING,
+    .mode = NAOS_VOLATILE | NAOS_SYSTEM | NAOS_LOCKED,
+};
+
+static naos_metric_t naos_cpu_task_metrics[] = {
+    {
+        .name = "task-cpu-usage",
+        .kind = NAOS_METRIC_GAUGE,
+        .type = NAOS_METRIC_FLOAT,
+        .data = naos_cpu_task_usage,
+        .keys = {"task"},
+    },
+    {
+        .name = "task-stack-free",
+        .kind = NAOS_METRIC_GAUGE,
+        .type = NAOS_METRIC_LONG,
+        .data = naos_cpu_task_stack,
+        .keys = {"task"},
+    },
+};
+
+static void naos_cpu_publish_tasks() {
+  // join task names in slot order, free slots are empty
+  char list[(NAOS_CPU_TASKS - 1) * configMAX_TASK_NAME_LEN] = {0};
+  size_t len = 0;
+  for (int j = 0; j < NAOS_CPU_TASKS - 1; j++) {
+    if (j > 0) {
+      list[len++] = ',';
+    }
+    size_t n = strlen(naos_cpu_task_names[j]);
+    memcpy(list + len, naos_cpu_task_names[j], n);
+    len += n;
+  }
+  list[len] = 0;
+
+  // set parameter
+  naos_set_s("task-slots", list);
+}
+
+static void naos_cpu_update_tasks() {
+  // allocate task list with headroom for new tasks
+  UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+  TaskStatus_t *list = malloc(capacity * sizeof(TaskStatus_t));
+  if (list == NULL) {
+    return;
+  }
+
+  // get task list and total run time
+  URT total_rt = 0;
+  UBaseType_t count = uxTaskGetSystemState(list, capacity, &total_rt);
+  if (count == 0) {
+    free(list);
+    return;
+  }
+
+  // calculate system run time difference
+  URT system_rtd = total_rt - naos_cpu_tasks_run_time;
+  naos_cpu_tasks_run_time = total_rt;
+
+  // prepare usage and stack of remaining tasks
+  float other_usage = portNUM_PROCESSORS;
+  int32_t other_stack = INT32_MAX;
+  bool seen[NAOS_CPU_TASKS - 1] = {0};
+
+  // update tasks
+  for (UBaseType_t i = 0; i < count; i++) {
+    // find slot
+    TaskStatus_t *status = &list[i];
+    int slot = -1;
+    for (int j = 0; j < NAOS_CPU_TASKS - 1; j++) {
+      if (naos_cpu_tasks[j].handle == status->xHandle) {
+        slot = j;
+        break;
+      }
+    }
+
+    // otherwise, claim free slot
+    if (slot < 0) {
+      for (int j = 0; j < NAOS_CPU_TASKS - 1; j++) {
+        if (naos_cpu_tasks[j].handle == NULL) {
+          slot = j;
+          naos_cpu_tasks[j] = (naos_cpu_task_t){
+              .handle = status->xHandle,
+              .run_time = status->ulRunTimeCounter,
+          };
+          strncpy(naos_cpu_task_names[j], status->pcTaskName, configMAX_TASK_NAME_LEN - 1);
+          naos_cpu_task_changed = true;
+          break;
+        }
+      }
+    }
+
+    // account task without slot as other
+    if (slot < 0) {
+      other_stack = status->usStackHighWaterMark < other_stack ? status->usStackHighWaterMark : other_stack;
+      continue;
+    }
+
+    // calculate usage of slot
+    naos_cpu_task_t *task = &naos_cpu_tasks[slot];
+    float usage = system_rtd > 0 ? (float)(status->ulRunTimeCounter - task->run_time) / (float)system_rtd : 0;
+    task->run_time = status->ulRunTimeCounter;
+    other_usage -= usage;
+    seen[slot] = true;
+
+    // set values
+    naos_metric_set(&naos_cpu_task_metrics[0], slot, usage);
+    naos_metric_set(&naos_cpu_task_metrics[1], slot, status->usStackHighWaterMark);
+  }
+
+  // release slots of deleted tasks
+  for (int j = 0; j < NAOS_CPU_TASKS - 1; j++) {
+    if (!seen[j] && naos_cpu_tasks[j].handle != NULL) {
+      naos_cpu_tasks[j] = (naos_cpu_task_t){0};
+      naos_cpu_task_names[j][0] = 0;
+      naos_cpu_task_changed = true;
+      naos_metric_set(&naos_cpu_task_metrics[0], j, 0);
+      naos_metric_set(&naos_cpu_task_metrics[1], j, 0);
+    }
+  }
+
+  // set remaining tasks
+  naos_metric_set(&naos_cpu_task_metrics[0], NAOS_CPU_TASKS - 1, other_usage > 0 ? other_usage : 0);
+  naos_metric_set(&naos_cpu_task_metrics[1], NAOS_CPU_TASKS - 1, other_stack != INT32_MAX ? other_stack : 0);
+
+  // free list
+  free(list);
+
+  // publish slot assignments on change
+  if (naos_cpu_task_changed) {
+    naos_cpu_publish_tasks();
+    naos_cpu_task_changed = false;
+  }
+}
+
+#endif
+
 void naos_cpu_init() {
   // add metrics
   for (size_t i = 0; i < NAOS_COUNT(naos_cpu_metrics); i++) {
     naos_metrics_add(&naos_cpu_metrics[i]);
   }
 
-  // get task handles
-  naos_cpu_handles[0] = xTaskGetHandle("IDLE0");
-  naos_cpu_handles[1] = xTaskGetHandle("IDLE1");
-  if (naos_cpu_handles[0] == NULL || naos_cpu_handles[1] == NULL) {
-    ESP_ERROR_CHECK(ESP_FAIL);
-    return;
+  // get idle task handles
+  for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
+    naos_cpu_handles[i] = xTaskGetIdleTaskHandleForCore(i);
+    if (naos_cpu_handles[i] == NULL) {
+      ESP_ERROR_CHECK(ESP_FAIL);
+      return;
+    }
   }
 
   // start update timer
   naos_repeat("naos-cpu", 250, naos_cpu_update);
+
+#if CONFIG_NAOS_CPU_TASK_INTERVAL > 0
+  // register slot parameter
+  naos_register(&naos_cpu_task_param);
+
+  // use slot labels as values, the last slot accounts all other tasks
+  for (size_t i = 0; i < NAOS_COUNT(naos_cpu_task_metrics); i++) {
+    for (size_t j = 0; j < NAOS_CPU_TASKS; j++) {
+      naos_cpu_task_metrics[i].values[j] = naos_cpu_task_slots[j];
+    }
+    naos_metrics_add(&naos_cpu_task_metrics[i]);
+  }
+
+  // initialize run time and start task timer
+  naos_cpu_tasks_run_time = portGET_RUN_TIME_COUNTER_VALUE();
+  naos_repeat_defer("naos-cpu-tasks", CONFIG_NAOS_CPU_TASK_INTERVAL, naos_cpu_update_tasks);
+#endif
 }
 
 void naos_cpu_get(float *cpu0, float *cpu1) {
   // set values
   *cpu0 = naos_cpu_usage[0];
+#if portNUM_PROCESSORS > 1
   *cpu1 = naos_cpu_usage[1];
+#else
+  *cpu1 = 0;
+#endif
 }
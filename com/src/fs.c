@@ -1,6 +1,8 @@
+#include <naos.h>
 #include <naos/fs.h>
 #include <naos/msg.h>
 #include <naos/sys.h>
+#include <naos/trace.h>
 
 #include <errno.h>
 #include <string.h>
@@ -15,8 +17,15 @@
 #include <esp_vfs_fat.h>
 #include <mbedtls/sha256.h>
 
-#define NAOS_FS_ENDPOINT 0x3
-#define NAOS_FS_MAX_FILES 4
+#include "fs.h"
+#include "fs_log.h"
+#include "mem.h"
+
+#define NAOS_FS_MAX_FILES CONFIG_NAOS_FS_MAX_FILES
+#define NAOS_FS_QUEUE_LENGTH CONFIG_NAOS_FS_QUEUE_LENGTH
+#define NAOS_FS_STACK_SIZE CONFIG_NAOS_FS_STACK_SIZE
+#define NAOS_FS_BUFFER_SIZE CONFIG_NAOS_FS_BUFFER_SIZE
+#define NAOS_FS_ARCHIVE_DEPTH 8
 
 typedef enum {
   NAOS_FS_CMD_STAT,
@@ -29,20 +38,23 @@ typedef enum {
   NAOS_FS_CMD_REMOVE,
   NAOS_FS_CMD_SHA256,
   NAOS_FS_CMD_MAKE,
+  NAOS_FS_CMD_HASHES,
+  NAOS_FS_CMD_COPY,
+  NAOS_FS_CMD_SCAN,
+  NAOS_FS_CMD_ARCHIVE,
+  NAOS_FS_CMD_HREAD,
+  NAOS_FS_CMD_HWRITE,
+  NAOS_FS_CMD_HCLOSE,
+  NAOS_FS_CMD_LOG,
 } naos_fs_cmd_t;
 
-typedef enum {
-  NAOS_FS_REPLY_ERROR,
-  NAOS_FS_REPLY_INFO,
-  NAOS_FS_REPLY_CHUNK,
-  NAOS_FS_REPLY_SHA256,
-} naos_fs_reply_t;
-
 typedef enum {
   NAOS_FS_OPEN_FLAG_CREATE = 1 << 0,
   NAOS_FS_OPEN_FLAG_APPEND = 1 << 1,
   NAOS_FS_OPEN_FLAG_TRUNCATE = 1 << 2,
   NAOS_FS_OPEN_FLAG_EXCLUSIVE = 1 << 3,
+  NAOS_FS_OPEN_FLAG_EXTRACT = 1 << 4,
+  NAOS_FS_OPEN_FLAG_HANDLE = 1 << 5,
 } naos_fs_open_flags_t;
 
 typedef enum {
@@ -50,15 +62,54 @@ typedef enum {
   NAOS_FS_WRITE_FLAG_SEQUENTIAL = 1 << 1,
 } naos_fs_write_flags_t;
 
+typedef enum {
+  NAOS_FS_ARCHIVE_FILE,
+  NAOS_FS_ARCHIVE_DIR,
+} naos_fs_archive_type_t;
+
+typedef struct {
+  // staging and target directory
+  char staging[PATH_MAX];
+  char target[PATH_MAX];
+  // current entry header, name and remaining data
+  uint8_t head[5];
+  size_t head_len;
+  char name[PATH_MAX];
+  size_t name_len;
+  bool named;
+  uint32_t remaining;
+  int fd;
+  // entry write buffer
+  uint8_t *buf;
+  size_t buf_len;
+} naos_fs_extract_t;
+
 typedef struct {
   bool active;
+  // whether the file is addressed by handle instead of being the session's
+  // implicit file
+  bool handle;
   int fd;
   uint16_t sid;
   int64_t ts;
   uint32_t off;
+  // write-behind buffer holding the bytes preceding "off"
+  uint8_t *buf;
+  size_t buf_len;
+  // deferred error from a silent write
+  int err;
+  // archive extraction, if opened for extraction
+  naos_fs_extract_t *ext;
 } naos_fs_file_t;
 
-static naos_mutex_t naos_fs_mutex = 0;
+typedef struct {
+  naos_msg_t msg;
+  bool cleanup;
+} naos_fs_request_t;
+
+// all file state is owned by the worker task, requests are queued by the
+// message endpoint and processed sequentially
+static naos_queue_t naos_fs_queue = NULL;
 static naos_fs_file_t naos_fs_files[NAOS_FS_MAX_FILES] = {0};
 static naos_fs_config_t naos_fs_config = {0};
 
@@ -139,7 +190,458 @@ static int naos_fs_mkdir(const char *path, mode_t mode) {
   return 0;
 }
 
-static naos_msg_reply_t naos_fs_send_error(uint16_t session, int error) {
+static bool naos_fs_match(const char *pattern, const char *name) {
+  // match name against a glob pattern supporting "*" and "?"
+  const char *star = NULL;
+  const char *back = NULL;
+  while (*name != 0) {
+    if (*pattern == '*') {
+      // remember star and try an empty match first
+      star = pattern++;
+      back = name;
+    } else if (*pattern == '?' || *pattern == *name) {
+      pattern++;
+      name++;
+    } else if (star != NULL) {
+      // let the last star consume one more character
+      pattern = star + 1;
+      name = ++back;
+    } else {
+      return false;
+    }
+  }
+
+  // skip trailing stars
+  while (*pattern == '*') {
+    pattern++;
+  }
+
+  return *pattern == 0;
+}
+
+static bool naos_fs_flush(naos_fs_file_t *file) {
+  // write all buffered data
+  size_t total = 0;
+  while (total < file->buf_len) {
+    ssize_t ret = write(file->fd, file->buf + total, file->buf_len - total);
+    if (ret < 0) {
+      file->buf_len = 0;
+      return false;
+    }
+    total += ret;
+  }
+
+  // clear buffer
+  file->buf_len = 0;
+
+  return true;
+}
+
+static bool naos_fs_buffer(naos_fs_file_t *file, const uint8_t *data, size_t len) {
+  // allocate buffer lazily and fall back to direct writes if not available
+  if (file->buf == NULL) {
+    file->buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_FS_BUFFER_SIZE);
+  }
+  if (file->buf == NULL) {
+    size_t total = 0;
+    while (total < len) {
+      ssize_t ret = write(file->fd, data + total, len - total);
+      if (ret < 0) {
+        return false;
+      }
+      total += ret;
+    }
+    file->off += len;
+    return true;
+  }
+
+  while (len > 0) {
+    // determine the buffer limit so that flushes end on block boundaries
+    uint32_t start = file->off - file->buf_len;
+    size_t limit = NAOS_FS_BUFFER_SIZE - (start % NAOS_FS_BUFFER_SIZE);
+
+    // copy data into buffer
+    size_t num = limit - file->buf_len;
+    if (num > len) {
+      num = len;
+    }
+    memcpy(file->buf + file->buf_len, data, num);
+    file->buf_len += num;
+    file->off += num;
+    data += num;
+    len -= num;
+
+    // flush full buffer
+    if (file->buf_len == limit && !naos_fs_flush(file)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool naos_fs_remove_tree(const char *root) {
+  // stat root
+  struct stat info;
+  if (stat(root, &info) != 0) {
+    return errno == ENOENT;
+  }
+
+  // remove files directly
+  if (!S_ISDIR(info.st_mode)) {
+    return unlink(root) == 0;
+  }
+
+  // allocate path, which is extended with the entry names while walking the
+  // tree, on the heap to keep the fs task stack small
+  char *path = naos_mem_alloc(NAOS_MEM_FS, PATH_MAX);
+  if (path == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  int root_len = snprintf(path, PATH_MAX, "%s", root);
+  if (root_len < 0 || root_len >= PATH_MAX) {
+    naos_mem_free(NAOS_MEM_FS, path);
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  // open root directory
+  DIR *dirs[NAOS_FS_ARCHIVE_DEPTH];
+  size_t lens[NAOS_FS_ARCHIVE_DEPTH];
+  dirs[0] = opendir(path);
+  lens[0] = root_len;
+  if (dirs[0] == NULL) {
+    int err = errno;
+    naos_mem_free(NAOS_MEM_FS, path);
+    errno = err;
+    return false;
+  }
+
+  // walk tree depth-first, directories are removed after their contents
+  int depth = 0;
+  int err = 0;
+  while (depth >= 0 && err == 0) {
+    // get next entry or remove directory
+    struct dirent *entry = readdir(dirs[depth]);
+    if (entry == NULL) {
+      closedir(dirs[depth]);
+      path[lens[depth]] = 0;
+      if (rmdir(path) != 0) {
+        err = errno;
+      }
+      depth--;
+      continue;
+    }
+
+    // skip the "." and ".." entries
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    // append name
+    size_t len = lens[depth];
+    int written = snprintf(path + len, PATH_MAX - len, "/%s", entry->d_name);
+    if (written < 0 || (size_t)written >= PATH_MAX - len) {
+      err = ENAMETOOLONG;
+      break;
+    }
+
+    // stat entry
+    if (stat(path, &info) != 0) {
+      err = errno;
+      break;
+    }
+
+    // remove file
+    if (!S_ISDIR(info.st_mode)) {
+      if (unlink(path) != 0) {
+        err = errno;
+      }
+      continue;
+    }
+
+    // enter directory
+    if (depth + 1 >= NAOS_FS_ARCHIVE_DEPTH) {
+      err = ELOOP;
+      break;
+    }
+    dirs[depth + 1] = opendir(path);
+    if (dirs[depth + 1] == NULL) {
+      err = errno;
+      break;
+    }
+    depth++;
+    lens[depth] = len + written;
+  }
+
+  // close remaining directories
+  for (; depth >= 0; depth--) {
+    closedir(dirs[depth]);
+  }
+
+  // free path
+  naos_mem_free(NAOS_MEM_FS, path);
+
+  // handle errors
+  if (err != 0) {
+    errno = err;
+    return false;
+  }
+
+  return true;
+}
+
+static bool naos_fs_extract_flush(naos_fs_extract_t *ext) {
+  // write all buffered data
+  size_t total = 0;
+  while (total < ext->buf_len) {
+    ssize_t ret = write(ext->fd, ext->buf + total, ext->buf_len - total);
+    if (ret < 0) {
+      ext->buf_len = 0;
+      return false;
+    }
+    total += ret;
+  }
+
+  // clear buffer
+  ext->buf_len = 0;
+
+  return true;
+}
+
+static bool naos_fs_extract_end(naos_fs_extract_t *ext) {
+  // flush and close entry file
+  bool ok = true;
+  if (ext->fd >= 0) {
+    ok = naos_fs_extract_flush(ext);
+    close(ext->fd);
+    ext->fd = -1;
+  }
+
+  // reset entry
+  ext->head_len = 0;
+  ext->name_len = 0;
+  ext->named = false;
+
+  return ok;
+}
+
+static bool naos_fs_extract_begin(naos_fs_extract_t *ext) {
+  // get type and size
+  naos_fs_archive_type_t type = ext->head[0];
+  memcpy(&ext->remaining, ext->head + 1, sizeof(ext->remaining));
+
+  // validate name, which must be relative and free of traversals
+  char rel[PATH_MAX];
+  snprintf(rel, sizeof(rel), "/%s", ext->name);
+  if (ext->name_len == 0 || !naos_fs_valid_path(rel)) {
+    errno = EINVAL;
+    return false;
+  }
+
+  // get path
+  char path[PATH_MAX];
+  int written = snprintf(path, sizeof(path), "%s%s", ext->staging, rel);
+  if (written < 0 || (size_t)written >= sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  // create directory or file
+  switch (type) {
+    case NAOS_FS_ARCHIVE_FILE:
+      ext->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (ext->fd < 0) {
+        return false;
+      }
+      break;
+    case NAOS_FS_ARCHIVE_DIR:
+      if (ext->remaining != 0) {
+        errno = EINVAL;
+        return false;
+      }
+      if (naos_fs_mkdir(path, 0755) != 0) {
+        return false;
+      }
+      break;
+    default:
+      errno = EINVAL;
+      return false;
+  }
+
+  // end empty entries immediately
+  if (ext->remaining == 0) {
+    return naos_fs_extract_end(ext);
+  }
+
+  return true;
+}
+
+static bool naos_fs_extract(naos_fs_extract_t *ext, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    // read entry header
+    if (ext->head_len < sizeof(ext->head)) {
+      size_t num = sizeof(ext->head) - ext->head_len;
+      if (num > len) {
+        num = len;
+      }
+      memcpy(ext->head + ext->head_len, data, num);
+      ext->head_len += num;
+      data += num;
+      len -= num;
+      continue;
+    }
+
+    // read entry name up to the terminating zero byte
+    if (!ext->named) {
+      const uint8_t *end = memchr(data, 0, len);
+      size_t num = end != NULL ? (size_t)(end - data) : len;
+      if (ext->name_len + num >= sizeof(ext->name)) {
+        errno = ENAMETOOLONG;
+        return false;
+      }
+      memcpy(ext->name + ext->name_len, data, num);
+      ext->name_len += num;
+      ext->name[ext->name_len] = 0;
+      data += num;
+      len -= num;
+      if (end != NULL) {
+        data++;
+        len--;
+        ext->named = true;
+        if (!naos_fs_extract_begin(ext)) {
+          return false;
+        }
+      }
+      continue;
+    }
+
+    // buffer entry data
+    size_t num = ext->remaining;
+    if (num > len) {
+      num = len;
+    }
+    if (num > NAOS_FS_BUFFER_SIZE - ext->buf_len) {
+      num = NAOS_FS_BUFFER_SIZE - ext->buf_len;
+    }
+    memcpy(ext->buf + ext->buf_len, data, num);
+    ext->buf_len += num;
+    ext->remaining -= num;
+    data += num;
+    len -= num;
+
+    // flush full buffer
+    if (ext->buf_len == NAOS_FS_BUFFER_SIZE && !naos_fs_extract_flush(ext)) {
+      return false;
+    }
+
+    // end completed entry
+    if (ext->remaining == 0 && !naos_fs_extract_end(ext)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool naos_fs_extract_commit(naos_fs_extract_t *ext) {
+  // check for a truncated archive
+  if (ext->head_len != 0) {
+    errno = EINVAL;
+    return false;
+  }
+
+  // get backup path
+  char old[PATH_MAX];
+  int written = snprintf(old, sizeof(old), "%s.old", ext->target);
+  if (written < 0 || (size_t)written >= sizeof(old)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  // move existing target aside
+  struct stat info;
+  bool exists = stat(ext->target, &info) == 0;
+  if (exists && (!naos_fs_remove_tree(old) || rename(ext->target, old) != 0)) {
+    return false;
+  }
+
+  // move staging directory into place, restoring the old target on failure
+  if (rename(ext->staging, ext->target) != 0) {
+    int err = errno;
+    if (exists) {
+      rename(old, ext->target);
+    }
+    errno = err;
+    return false;
+  }
+
+  // remove old target
+  if (exists) {
+    naos_fs_remove_tree(old);
+  }
+
+  return true;
+}
+
+static void naos_fs_extract_free(naos_fs_extract_t *ext) {
+  // close entry file
+  if (ext->fd >= 0) {
+    close(ext->fd);
+  }
+
+  // remove staging directory, which is gone if committed
+  naos_fs_remove_tree(ext->staging);
+
+  // free state
+  naos_mem_free(NAOS_MEM_FS, ext->buf);
+  naos_mem_free(NAOS_MEM_FS, ext);
+}
+
+static void naos_fs_close(naos_fs_file_t *file) {
+  // abort extraction
+  if (file->ext != NULL) {
+    naos_fs_extract_free(file->ext);
+  }
+
+  // flush remaining data and close file
+  if (file->fd >= 0) {
+    naos_fs_flush(file);
+    close(file->fd);
+  }
+
+  // free buffer
+  naos_mem_free(NAOS_MEM_FS, file->buf);
+
+  // reset descriptor
+  *file = (naos_fs_file_t){0};
+}
+
+static naos_fs_file_t *naos_fs_find(uint16_t session, int handle) {
+  // find file by handle
+  if (handle >= 0) {
+    if (handle >= NAOS_FS_MAX_FILES) {
+      return NULL;
+    }
+    naos_fs_file_t *file = &naos_fs_files[handle];
+    if (!file->active || !file->handle || file->sid != session) {
+      return NULL;
+    }
+    return file;
+  }
+
+  // otherwise, find the session's implicit file
+  for (size_t i = 0; i < NAOS_FS_MAX_FILES; i++) {
+    if (naos_fs_files[i].active && !naos_fs_files[i].handle && naos_fs_files[i].sid == session) {
+      return &naos_fs_files[i];
+    }
+  }
+
+  return NULL;
+}
+
+naos_msg_reply_t naos_fs_send_error(uint16_t session, int error) {
   // reply structure:
   // TYPE (1) | ERRNO (1)
 
@@ -316,12 +818,13 @@ static naos_msg_reply_t naos_fs_handle_open(naos_msg_t msg) {
     return NAOS_MSG_INVALID;
   }
 
-  // close already open files
-  for (size_t i = 0; i < NAOS_FS_MAX_FILES; i++) {
-    if (naos_fs_files[i].active && naos_fs_files[i].sid == msg.session) {
-      close(naos_fs_files[i].fd);
-      naos_fs_files[i].active = false;
-    }
+  // get flags
+  naos_fs_open_flags_t flags = msg.data[0];
+
+  // close the session's implicit file unless opening a handle
+  naos_fs_file_t *current = naos_fs_find(msg.session, -1);
+  if (current != NULL && !(flags & NAOS_FS_OPEN_FLAG_HANDLE)) {
+    naos_fs_close(current);
   }
 
   // find first free file
@@ -336,9 +839,6 @@ static naos_msg_reply_t naos_fs_handle_open(naos_msg_t msg) {
     return naos_fs_send_error(msg.session, ENFILE);
   }
 
-  // get flags
-  naos_fs_open_flags_t flags = msg.data[0];
-
   // prepare open flags
   int open_flags = O_RDWR;
   if (flags & NAOS_FS_OPEN_FLAG_CREATE) {
@@ -360,23 +860,78 @@ static naos_msg_reply_t naos_fs_handle_open(naos_msg_t msg) {
     return naos_fs_send_error(msg.session, errno);
   }
 
-  // create file
-  int fd = open(path, open_flags, 0644);
-  if (fd < 0) {
-    return naos_fs_send_error(msg.session, errno);
+  // prepare extraction or open file
+  if (flags & NAOS_FS_OPEN_FLAG_EXTRACT) {
+    // allocate state
+    naos_fs_extract_t *ext = naos_mem_calloc(NAOS_MEM_FS, 1, sizeof(naos_fs_extract_t));
+    uint8_t *buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_FS_BUFFER_SIZE);
+    if (ext == NULL || buf == NULL) {
+      naos_mem_free(NAOS_MEM_FS, ext);
+      naos_mem_free(NAOS_MEM_FS, buf);
+      return naos_fs_send_error(msg.session, ENOMEM);
+    }
+    ext->buf = buf;
+    ext->fd = -1;
+
+    // get target and staging directory
+    strcpy(ext->target, path);
+    int written = snprintf(ext->staging, sizeof(ext->staging), "%s.extract", path);
+    if (written < 0 || (size_t)written >= sizeof(ext->staging)) {
+      naos_mem_free(NAOS_MEM_FS, buf);
+      naos_mem_free(NAOS_MEM_FS, ext);
+      return naos_fs_send_error(msg.session, ENAMETOOLONG);
+    }
+
+    // create a fresh staging directory
+    if (!naos_fs_remove_tree(ext->staging) || naos_fs_mkdir(ext->staging, 0755) != 0) {
+      int err = errno;
+      naos_mem_free(NAOS_MEM_FS, buf);
+      naos_mem_free(NAOS_MEM_FS, ext);
+      return naos_fs_send_error(msg.session, err);
+    }
+
+    // set file
+    file->fd = -1;
+    file->ext = ext;
+  } else {
+    // create file
+    int fd = open(path, open_flags, 0644);
+    if (fd < 0) {
+      return naos_fs_send_error(msg.session, errno);
+    }
+
+    // set file
+    file->fd = fd;
   }
 
-  // set file
+  // activate file
   file->active = true;
-  file->fd = fd;
+  file->handle = (flags & NAOS_FS_OPEN_FLAG_HANDLE) != 0;
   file->sid = msg.session;
   file->ts = naos_millis();
   file->off = 0;
 
-  return NAOS_MSG_ACK;
+  // acknowledge implicit file
+  if (!file->handle) {
+    return NAOS_MSG_ACK;
+  }
+
+  // reply structure:
+  // TYPE (1) | HANDLE (1)
+
+  // send reply
+  uint8_t data[2] = {NAOS_FS_REPLY_HANDLE, (uint8_t)(file - naos_fs_files)};
+  naos_msg_send((naos_msg_t){
+      .session = msg.session,
+      .endpoint = NAOS_FS_ENDPOINT,
+      .data = data,
+      .len = 2,
+  });
+
+  return NAOS_MSG_OK;
 }
 
-static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg) {
+static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg, int handle) {
   // command structure:
   // OFFSET (4) | LENGTH (4)
 
@@ -386,13 +941,7 @@ static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg) {
   }
 
   // find file
-  naos_fs_file_t *file = NULL;
-  for (size_t i = 0; i < NAOS_FS_MAX_FILES; i++) {
-    if (naos_fs_files[i].active && naos_fs_files[i].sid == msg.session) {
-      file = &naos_fs_files[i];
-      break;
-    }
-  }
+  naos_fs_file_t *file = naos_fs_find(msg.session, handle);
   if (file == NULL) {
     return naos_fs_send_error(msg.session, EBADF);
   }
@@ -403,6 +952,11 @@ static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg) {
   memcpy(&offset, msg.data, sizeof(offset));
   memcpy(&length, &msg.data[4], sizeof(length));
 
+  // flush buffered writes
+  if (!naos_fs_flush(file)) {
+    return naos_fs_send_error(msg.session, errno);
+  }
+
   // stat file
   struct stat info;
   if (fstat(file->fd, &info) != 0) {
@@ -410,7 +964,7 @@ static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg) {
   }
 
   // check offset bounds
-  if (offset >= info.st_size) {
+  if (offset > info.st_size) {
     return naos_fs_send_error(msg.session, EINVAL);
   }
 
@@ -419,6 +973,7 @@ static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg) {
   if (ret < 0) {
     return naos_fs_send_error(msg.session, errno);
   }
+  file->off = offset;
 
   // determine length if zero or limit length
   if (length == 0 || offset + length > info.st_size) {
@@ -434,63 +989,75 @@ static naos_msg_reply_t naos_fs_handle_read(naos_msg_t msg) {
   // reply structure:
   // TYPE (1) | OFFSET (4) | DATA (*)
 
-  // prepare data with framing headroom
-  uint8_t *buf = malloc(NAOS_MSG_FRAMING + 5 + max_chunk_size);
+  // prepare read-ahead block with headroom for the framing and chunk header,
+  // chunks are framed in-place by overwriting the already sent bytes in front
+  // of them
+  size_t block_size = length < NAOS_FS_BUFFER_SIZE ? length : NAOS_FS_BUFFER_SIZE;
+  uint8_t *buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_MSG_FRAMING + 5 + block_size);
   if (buf == NULL) {
     return naos_fs_send_error(msg.session, ENOMEM);
   }
-  uint8_t *data = buf + NAOS_MSG_FRAMING;
-  data[0] = NAOS_FS_REPLY_CHUNK;
+  uint8_t *block = buf + NAOS_MSG_FRAMING + 5;
 
-  // read and reply with chunks
-  off_t total = 0;
+  // read blocks and reply with chunks
+  uint32_t total = 0;
   while (total < length) {
-    // determine chunk size
-    size_t chunk_size = (length - total) < max_chunk_size ? (length - total) : max_chunk_size;
-
-    // write chunk offset
-    uint32_t chunk_offset = offset + total;
-    memcpy(&data[1], &chunk_offset, sizeof(chunk_offset));
-
-    // read chunk
-    ret = read(file->fd, data + 5, chunk_size);
+    // read block
+    size_t block_len = (length - total) < block_size ? (length - total) : block_size;
+    ret = read(file->fd, block, block_len);
     if (ret < 0) {
-      free(buf);
+      naos_mem_free(NAOS_MEM_FS, buf);
       return naos_fs_send_error(msg.session, errno);
     }
     if (ret == 0) {
-      free(buf);
+      naos_mem_free(NAOS_MEM_FS, buf);
       return naos_fs_send_error(msg.session, EIO);
     }
-
-    // send reply
-    naos_msg_send((naos_msg_t){
-        .session = msg.session,
-        .endpoint = NAOS_FS_ENDPOINT,
-        .data = data,
-        .len = 5 + ret,
-        .framed = true,
-    });
+    block_len = ret;
+
+    // send block in chunks
+    size_t pos = 0;
+    while (pos < block_len) {
+      // determine chunk size
+      size_t chunk_size = (block_len - pos) < max_chunk_size ? (block_len - pos) : max_chunk_size;
+
+      // write chunk header
+      uint8_t *data = block + pos - 5;
+      uint32_t chunk_offset = offset + total + pos;
+      data[0] = NAOS_FS_REPLY_CHUNK;
+      memcpy(&data[1], &chunk_offset, sizeof(chunk_offset));
+
+      // send reply
+      naos_msg_send((naos_msg_t){
+          .session = msg.session,
+          .endpoint = NAOS_FS_ENDPOINT,
+          .data = data,
+          .len = 5 + chunk_size,
+          .framed = true,
+      });
+
+      // increment position
+      pos += chunk_size;
+
+      // yield to system
+      naos_delay(1);
+    }
 
     // increment total
-    total += ret;
+    total += block_len;
+    file->off += block_len;
 
     // update timestamp
     file->ts = naos_millis();
-
-    // yield to system
-    naos_unlock(naos_fs_mutex);
-    naos_delay(1);
-    naos_lock(naos_fs_mutex);
   }
 
   // free data
-  free(buf);
+  naos_mem_free(NAOS_MEM_FS, buf);
 
   return NAOS_MSG_ACK;
 }
 
-static naos_msg_reply_t naos_fs_handle_write(naos_msg_t msg) {
+static naos_msg_reply_t naos_fs_handle_write(naos_msg_t msg, int handle) {
   // command structure:
   // FLAGS (1) | OFFSET (4) | DATA (*)
 
@@ -509,24 +1076,48 @@ static naos_msg_reply_t naos_fs_handle_write(naos_msg_t msg) {
   memcpy(&offset, msg.data + 1, sizeof(offset));
 
   // find file
-  naos_fs_file_t *file = NULL;
-  for (size_t i = 0; i < NAOS_FS_MAX_FILES; i++) {
-    if (naos_fs_files[i].active && naos_fs_files[i].sid == msg.session) {
-      file = &naos_fs_files[i];
-      break;
-    }
-  }
+  naos_fs_file_t *file = naos_fs_find(msg.session, handle);
   if (file == NULL) {
     return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, EBADF);
   }
 
+  // report deferred errors from previous silent writes
+  if (file->err != 0) {
+    if (silent) {
+      return NAOS_MSG_OK;
+    }
+    int err = file->err;
+    file->err = 0;
+    return naos_fs_send_error(msg.session, err);
+  }
+
+  // extract archive data, which must be written sequentially
+  if (file->ext != NULL) {
+    if (offset != file->off) {
+      return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, EINVAL);
+    }
+    if (!naos_fs_extract(file->ext, msg.data + 5, msg.len - 5)) {
+      if (silent) {
+        file->err = errno;
+        return NAOS_MSG_OK;
+      }
+      return naos_fs_send_error(msg.session, errno);
+    }
+    file->off += msg.len - 5;
+    file->ts = naos_millis();
+    return silent ? NAOS_MSG_OK : NAOS_MSG_ACK;
+  }
+
   // verify sequential offset
   if (sequential && offset != file->off) {
     return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, EINVAL);
   }
 
-  // otherwise, seek random offset
+  // otherwise, flush buffer and seek random offset
   if (!sequential) {
+    if (!naos_fs_flush(file)) {
+      return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, errno);
+    }
     off_t ret = lseek(file->fd, offset, SEEK_SET);
     if (ret < 0) {
       return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, errno);
@@ -534,46 +1125,50 @@ static naos_msg_reply_t naos_fs_handle_write(naos_msg_t msg) {
     file->off = offset;
   }
 
-  // write all data
-  uint32_t total = 0;
-  while (total < msg.len - 5) {
-    ssize_t ret = write(file->fd, msg.data + 5 + total, msg.len - 5 - total);
-    if (ret < 0) {
-      return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, errno);
+  // buffer data, written to the file in block-aligned chunks
+  if (!naos_fs_buffer(file, msg.data + 5, msg.len - 5)) {
+    if (silent) {
+      file->err = errno;
+      return NAOS_MSG_OK;
     }
-    total += ret;
+    return naos_fs_send_error(msg.session, errno);
   }
 
-  // update timestamp and offset
+  // update timestamp
   file->ts = naos_millis();
-  file->off = offset + total;
 
   return silent ? NAOS_MSG_OK : NAOS_MSG_ACK;
 }
 
-static naos_msg_reply_t naos_fs_handle_close(naos_msg_t msg) {
+static naos_msg_reply_t naos_fs_handle_close(naos_msg_t msg, int handle) {
   // check msg
   if (msg.len != 0) {
     return NAOS_MSG_INVALID;
   }
 
   // find file
-  naos_fs_file_t *file = NULL;
-  for (size_t i = 0; i < NAOS_FS_MAX_FILES; i++) {
-    if (naos_fs_files[i].active && naos_fs_files[i].sid == msg.session) {
-      file = &naos_fs_files[i];
-      break;
-    }
-  }
+  naos_fs_file_t *file = naos_fs_find(msg.session, handle);
   if (file == NULL) {
     return naos_fs_send_error(msg.session, EBADF);
   }
 
+  // flush buffered writes or commit extraction
+  int err = file->err;
+  if (file->ext != NULL) {
+    if (err == 0 && !naos_fs_extract_commit(file->ext)) {
+      err = errno;
+    }
+  } else if (!naos_fs_flush(file) && err == 0) {
+    err = errno;
+  }
+
   // close file
-  close(file->fd);
+  naos_fs_close(file);
 
-  // reset descriptor
-  *file = (naos_fs_file_t){0};
+  // report write errors
+  if (err != 0) {
+    return naos_fs_send_error(msg.session, err);
+  }
 
   return NAOS_MSG_ACK;
 }
@@ -772,15 +1367,652 @@ static naos_msg_reply_t naos_fs_handle_make(naos_msg_t msg) {
   return NAOS_MSG_ACK;
 }
 
-static naos_msg_reply_t naos_fs_handle(naos_msg_t msg) {
-  // message structure:
-  // CMD (1) | *
+static naos_msg_reply_t naos_fs_handle_hashes(naos_msg_t msg) {
+  // command structure:
+  // BLOCK_SIZE (4) | PATH (*)
+
+  // check path
+  if (msg.len <= 4 || msg.data[4] != '/') {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get block size
+  uint32_t block_size;
+  memcpy(&block_size, msg.data, sizeof(block_size));
+  if (block_size == 0) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get path
+  char path[PATH_MAX];
+  if (!naos_fs_join(path, sizeof(path), (const char *)(msg.data + 4))) {
+    return naos_fs_send_error(msg.session, errno);
+  }
+
+  // open file
+  int fd = open(path, O_RDONLY, 0);
+  if (fd < 0) {
+    return naos_fs_send_error(msg.session, errno);
+  }
+
+  // reply structure:
+  // TYPE (1) | INDEX (4) | { WEAK (4) | STRONG (16) } (*)
+
+  // determine entries per reply
+  size_t max_entries = (naos_msg_get_mtu(msg.session) - 5) / 20;
+  if (max_entries == 0) {
+    close(fd);
+    return NAOS_MSG_ERROR;
+  }
+
+  // prepare reply with framing headroom
+  uint8_t *buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_MSG_FRAMING + 5 + max_entries * 20);
+  if (buf == NULL) {
+    close(fd);
+    return naos_fs_send_error(msg.session, ENOMEM);
+  }
+  uint8_t *reply = buf + NAOS_MSG_FRAMING;
+  reply[0] = NAOS_FS_REPLY_HASHES;
+
+  // prepare context
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+
+  // prepare data
+  uint8_t data[1024];
+  uint8_t hash[32];
+
+  // hash blocks
+  uint32_t index = 0;
+  size_t count = 0;
+  bool eof = false;
+  while (!eof) {
+    // start checksum
+    mbedtls_sha256_starts(&ctx, false);
+
+    // read block and compute rsync-style weak checksum in the same pass
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t total = 0;
+    while (total < block_size) {
+      size_t len = block_size - total < sizeof(data) ? block_size - total : sizeof(data);
+      ssize_t ret = read(fd, data, len);
+      if (ret < 0) {
+        naos_mem_free(NAOS_MEM_FS, buf);
+        close(fd);
+        mbedtls_sha256_free(&ctx);
+        return naos_fs_send_error(msg.session, errno);
+      } else if (ret == 0) {
+        eof = true;
+        break;
+      }
+      mbedtls_sha256_update(&ctx, data, ret);
+      for (ssize_t i = 0; i < ret; i++) {
+        a += data[i];
+        b += a;
+      }
+      total += ret;
+    }
+
+    // stop on empty block
+    if (total == 0) {
+      break;
+    }
+
+    // finish checksum
+    mbedtls_sha256_finish(&ctx, hash);
+
+    // add entry
+    uint32_t weak = (a & 0xFFFF) | (b << 16);
+    uint8_t *entry = reply + 5 + count * 20;
+    memcpy(entry, &weak, sizeof(weak));
+    memcpy(entry + 4, hash, 16);
+    count++;
+
+    // send full reply
+    if (count == max_entries) {
+      memcpy(reply + 1, &index, sizeof(index));
+      naos_msg_send((naos_msg_t){
+          .session = msg.session,
+          .endpoint = NAOS_FS_ENDPOINT,
+          .data = reply,
+          .len = 5 + count * 20,
+          .framed = true,
+      });
+      index += count;
+      count = 0;
+
+      // yield to system
+      naos_delay(1);
+    }
+  }
+
+  // send remaining entries
+  if (count > 0) {
+    memcpy(reply + 1, &index, sizeof(index));
+    naos_msg_send((naos_msg_t){
+        .session = msg.session,
+        .endpoint = NAOS_FS_ENDPOINT,
+        .data = reply,
+        .len = 5 + count * 20,
+        .framed = true,
+    });
+  }
+
+  // free buffer, close file and free context
+  naos_mem_free(NAOS_MEM_FS, buf);
+  close(fd);
+  mbedtls_sha256_free(&ctx);
+
+  return NAOS_MSG_ACK;
+}
+
+static naos_msg_reply_t naos_fs_handle_copy(naos_msg_t msg, int handle) {
+  // command structure:
+  // FLAGS (1) | OFFSET (4) | SOURCE_OFFSET (4) | LENGTH (4) | PATH (*)
+
+  // check path
+  if (msg.len <= 13 || msg.data[13] != '/') {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get flags (copies are always sequential)
+  naos_fs_write_flags_t flags = msg.data[0];
+  bool silent = flags & NAOS_FS_WRITE_FLAG_SILENT;
+
+  // get offsets and length
+  uint32_t offset;
+  uint32_t source_offset;
+  uint32_t length;
+  memcpy(&offset, msg.data + 1, sizeof(offset));
+  memcpy(&source_offset, msg.data + 5, sizeof(source_offset));
+  memcpy(&length, msg.data + 9, sizeof(length));
+
+  // find file
+  naos_fs_file_t *file = naos_fs_find(msg.session, handle);
+  if (file == NULL) {
+    return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, EBADF);
+  }
+
+  // report deferred errors from previous silent writes
+  if (file->err != 0) {
+    if (silent) {
+      return NAOS_MSG_OK;
+    }
+    int err = file->err;
+    file->err = 0;
+    return naos_fs_send_error(msg.session, err);
+  }
+
+  // verify sequential offset
+  if (offset != file->off) {
+    return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, EINVAL);
+  }
+
+  // get source path
+  char path[PATH_MAX];
+  if (!naos_fs_join(path, sizeof(path), (const char *)(msg.data + 13))) {
+    return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, errno);
+  }
+
+  // open source
+  int fd = open(path, O_RDONLY, 0);
+  if (fd < 0 || lseek(fd, source_offset, SEEK_SET) < 0) {
+    int err = errno;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return silent ? NAOS_MSG_OK : naos_fs_send_error(msg.session, err);
+  }
+
+  // copy range
+  uint8_t data[1024];
+  uint32_t total = 0;
+  int err = 0;
+  while (total < length) {
+    size_t len = length - total < sizeof(data) ? length - total : sizeof(data);
+    ssize_t ret = read(fd, data, len);
+    if (ret <= 0) {
+      err = ret < 0 ? errno : EIO;
+      break;
+    }
+    if (!naos_fs_buffer(file, data, ret)) {
+      err = errno;
+      break;
+    }
+    total += ret;
+  }
+
+  // close source
+  close(fd);
+
+  // handle errors
+  if (err != 0) {
+    if (silent) {
+      file->err = err;
+      return NAOS_MSG_OK;
+    }
+    return naos_fs_send_error(msg.session, err);
+  }
+
+  // update timestamp
+  file->ts = naos_millis();
+
+  return silent ? NAOS_MSG_OK : NAOS_MSG_ACK;
+}
+
+static naos_msg_reply_t naos_fs_handle_scan(naos_msg_t msg) {
+  // command structure:
+  // CURSOR (4) | LIMIT (2) | SINCE (4) | PATH (*) | 0 | PATTERN (*)
+
+  // check path
+  if (msg.len <= 10 || msg.data[10] != '/') {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get cursor, limit and since
+  uint32_t cursor;
+  uint16_t limit;
+  uint32_t since;
+  memcpy(&cursor, msg.data, sizeof(cursor));
+  memcpy(&limit, msg.data + 4, sizeof(limit));
+  memcpy(&since, msg.data + 6, sizeof(since));
+
+  // get path and optional pattern
+  const char *dir_path = (const char *)(msg.data + 10);
+  size_t dir_len = strlen(dir_path);
+  const char *pattern = NULL;
+  if (10 + dir_len + 1 < msg.len) {
+    pattern = dir_path + dir_len + 1;
+  }
+
+  // check if listing root with configured entries
+  bool entries = strcmp(dir_path, "/") == 0 && naos_fs_config.root_entries != NULL;
+
+  // get root
+  char root[PATH_MAX];
+  if (!entries && !naos_fs_join(root, sizeof(root), dir_path)) {
+    return naos_fs_send_error(msg.session, errno);
+  }
+
+  // open directory
+  DIR *dir = NULL;
+  if (!entries) {
+    dir = opendir(root);
+    if (dir == NULL) {
+      return naos_fs_send_error(msg.session, errno);
+    }
+  }
+
+  // reply structure:
+  // TYPE (1) | CURSOR (4) | { IS_DIR (1) | SIZE (4) | MTIME (4) | NAME (*) | 0 } (*)
+
+  // prepare reply with framing headroom
+  size_t mtu = naos_msg_get_mtu(msg.session);
+  uint8_t *buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_MSG_FRAMING + mtu);
+  if (buf == NULL) {
+    if (dir != NULL) {
+      closedir(dir);
+    }
+    return naos_fs_send_error(msg.session, ENOMEM);
+  }
+  uint8_t *reply = buf + NAOS_MSG_FRAMING;
+  reply[0] = NAOS_FS_REPLY_ENTRIES;
+  size_t len = 5;
+
+  // prepare path
+  char path[PATH_MAX];
+
+  // iterate over entries, the cursor is the raw entry index which stays valid
+  // as long as the directory is not modified
+  uint32_t index = 0;
+  uint16_t count = 0;
+  bool done = false;
+  for (;; index++) {
+    // get next name
+    const char *name;
+    if (entries) {
+      name = naos_fs_config.root_entries[index];
+    } else {
+      struct dirent *entry = readdir(dir);
+      name = entry != NULL ? entry->d_name : NULL;
+    }
+
+    // check end
+    if (name == NULL) {
+      done = true;
+      break;
+    }
+
+    // skip entries before cursor
+    if (index < cursor) {
+      continue;
+    }
 
+    // check limit
+    if (limit > 0 && count >= limit) {
+      break;
+    }
+
+    // skip the "." and ".." entries
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+
+    // apply pattern
+    if (pattern != NULL && !naos_fs_match(pattern, name)) {
+      continue;
+    }
+
+    // join path
+    int err = 0;
+    if (entries) {
+      char rel[PATH_MAX];
+      snprintf(rel, sizeof(rel), "/%s", name);
+      if (!naos_fs_join(path, sizeof(path), rel)) {
+        err = errno;
+      }
+    } else {
+      int written = snprintf(path, sizeof(path), "%s/%s", root, name);
+      if (written < 0 || (size_t)written >= sizeof(path)) {
+        err = ENAMETOOLONG;
+      }
+    }
+
+    // stat entry
+    struct stat info;
+    if (err == 0 && stat(path, &info) != 0) {
+      err = errno;
+    }
+
+    // handle errors
+    if (err != 0) {
+      naos_mem_free(NAOS_MEM_FS, buf);
+      if (dir != NULL) {
+        closedir(dir);
+      }
+      return naos_fs_send_error(msg.session, err);
+    }
+
+    // apply modification filter
+    if (since > 0 && (uint32_t)info.st_mtime < since) {
+      continue;
+    }
+
+    // skip entries that never fit a reply
+    size_t name_len = strlen(name);
+    size_t size = 10 + name_len;
+    if (5 + size > mtu) {
+      continue;
+    }
+
+    // send full reply, resuming at this entry
+    if (len + size > mtu) {
+      memcpy(reply + 1, &index, sizeof(index));
+      naos_msg_send((naos_msg_t){
+          .session = msg.session,
+          .endpoint = NAOS_FS_ENDPOINT,
+          .data = reply,
+          .len = len,
+          .framed = true,
+      });
+      len = 5;
+
+      // yield to system
+      naos_delay(1);
+    }
+
+    // add entry
+    uint32_t entry_size = info.st_size;
+    uint32_t entry_time = info.st_mtime;
+    reply[len] = S_ISDIR(info.st_mode);
+    memcpy(reply + len + 1, &entry_size, sizeof(entry_size));
+    memcpy(reply + len + 5, &entry_time, sizeof(entry_time));
+    memcpy(reply + len + 9, name, name_len + 1);
+    len += size;
+    count++;
+  }
+
+  // close directory
+  if (dir != NULL) {
+    closedir(dir);
+  }
+
+  // send last reply with the next cursor or zero if done
+  uint32_t next = done ? 0 : index;
+  memcpy(reply + 1, &next, sizeof(next));
+  naos_msg_send((naos_msg_t){
+      .session = msg.session,
+      .endpoint = NAOS_FS_ENDPOINT,
+      .data = reply,
+      .len = len,
+      .framed = true,
+  });
+
+  // free buffer
+  naos_mem_free(NAOS_MEM_FS, buf);
+
+  return NAOS_MSG_ACK;
+}
+
+typedef struct {
+  uint16_t session;
+  uint8_t *buf;
+  uint8_t *reply;
+  size_t len;
+  size_t max;
+  uint32_t off;
+} naos_fs_stream_t;
+
+static void naos_fs_stream_send(naos_fs_stream_t *stream) {
   // check length
-  if (msg.len == 0) {
+  if (stream->len == 0) {
+    return;
+  }
+
+  // write chunk header
+  stream->reply[0] = NAOS_FS_REPLY_CHUNK;
+  memcpy(stream->reply + 1, &stream->off, sizeof(stream->off));
+
+  // send reply
+  naos_msg_send((naos_msg_t){
+      .session = stream->session,
+      .endpoint = NAOS_FS_ENDPOINT,
+      .data = stream->reply,
+      .len = 5 + stream->len,
+      .framed = true,
+  });
+
+  // advance offset
+  stream->off += stream->len;
+  stream->len = 0;
+
+  // yield to system
+  naos_delay(1);
+}
+
+static void naos_fs_stream_write(naos_fs_stream_t *stream, const void *data, size_t len) {
+  while (len > 0) {
+    // copy data into chunk
+    size_t num = stream->max - stream->len;
+    if (num > len) {
+      num = len;
+    }
+    memcpy(stream->reply + 5 + stream->len, data, num);
+    stream->len += num;
+    data = (const uint8_t *)data + num;
+    len -= num;
+
+    // send full chunk
+    if (stream->len == stream->max) {
+      naos_fs_stream_send(stream);
+    }
+  }
+}
+
+static int naos_fs_stream_file(naos_fs_stream_t *stream, const char *path, uint32_t size) {
+  // open file
+  int fd = open(path, O_RDONLY, 0);
+  if (fd < 0) {
+    return errno;
+  }
+
+  // read file directly into chunks
+  uint32_t total = 0;
+  while (total < size) {
+    size_t num = stream->max - stream->len;
+    if (num > size - total) {
+      num = size - total;
+    }
+    ssize_t ret = read(fd, stream->reply + 5 + stream->len, num);
+    if (ret <= 0) {
+      int err = ret < 0 ? errno : EIO;
+      close(fd);
+      return err;
+    }
+    stream->len += ret;
+    total += ret;
+
+    // send full chunk
+    if (stream->len == stream->max) {
+      naos_fs_stream_send(stream);
+    }
+  }
+
+  // close file
+  close(fd);
+
+  return 0;
+}
+
+static naos_msg_reply_t naos_fs_handle_archive(naos_msg_t msg) {
+  // command structure:
+  // PATH (*)
+
+  // check path
+  if (msg.len == 0 || msg.data[0] != '/') {
     return NAOS_MSG_INVALID;
   }
 
+  // get path, which is extended with the entry names while walking the tree
+  char path[PATH_MAX];
+  if (!naos_fs_join(path, sizeof(path), (const char *)msg.data)) {
+    return naos_fs_send_error(msg.session, errno);
+  }
+  size_t root_len = strlen(path);
+
+  // open root directory
+  DIR *dirs[NAOS_FS_ARCHIVE_DEPTH];
+  size_t lens[NAOS_FS_ARCHIVE_DEPTH];
+  dirs[0] = opendir(path);
+  lens[0] = root_len;
+  if (dirs[0] == NULL) {
+    return naos_fs_send_error(msg.session, errno);
+  }
+
+  // reply structure:
+  // TYPE (1) | OFFSET (4) | DATA (*)
+
+  // prepare stream with framing headroom
+  naos_fs_stream_t stream = {
+      .session = msg.session,
+      .max = naos_msg_get_mtu(msg.session) - 16,
+  };
+  stream.buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_MSG_FRAMING + 5 + stream.max);
+  if (stream.buf == NULL) {
+    closedir(dirs[0]);
+    return naos_fs_send_error(msg.session, ENOMEM);
+  }
+  stream.reply = stream.buf + NAOS_MSG_FRAMING;
+
+  // archive structure:
+  // { TYPE (1) | SIZE (4) | NAME (*) | 0 | DATA (SIZE) } (*)
+
+  // walk tree depth-first, directories precede their contents
+  int depth = 0;
+  int err = 0;
+  while (depth >= 0 && err == 0) {
+    // get next entry or leave directory
+    struct dirent *entry = readdir(dirs[depth]);
+    if (entry == NULL) {
+      closedir(dirs[depth]);
+      depth--;
+      continue;
+    }
+
+    // skip the "." and ".." entries
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    // append name
+    size_t len = lens[depth];
+    int written = snprintf(path + len, sizeof(path) - len, "/%s", entry->d_name);
+    if (written < 0 || (size_t)written >= sizeof(path) - len) {
+      err = ENAMETOOLONG;
+      break;
+    }
+
+    // stat entry
+    struct stat info;
+    if (stat(path, &info) != 0) {
+      err = errno;
+      break;
+    }
+
+    // write entry header with the name relative to the root
+    bool is_dir = S_ISDIR(info.st_mode);
+    uint8_t head[5] = {is_dir ? NAOS_FS_ARCHIVE_DIR : NAOS_FS_ARCHIVE_FILE};
+    uint32_t size = is_dir ? 0 : info.st_size;
+    memcpy(head + 1, &size, sizeof(size));
+    naos_fs_stream_write(&stream, head, sizeof(head));
+    naos_fs_stream_write(&stream, path + root_len + 1, len + written - root_len);
+
+    // write file data
+    if (!is_dir) {
+      err = naos_fs_stream_file(&stream, path, size);
+      continue;
+    }
+
+    // enter directory
+    if (depth + 1 >= NAOS_FS_ARCHIVE_DEPTH) {
+      err = ELOOP;
+      break;
+    }
+    dirs[depth + 1] = opendir(path);
+    if (dirs[depth + 1] == NULL) {
+      err = errno;
+      break;
+    }
+    depth++;
+    lens[depth] = len + written;
+  }
+
+  // close remaining directories
+  for (; depth >= 0; depth--) {
+    closedir(dirs[depth]);
+  }
+
+  // send remaining data
+  if (err == 0) {
+    naos_fs_stream_send(&stream);
+  }
+
+  // free buffer
+  naos_mem_free(NAOS_MEM_FS, stream.buf);
+
+  // handle errors
+  if (err != 0) {
+    return naos_fs_send_error(msg.session, err);
+  }
+
+  return NAOS_MSG_ACK;
+}
+
+static naos_msg_reply_t naos_fs_process(naos_msg_t msg) {
+  // message structure:
+  // CMD (1) | *
+
   // get command
   naos_fs_cmd_t cmd = msg.data[0];
 
@@ -788,56 +2020,59 @@ static naos_msg_reply_t naos_fs_handle(naos_msg_t msg) {
   msg.data = &msg.data[1];
   msg.len -= 1;
 
-  // acquire mutex
-  naos_lock(naos_fs_mutex);
+  // get handle of handle addressed commands:
+  // HANDLE (1) | *
+  int handle = -1;
+  if (cmd == NAOS_FS_CMD_HREAD || cmd == NAOS_FS_CMD_HWRITE || cmd == NAOS_FS_CMD_HCLOSE) {
+    if (msg.len == 0) {
+      return NAOS_MSG_INVALID;
+    }
+    handle = msg.data[0];
+    msg.data = &msg.data[1];
+    msg.len -= 1;
+  }
 
   // handle command
-  naos_msg_reply_t reply;
   switch (cmd) {
     case NAOS_FS_CMD_STAT:
-      reply = naos_fs_handle_stat(msg);
-      break;
+      return naos_fs_handle_stat(msg);
     case NAOS_FS_CMD_LIST:
-      reply = naos_fs_handle_list(msg);
-      break;
+      return naos_fs_handle_list(msg);
     case NAOS_FS_CMD_OPEN:
-      reply = naos_fs_handle_open(msg);
-      break;
+      return naos_fs_handle_open(msg);
     case NAOS_FS_CMD_READ:
-      reply = naos_fs_handle_read(msg);
-      break;
+    case NAOS_FS_CMD_HREAD:
+      return naos_fs_handle_read(msg, handle);
     case NAOS_FS_CMD_WRITE:
-      reply = naos_fs_handle_write(msg);
-      break;
+    case NAOS_FS_CMD_HWRITE:
+      return naos_fs_handle_write(msg, handle);
     case NAOS_FS_CMD_CLOSE:
-      reply = naos_fs_handle_close(msg);
-      break;
+    case NAOS_FS_CMD_HCLOSE:
+      return naos_fs_handle_close(msg, handle);
     case NAOS_FS_CMD_RENAME:
-      reply = naos_fs_handle_rename(msg);
-      break;
+      return naos_fs_handle_rename(msg);
     case NAOS_FS_CMD_REMOVE:
-      reply = naos_fs_handle_remove(msg);
-      break;
+      return naos_fs_handle_remove(msg);
     case NAOS_FS_CMD_SHA256:
-      reply = naos_fs_handle_sha256(msg);
-      break;
+      return naos_fs_handle_sha256(msg);
     case NAOS_FS_CMD_MAKE:
-      reply = naos_fs_handle_make(msg);
-      break;
+      return naos_fs_handle_make(msg);
+    case NAOS_FS_CMD_HASHES:
+      return naos_fs_handle_hashes(msg);
+    case NAOS_FS_CMD_COPY:
+      return naos_fs_handle_copy(msg, handle);
+    case NAOS_FS_CMD_SCAN:
+      return naos_fs_handle_scan(msg);
+    case NAOS_FS_CMD_ARCHIVE:
+      return naos_fs_handle_archive(msg);
+    case NAOS_FS_CMD_LOG:
+      return naos_fs_log_handle(msg);
     default:
-      reply = NAOS_MSG_UNKNOWN;
+      return NAOS_MSG_UNKNOWN;
   }
-
-  // acquire mutex
-  naos_unlock(naos_fs_mutex);
-
-  return reply;
 }
 
-static void naos_fs_cleanup(uint16_t session) {
-  // acquire mutex
-  naos_lock(naos_fs_mutex);
-
+static void naos_fs_cleanup_files(uint16_t session) {
   // get time
   int64_t now = naos_millis();
 
@@ -845,13 +2080,70 @@ static void naos_fs_cleanup(uint16_t session) {
   for (int i = 0; i < NAOS_FS_MAX_FILES; i++) {
     naos_fs_file_t *f = &naos_fs_files[i];
     if (f->active && (f->sid == session || now - f->ts > 5000)) {
-      close(f->fd);
-      *f = (naos_fs_file_t){0};
+      naos_fs_close(f);
     }
   }
+}
 
-  // release mutex
-  naos_unlock(naos_fs_mutex);
+static void naos_fs_worker() {
+  for (;;) {
+    // await request
+    naos_fs_request_t req;
+    naos_pop(naos_fs_queue, &req, -1);
+
+    // handle cleanup
+    if (req.cleanup) {
+      naos_fs_cleanup_files(req.msg.session);
+      continue;
+    }
+
+    // process command
+    int trace_id = naos_trace_begin("naos-fs", "process", req.msg.data[0]);
+    naos_msg_reply_t reply = naos_fs_process(req.msg);
+    naos_trace_end(trace_id);
+
+    // send non-ok replies
+    if (reply != NAOS_MSG_OK) {
+      naos_msg_send((naos_msg_t){
+          .session = req.msg.session,
+          .endpoint = 0xFE,
+          .data = (uint8_t *)&reply,
+          .len = 1,
+      });
+    }
+
+    // free data
+    naos_mem_free(NAOS_MEM_FS, req.msg.data);
+  }
+}
+
+static naos_msg_reply_t naos_fs_handle(naos_msg_t msg) {
+  // check length
+  if (msg.len == 0) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // copy data, as it is freed once the handler returns (the messaging system
+  // guarantees a terminating zero that handlers rely on for paths)
+  uint8_t *copy = naos_mem_alloc(NAOS_MEM_FS, msg.len + 1);
+  if (copy == NULL) {
+    return NAOS_MSG_ERROR;
+  }
+  memcpy(copy, msg.data, msg.len);
+  copy[msg.len] = 0;
+  msg.data = copy;
+
+  // queue request, replies are sent by the worker
+  naos_fs_request_t req = {.msg = msg};
+  naos_push(naos_fs_queue, &req, -1);
+
+  return NAOS_MSG_OK;
+}
+
+static void naos_fs_cleanup(uint16_t session) {
+  // queue cleanup to run after pending requests
+  naos_fs_request_t req = {.msg = {.session = session}, .cleanup = true};
+  naos_push(naos_fs_queue, &req, -1);
 }
 
 void naos_fs_mount_fat(const char *path, const char *label, int max_files) {
@@ -877,12 +2169,15 @@ void naos_fs_install(naos_fs_config_t cfg) {
     return;
   }
 
-  // create mutex
-  naos_fs_mutex = naos_mutex();
-
   // store config
   naos_fs_config = cfg;
 
+  // create queue
+  naos_fs_queue = naos_queue(NAOS_FS_QUEUE_LENGTH, sizeof(naos_fs_request_t));
+
+  // run worker
+  naos_run("naos-fs", NAOS_FS_STACK_SIZE, naos_config()->msg_core, naos_fs_worker);
+
   // install endpoint
   naos_msg_install((naos_msg_endpoint_t){
       .ref = NAOS_FS_ENDPOINT,
@@ -0,0 +1,21 @@
+#ifndef _NAOS_FS_H
+#define _NAOS_FS_H
+
+#include <naos/msg.h>
+
+#define NAOS_FS_ENDPOINT 0x3
+
+typedef enum {
+  NAOS_FS_REPLY_ERROR,
+  NAOS_FS_REPLY_INFO,
+  NAOS_FS_REPLY_CHUNK,
+  NAOS_FS_REPLY_SHA256,
+  NAOS_FS_REPLY_HASHES,
+  NAOS_FS_REPLY_ENTRIES,
+  NAOS_FS_REPLY_HANDLE,
+  NAOS_FS_REPLY_RECORDS,
+} naos_fs_reply_t;
+
+naos_msg_reply_t naos_fs_send_error(uint16_t session, int error);
+
+#endif  // _NAOS_FS_H
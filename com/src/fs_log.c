@@ -0,0 +1,529 @@
+#include <naos.h>
+#include <naos/fs.h>
+#include <naos/msg.h>
+#include <naos/sys.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/syslimits.h>
+#include <esp_log.h>
+
+#include "fs.h"
+#include "fs_log.h"
+#include "utils.h"
+#include "mem.h"
+
+#define NAOS_FS_LOG_MAGIC 0x474C534E
+#define NAOS_FS_LOG_HEADER_SIZE 16
+#define NAOS_FS_LOG_RECORD_SIZE 14
+
+typedef enum {
+  NAOS_FS_LOG_MODE_SEQ,
+  NAOS_FS_LOG_MODE_TIME,
+} naos_fs_log_mode_t;
+
+typedef struct {
+  uint32_t first;
+  uint32_t count;
+  int64_t first_time;
+  int64_t last_time;
+  uint32_t end;
+} naos_fs_log_segment_t;
+
+struct naos_fs_log {
+  naos_fs_log_config_t cfg;
+  naos_mutex_t mutex;
+  // segment directory, rebuilt from the segment files when opened
+  naos_fs_log_segment_t *segments;
+  size_t current;
+  int fd;
+  uint32_t next;
+  // append buffer for the current segment
+  uint8_t *buf;
+  size_t buf_len;
+  naos_fs_log_t *link;
+};
+
+static naos_fs_log_t *naos_fs_log_list = NULL;
+
+static int64_t naos_fs_log_time() {
+  // get time in milliseconds since the epoch
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void naos_fs_log_path(naos_fs_log_t *log, size_t index, char *path) {
+  // build segment path
+  snprintf(path, PATH_MAX, "%s/%u.seg", log->cfg.path, (unsigned)index);
+}
+
+static bool naos_fs_log_write(int fd, uint32_t offset, const uint8_t *data, size_t len) {
+  // seek to offset
+  if (lseek(fd, offset, SEEK_SET) < 0) {
+    return false;
+  }
+
+  // write data
+  size_t total = 0;
+  while (total < len) {
+    ssize_t ret = write(fd, data + total, len - total);
+    if (ret < 0) {
+      return false;
+    }
+    total += ret;
+  }
+
+  return true;
+}
+
+static bool naos_fs_log_read(int fd, uint8_t *data, size_t len) {
+  // read data
+  size_t total = 0;
+  while (total < len) {
+    ssize_t ret = read(fd, data + total, len - total);
+    if (ret <= 0) {
+      return false;
+    }
+    total += ret;
+  }
+
+  return true;
+}
+
+static bool naos_fs_log_prepare(naos_fs_log_t *log, size_t index) {
+  // open segment file
+  char path[PATH_MAX];
+  naos_fs_log_path(log, index, path);
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  // preallocate segment with zeroes so that later writes do not allocate
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return false;
+  }
+  uint8_t zero[256] = {0};
+  for (uint32_t off = info.st_size; off < log->cfg.segment_size;) {
+    size_t len = log->cfg.segment_size - off < sizeof(zero) ? log->cfg.segment_size - off : sizeof(zero);
+    if (!naos_fs_log_write(fd, off, zero, len)) {
+      close(fd);
+      return false;
+    }
+    off += len;
+  }
+
+  // prepare segment
+  naos_fs_log_segment_t *seg = &log->segments[index];
+  *seg = (naos_fs_log_segment_t){0};
+
+  // read header
+  uint8_t head[NAOS_FS_LOG_HEADER_SIZE];
+  uint32_t magic = 0;
+  if (lseek(fd, 0, SEEK_SET) == 0 && naos_fs_log_read(fd, head, sizeof(head))) {
+    memcpy(&magic, head, sizeof(magic));
+  }
+  if (magic != NAOS_FS_LOG_MAGIC) {
+    close(fd);
+    return true;
+  }
+  memcpy(&seg->first, head + 4, sizeof(seg->first));
+  memcpy(&seg->first_time, head + 8, sizeof(seg->first_time));
+  seg->last_time = seg->first_time;
+  seg->end = NAOS_FS_LOG_HEADER_SIZE;
+
+  // scan records until a zero length or a sequence gap, which marks stale
+  // records from an earlier use of the segment
+  uint8_t rec[NAOS_FS_LOG_RECORD_SIZE];
+  while (seg->end + NAOS_FS_LOG_RECORD_SIZE <= log->cfg.segment_size) {
+    if (!naos_fs_log_read(fd, rec, sizeof(rec))) {
+      break;
+    }
+    uint16_t len;
+    uint32_t seq;
+    int64_t time;
+    memcpy(&len, rec, sizeof(len));
+    memcpy(&seq, rec + 2, sizeof(seq));
+    memcpy(&time, rec + 6, sizeof(time));
+    if (len == 0 || seq != seg->first + seg->count ||
+        seg->end + NAOS_FS_LOG_RECORD_SIZE + len > log->cfg.segment_size) {
+      break;
+    }
+    if (lseek(fd, len, SEEK_CUR) < 0) {
+      break;
+    }
+    seg->count++;
+    seg->last_time = time;
+    seg->end += NAOS_FS_LOG_RECORD_SIZE + len;
+  }
+
+  // close file
+  close(fd);
+
+  return true;
+}
+
+static bool naos_fs_log_start(naos_fs_log_t *log, size_t index, int64_t time) {
+  // close current segment
+  if (log->fd >= 0) {
+    close(log->fd);
+    log->fd = -1;
+  }
+
+  // open segment
+  char path[PATH_MAX];
+  naos_fs_log_path(log, index, path);
+  int fd = open(path, O_RDWR, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  // write header, stale records are ignored as their sequence numbers do not
+  // continue the new first sequence number
+  uint8_t head[NAOS_FS_LOG_HEADER_SIZE];
+  uint32_t magic = NAOS_FS_LOG_MAGIC;
+  memcpy(head, &magic, sizeof(magic));
+  memcpy(head + 4, &log->next, sizeof(log->next));
+  memcpy(head + 8, &time, sizeof(time));
+  if (!naos_fs_log_write(fd, 0, head, sizeof(head))) {
+    close(fd);
+    return false;
+  }
+
+  // set segment
+  log->segments[index] = (naos_fs_log_segment_t){
+      .first = log->next,
+      .first_time = time,
+      .last_time = time,
+      .end = NAOS_FS_LOG_HEADER_SIZE,
+  };
+  log->current = index;
+  log->fd = fd;
+
+  return true;
+}
+
+static bool naos_fs_log_commit(naos_fs_log_t *log) {
+  // check buffer
+  if (log->buf_len == 0) {
+    return true;
+  }
+
+  // write buffer and sync file, on failure the buffer is kept and rewritten
+  // at the same offset by the next commit so that no hole is left behind
+  naos_fs_log_segment_t *seg = &log->segments[log->current];
+  if (!naos_fs_log_write(log->fd, seg->end, log->buf, log->buf_len) || fsync(log->fd) != 0) {
+    return false;
+  }
+
+  // advance end
+  seg->end += log->buf_len;
+  log->buf_len = 0;
+
+  return true;
+}
+
+naos_fs_log_t *naos_fs_log_open(naos_fs_log_config_t cfg) {
+  // check config
+  if (cfg.name == NULL || cfg.path == NULL || cfg.segments < 2 ||
+      cfg.segment_size < NAOS_FS_LOG_HEADER_SIZE + NAOS_FS_LOG_RECORD_SIZE + 1 ||
+      cfg.buffer_size < NAOS_FS_LOG_RECORD_SIZE + 1) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_fs_log_open: invalid config");
+    return NULL;
+  }
+
+  // allocate log
+  naos_fs_log_t *log = naos_mem_calloc(NAOS_MEM_FS, 1, sizeof(naos_fs_log_t));
+  naos_fs_log_segment_t *segments = naos_mem_calloc(NAOS_MEM_FS, cfg.segments, sizeof(naos_fs_log_segment_t));
+  uint8_t *buf = naos_mem_alloc(NAOS_MEM_FS, cfg.buffer_size);
+  if (log == NULL || segments == NULL || buf == NULL) {
+    naos_mem_free(NAOS_MEM_FS, log);
+    naos_mem_free(NAOS_MEM_FS, segments);
+    naos_mem_free(NAOS_MEM_FS, buf);
+    return NULL;
+  }
+  log->cfg = cfg;
+  log->segments = segments;
+  log->buf = buf;
+  log->fd = -1;
+
+  // create directory
+  if (mkdir(cfg.path, 0755) != 0 && errno != EEXIST) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_fs_log_open: failed to create directory (%d)", errno);
+    naos_mem_free(NAOS_MEM_FS, log);
+    naos_mem_free(NAOS_MEM_FS, segments);
+    naos_mem_free(NAOS_MEM_FS, buf);
+    return NULL;
+  }
+
+  // prepare segments and find the newest one
+  bool found = false;
+  for (size_t i = 0; i < cfg.segments; i++) {
+    if (!naos_fs_log_prepare(log, i)) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_fs_log_open: failed to prepare segment (%d)", errno);
+      naos_mem_free(NAOS_MEM_FS, log);
+      naos_mem_free(NAOS_MEM_FS, segments);
+      naos_mem_free(NAOS_MEM_FS, buf);
+      return NULL;
+    }
+    naos_fs_log_segment_t *seg = &segments[i];
+    if (seg->end > 0 && (!found || seg->first + seg->count > log->next)) {
+      log->current = i;
+      log->next = seg->first + seg->count;
+      found = true;
+    }
+  }
+
+  // continue newest segment or start the first one
+  bool ok;
+  if (found) {
+    char path[PATH_MAX];
+    naos_fs_log_path(log, log->current, path);
+    log->fd = open(path, O_RDWR, 0);
+    ok = log->fd >= 0;
+  } else {
+    log->next = 1;
+    ok = naos_fs_log_start(log, 0, naos_fs_log_time());
+  }
+  if (!ok) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_fs_log_open: failed to open segment (%d)", errno);
+    naos_mem_free(NAOS_MEM_FS, log);
+    naos_mem_free(NAOS_MEM_FS, segments);
+    naos_mem_free(NAOS_MEM_FS, buf);
+    return NULL;
+  }
+
+  // create mutex
+  log->mutex = naos_mutex();
+
+  // add log
+  log->link = naos_fs_log_list;
+  naos_fs_log_list = log;
+
+  return log;
+}
+
+uint32_t naos_fs_log_append(naos_fs_log_t *log, const void *data, size_t len) {
+  // check length
+  size_t size = NAOS_FS_LOG_RECORD_SIZE + len;
+  if (len == 0 || len > UINT16_MAX || size > log->cfg.buffer_size ||
+      NAOS_FS_LOG_HEADER_SIZE + size > log->cfg.segment_size) {
+    return 0;
+  }
+
+  // get time
+  int64_t time = naos_fs_log_time();
+
+  // acquire mutex
+  naos_lock(log->mutex);
+
+  // write buffer if full
+  if (log->buf_len + size > log->cfg.buffer_size && !naos_fs_log_commit(log)) {
+    naos_unlock(log->mutex);
+    return 0;
+  }
+
+  // start next segment if full
+  naos_fs_log_segment_t *seg = &log->segments[log->current];
+  if (seg->end + log->buf_len + size > log->cfg.segment_size) {
+    if (!naos_fs_log_commit(log) || !naos_fs_log_start(log, (log->current + 1) % log->cfg.segments, time)) {
+      naos_unlock(log->mutex);
+      return 0;
+    }
+    seg = &log->segments[log->current];
+  }
+
+  // add record:
+  // LENGTH (2) | SEQ (4) | TIME (8) | DATA (*)
+  uint32_t seq = log->next++;
+  uint16_t length = len;
+  uint8_t *rec = log->buf + log->buf_len;
+  memcpy(rec, &length, sizeof(length));
+  memcpy(rec + 2, &seq, sizeof(seq));
+  memcpy(rec + 6, &time, sizeof(time));
+  memcpy(rec + NAOS_FS_LOG_RECORD_SIZE, data, len);
+  log->buf_len += size;
+
+  // update segment
+  seg->count++;
+  seg->last_time = time;
+
+  // release mutex
+  naos_unlock(log->mutex);
+
+  return seq;
+}
+
+bool naos_fs_log_flush(naos_fs_log_t *log) {
+  // write buffer
+  naos_lock(log->mutex);
+  bool ok = naos_fs_log_commit(log);
+  naos_unlock(log->mutex);
+
+  return ok;
+}
+
+naos_msg_reply_t naos_fs_log_handle(naos_msg_t msg) {
+  // command structure:
+  // MODE (1) | FROM (8) | TO (8) | NAME (*)
+
+  // check length
+  if (msg.len <= 17) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get mode and range
+  naos_fs_log_mode_t mode = msg.data[0];
+  int64_t from;
+  int64_t to;
+  memcpy(&from, msg.data + 1, sizeof(from));
+  memcpy(&to, msg.data + 9, sizeof(to));
+  if (mode != NAOS_FS_LOG_MODE_SEQ && mode != NAOS_FS_LOG_MODE_TIME) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // find log
+  naos_fs_log_t *log = naos_fs_log_list;
+  while (log != NULL && strcmp(log->cfg.name, (const char *)(msg.data + 17)) != 0) {
+    log = log->link;
+  }
+  if (log == NULL) {
+    return naos_fs_send_error(msg.session, ENOENT);
+  }
+
+  // write buffered records and copy the segment directory, the segment files
+  // are read without holding the mutex to not block appends
+  naos_lock(log->mutex);
+  naos_fs_log_commit(log);
+  naos_fs_log_segment_t *segments = naos_mem_alloc(NAOS_MEM_FS, log->cfg.segments * sizeof(naos_fs_log_segment_t));
+  if (segments != NULL) {
+    memcpy(segments, log->segments, log->cfg.segments * sizeof(naos_fs_log_segment_t));
+  }
+  size_t oldest = (log->current + 1) % log->cfg.segments;
+  naos_unlock(log->mutex);
+  if (segments == NULL) {
+    return NAOS_MSG_ERROR;
+  }
+
+  // reply structure:
+  // TYPE (1) | { SEQ (4) | TIME (8) | LENGTH (2) | DATA (*) } (*)
+
+  // prepare reply with framing headroom
+  size_t mtu = naos_msg_get_mtu(msg.session);
+  uint8_t *buf = naos_mem_alloc(NAOS_MEM_FS, NAOS_MSG_FRAMING + mtu);
+  if (buf == NULL) {
+    naos_mem_free(NAOS_MEM_FS, segments);
+    return NAOS_MSG_ERROR;
+  }
+  uint8_t *reply = buf + NAOS_MSG_FRAMING;
+  reply[0] = NAOS_FS_REPLY_RECORDS;
+  size_t len = 1;
+
+  // read segments from oldest to newest
+  for (size_t i = 0; i < log->cfg.segments; i++) {
+    naos_fs_log_segment_t *seg = &segments[(oldest + i) % log->cfg.segments];
+
+    // skip empty and non-overlapping segments
+    if (seg->count == 0) {
+      continue;
+    }
+    if (mode == NAOS_FS_LOG_MODE_SEQ && (to < seg->first || from > (int64_t)seg->first + seg->count - 1)) {
+      continue;
+    } else if (mode == NAOS_FS_LOG_MODE_TIME && (to < seg->first_time || from > seg->last_time)) {
+      continue;
+    }
+
+    // open segment
+    char path[PATH_MAX];
+    naos_fs_log_path(log, (oldest + i) % log->cfg.segments, path);
+    int fd = open(path, O_RDONLY, 0);
+    if (fd < 0 || lseek(fd, NAOS_FS_LOG_HEADER_SIZE, SEEK_SET) < 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+
+    // read records
+    for (uint32_t j = 0; j < seg->count; j++) {
+      // read record header
+      uint8_t rec[NAOS_FS_LOG_RECORD_SIZE];
+      if (!naos_fs_log_read(fd, rec, sizeof(rec))) {
+        break;
+      }
+      uint16_t length;
+      uint32_t seq;
+      int64_t time;
+      memcpy(&length, rec, sizeof(length));
+      memcpy(&seq, rec + 2, sizeof(seq));
+      memcpy(&time, rec + 6, sizeof(time));
+
+      // stop if the segment has been reused meanwhile
+      if (seq != seg->first + j) {
+        break;
+      }
+
+      // skip records outside the range or larger than a reply
+      int64_t key = mode == NAOS_FS_LOG_MODE_SEQ ? seq : time;
+      if (key < from || key > to || 1 + NAOS_FS_LOG_RECORD_SIZE + length > mtu) {
+        if (lseek(fd, length, SEEK_CUR) < 0) {
+          break;
+        }
+        continue;
+      }
+
+      // send full reply
+      if (len + NAOS_FS_LOG_RECORD_SIZE + length > mtu) {
+        naos_msg_send((naos_msg_t){
+            .session = msg.session,
+            .endpoint = NAOS_FS_ENDPOINT,
+            .data = reply,
+            .len = len,
+            .framed = true,
+        });
+        len = 1;
+
+        // yield to system
+        naos_delay(1);
+      }
+
+      // add record
+      memcpy(reply + len, &seq, sizeof(seq));
+      memcpy(reply + len + 4, &time, sizeof(time));
+      memcpy(reply + len + 12, &length, sizeof(length));
+      if (!naos_fs_log_read(fd, reply + len + NAOS_FS_LOG_RECORD_SIZE, length)) {
+        break;
+      }
+      len += NAOS_FS_LOG_RECORD_SIZE + length;
+    }
+
+    // close segment
+    close(fd);
+  }
+
+  // send remaining records
+  if (len > 1) {
+    naos_msg_send((naos_msg_t){
+        .session = msg.session,
+        .endpoint = NAOS_FS_ENDPOINT,
+        .data = reply,
+        .len = len,
+        .framed = true,
+    });
+  }
+
+  // free buffers
+  naos_mem_free(NAOS_MEM_FS, buf);
+  naos_mem_free(NAOS_MEM_FS, segments);
+
+  return NAOS_MSG_ACK;
+}
@@ -0,0 +1,8 @@
+#ifndef _NAOS_FS_LOG_H
+#define _NAOS_FS_LOG_H
+
+#include <naos/msg.h>
+
+naos_msg_reply_t naos_fs_log_handle(naos_msg_t msg);
+
+#endif  // _NAOS_FS_LOG_H
@@ -4,8 +4,12 @@
 #include <esp_http_server.h>
 #include <freertos/FreeRTOS.h>
 
+#include "metrics.h"
+#include "mem.h"
+
 #define NAOS_HTTP_MAX_CONNS 7
 #define NAOS_HTTP_MAX_FILES 8
+#define NAOS_HTTP_METRICS_BUF 1024
 
 // Max frames queued for async send. Kept below the httpd UDP control mailbox
 // depth (CONFIG_LWIP_UDP_RECVMBOX_SIZE, default 6) so httpd_queue_work can never
@@ -24,6 +28,12 @@ typedef struct {
   size_t length;
 } naos_http_file_t;
 
+typedef struct {
+  httpd_req_t *req;
+  size_t len;
+  char buf[NAOS_HTTP_METRICS_BUF];
+} naos_http_metrics_t;
+
 typedef struct {
   uint8_t *payload;
   size_t len;
@@ -36,6 +46,12 @@ static size_t naos_http_file_count = 0;
 static uint8_t naos_http_channel = 0;
 static portMUX_TYPE naos_http_inflight_mux = portMUX_INITIALIZER_UNLOCKED;
 static int naos_http_inflight = 0;  // frames queued for async send, not yet freed
+static bool naos_http_metrics_enabled = false;
+
+static void naos_http_free(void *ptr) {
+  // free tracked context
+  naos_mem_free(NAOS_MEM_HTTP, ptr);
+}
 
 static esp_err_t naos_http_socket(httpd_req_t *conn) {
   // get context
@@ -61,7 +77,7 @@ static esp_err_t naos_http_socket(httpd_req_t *conn) {
   }
 
   // allocate payload
-  req.payload = malloc(req.len);
+  req.payload = naos_mem_alloc(NAOS_MEM_HTTP, req.len);
   if (req.payload == NULL) {
     return ESP_ERR_NO_MEM;
   }
@@ -69,7 +85,7 @@ static esp_err_t naos_http_socket(httpd_req_t *conn) {
   // read frame
   err = httpd_ws_recv_frame(conn, &req, req.len);
   if (err != ESP_OK) {
-    free(req.payload);
+    naos_mem_free(NAOS_MEM_HTTP, req.payload);
     return err;
   }
 
@@ -77,11 +93,66 @@ static esp_err_t naos_http_socket(httpd_req_t *conn) {
   bool ok = naos_msg_dispatch(naos_http_channel, req.payload, req.len, ctx);
 
   // free request payload
-  free(req.payload);
+  naos_mem_free(NAOS_MEM_HTTP, req.payload);
 
   return ok ? ESP_OK : ESP_FAIL;
 }
 
+static bool naos_http_metrics_write(const char *line, size_t len, void *ctx) {
+  // get state
+  naos_http_metrics_t *state = ctx;
+
+  // send buffered lines as chunk if full
+  if (state->len + len > sizeof(state->buf)) {
+    if (httpd_resp_send_chunk(state->req, state->buf, (ssize_t)state->len) != ESP_OK) {
+      return false;
+    }
+    state->len = 0;
+  }
+
+  // send line directly if too long
+  if (len > sizeof(state->buf)) {
+    return httpd_resp_send_chunk(state->req, line, (ssize_t)len) == ESP_OK;
+  }
+
+  // buffer line
+  memcpy(state->buf + state->len, line, len);
+  state->len += len;
+
+  return true;
+}
+
+static esp_err_t naos_http_metrics(httpd_req_t *req) {
+  // set content type
+  esp_err_t err = httpd_resp_set_type(req, "application/openmetrics-text; version=1.0.0; charset=utf-8");
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // allocate state
+  naos_http_metrics_t *state = naos_mem_alloc(NAOS_MEM_HTTP, sizeof(naos_http_metrics_t));
+  if (state == NULL) {
+    return httpd_resp_send_500(req);
+  }
+  state->req = req;
+  state->len = 0;
+
+  // render metrics and send remaining lines
+  bool ok = naos_metrics_render(naos_http_metrics_write, state);
+  if (ok && state->len > 0) {
+    ok = httpd_resp_send_chunk(req, state->buf, (ssize_t)state->len) == ESP_OK;
+  }
+
+  // free state
+  naos_mem_free(NAOS_MEM_HTTP, state);
+  if (!ok) {
+    return ESP_FAIL;
+  }
+
+  // finish response
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 static esp_err_t naos_http_request(httpd_req_t *req) {
   // handle socket messages immediately
   if (req->method != HTTP_GET) {
@@ -96,14 +167,14 @@ static esp_err_t naos_http_request(httpd_req_t *req) {
   // handle initial websocket request
   if (is_ws) {
     // prepare context
-    naos_http_ctx_t *ctx = malloc(sizeof(naos_http_ctx_t));
+    naos_http_ctx_t *ctx = naos_mem_alloc(NAOS_MEM_HTTP, sizeof(naos_http_ctx_t));
     *ctx = (naos_http_ctx_t){
         .fd = httpd_req_to_sockfd(req),
     };
 
     // set context
     req->sess_ctx = ctx;
-    req->free_ctx = free;
+    req->free_ctx = naos_http_free;
 
     return ESP_OK;
   }
@@ -125,6 +196,11 @@ static esp_err_t naos_http_request(httpd_req_t *req) {
     }
   }
 
+  // handle metrics
+  if (naos_http_metrics_enabled && len == 8 && strncmp(req->uri, "/metrics", len) == 0) {
+    return naos_http_metrics(req);
+  }
+
   // check files
   for (size_t i = 0; i < naos_http_file_count; i++) {
     // get file
@@ -187,14 +263,14 @@ static void naos_http_send_frame(void *arg) {
   portEXIT_CRITICAL(&naos_http_inflight_mux);
 
   // free message
-  free(msg);
+  naos_mem_free(NAOS_MEM_HTTP, msg);
 }
 
 static uint16_t naos_http_msg_mtu() { return 4096; }
 
 static bool naos_http_msg_send(const uint8_t *data, size_t len, void *ctx) {
   // prepare message
-  naos_http_msg_t *msg = malloc(sizeof(naos_http_msg_t) + len);
+  naos_http_msg_t *msg = naos_mem_alloc(NAOS_MEM_HTTP, sizeof(naos_http_msg_t) + len);
   if (msg == NULL) {
     return false;
   }
@@ -204,7 +280,7 @@ static bool naos_http_msg_send(const uint8_t *data, size_t len, void *ctx) {
 
   // check if context is still valid
   if (httpd_ws_get_fd_info(naos_http_handle, msg->ctx->fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
-    free(msg);
+    naos_mem_free(NAOS_MEM_HTTP, msg);
     return false;
   }
 
@@ -217,7 +293,7 @@ static bool naos_http_msg_send(const uint8_t *data, size_t len, void *ctx) {
   }
   portEXIT_CRITICAL(&naos_http_inflight_mux);
   if (full) {
-    free(msg);
+    naos_mem_free(NAOS_MEM_HTTP, msg);
     return true;
   }
 
@@ -229,7 +305,7 @@ static bool naos_http_msg_send(const uint8_t *data, size_t len, void *ctx) {
     portENTER_CRITICAL(&naos_http_inflight_mux);
     naos_http_inflight--;
     portEXIT_CRITICAL(&naos_http_inflight_mux);
-    free(msg);
+    naos_mem_free(NAOS_MEM_HTTP, msg);
     return false;
   }
 
@@ -265,6 +341,9 @@ void naos_http_init(naos_http_config_t config) {
     httpd_conf.keep_alive_count = 3;     // unanswered probes before the socket is dropped
   }
 
+  // enable metrics
+  naos_http_metrics_enabled = config.metrics;
+
   // start server
   ESP_ERROR_CHECK(httpd_start(&naos_http_handle, &httpd_conf));
 
@@ -0,0 +1,85 @@
+#include <naos/metrics.h>
+
+#include <esp_heap_caps.h>
+
+#include "mem.h"
+
+#ifdef CONFIG_NAOS_MEM_ACCOUNTING
+
+// blocks may be allocated before the metric is added, the usage is therefore
+// updated atomically in place and only exposed by the metric
+static int32_t naos_mem_usage[NAOS_MEM_TAGS][2] = {0};
+
+static naos_metric_t naos_mem_metric = {
+    .name = "memory-usage",
+    .kind = NAOS_METRIC_GAUGE,
+    .type = NAOS_METRIC_LONG,
+    .data = naos_mem_usage,
+    .keys = {"subsystem", "unit"},
+    .values = {"msg", "params", "fs", "http", "serial", NULL, "bytes", "blocks"},
+};
+
+void naos_mem_init() {
+  // add metric
+  naos_metrics_add(&naos_mem_metric);
+}
+
+void naos_mem_track(naos_mem_tag_t tag, void *ptr) {
+  // check block
+  if (ptr == NULL) {
+    return;
+  }
+
+  // add block
+  __atomic_fetch_add(&naos_mem_usage[tag][0], (int32_t)heap_caps_get_allocated_size(ptr), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&naos_mem_usage[tag][1], 1, __ATOMIC_RELAXED);
+}
+
+void naos_mem_untrack(naos_mem_tag_t tag, void *ptr) {
+  // check block
+  if (ptr == NULL) {
+    return;
+  }
+
+  // remove block
+  __atomic_fetch_sub(&naos_mem_usage[tag][0], (int32_t)heap_caps_get_allocated_size(ptr), __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&naos_mem_usage[tag][1], 1, __ATOMIC_RELAXED);
+}
+
+void *naos_mem_alloc(naos_mem_tag_t tag, size_t size) {
+  // allocate and track block
+  void *ptr = malloc(size);
+  naos_mem_track(tag, ptr);
+
+  return ptr;
+}
+
+void *naos_mem_calloc(naos_mem_tag_t tag, size_t num, size_t size) {
+  // allocate and track block
+  void *ptr = calloc(num, size);
+  naos_mem_track(tag, ptr);
+
+  return ptr;
+}
+
+char *naos_mem_strdup(naos_mem_tag_t tag, const char *str) {
+  // duplicate and track string
+  char *ptr = strdup(str);
+  naos_mem_track(tag, ptr);
+
+  return ptr;
+}
+
+void naos_mem_free(naos_mem_tag_t tag, void *ptr) {
+  // untrack and free block
+  naos_mem_untrack(tag, ptr);
+  free(ptr);
+}
+
+#else
+
+void naos_mem_init() {
+  // accounting is disabled
+}
+
+#endif
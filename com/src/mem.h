@@ -0,0 +1,56 @@
+#ifndef _NAOS_MEM_H
+#define _NAOS_MEM_H
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  NAOS_MEM_MSG,
+  NAOS_MEM_PARAMS,
+  NAOS_MEM_FS,
+  NAOS_MEM_HTTP,
+  NAOS_MEM_SERIAL,
+  NAOS_MEM_TAGS,
+} naos_mem_tag_t;
+
+/**
+ * Adds the memory accounting metric. Blocks tracked before are included.
+ */
+void naos_mem_init();
+
+#ifdef CONFIG_NAOS_MEM_ACCOUNTING
+
+/**
+ * Accounts an allocated block to a subsystem.
+ *
+ * @param tag The subsystem.
+ * @param ptr The block or NULL.
+ */
+void naos_mem_track(naos_mem_tag_t tag, void *ptr);
+
+/**
+ * Removes an allocated block from the account of a subsystem.
+ *
+ * @param tag The subsystem.
+ * @param ptr The block or NULL.
+ */
+void naos_mem_untrack(naos_mem_tag_t tag, void *ptr);
+
+void *naos_mem_alloc(naos_mem_tag_t tag, size_t size);
+void *naos_mem_calloc(naos_mem_tag_t tag, size_t num, size_t size);
+char *naos_mem_strdup(naos_mem_tag_t tag, const char *str);
+void naos_mem_free(naos_mem_tag_t tag, void *ptr);
+
+#else
+
+#define naos_mem_track(tag, ptr) ((void)(ptr))
+#define naos_mem_untrack(tag, ptr) ((void)(ptr))
+#define naos_mem_alloc(tag, size) malloc(size)
+#define naos_mem_calloc(tag, num, size) calloc(num, size)
+#define naos_mem_strdup(tag, str) strdup(str)
+#define naos_mem_free(tag, ptr) free(ptr)
+
+#endif
+
+#endif  // _NAOS_MEM_H
@@ -1,22 +1,196 @@
 #include <naos/metrics.h>
 #include <naos/msg.h>
+#include <naos/sys.h>
+#include <freertos/FreeRTOS.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
+#include "metrics.h"
+
 #define NAOS_METRICS_NUM 32
 #define NAOS_METRICS_ENDPOINT 0x5
 #define NAOS_METRICS_MAX_NAME_LEN 32
 #define NAOS_METRICS_MAX_KEY_LEN 32
 #define NAOS_METRICS_MAX_VALUE_LEN 64
+#define NAOS_METRICS_SUBS 4
+#define NAOS_METRICS_TICK 50
+#define NAOS_METRICS_KEEPALIVE 10000
 
 typedef enum {
   NAOS_METRICS_CMD_LIST,
   NAOS_METRICS_CMD_DESCRIBE,
   NAOS_METRICS_CMD_READ,
+  NAOS_METRICS_CMD_READ_MANY,
+  NAOS_METRICS_CMD_SUBSCRIBE,
+  NAOS_METRICS_CMD_HISTORY_INFO,
+  NAOS_METRICS_CMD_HISTORY_READ,
 } naos_metrics_cmd_t;
 
+typedef struct {
+  uint16_t session;
+  uint16_t interval;
+  uint32_t refs;
+  int64_t next;
+  int64_t last;
+  uint8_t *values[NAOS_METRICS_NUM];
+} naos_metrics_sub_t;
+
+typedef struct {
+  uint32_t period;
+  uint16_t samples;
+  uint32_t ratio;
+  uint32_t pending;
+  uint32_t seq;
+  int64_t last;
+  double *sums;
+  uint8_t *ring;
+} naos_metrics_tier_t;
+
+typedef struct {
+  size_t num_tiers;
+  int64_t next;
+  naos_metrics_tier_t tiers[NAOS_METRIC_TIERS];
+} naos_metrics_history_t;
+
 static naos_metric_t *naos_metrics_list[NAOS_METRICS_NUM] = {0};
 static size_t naos_metrics_count = 0;
+static portMUX_TYPE naos_metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+static naos_mutex_t naos_metrics_mutex = 0;
+static naos_metrics_sub_t naos_metrics_subs[NAOS_METRICS_SUBS] = {0};
+static naos_timer_t naos_metrics_timer = NULL;
+static naos_timer_t naos_metrics_history_timer = NULL;
+static uint32_t naos_metrics_history_tick = 0;
+
+static size_t naos_metrics_width(naos_metric_t *metric) {
+  // determine width
+  if (metric->kind == NAOS_METRIC_HISTOGRAM) {
+    return sizeof(naos_metric_histogram_t);
+  } else if (metric->type == NAOS_METRIC_LONG) {
+    return sizeof(int32_t);
+  } else if (metric->type == NAOS_METRIC_FLOAT) {
+    return sizeof(float);
+  } else if (metric->type == NAOS_METRIC_DOUBLE) {
+    return sizeof(double);
+  }
+
+  return 0;
+}
+
+static void naos_metrics_snapshot(naos_metric_t *metric, uint8_t *buf) {
+  // get length
+  size_t len = metric->size * naos_metrics_width(metric);
+
+  // copy doubles within the critical section of their updates
+  if (metric->kind != NAOS_METRIC_HISTOGRAM && metric->type == NAOS_METRIC_DOUBLE) {
+    portENTER_CRITICAL_SAFE(&naos_metrics_lock);
+    memcpy(buf, metric->data, len);
+    portEXIT_CRITICAL_SAFE(&naos_metrics_lock);
+    return;
+  }
+
+  // otherwise, copy words atomically
+  for (size_t i = 0; i < len / sizeof(uint32_t); i++) {
+    uint32_t word = __atomic_load_n((uint32_t *)metric->data + i, __ATOMIC_RELAXED);
+    memcpy(buf + i * sizeof(uint32_t), &word, sizeof(uint32_t));
+  }
+
+  // copy histogram sums within the critical section of their updates
+  if (metric->kind == NAOS_METRIC_HISTOGRAM) {
+    portENTER_CRITICAL_SAFE(&naos_metrics_lock);
+    for (size_t i = 0; i < metric->size; i++) {
+      naos_metric_histogram_t *histogram = (naos_metric_histogram_t *)metric->data + i;
+      memcpy(buf + i * sizeof(naos_metric_histogram_t) + offsetof(naos_metric_histogram_t, sum), histogram->sum,
+             sizeof(histogram->sum));
+    }
+    portEXIT_CRITICAL_SAFE(&naos_metrics_lock);
+  }
+}
+
+static double naos_metrics_get(naos_metric_t *metric, const uint8_t *buf, size_t index) {
+  // read value
+  switch (metric->type) {
+    case NAOS_METRIC_LONG: {
+      int32_t value;
+      memcpy(&value, buf + index * sizeof(value), sizeof(value));
+      return value;
+    }
+    case NAOS_METRIC_FLOAT: {
+      float value;
+      memcpy(&value, buf + index * sizeof(value), sizeof(value));
+      return value;
+    }
+    case NAOS_METRIC_DOUBLE: {
+      double value;
+      memcpy(&value, buf + index * sizeof(value), sizeof(value));
+      return value;
+    }
+  }
+
+  return 0;
+}
+
+static void naos_metrics_put(naos_metric_t *metric, uint8_t *buf, size_t index, double value) {
+  // write value
+  switch (metric->type) {
+    case NAOS_METRIC_LONG: {
+      int32_t num = (int32_t)(value < 0 ? value - 0.5 : value + 0.5);
+      memcpy(buf + index * sizeof(num), &num, sizeof(num));
+      break;
+    }
+    case NAOS_METRIC_FLOAT: {
+      float num = (float)value;
+      memcpy(buf + index * sizeof(num), &num, sizeof(num));
+      break;
+    }
+    case NAOS_METRIC_DOUBLE:
+      memcpy(buf + index * sizeof(value), &value, sizeof(value));
+      break;
+  }
+}
+
+static bool naos_metrics_pack(uint16_t session, uint8_t *frame, size_t mtu, size_t *pos, uint8_t ref, size_t offset,
+                              const uint8_t *data, size_t len) {
+  // entry structure:
+  // REF(1) | OFFSET(2) | LENGTH(2) | DATA(LENGTH)
+
+  // pack data, split across frames if necessary
+  size_t end = offset + len;
+  do {
+    // send frame if full
+    if (*pos + 5 >= mtu) {
+      bool ok = naos_msg_send((naos_msg_t){
+          .session = session,
+          .endpoint = NAOS_METRICS_ENDPOINT,
+          .data = frame,
+          .len = *pos,
+      });
+      *pos = 0;
+      if (!ok) {
+        return false;
+      }
+    }
+
+    // write entry
+    size_t chunk = end - offset < mtu - *pos - 5 ? end - offset : mtu - *pos - 5;
+    frame[*pos] = ref;
+    frame[*pos + 1] = offset & 0xFF;
+    frame[*pos + 2] = offset >> 8;
+    frame[*pos + 3] = chunk & 0xFF;
+    frame[*pos + 4] = chunk >> 8;
+    memcpy(frame + *pos + 5, data, chunk);
+    *pos += 5 + chunk;
+    offset += chunk;
+    data += chunk;
+  } while (offset < end);
+
+  return true;
+}
 
 static naos_msg_reply_t naos_metrics_handle_list(naos_msg_t msg) {
   // check length
@@ -120,6 +294,529 @@ static naos_msg_reply_t naos_metrics_handle_describe(naos_msg_t msg) {
 }
 
 static naos_msg_reply_t naos_metrics_handle_read(naos_msg_t msg) {
+  // command structure:
+  // REF (1) | CHUNKED (1)?
+
+  // check length
+  if (msg.len != 1 && msg.len != 2) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // check ref
+  if (msg.data[0] >= naos_metrics_count) {
+    return NAOS_MSG_ERROR;
+  }
+
+  // get metric and mode
+  naos_metric_t *metric = naos_metrics_list[msg.data[0]];
+  bool chunked = msg.len == 2 && msg.data[1] != 0;
+
+  // determine frame size
+  size_t len = metric->size * naos_metrics_width(metric);
+  size_t mtu = chunked ? naos_msg_get_mtu(msg.session) : 2 + len;
+  if (mtu <= 2) {
+    return NAOS_MSG_ERROR;
+  }
+
+  // allocate buffers
+  uint8_t *buf = malloc(len);
+  uint8_t *frame = chunked ? malloc(mtu) : NULL;
+  if ((len > 0 && buf == NULL) || (chunked && frame == NULL)) {
+    free(buf);
+    free(frame);
+    return NAOS_MSG_ERROR;
+  }
+
+  // snapshot values
+  naos_metrics_snapshot(metric, buf);
+
+  // reply structure:
+  // DATA(*)
+  // histogram: (BUCKETS(4 * NAOS_METRIC_BUCKETS) | SUM(8))*
+
+  // send values in one reply
+  if (!chunked) {
+    naos_msg_send((naos_msg_t){
+        .session = msg.session,
+        .endpoint = NAOS_METRICS_ENDPOINT,
+        .data = buf,
+        .len = len,
+    });
+    free(buf);
+    return NAOS_MSG_OK;
+  }
+
+  // chunked reply structure:
+  // OFFSET(2) | DATA(*)
+
+  // send values in chunks
+  bool ok = true;
+  for (size_t offset = 0; ok && offset < len; offset += mtu - 2) {
+    // prepare chunk
+    size_t chunk = len - offset < mtu - 2 ? len - offset : mtu - 2;
+    frame[0] = offset & 0xFF;
+    frame[1] = offset >> 8;
+    memcpy(frame + 2, buf + offset, chunk);
+
+    // send chunk
+    ok = naos_msg_send((naos_msg_t){
+        .session = msg.session,
+        .endpoint = NAOS_METRICS_ENDPOINT,
+        .data = frame,
+        .len = 2 + chunk,
+    });
+  }
+
+  // free buffers
+  free(buf);
+  free(frame);
+
+  return ok ? NAOS_MSG_ACK : NAOS_MSG_ERROR;
+}
+
+static naos_msg_reply_t naos_metrics_handle_read_many(naos_msg_t msg) {
+  // command structure:
+  // REF (1)*
+
+  // check refs
+  for (size_t i = 0; i < msg.len; i++) {
+    if (msg.data[i] >= naos_metrics_count) {
+      return NAOS_MSG_ERROR;
+    }
+  }
+
+  // read all metrics if none are selected
+  size_t count = msg.len > 0 ? msg.len : naos_metrics_count;
+
+  // allocate frame
+  size_t mtu = naos_msg_get_mtu(msg.session);
+  if (mtu <= 5) {
+    return NAOS_MSG_ERROR;
+  }
+  uint8_t *frame = malloc(mtu);
+  if (frame == NULL) {
+    return NAOS_MSG_ERROR;
+  }
+
+  // reply structure:
+  // (REF(1) | OFFSET(2) | LENGTH(2) | DATA(LENGTH))*
+
+  // pack metrics
+  size_t pos = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && i < count; i++) {
+    // get metric
+    uint8_t ref = msg.len > 0 ? msg.data[i] : i;
+    naos_metric_t *metric = naos_metrics_list[ref];
+
+    // snapshot values
+    size_t len = metric->size * naos_metrics_width(metric);
+    uint8_t *buf = malloc(len);
+    if (len > 0 && buf == NULL) {
+      ok = false;
+      break;
+    }
+    naos_metrics_snapshot(metric, buf);
+
+    // pack values
+    ok = naos_metrics_pack(msg.session, frame, mtu, &pos, ref, 0, buf, len);
+
+    // free buffer
+    free(buf);
+  }
+
+  // send last frame
+  if (ok && pos > 0) {
+    ok = naos_msg_send((naos_msg_t){
+        .session = msg.session,
+        .endpoint = NAOS_METRICS_ENDPOINT,
+        .data = frame,
+        .len = pos,
+    });
+  }
+
+  // free frame
+  free(frame);
+
+  return ok ? NAOS_MSG_ACK : NAOS_MSG_ERROR;
+}
+
+static void naos_metrics_drop(naos_metrics_sub_t *sub) {
+  // free values and clear subscription
+  for (size_t i = 0; i < NAOS_METRICS_NUM; i++) {
+    free(sub->values[i]);
+  }
+  memset(sub, 0, sizeof(naos_metrics_sub_t));
+}
+
+static void naos_metrics_push();
+
+static void naos_metrics_schedule() {
+  // check subscriptions
+  bool active = false;
+  for (size_t i = 0; i < NAOS_METRICS_SUBS; i++) {
+    if (naos_metrics_subs[i].session != 0) {
+      active = true;
+      break;
+    }
+  }
+
+  // start or stop timer
+  if (active && naos_metrics_timer == NULL) {
+    naos_metrics_timer = naos_repeat_defer("naos-metrics-push", NAOS_METRICS_TICK, naos_metrics_push);
+  } else if (!active && naos_metrics_timer != NULL) {
+    naos_cancel(naos_metrics_timer);
+    naos_metrics_timer = NULL;
+  }
+}
+
+static bool naos_metrics_push_sub(naos_metrics_sub_t *sub, int64_t now) {
+  // allocate frame
+  size_t mtu = naos_msg_get_mtu(sub->session);
+  if (mtu <= 5) {
+    return false;
+  }
+  uint8_t *frame = malloc(mtu);
+  if (frame == NULL) {
+    return false;
+  }
+
+  // push structure:
+  // (REF(1) | OFFSET(2) | LENGTH(2) | DATA(LENGTH))*
+
+  // pack changed cells of selected metrics
+  size_t pos = 0;
+  bool pushed = false;
+  bool ok = true;
+  for (size_t ref = 0; ok && ref < naos_metrics_count; ref++) {
+    // check selection
+    if (!(sub->refs & (1u << ref))) {
+      continue;
+    }
+
+    // get metric
+    naos_metric_t *metric = naos_metrics_list[ref];
+    size_t width = naos_metrics_width(metric);
+    size_t len = metric->size * width;
+
+    // snapshot values
+    uint8_t *buf = malloc(len);
+    if (len > 0 && buf == NULL) {
+      ok = false;
+      break;
+    }
+    naos_metrics_snapshot(metric, buf);
+
+    // pack all values on first push
+    if (sub->values[ref] == NULL) {
+      ok = naos_metrics_pack(sub->session, frame, mtu, &pos, ref, 0, buf, len);
+      sub->values[ref] = buf;
+      pushed = true;
+      continue;
+    }
+
+    // pack runs of changed cells
+    uint8_t *last = sub->values[ref];
+    size_t cell = 0;
+    while (ok && cell < metric->size) {
+      // skip unchanged cells
+      if (memcmp(buf + cell * width, last + cell * width, width) == 0) {
+        cell++;
+        continue;
+      }
+
+      // find end of run
+      size_t end = cell + 1;
+      while (end < metric->size && memcmp(buf + end * width, last + end * width, width) != 0) {
+        end++;
+      }
+
+      // pack run
+      ok = naos_metrics_pack(sub->session, frame, mtu, &pos, ref, cell * width, buf + cell * width,
+                             (end - cell) * width);
+      pushed = true;
+      cell = end;
+    }
+
+    // keep snapshot as new base
+    free(last);
+    sub->values[ref] = buf;
+  }
+
+  // send last frame, or an empty frame as keepalive
+  if (ok && (pos > 0 || (!pushed && now - sub->last >= NAOS_METRICS_KEEPALIVE))) {
+    ok = naos_msg_send((naos_msg_t){
+        .session = sub->session,
+        .endpoint = NAOS_METRICS_ENDPOINT,
+        .data = frame,
+        .len = pos,
+    });
+    sub->last = now;
+  } else if (pushed) {
+    sub->last = now;
+  }
+
+  // free frame
+  free(frame);
+
+  return ok;
+}
+
+static void naos_metrics_push() {
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // push due subscriptions
+  int64_t now = naos_millis();
+  for (size_t i = 0; i < NAOS_METRICS_SUBS; i++) {
+    // get subscription
+    naos_metrics_sub_t *sub = &naos_metrics_subs[i];
+    if (sub->session == 0 || now < sub->next) {
+      continue;
+    }
+
+    // schedule next push without accumulating drift
+    sub->next += sub->interval;
+    if (sub->next <= now) {
+      sub->next = now + sub->interval;
+    }
+
+    // push values, drop subscription on failure
+    if (!naos_metrics_push_sub(sub, now)) {
+      naos_metrics_drop(sub);
+    }
+  }
+
+  // update timer
+  naos_metrics_schedule();
+
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
+}
+
+static naos_msg_reply_t naos_metrics_handle_subscribe(naos_msg_t msg) {
+  // command structure:
+  // INTERVAL(2) | REF (1)*
+
+  // check length
+  if (msg.len < 2) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get interval
+  uint16_t interval = msg.data[0] | (msg.data[1] << 8);
+
+  // check refs and build selection, select all metrics if none are given
+  uint32_t refs = 0;
+  for (size_t i = 2; i < msg.len; i++) {
+    if (msg.data[i] >= naos_metrics_count) {
+      return NAOS_MSG_ERROR;
+    }
+    refs |= 1u << msg.data[i];
+  }
+  if (msg.len == 2) {
+    for (size_t i = 0; i < naos_metrics_count; i++) {
+      refs |= 1u << i;
+    }
+  }
+
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // drop existing subscription
+  naos_metrics_sub_t *sub = NULL;
+  for (size_t i = 0; i < NAOS_METRICS_SUBS; i++) {
+    if (naos_metrics_subs[i].session == msg.session) {
+      naos_metrics_drop(&naos_metrics_subs[i]);
+      sub = &naos_metrics_subs[i];
+      break;
+    }
+  }
+
+  // add subscription unless unsubscribing
+  bool ok = true;
+  if (interval > 0) {
+    // find free slot
+    for (size_t i = 0; sub == NULL && i < NAOS_METRICS_SUBS; i++) {
+      if (naos_metrics_subs[i].session == 0) {
+        sub = &naos_metrics_subs[i];
+      }
+    }
+
+    // set subscription
+    if (sub != NULL) {
+      sub->session = msg.session;
+      sub->interval = interval < NAOS_METRICS_TICK ? NAOS_METRICS_TICK : interval;
+      sub->refs = refs;
+      sub->next = naos_millis();
+      sub->last = sub->next;
+    } else {
+      ok = false;
+    }
+  }
+
+  // update timer
+  naos_metrics_schedule();
+
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
+
+  return ok ? NAOS_MSG_ACK : NAOS_MSG_ERROR;
+}
+
+static void naos_metrics_history_record(naos_metric_t *metric, int64_t now) {
+  // get history
+  naos_metrics_history_t *history = metric->state;
+  size_t len = metric->size * naos_metrics_width(metric);
+
+  // sample values into first tier
+  naos_metrics_tier_t *base = &history->tiers[0];
+  uint8_t *sample = base->ring + (base->seq % base->samples) * len;
+  naos_metrics_snapshot(metric, sample);
+  base->seq++;
+  base->last = now;
+
+  // downsample into following tiers
+  for (size_t i = 1; i < history->num_tiers; i++) {
+    // accumulate sample
+    naos_metrics_tier_t *tier = &history->tiers[i];
+    for (size_t j = 0; j < metric->size; j++) {
+      tier->sums[j] += naos_metrics_get(metric, sample, j);
+    }
+    tier->pending++;
+    if (tier->pending < tier->ratio) {
+      continue;
+    }
+
+    // write average of gauges and last value of counters
+    uint8_t *slot = tier->ring + (tier->seq % tier->samples) * len;
+    for (size_t j = 0; j < metric->size; j++) {
+      if (metric->kind == NAOS_METRIC_GAUGE) {
+        naos_metrics_put(metric, slot, j, tier->sums[j] / tier->ratio);
+      } else {
+        naos_metrics_put(metric, slot, j, naos_metrics_get(metric, sample, j));
+      }
+      tier->sums[j] = 0;
+    }
+    tier->pending = 0;
+    tier->seq++;
+    tier->last = now;
+  }
+}
+
+static void naos_metrics_history_sample() {
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // record due metrics
+  int64_t now = naos_millis();
+  for (size_t i = 0; i < naos_metrics_count; i++) {
+    // get history
+    naos_metric_t *metric = naos_metrics_list[i];
+    naos_metrics_history_t *history = metric->state;
+    if (history == NULL || now < history->next) {
+      continue;
+    }
+
+    // record sample
+    naos_metrics_history_record(metric, now);
+
+    // schedule next sample, resynchronize if late by more than a period
+    uint32_t period = history->tiers[0].period;
+    history->next += period;
+    if (history->next <= now) {
+      history->next = now + period;
+    }
+  }
+
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
+}
+
+static void naos_metrics_history_setup(naos_metric_t *metric) {
+  // count tiers
+  size_t num_tiers = 0;
+  while (num_tiers < NAOS_METRIC_TIERS && metric->history[num_tiers].period > 0) {
+    num_tiers++;
+  }
+  if (num_tiers == 0) {
+    metric->state = NULL;
+    return;
+  }
+
+  // histograms have no history
+  if (metric->kind == NAOS_METRIC_HISTOGRAM) {
+    ESP_ERROR_CHECK(ESP_FAIL);
+  }
+
+  // validate tiers
+  uint32_t period = metric->history[0].period;
+  for (size_t i = 0; i < num_tiers; i++) {
+    naos_metric_tier_t tier = metric->history[i];
+    if (tier.samples == 0 || tier.period % period != 0 || (i > 0 && tier.period <= metric->history[i - 1].period)) {
+      ESP_ERROR_CHECK(ESP_FAIL);
+    }
+  }
+
+  // allocate history
+  naos_metrics_history_t *history = calloc(1, sizeof(naos_metrics_history_t));
+  if (history == NULL) {
+    ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+  }
+  history->num_tiers = num_tiers;
+  history->next = naos_millis();
+
+  // allocate tiers, prefer PSRAM for the rings
+  size_t len = metric->size * naos_metrics_width(metric);
+  for (size_t i = 0; i < num_tiers; i++) {
+    naos_metrics_tier_t *tier = &history->tiers[i];
+    tier->period = metric->history[i].period;
+    tier->samples = metric->history[i].samples;
+    tier->ratio = tier->period / period;
+#ifdef CONFIG_SPIRAM
+    tier->ring = heap_caps_malloc_prefer(tier->samples * len, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+#else
+    tier->ring = malloc(tier->samples * len);
+#endif
+    if (tier->ring == NULL) {
+      ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+    }
+    if (i > 0) {
+      tier->sums = calloc(metric->size, sizeof(double));
+      if (tier->sums == NULL) {
+        ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+      }
+    }
+  }
+
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // set history
+  metric->state = history;
+
+  // determine tick as the greatest common divisor of all sample periods
+  uint32_t tick = naos_metrics_history_tick;
+  while (period > 0) {
+    uint32_t rest = tick % period;
+    tick = period;
+    period = rest;
+  }
+
+  // (re)start timer if the tick changed
+  if (tick != naos_metrics_history_tick) {
+    if (naos_metrics_history_timer != NULL) {
+      naos_cancel(naos_metrics_history_timer);
+    }
+    naos_metrics_history_timer = naos_repeat_defer("naos-metrics-history", tick, naos_metrics_history_sample);
+    naos_metrics_history_tick = tick;
+  }
+
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
+}
+
+static naos_msg_reply_t naos_metrics_handle_history_info(naos_msg_t msg) {
   // command structure:
   // REF (1)
 
@@ -135,34 +832,173 @@ static naos_msg_reply_t naos_metrics_handle_read(naos_msg_t msg) {
 
   // get metric
   naos_metric_t *metric = naos_metrics_list[msg.data[0]];
+  naos_metrics_history_t *history = metric->state;
 
-  // determine width
-  size_t width = 0;
-  if (metric->type == NAOS_METRIC_LONG) {
-    width = sizeof(int32_t);
-  } else if (metric->type == NAOS_METRIC_FLOAT) {
-    width = sizeof(float);
-  } else if (metric->type == NAOS_METRIC_DOUBLE) {
-    width = sizeof(double);
+  // reply structure:
+  // (PERIOD(4) | SAMPLES(2) | STORED(2))*
+
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // write tiers
+  uint8_t data[NAOS_METRIC_TIERS * 8];
+  size_t len = 0;
+  for (size_t i = 0; history != NULL && i < history->num_tiers; i++) {
+    naos_metrics_tier_t *tier = &history->tiers[i];
+    uint16_t stored = tier->seq < tier->samples ? tier->seq : tier->samples;
+    memcpy(data + len, &tier->period, 4);
+    memcpy(data + len + 4, &tier->samples, 2);
+    memcpy(data + len + 6, &stored, 2);
+    len += 8;
   }
 
-  // reply structure:
-  // DATA(*)
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
 
-  // prepare reply
-  naos_msg_t reply = {
+  // send reply
+  naos_msg_send((naos_msg_t){
       .session = msg.session,
       .endpoint = NAOS_METRICS_ENDPOINT,
-      .data = (uint8_t *)metric->data,
-      .len = metric->size * width,
-  };
-
-  // send reply
-  naos_msg_send(reply);
+      .data = data,
+      .len = len,
+  });
 
   return NAOS_MSG_OK;
 }
 
+static naos_msg_reply_t naos_metrics_handle_history_read(naos_msg_t msg) {
+  // command structure:
+  // REF (1) | TIER (1) | FROM (4) | TO (4)
+
+  // check length
+  if (msg.len != 10) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // check ref
+  if (msg.data[0] >= naos_metrics_count) {
+    return NAOS_MSG_ERROR;
+  }
+
+  // get metric and tier
+  naos_metric_t *metric = naos_metrics_list[msg.data[0]];
+  naos_metrics_history_t *history = metric->state;
+  if (history == NULL || msg.data[1] >= history->num_tiers) {
+    return NAOS_MSG_ERROR;
+  }
+  naos_metrics_tier_t *tier = &history->tiers[msg.data[1]];
+
+  // get range, given as sample ages in milliseconds
+  uint32_t from, to;
+  memcpy(&from, msg.data + 2, 4);
+  memcpy(&to, msg.data + 6, 4);
+
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // select samples within range
+  int64_t base = naos_millis() - tier->last;
+  uint32_t stored = tier->seq < tier->samples ? tier->seq : tier->samples;
+  uint32_t newest = tier->seq - 1;
+  uint32_t first = 0;
+  uint32_t count = 0;
+  uint32_t age = 0;
+  if (stored > 0 && from >= base) {
+    // determine newest sample not younger than TO
+    int64_t skip = to > base ? (to - base + tier->period - 1) / tier->period : 0;
+
+    // determine oldest sample not older than FROM
+    int64_t back = (from - base) / tier->period;
+    if (back > stored - 1) {
+      back = stored - 1;
+    }
+
+    // compute selection
+    if (skip <= back) {
+      first = newest - back;
+      count = back - skip + 1;
+      age = base + skip * tier->period;
+    }
+  }
+
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
+
+  // allocate frame
+  size_t mtu = naos_msg_get_mtu(msg.session);
+  if (mtu <= 4) {
+    return NAOS_MSG_ERROR;
+  }
+  uint8_t *frame = malloc(mtu);
+  if (frame == NULL) {
+    return NAOS_MSG_ERROR;
+  }
+
+  // stream structure:
+  // PERIOD(4) | AGE(4) | COUNT(2) | SAMPLES(COUNT * LEN)
+  uint8_t head[10];
+  uint16_t num = count;
+  memcpy(head, &tier->period, 4);
+  memcpy(head + 4, &age, 4);
+  memcpy(head + 8, &num, 2);
+
+  // reply structure:
+  // OFFSET(4) | DATA(*)
+
+  // send stream in chunks
+  size_t len = metric->size * naos_metrics_width(metric);
+  size_t total = sizeof(head) + count * len;
+  bool ok = true;
+  for (size_t offset = 0; ok && offset < total; offset += mtu - 4) {
+    // write offset
+    size_t chunk = total - offset < mtu - 4 ? total - offset : mtu - 4;
+    uint32_t off = offset;
+    memcpy(frame, &off, 4);
+
+    // acquire mutex
+    naos_lock(naos_metrics_mutex);
+
+    // fail if samples have been overwritten meanwhile
+    if (count > 0 && tier->seq - first > tier->samples) {
+      naos_unlock(naos_metrics_mutex);
+      ok = false;
+      break;
+    }
+
+    // copy header and samples
+    for (size_t pos = offset; pos < offset + chunk;) {
+      size_t n;
+      if (pos < sizeof(head)) {
+        n = sizeof(head) - pos < offset + chunk - pos ? sizeof(head) - pos : offset + chunk - pos;
+        memcpy(frame + 4 + pos - offset, head + pos, n);
+      } else {
+        size_t index = (pos - sizeof(head)) / len;
+        size_t skip = (pos - sizeof(head)) % len;
+        n = len - skip < offset + chunk - pos ? len - skip : offset + chunk - pos;
+        uint8_t *sample = tier->ring + ((first + index) % tier->samples) * len;
+        memcpy(frame + 4 + pos - offset, sample + skip, n);
+      }
+      pos += n;
+    }
+
+    // release mutex
+    naos_unlock(naos_metrics_mutex);
+
+    // send chunk
+    ok = naos_msg_send((naos_msg_t){
+        .session = msg.session,
+        .endpoint = NAOS_METRICS_ENDPOINT,
+        .data = frame,
+        .len = 4 + chunk,
+    });
+  }
+
+  // free frame
+  free(frame);
+
+  return ok ? NAOS_MSG_ACK : NAOS_MSG_ERROR;
+}
+
 static naos_msg_reply_t naos_metrics_process(naos_msg_t msg) {
   // message structure
   // CMD (1) | *
@@ -189,6 +1025,18 @@ static naos_msg_reply_t naos_metrics_process(naos_msg_t msg) {
     case NAOS_METRICS_CMD_READ:
       reply = naos_metrics_handle_read(msg);
       break;
+    case NAOS_METRICS_CMD_READ_MANY:
+      reply = naos_metrics_handle_read_many(msg);
+      break;
+    case NAOS_METRICS_CMD_SUBSCRIBE:
+      reply = naos_metrics_handle_subscribe(msg);
+      break;
+    case NAOS_METRICS_CMD_HISTORY_INFO:
+      reply = naos_metrics_handle_history_info(msg);
+      break;
+    case NAOS_METRICS_CMD_HISTORY_READ:
+      reply = naos_metrics_handle_history_read(msg);
+      break;
     default:
       reply = NAOS_MSG_UNKNOWN;
   }
@@ -196,12 +1044,34 @@ static naos_msg_reply_t naos_metrics_process(naos_msg_t msg) {
   return reply;
 }
 
+static void naos_metrics_cleanup(uint16_t session) {
+  // acquire mutex
+  naos_lock(naos_metrics_mutex);
+
+  // remove subscriptions
+  for (size_t i = 0; i < NAOS_METRICS_SUBS; i++) {
+    if (naos_metrics_subs[i].session == session) {
+      naos_metrics_drop(&naos_metrics_subs[i]);
+    }
+  }
+
+  // update timer
+  naos_metrics_schedule();
+
+  // release mutex
+  naos_unlock(naos_metrics_mutex);
+}
+
 void naos_metrics_init() {
+  // create mutex
+  naos_metrics_mutex = naos_mutex();
+
   // install endpoint
   naos_msg_install((naos_msg_endpoint_t){
       .ref = NAOS_METRICS_ENDPOINT,
       .name = "metrics",
       .handle = naos_metrics_process,
+      .cleanup = naos_metrics_cleanup,
   });
 }
 
@@ -216,6 +1086,11 @@ void naos_metrics_add(naos_metric_t *metric) {
     ESP_ERROR_CHECK(ESP_FAIL);
   }
 
+  // histograms only record long values
+  if (metric->kind == NAOS_METRIC_HISTOGRAM && metric->type != NAOS_METRIC_LONG) {
+    ESP_ERROR_CHECK(ESP_FAIL);
+  }
+
   // clear internal state
   metric->num_keys = 0;
   memset(metric->num_values, 0, sizeof(metric->num_values));
@@ -261,7 +1136,255 @@ void naos_metrics_add(naos_metric_t *metric) {
     }
   }
 
+  // check that values can be addressed by chunked reads
+  if (metric->size * naos_metrics_width(metric) > UINT16_MAX) {
+    ESP_ERROR_CHECK(ESP_FAIL);
+  }
+
+  // set up history
+  naos_metrics_history_setup(metric);
+
   // store metric
   naos_metrics_list[naos_metrics_count] = metric;
   naos_metrics_count++;
 }
+
+void naos_metric_add(naos_metric_t *metric, size_t index, double value) {
+  // check kind and index
+  if (metric->kind == NAOS_METRIC_HISTOGRAM || index >= metric->size) {
+    return;
+  }
+
+  // add value
+  switch (metric->type) {
+    case NAOS_METRIC_LONG:
+      __atomic_fetch_add((int32_t *)metric->data + index, (int32_t)value, __ATOMIC_RELAXED);
+      break;
+    case NAOS_METRIC_FLOAT: {
+      // compare and swap bit patterns
+      uint32_t *cell = (uint32_t *)metric->data + index;
+      uint32_t old = __atomic_load_n(cell, __ATOMIC_RELAXED);
+      uint32_t new;
+      do {
+        float num;
+        memcpy(&num, &old, sizeof(num));
+        num += (float)value;
+        memcpy(&new, &num, sizeof(new));
+      } while (!__atomic_compare_exchange_n(cell, &old, new, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+      break;
+    }
+    case NAOS_METRIC_DOUBLE:
+      portENTER_CRITICAL_SAFE(&naos_metrics_lock);
+      ((double *)metric->data)[index] += value;
+      portEXIT_CRITICAL_SAFE(&naos_metrics_lock);
+      break;
+  }
+}
+
+void naos_metric_set(naos_metric_t *metric, size_t index, double value) {
+  // check kind and index
+  if (metric->kind == NAOS_METRIC_HISTOGRAM || index >= metric->size) {
+    return;
+  }
+
+  // set value
+  switch (metric->type) {
+    case NAOS_METRIC_LONG:
+      __atomic_store_n((int32_t *)metric->data + index, (int32_t)value, __ATOMIC_RELAXED);
+      break;
+    case NAOS_METRIC_FLOAT: {
+      float num = (float)value;
+      uint32_t bits;
+      memcpy(&bits, &num, sizeof(bits));
+      __atomic_store_n((uint32_t *)metric->data + index, bits, __ATOMIC_RELAXED);
+      break;
+    }
+    case NAOS_METRIC_DOUBLE:
+      portENTER_CRITICAL_SAFE(&naos_metrics_lock);
+      ((double *)metric->data)[index] = value;
+      portEXIT_CRITICAL_SAFE(&naos_metrics_lock);
+      break;
+  }
+}
+
+void naos_metric_observe(naos_metric_t *metric, size_t index, int32_t value) {
+  // check index
+  if (index >= metric->size) {
+    return;
+  }
+
+  // get histogram
+  naos_metric_histogram_t *histogram = (naos_metric_histogram_t *)metric->data + index;
+
+  // determine bucket
+  uint32_t num = value > 0 ? (uint32_t)value : 0;
+  int bucket = num > 0 ? 32 - __builtin_clz(num) : 0;
+
+  // count value
+  __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+  // add value to sum and carry overflows into the high word, both words are
+  // updated together so that snapshots never see a wrapped low word
+  portENTER_CRITICAL_SAFE(&naos_metrics_lock);
+  uint32_t low = histogram->sum[0];
+  histogram->sum[0] = low + num;
+  if (low + num < low) {
+    histogram->sum[1]++;
+  }
+  portEXIT_CRITICAL_SAFE(&naos_metrics_lock);
+}
+
+static size_t naos_metrics_render_name(char *buf, size_t size, const char *name) {
+  // copy name, replacing characters that are not allowed
+  size_t len = 0;
+  for (; name[len] != 0 && len + 1 < size; len++) {
+    char c = name[len];
+    bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9' && len > 0) || c == '_' ||
+                 c == ':';
+    buf[len] = valid ? c : '_';
+  }
+  buf[len] = 0;
+
+  return len;
+}
+
+static size_t naos_metrics_render_labels(char *buf, size_t size, naos_metric_t *metric, size_t index,
+                                         const char *extra) {
+  // skip scalar metrics without extra label
+  if (metric->num_keys == 0 && extra == NULL) {
+    buf[0] = 0;
+    return 0;
+  }
+
+  // write keys and values, the last key varies fastest
+  size_t len = snprintf(buf, size, "{");
+  size_t stride = metric->size;
+  for (int i = 0; i < metric->num_keys && len < size; i++) {
+    // get value
+    stride /= metric->num_values[i];
+    const char *value = metric->values[metric->first_value[i] + (index / stride) % metric->num_values[i]];
+
+    // write key
+    len += snprintf(buf + len, size - len, "%s", i > 0 ? "," : "");
+    len += naos_metrics_render_name(buf + len, size - len, metric->keys[i]);
+    len += snprintf(buf + len, size - len, "=\"");
+
+    // write escaped value
+    for (const char *c = value; *c != 0 && len + 2 < size; c++) {
+      if (*c == '\\' || *c == '"') {
+        buf[len++] = '\\';
+        buf[len++] = *c;
+      } else if (*c == '\n') {
+        buf[len++] = '\\';
+        buf[len++] = 'n';
+      } else {
+        buf[len++] = *c;
+      }
+    }
+    buf[len] = 0;
+    len += snprintf(buf + len, size - len, "\"");
+  }
+
+  // write extra label
+  if (extra != NULL && len < size) {
+    len += snprintf(buf + len, size - len, "%s%s", metric->num_keys > 0 ? "," : "", extra);
+  }
+  if (len < size) {
+    len += snprintf(buf + len, size - len, "}");
+  }
+
+  return len < size ? len : size - 1;
+}
+
+static void naos_metrics_render_value(char *buf, size_t size, double value, bool precise) {
+  // format special and regular values
+  if (isnan(value)) {
+    snprintf(buf, size, "NaN");
+  } else if (isinf(value)) {
+    snprintf(buf, size, value > 0 ? "+Inf" : "-Inf");
+  } else {
+    snprintf(buf, size, precise ? "%.17g" : "%.9g", value);
+  }
+}
+
+bool naos_metrics_render(bool (*write)(const char *line, size_t len, void *ctx), void *ctx) {
+  // prepare buffers
+  char name[NAOS_METRICS_MAX_NAME_LEN + 1];
+  char labels[NAOS_METRIC_KEYS * (NAOS_METRICS_MAX_KEY_LEN + NAOS_METRICS_MAX_VALUE_LEN * 2 + 4) + 32];
+  char value[32];
+  char line[sizeof(name) + sizeof(labels) + sizeof(value) + 16];
+
+  // render metrics
+  for (size_t ref = 0; ref < naos_metrics_count; ref++) {
+    // get metric
+    naos_metric_t *metric = naos_metrics_list[ref];
+    naos_metrics_render_name(name, sizeof(name), metric->name);
+
+    // write type
+    const char *type = metric->kind == NAOS_METRIC_COUNTER ? "counter"
+                       : metric->kind == NAOS_METRIC_GAUGE ? "gauge"
+                                                            : "histogram";
+    int len = snprintf(line, sizeof(line), "# TYPE %s %s\n", name, type);
+    if (!write(line, len, ctx)) {
+      return false;
+    }
+
+    // snapshot values
+    size_t width = naos_metrics_width(metric);
+    uint8_t *buf = malloc(metric->size * width);
+    if (metric->size > 0 && buf == NULL) {
+      return false;
+    }
+    naos_metrics_snapshot(metric, buf);
+
+    // write samples
+    bool ok = true;
+    for (size_t i = 0; ok && i < metric->size; i++) {
+      // handle counters and gauges
+      if (metric->kind != NAOS_METRIC_HISTOGRAM) {
+        naos_metrics_render_labels(labels, sizeof(labels), metric, i, NULL);
+        naos_metrics_render_value(value, sizeof(value), naos_metrics_get(metric, buf, i),
+                                  metric->type == NAOS_METRIC_DOUBLE);
+        len = snprintf(line, sizeof(line), "%s%s%s %s\n", name, metric->kind == NAOS_METRIC_COUNTER ? "_total" : "",
+                       labels, value);
+        ok = write(line, len, ctx);
+        continue;
+      }
+
+      // get histogram
+      naos_metric_histogram_t histogram;
+      memcpy(&histogram, buf + i * width, sizeof(histogram));
+
+      // write cumulative buckets, bucket i holds values up to 2^i - 1
+      uint64_t count = 0;
+      for (size_t j = 0; ok && j < NAOS_METRIC_BUCKETS; j++) {
+        char le[24];
+        count += histogram.buckets[j];
+        snprintf(le, sizeof(le), "le=\"%" PRIu32 "\"", (uint32_t)((1ull << j) - 1));
+        naos_metrics_render_labels(labels, sizeof(labels), metric, i, le);
+        len = snprintf(line, sizeof(line), "%s_bucket%s %" PRIu64 "\n", name, labels, count);
+        ok = write(line, len, ctx);
+      }
+
+      // write infinite bucket, count and sum
+      uint64_t sum = ((uint64_t)histogram.sum[1] << 32) | histogram.sum[0];
+      naos_metrics_render_labels(labels, sizeof(labels), metric, i, "le=\"+Inf\"");
+      len = snprintf(line, sizeof(line), "%s_bucket%s %" PRIu64 "\n", name, labels, count);
+      ok = ok && write(line, len, ctx);
+      naos_metrics_render_labels(labels, sizeof(labels), metric, i, NULL);
+      len = snprintf(line, sizeof(line), "%s_count%s %" PRIu64 "\n", name, labels, count);
+      ok = ok && write(line, len, ctx);
+      len = snprintf(line, sizeof(line), "%s_sum%s %" PRIu64 "\n", name, labels, sum);
+      ok = ok && write(line, len, ctx);
+    }
+
+    // free buffer
+    free(buf);
+    if (!ok) {
+      return false;
+    }
+  }
+
+  // write end marker
+  return write("# EOF\n", 6, ctx);
+}
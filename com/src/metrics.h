@@ -1,6 +1,20 @@
 #ifndef _NAOS_METRICS_H
 #define _NAOS_METRICS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 void naos_metrics_init();
 
+/**
+ * Renders all metrics in the OpenMetrics text format. The output is written
+ * line by line using the provided function. Rendering stops if the function
+ * returns false.
+ *
+ * @param write The write function.
+ * @param ctx The context passed to the write function.
+ * @return Whether all lines have been written.
+ */
+bool naos_metrics_render(bool (*write)(const char *line, size_t len, void *ctx), void *ctx);
+
 #endif  // _NAOS_METRICS_H
@@ -9,6 +9,7 @@
 #include <naos/trace.h>
 
 #include "utils.h"
+#include "mem.h"
 
 #define NAOS_MSG_DEBUG CONFIG_NAOS_MSG_DEBUG
 #define NAOS_MSG_MAX_CHANNELS 8
@@ -155,7 +156,7 @@ static void naos_msg_worker() {
     naos_msg_session_t* session = naos_msg_find(msg.session);
     if (session == NULL) {
       naos_unlock(naos_msg_mutex);
-      free(msg.data);
+      naos_mem_free(NAOS_MEM_MSG, msg.data);
       continue;
     }
 
@@ -173,7 +174,7 @@ static void naos_msg_worker() {
 
     // skip if endpoint not found
     if (endpoint == NULL) {
-      free(msg.data);
+      naos_mem_free(NAOS_MEM_MSG, msg.data);
       continue;
     }
 
@@ -202,7 +203,7 @@ static void naos_msg_worker() {
     }
 
     // free data
-    free(msg.data);
+    naos_mem_free(NAOS_MEM_MSG, msg.data);
   }
 }
 
@@ -602,7 +603,7 @@ bool naos_msg_dispatch(uint8_t channel, uint8_t* data, size_t len, void* ctx) {
   }
 
   // copy data
-  uint8_t* copy = malloc(len - 4 + 1);
+  uint8_t* copy = naos_mem_alloc(NAOS_MEM_MSG, len - 4 + 1);
   if (copy == NULL) {
     naos_unlock(naos_msg_mutex);
     ESP_LOGE(NAOS_LOG_TAG, "naos_msg_dispatch: allocation failed (%s)", name);
@@ -687,7 +688,7 @@ bool naos_msg_send(naos_msg_t msg) {
   if (msg.framed) {
     frame = msg.data - NAOS_MSG_FRAMING;
   } else {
-    frame = malloc(frame_len);
+    frame = naos_mem_alloc(NAOS_MEM_MSG, frame_len);
     if (frame == NULL) {
       ESP_LOGE(NAOS_LOG_TAG, "naos_msg_send: allocation failed (%s)", channel.name);
       return false;
@@ -719,7 +720,7 @@ bool naos_msg_send(naos_msg_t msg) {
 
   // free frame if we allocated it (framed buffers are owned by the caller)
   if (!msg.framed) {
-    free(frame);
+    naos_mem_free(NAOS_MEM_MSG, frame);
   }
 
   // update session status
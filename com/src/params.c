@@ -8,6 +8,7 @@
 
 #include "params.h"
 #include "utils.h"
+#include "mem.h"
 
 #define NAOS_PARAMS_ENDPOINT 0x1
 #define NAOS_PARAMS_MAX_HANDLERS 8
@@ -66,7 +67,7 @@ static naos_value_t naos_params_default(naos_param_t *param) {
   }
 
   // copy value
-  uint8_t *copy = malloc(len + 1);
+  uint8_t *copy = naos_mem_alloc(NAOS_MEM_PARAMS, len + 1);
   memcpy(copy, buf, len);
   copy[len] = 0;
 
@@ -502,7 +503,7 @@ void naos_register(naos_param_t *param) {
   // handle actions
   if (param->type == NAOS_ACTION) {
     param->current = (naos_value_t){
-        .buf = (uint8_t *)strdup(""),
+        .buf = (uint8_t *)naos_mem_strdup(NAOS_MEM_PARAMS, ""),
         .len = 0,
     };
     naos_unlock(naos_params_mutex);
@@ -517,7 +518,7 @@ void naos_register(naos_param_t *param) {
     param->current = naos_params_default(param);
   } else if (err == ESP_OK) {
     // otherwise, load stored value
-    uint8_t *buf = malloc(length + 1);
+    uint8_t *buf = naos_mem_alloc(NAOS_MEM_PARAMS, length + 1);
     ESP_ERROR_CHECK(nvs_get_blob(naos_params_handle, param->name, buf, &length));
     buf[length] = 0;
 
@@ -799,14 +800,14 @@ void naos_set(const char *name, uint8_t *value, size_t length) {
 
   // free last value
   if (param->last.buf != NULL) {
-    free(param->last.buf);
+    naos_mem_free(NAOS_MEM_PARAMS, param->last.buf);
   }
 
   // move current to last value
   param->last = param->current;
 
   // copy value
-  uint8_t *copy = malloc(length + 1);
+  uint8_t *copy = naos_mem_alloc(NAOS_MEM_PARAMS, length + 1);
   memcpy(copy, value, length);
   copy[length] = 0;
 
@@ -875,7 +876,7 @@ void naos_clear(const char *name) {
 
   // free last value
   if (param->last.buf != NULL) {
-    free(param->last.buf);
+    naos_mem_free(NAOS_MEM_PARAMS, param->last.buf);
   }
 
   // move current to last value
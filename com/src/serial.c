@@ -16,6 +16,8 @@
 #include <driver/usb_serial_jtag_vfs.h>
 #include <sys/fcntl.h>
 
+#include "mem.h"
+
 #define NAOS_SERIAL_BS CONFIG_NAOS_SERIAL_BUFFER_SIZE
 
 /* Encoder */
@@ -177,6 +179,9 @@ static void* naos_serial_alloc() {
     ESP_ERROR_CHECK(ESP_FAIL);
   }
 
+  // account buffer
+  naos_mem_track(NAOS_MEM_SERIAL, buf);
+
   return buf;
 }
 
@@ -15,6 +15,7 @@
 #include "net.h"
 #include "params.h"
 #include "metrics.h"
+#include "mem.h"
 #include "update.h"
 #include "utils.h"
 #include "com.h"
@@ -29,6 +30,10 @@ static uint32_t naos_system_generation = 0;
 static naos_system_handler_t naos_system_handlers[NAOS_SYSTEM_MAX_HANDLERS];
 static size_t naos_system_handler_count;
 static int32_t naos_system_memory[3] = {0};
+static int32_t naos_system_memory_largest[3] = {0};
+static int32_t naos_system_memory_minimum[3] = {0};
+static int32_t naos_system_memory_blocks[3][2] = {0};
+static const uint32_t naos_system_memory_caps[3] = {MALLOC_CAP_DEFAULT, MALLOC_CAP_INTERNAL, MALLOC_CAP_SPIRAM};
 
 static void naos_system_reboot() {
   // restart in one second
@@ -57,6 +62,30 @@ static naos_metric_t naos_system_metrics[] = {
         .keys = {"type"},
         .values = {"all", "internal", "external"},
     },
+    {
+        .name = "largest-free-block",
+        .kind = NAOS_METRIC_GAUGE,
+        .type = NAOS_METRIC_LONG,
+        .data = naos_system_memory_largest,
+        .keys = {"type"},
+        .values = {"all", "internal", "external"},
+    },
+    {
+        .name = "min-free-memory",
+        .kind = NAOS_METRIC_GAUGE,
+        .type = NAOS_METRIC_LONG,
+        .data = naos_system_memory_minimum,
+        .keys = {"type"},
+        .values = {"all", "internal", "external"},
+    },
+    {
+        .name = "memory-blocks",
+        .kind = NAOS_METRIC_GAUGE,
+        .type = NAOS_METRIC_LONG,
+        .data = naos_system_memory_blocks,
+        .keys = {"type", "state"},
+        .values = {"all", "internal", "external", NULL, "allocated", "free"},
+    },
 };
 
 static void naos_system_dispatch() {
@@ -87,6 +116,16 @@ static void naos_system_update() {
   naos_system_memory[0] = (int32_t)esp_get_free_heap_size();
   naos_system_memory[1] = (int32_t)esp_get_free_internal_heap_size();
   naos_system_memory[2] = (int32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+
+  // update fragmentation metrics
+  for (size_t i = 0; i < NAOS_COUNT(naos_system_memory_caps); i++) {
+    multi_heap_info_t info = {0};
+    heap_caps_get_info(&info, naos_system_memory_caps[i]);
+    naos_system_memory_largest[i] = (int32_t)info.largest_free_block;
+    naos_system_memory_minimum[i] = (int32_t)info.minimum_free_bytes;
+    naos_system_memory_blocks[i][0] = (int32_t)info.allocated_blocks;
+    naos_system_memory_blocks[i][1] = (int32_t)info.free_blocks;
+  }
 }
 
 static void naos_system_tick() {
@@ -145,6 +184,9 @@ void naos_system_init() {
     naos_metrics_add(&naos_system_metrics[i]);
   }
 
+  // initialize memory accounting
+  naos_mem_init();
+
   // read factory MAC
   uint8_t mac[8] = {0};
   ESP_ERROR_CHECK(esp_efuse_mac_get_default(mac));
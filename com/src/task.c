@@ -1,6 +1,9 @@
 #include <naos/sys.h>
+#include <naos/metrics.h>
 
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include "utils.h"
 #include "system.h"
@@ -12,15 +15,81 @@ static naos_task_t naos_task_handle;
 static bool naos_task_started = false;
 static naos_status_t naos_task_last_status = NAOS_DISCONNECTED;
 
+static naos_metric_histogram_t naos_task_loop_duration = {0};
+static naos_metric_histogram_t naos_task_loop_jitter = {0};
+static int32_t naos_task_loop_overruns = 0;
+
+static naos_metric_t naos_task_metrics[] = {
+    {
+        .name = "loop-duration",
+        .kind = NAOS_METRIC_HISTOGRAM,
+        .type = NAOS_METRIC_LONG,
+        .data = &naos_task_loop_duration,
+    },
+    {
+        .name = "loop-jitter",
+        .kind = NAOS_METRIC_HISTOGRAM,
+        .type = NAOS_METRIC_LONG,
+        .data = &naos_task_loop_jitter,
+    },
+    {
+        .name = "loop-overruns",
+        .kind = NAOS_METRIC_COUNTER,
+        .type = NAOS_METRIC_LONG,
+        .data = &naos_task_loop_overruns,
+    },
+};
+
 static void naos_task_process() {
+  // get period
+  bool fixed_rate = naos_config()->loop_fixed_rate;
+  TickType_t period = naos_config()->loop_interval / portTICK_PERIOD_MS;
+  if (period == 0) {
+    period = 1;
+  }
+
+  // align schedule with a tick boundary
+  vTaskDelay(1);
+  TickType_t wake = xTaskGetTickCount();
+  int64_t due = naos_micros();
+
   for (;;) {
+    // record wake-up lateness
+    int64_t start = naos_micros();
+    if (fixed_rate) {
+      naos_metric_observe(&naos_task_metrics[1], 0, (int32_t)(start - due));
+    }
+
     // call loop callback
     naos_lock(naos_task_mutex);
     naos_config()->loop_callback();
     naos_unlock(naos_task_mutex);
 
-    // yield to other processes
-    naos_delay(naos_config()->loop_interval);
+    // record duration
+    naos_metric_observe(&naos_task_metrics[0], 0, (int32_t)(naos_micros() - start));
+
+    // yield to other processes if not fixed rate
+    if (!fixed_rate) {
+      naos_delay(naos_config()->loop_interval);
+      continue;
+    }
+
+    // handle missed deadlines
+    TickType_t late = xTaskGetTickCount() - wake;
+    if (late >= period) {
+      // count missed deadlines
+      naos_metric_add(&naos_task_metrics[2], 0, (double)(late / period));
+
+      // restart schedule after yielding for one tick to not starve other tasks
+      wake = xTaskGetTickCount();
+      vTaskDelayUntil(&wake, 1);
+      due = naos_micros();
+      continue;
+    }
+
+    // wait until next deadline
+    due += (int64_t)period * portTICK_PERIOD_MS * 1000;
+    vTaskDelayUntil(&wake, period);
   }
 }
 
@@ -141,6 +210,15 @@ void naos_start() {
     naos_repeat("naos-battery", 1000, naos_task_battery);
   }
 
+  // add loop metrics if available
+  if (naos_config()->loop_callback != NULL) {
+    naos_metrics_add(&naos_task_metrics[0]);
+    if (naos_config()->loop_fixed_rate) {
+      naos_metrics_add(&naos_task_metrics[1]);
+      naos_metrics_add(&naos_task_metrics[2]);
+    }
+  }
+
   // register ping parameter if available
   if (naos_config()->ping_callback != NULL) {
     naos_register(&naos_task_param_ping);
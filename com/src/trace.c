@@ -1,7 +1,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <esp_system.h>
 #include <esp_timer.h>
+#ifdef CONFIG_NAOS_TRACE_HEAP
+#include <esp_debug_helpers.h>
+#include <esp_memory_utils.h>
+#endif
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
@@ -13,14 +18,25 @@
 #define NAOS_TRACE_MAX_TASKS 64
 #define NAOS_TRACE_MAX_LABELS 255
 #define NAOS_TRACE_BUF_SIZE CONFIG_NAOS_TRACE_BUF_SIZE
-
-#define NAOS_TRACE_REC_SWITCH 1  // TYPE(1) TS(4) CORE(1) ID(1) = 7
-#define NAOS_TRACE_REC_EVENT 2   // TYPE(1) TS(4) CAT(1) NAME(1) ARG(2) = 9
-#define NAOS_TRACE_REC_BEGIN 3   // TYPE(1) TS(4) CAT(1) NAME(1) ARG(2) ID(1) = 10
-#define NAOS_TRACE_REC_END 4     // TYPE(1) TS(4) ID(1) = 6
-#define NAOS_TRACE_REC_VALUE 5   // TYPE(1) TS(4) CAT(1) NAME(1) VAL(4) = 11
-#define NAOS_TRACE_REC_LABEL 6   // TYPE(1) ID(1) TEXT(*) NUL(1) = 3+
-#define NAOS_TRACE_REC_TASK 7    // TYPE(1) ID(1) NAME(*) NUL(1) = 3+
+#define NAOS_TRACE_STREAM_PERIOD 10
+#define NAOS_TRACE_MAGIC 0x4E545243
+
+// records carry the microseconds since the previous record of the same core
+// as a varint delta, readers prefix each chunk with a SYNC record holding the
+// absolute time and core the following deltas are relative to (types 1-5 are
+// the former fixed-size records)
+#define NAOS_TRACE_REC_LABEL 6    // TYPE(1) ID(1) TEXT(*) NUL(1) = 3+
+#define NAOS_TRACE_REC_TASK 7     // TYPE(1) ID(1) NAME(*) NUL(1) = 3+
+#define NAOS_TRACE_REC_SYNC 8     // TYPE(1) CORE(1) TIME(8) = 10
+#define NAOS_TRACE_REC_SWITCH 9   // TYPE(1) DELTA(v) ID(1) = 3+
+#define NAOS_TRACE_REC_EVENT 10   // TYPE(1) DELTA(v) CAT(1) NAME(1) ARG(v) = 5+
+#define NAOS_TRACE_REC_BEGIN 11   // TYPE(1) DELTA(v) CAT(1) NAME(1) ARG(v) ID(1) = 6+
+#define NAOS_TRACE_REC_END 12     // TYPE(1) DELTA(v) ID(1) = 3+
+#define NAOS_TRACE_REC_VALUE 13   // TYPE(1) DELTA(v) CAT(1) NAME(1) VAL(zv) = 5+
+#define NAOS_TRACE_REC_ALLOC 14   // TYPE(1) DELTA(v) PTR(4) SIZE(v) CAPS(v) CALLER(4) TASK(1) = 12+
+#define NAOS_TRACE_REC_FREE 15    // TYPE(1) DELTA(v) PTR(4) = 6+
+#define NAOS_TRACE_REC_READY 16   // TYPE(1) DELTA(v) ID(1) = 3+
+#define NAOS_TRACE_REC_MAX 32     // largest timed record
 
 // feature flags select which records are captured; bits 0..(cores-1) enable
 // task switches per core, the remaining bits toggle the other record types
@@ -28,6 +44,7 @@
 #define NAOS_TRACE_FLAG_EVENT (1 << 4)      // instant events
 #define NAOS_TRACE_FLAG_VALUE (1 << 5)      // counter values
 #define NAOS_TRACE_FLAG_SPAN (1 << 6)       // begin/end spans
+#define NAOS_TRACE_FLAG_HEAP (1 << 7)       // heap allocations
 #define NAOS_TRACE_FLAG_ALL 0xFF            // capture everything
 
 typedef enum {
@@ -35,164 +52,395 @@ typedef enum {
   NAOS_TRACE_CMD_STOP,
   NAOS_TRACE_CMD_READ,
   NAOS_TRACE_CMD_STATUS,
+  NAOS_TRACE_CMD_CREDIT,
+  NAOS_TRACE_CMD_TRIGGER,
 } naos_trace_cmd_t;
 
-static portMUX_TYPE naos_trace_spinlock = portMUX_INITIALIZER_UNLOCKED;
+typedef enum {
+  NAOS_TRACE_MODE_BUFFER,    // drop new records when full
+  NAOS_TRACE_MODE_STREAM,    // push records to a session
+  NAOS_TRACE_MODE_RECORDER,  // overwrite oldest records until frozen
+} naos_trace_mode_t;
+
+typedef enum {
+  NAOS_TRACE_TRIGGER_NONE,
+  NAOS_TRACE_TRIGGER_EVENT,  // named event is recorded
+  NAOS_TRACE_TRIGGER_ABOVE,  // named value reaches threshold
+  NAOS_TRACE_TRIGGER_BELOW,  // named value falls to threshold
+} naos_trace_trigger_t;
+
+// flight recordings are kept in uninitialized memory across panics if enabled,
+// the magic marks the state as valid after a reset
+#ifdef CONFIG_NAOS_TRACE_PANIC
+#define NAOS_TRACE_KEEP __NOINIT_ATTR
+#else
+#define NAOS_TRACE_KEEP
+#endif
+
 static bool naos_trace_active = false;
 static uint8_t naos_trace_flags = NAOS_TRACE_FLAG_ALL;
 static int64_t naos_trace_start_time = 0;
-
-// byte ring buffer; records never wrap, zeros pad to buffer start
-static uint8_t *naos_trace_buffer = NULL;
-static uint32_t naos_trace_capacity = 0;
-static volatile uint32_t naos_trace_head = 0;
-static volatile uint32_t naos_trace_tail = 0;
-static volatile uint32_t naos_trace_used = 0;
-static volatile uint32_t naos_trace_dropped = 0;
-
-// task handle-to-id mapping for dedup
+static NAOS_TRACE_KEEP uint32_t naos_trace_magic;
+static NAOS_TRACE_KEEP naos_trace_mode_t naos_trace_mode;
+static NAOS_TRACE_KEEP bool naos_trace_frozen;
+
+// stream subscription and remaining chunk credits
+static naos_mutex_t naos_trace_mutex = NULL;
+static naos_timer_t naos_trace_timer = NULL;
+static uint16_t naos_trace_stream = 0;
+static uint32_t naos_trace_credits = 0;
+
+// freeze trigger, the label is resolved when the name is first used
+static naos_trace_trigger_t naos_trace_trigger = NAOS_TRACE_TRIGGER_NONE;
+static char naos_trace_trigger_name[33] = {0};
+static const char *naos_trace_trigger_label = NULL;
+static int32_t naos_trace_trigger_threshold = 0;
+
+// per-core byte ring buffers; each ring is only written by its core with
+// interrupts masked and drained by the reader, records never wrap, zeros pad
+// to buffer start, the head never catches up with the tail; in recorder mode
+// the writer also advances the tail to evict the oldest records; the writer
+// tracks the time of the last written record and the consumer the time of the
+// last consumed record to resolve deltas
+typedef struct {
+  uint8_t *buffer;
+  uint32_t head;
+  uint32_t tail;
+  uint32_t dropped;
+  uint64_t last;
+  uint64_t base;
+  bool busy;
+} naos_trace_ring_t;
+
+#ifdef CONFIG_NAOS_TRACE_PANIC
+static NAOS_TRACE_KEEP uint8_t naos_trace_storage[NAOS_TRACE_BUF_SIZE];
+#endif
+static NAOS_TRACE_KEEP naos_trace_ring_t naos_trace_rings[portNUM_PROCESSORS];
+static NAOS_TRACE_KEEP uint32_t naos_trace_capacity;
+
+// task handle-to-id mapping for dedup, slots are claimed lock-free
 static TaskHandle_t naos_trace_tasks[NAOS_TRACE_MAX_TASKS] = {0};
-static volatile uint16_t naos_trace_task_count = 0;
 
-// label string-to-id mapping for dedup (by pointer identity)
-static const char *naos_trace_labels[NAOS_TRACE_MAX_LABELS] = {0};
-static volatile uint8_t naos_trace_label_count = 0;
+// label string-to-id mapping for dedup (by pointer identity), slots are
+// claimed lock-free
+static NAOS_TRACE_KEEP const char *naos_trace_labels[NAOS_TRACE_MAX_LABELS];
+
+// task names by id, used to replay task records of flight recordings
+static NAOS_TRACE_KEEP char naos_trace_names[NAOS_TRACE_MAX_TASKS][16];
 
 // auto-incrementing span instance counter
-static volatile uint8_t naos_trace_span_id = 0;
+static uint32_t naos_trace_span_id = 0;
 
 // per-core last task for change detection
 static TaskHandle_t naos_trace_last_task[portNUM_PROCESSORS] = {0};
 
-static void naos_trace_write(const uint8_t *data, size_t len) {
-  // must be called with spinlock held
+// field layouts of timed records after type and delta (o = byte, i = word,
+// v = varint), placed in DRAM as records are evicted from the IRAM hooks
+static const DRAM_ATTR char naos_trace_layouts[][6] = {
+    [NAOS_TRACE_REC_SWITCH] = "o", [NAOS_TRACE_REC_EVENT] = "oov", [NAOS_TRACE_REC_BEGIN] = "oovo",
+    [NAOS_TRACE_REC_END] = "o",    [NAOS_TRACE_REC_VALUE] = "oov", [NAOS_TRACE_REC_ALLOC] = "ivvio",
+    [NAOS_TRACE_REC_FREE] = "i",   [NAOS_TRACE_REC_READY] = "o",
+};
+
+// the helpers marked IRAM_ATTR are reached from the task and heap hooks,
+// which may run while the flash cache is disabled
+
+static IRAM_ATTR naos_trace_ring_t *naos_trace_enter(UBaseType_t *state) {
+  // mask interrupts to pin the caller to this core and exclude other writers
+  *state = portSET_INTERRUPT_MASK_FROM_ISR();
+
+  // mark ring busy and recheck state, a reset waits for busy rings
+  naos_trace_ring_t *ring = &naos_trace_rings[xPortGetCoreID()];
+  __atomic_store_n(&ring->busy, true, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&naos_trace_active, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(*state);
+    return NULL;
+  }
 
-  // determine buffer space
-  uint32_t free_bytes = naos_trace_capacity - naos_trace_used;
-  uint32_t end_space = naos_trace_capacity - naos_trace_head;
+  return ring;
+}
 
-  if (end_space >= len) {
-    // record fits at current position
-    if (free_bytes < len) {
-      naos_trace_dropped++;
-      return;
-    }
-    memcpy(naos_trace_buffer + naos_trace_head, data, len);
-    naos_trace_head += len;
-    if (naos_trace_head == naos_trace_capacity) {
-      naos_trace_head = 0;
-    }
-    naos_trace_used += len;
-  } else {
-    // pad remainder and write at start
-    uint32_t total = end_space + len;
-    if (free_bytes < total) {
-      naos_trace_dropped++;
-      return;
+static void IRAM_ATTR naos_trace_exit(naos_trace_ring_t *ring, UBaseType_t state) {
+  // clear busy and restore interrupts
+  __atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+static size_t IRAM_ATTR naos_trace_put_varint(uint8_t *buf, uint64_t value) {
+  // write 7 bits per byte, least significant first
+  size_t len = 0;
+  while (value >= 0x80) {
+    buf[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = (uint8_t)value;
+  return len;
+}
+
+static size_t IRAM_ATTR naos_trace_get_varint(const uint8_t *buf, size_t available, uint64_t *value) {
+  // read 7 bits per byte, least significant first
+  *value = 0;
+  for (size_t i = 0; i < available && i < 10; i++) {
+    *value |= (uint64_t)(buf[i] & 0x7F) << (7 * i);
+    if (!(buf[i] & 0x80)) {
+      return i + 1;
     }
-    memset(naos_trace_buffer + naos_trace_head, 0, end_space);
-    memcpy(naos_trace_buffer, data, len);
-    naos_trace_head = len;
-    naos_trace_used += total;
   }
+  return 0;
 }
 
-static size_t naos_trace_record_size(const uint8_t *data, size_t available) {
-  // determine record size from type byte
+static size_t IRAM_ATTR naos_trace_record_size(const uint8_t *data, size_t available, uint64_t *delta) {
+  // determine record size and time delta from type byte
+  *delta = 0;
   if (available == 0) {
     return 0;
   }
-  switch (data[0]) {
-    case NAOS_TRACE_REC_SWITCH:
-      return 7;
-    case NAOS_TRACE_REC_EVENT:
-      return 9;
-    case NAOS_TRACE_REC_BEGIN:
-      return 10;
-    case NAOS_TRACE_REC_END:
-      return 6;
-    case NAOS_TRACE_REC_VALUE:
-      return 11;
-    case NAOS_TRACE_REC_LABEL:
-    case NAOS_TRACE_REC_TASK:
-      for (size_t i = 2; i < available; i++) {
-        if (data[i] == 0) {
-          return i + 1;
-        }
+
+  // find terminator of text records
+  if (data[0] == NAOS_TRACE_REC_LABEL || data[0] == NAOS_TRACE_REC_TASK) {
+    for (size_t i = 2; i < available; i++) {
+      if (data[i] == 0) {
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+  // get field layout of timed records
+  if (data[0] >= sizeof(naos_trace_layouts) / sizeof(naos_trace_layouts[0]) || naos_trace_layouts[data[0]][0] == 0) {
+    return 0;
+  }
+  const char *layout = naos_trace_layouts[data[0]];
+
+  // read delta
+  size_t len = naos_trace_get_varint(data + 1, available - 1, delta);
+  if (len == 0) {
+    return 0;
+  }
+  len += 1;
+
+  // skip fields
+  for (const char *field = layout; *field != 0; field++) {
+    if (*field == 'v') {
+      uint64_t value;
+      size_t n = len < available ? naos_trace_get_varint(data + len, available - len, &value) : 0;
+      if (n == 0) {
+        return 0;
       }
-      return 0;
-    default:
-      return 0;
+      len += n;
+    } else {
+      len += *field == 'i' ? 4 : 1;
+    }
   }
+  if (len > available) {
+    return 0;
+  }
+
+  return len;
 }
 
-static uint8_t naos_trace_find_task(TaskHandle_t handle) {
-  // must be called with spinlock held
+static bool IRAM_ATTR naos_trace_evict(naos_trace_ring_t *ring) {
+  // must be called between enter and exit
 
-  // search existing
-  for (uint16_t i = 0; i < naos_trace_task_count; i++) {
-    if (naos_trace_tasks[i] == handle) {
-      return i;
+  // check if empty
+  uint32_t tail = ring->tail;
+  if (tail == ring->head) {
+    return false;
+  }
+
+  // skip padding or oldest record
+  if (ring->buffer[tail] == 0) {
+    tail = 0;
+  } else {
+    uint64_t delta;
+    size_t rec_size = naos_trace_record_size(ring->buffer + tail, naos_trace_capacity - tail, &delta);
+    if (rec_size == 0) {
+      tail = ring->head;
+    } else {
+      ring->base += delta;
+      tail += rec_size;
+      if (tail == naos_trace_capacity) {
+        tail = 0;
+      }
+    }
+  }
+
+  // publish tail
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+static bool IRAM_ATTR naos_trace_write(naos_trace_ring_t *ring, const uint8_t *data, size_t len) {
+  // must be called between enter and exit
+
+  // determine position, evicting the oldest records in recorder mode
+  uint32_t head = ring->head;
+  uint32_t pos = head;
+  for (;;) {
+    // get tail, the reader may advance it concurrently
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head >= tail) {
+      if (head + len < naos_trace_capacity || (head + len == naos_trace_capacity && tail > 0)) {
+        // record fits at current position
+        break;
+      } else if (len < tail) {
+        // pad remainder and write at start
+        memset(ring->buffer + head, 0, naos_trace_capacity - head);
+        pos = 0;
+        break;
+      }
+    } else if (head + len < tail) {
+      // record fits before tail
+      break;
+    }
+
+    // otherwise evict or drop
+    if (naos_trace_mode != NAOS_TRACE_MODE_RECORDER || !naos_trace_evict(ring)) {
+      ring->dropped++;
+      return false;
+    }
+  }
+
+  // write record
+  memcpy(ring->buffer + pos, data, len);
+  pos += len;
+  if (pos == naos_trace_capacity) {
+    pos = 0;
+  }
+
+  // publish head
+  __atomic_store_n(&ring->head, pos, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+static void IRAM_ATTR naos_trace_record(naos_trace_ring_t *ring, uint8_t type, const uint8_t *payload, size_t len) {
+  // must be called between enter and exit
+
+  // get timestamp
+  uint64_t ts = (uint64_t)(esp_timer_get_time() - naos_trace_start_time);
+
+  // encode type, delta and payload
+  uint8_t rec[NAOS_TRACE_REC_MAX];
+  rec[0] = type;
+  size_t rec_len = 1 + naos_trace_put_varint(rec + 1, ts - ring->last);
+  memcpy(rec + rec_len, payload, len);
+  rec_len += len;
+
+  // write record and advance time
+  if (naos_trace_write(ring, rec, rec_len)) {
+    ring->last = ts;
+  }
+}
+
+static uint32_t naos_trace_used(naos_trace_ring_t *ring) {
+  // calculate used bytes including padding
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  return (head + naos_trace_capacity - tail) % naos_trace_capacity;
+}
+
+static size_t IRAM_ATTR naos_trace_encode(uint8_t *rec, uint8_t type, uint8_t id, const char *text, size_t max) {
+  // write TYPE(1) ID(1) TEXT(*) NUL(1) with truncated text
+  size_t text_len = strlen(text);
+  if (text_len > max) {
+    text_len = max;
+  }
+  rec[0] = type;
+  rec[1] = id;
+  memcpy(rec + 2, text, text_len);
+  rec[2 + text_len] = 0;
+  return 2 + text_len + 1;
+}
+
+static void naos_trace_halt() {
+  // freeze recording, writers may still be leaving their rings
+  __atomic_store_n(&naos_trace_frozen, true, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&naos_trace_active, false, __ATOMIC_SEQ_CST);
+}
+
+static void naos_trace_settle() {
+  // wait for writers to leave their rings
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    while (__atomic_load_n(&naos_trace_rings[i].busy, __ATOMIC_SEQ_CST)) {
     }
   }
+}
+
+static uint8_t IRAM_ATTR naos_trace_find_task(naos_trace_ring_t *ring, TaskHandle_t handle) {
+  // must be called between enter and exit
 
-  // add new if space available
-  if (naos_trace_task_count < NAOS_TRACE_MAX_TASKS) {
-    uint8_t id = (uint8_t)naos_trace_task_count;
-    naos_trace_tasks[id] = handle;
-    naos_trace_task_count++;
+  for (uint16_t i = 0; i < NAOS_TRACE_MAX_TASKS; i++) {
+    // check slot
+    TaskHandle_t slot = __atomic_load_n(&naos_trace_tasks[i], __ATOMIC_ACQUIRE);
+    if (slot == handle) {
+      return i;
+    } else if (slot != NULL) {
+      continue;
+    }
 
-    // write TASK record
+    // claim slot, another core may claim it first
+    if (!__atomic_compare_exchange_n(&naos_trace_tasks[i], &slot, handle, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+      if (slot == handle) {
+        return i;
+      }
+      continue;
+    }
+
+    // get name
     const char *name = pcTaskGetName(handle);
-    if (!name) {
+    if (!name || name[0] == 0) {
       name = "?";
     }
-    size_t name_len = strlen(name);
-    if (name_len > 15) {
-      name_len = 15;
-    }
+
+    // remember name and write TASK record
     uint8_t rec[2 + 15 + 1];
-    rec[0] = NAOS_TRACE_REC_TASK;
-    rec[1] = id;
-    memcpy(rec + 2, name, name_len);
-    rec[2 + name_len] = 0;
-    naos_trace_write(rec, 2 + name_len + 1);
+    size_t rec_len = naos_trace_encode(rec, NAOS_TRACE_REC_TASK, (uint8_t)i, name, 15);
+    memcpy(naos_trace_names[i], rec + 2, rec_len - 2);
+    naos_trace_write(ring, rec, rec_len);
 
-    return id;
+    return i;
   }
 
   return UINT8_MAX;
 }
 
-static int naos_trace_find_label(const char *text) {
-  // must be called with spinlock held
+static int naos_trace_find_label(naos_trace_ring_t *ring, const char *text) {
+  // must be called between enter and exit
 
-  // search existing by pointer identity
-  for (uint8_t i = 0; i < naos_trace_label_count; i++) {
-    if (naos_trace_labels[i] == text) {
+  for (int i = 0; i < NAOS_TRACE_MAX_LABELS; i++) {
+    // check slot by pointer identity
+    const char *slot = __atomic_load_n(&naos_trace_labels[i], __ATOMIC_ACQUIRE);
+    if (slot == text) {
       return i;
+    } else if (slot != NULL) {
+      continue;
     }
-  }
 
-  // add new if space available
-  if (naos_trace_label_count < NAOS_TRACE_MAX_LABELS) {
-    uint8_t id = naos_trace_label_count;
-    naos_trace_labels[id] = text;
-    naos_trace_label_count++;
+    // claim slot, another core may claim it first
+    if (!__atomic_compare_exchange_n(&naos_trace_labels[i], &slot, text, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+      if (slot == text) {
+        return i;
+      }
+      continue;
+    }
 
-    // write LABEL record
-    size_t text_len = strlen(text);
-    if (text_len > 32) {
-      text_len = 32;
+    // resolve trigger label
+    if (__atomic_load_n(&naos_trace_trigger, __ATOMIC_ACQUIRE) != NAOS_TRACE_TRIGGER_NONE &&
+        strncmp(text, naos_trace_trigger_name, 32) == 0) {
+      __atomic_store_n(&naos_trace_trigger_label, text, __ATOMIC_RELEASE);
     }
+
+    // write LABEL record
     uint8_t rec[2 + 32 + 1];
-    rec[0] = NAOS_TRACE_REC_LABEL;
-    rec[1] = id;
-    memcpy(rec + 2, text, text_len);
-    rec[2 + text_len] = 0;
-    naos_trace_write(rec, 2 + text_len + 1);
+    size_t rec_len = naos_trace_encode(rec, NAOS_TRACE_REC_LABEL, (uint8_t)i, text, 32);
+    naos_trace_write(ring, rec, rec_len);
 
-    return id;
+    return i;
   }
 
   return -1;
@@ -218,49 +466,298 @@ void IRAM_ATTR naos_trace_task_switched_in(void *task) {
   // update last task record
   naos_trace_last_task[core] = (TaskHandle_t)task;
 
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
+
   // find or register task and write SWITCH record
-  portENTER_CRITICAL_ISR(&naos_trace_spinlock);
-  uint8_t id = naos_trace_find_task(task);
+  uint8_t id = naos_trace_find_task(ring, task);
+  if (id != UINT8_MAX) {
+    naos_trace_record(ring, NAOS_TRACE_REC_SWITCH, &id, 1);
+  }
+
+  // exit ring
+  naos_trace_exit(ring, state);
+}
+
+void IRAM_ATTR naos_trace_task_ready(void *task) {
+  // check if trace is active and task switches are traced on any core
+  if (!naos_trace_active || !(naos_trace_flags & (NAOS_TRACE_FLAG_CORE(portNUM_PROCESSORS) - 1))) {
+    return;
+  }
+
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
+
+  // find or register task and write READY record
+  uint8_t id = naos_trace_find_task(ring, task);
   if (id != UINT8_MAX) {
-    uint32_t ts = (uint32_t)(esp_timer_get_time() - naos_trace_start_time);
-    uint8_t rec[7] = {NAOS_TRACE_REC_SWITCH};
-    memcpy(rec + 1, &ts, 4);
-    rec[5] = core;
-    rec[6] = id;
-    naos_trace_write(rec, 7);
+    naos_trace_record(ring, NAOS_TRACE_REC_READY, &id, 1);
+  }
+
+  // exit ring
+  naos_trace_exit(ring, state);
+}
+
+typedef struct {
+  uint16_t session;
+  uint8_t *chunk;
+  size_t mtu;
+  size_t len;
+  uint32_t sent;
+  uint32_t limit;
+  int core;
+  int synced;
+  uint64_t time;
+} naos_trace_sink_t;
+
+static void naos_trace_flush(naos_trace_sink_t *sink) {
+  // check length
+  if (sink->len == 0) {
+    return;
+  }
+
+  // send chunk
+  naos_msg_send((naos_msg_t){
+      .session = sink->session,
+      .endpoint = NAOS_TRACE_ENDPOINT,
+      .data = sink->chunk,
+      .len = sink->len,
+      .framed = true,
+  });
+  sink->len = 0;
+  sink->sent++;
+  sink->synced = -1;
+
+  // yield
+  naos_delay(1);
+}
+
+static bool naos_trace_emit(naos_trace_sink_t *sink, const uint8_t *data, size_t len) {
+  // ring records need a SYNC record at chunk start and when the core changes
+  bool sync = sink->core >= 0 && sink->synced != sink->core;
+
+  // flush chunk if record does not fit, keeping one chunk for the final flush
+  if (sink->len + (sync ? 10 : 0) + len > sink->mtu) {
+    if (sink->sent + 1 >= sink->limit) {
+      return false;
+    }
+    naos_trace_flush(sink);
+    sync = sink->core >= 0;
+  }
+
+  // append SYNC record
+  if (sync) {
+    sink->chunk[sink->len] = NAOS_TRACE_REC_SYNC;
+    sink->chunk[sink->len + 1] = (uint8_t)sink->core;
+    memcpy(sink->chunk + sink->len + 2, &sink->time, 8);
+    sink->len += 10;
+    sink->synced = sink->core;
+  }
+
+  // append record
+  memcpy(sink->chunk + sink->len, data, len);
+  sink->len += len;
+
+  return true;
+}
+
+static void naos_trace_drain(naos_trace_sink_t *sink) {
+  // must be called with mutex held
+
+  // drain rings one after another, starting with the next ring each time so
+  // that limited sinks do not starve a ring, the client merges records by
+  // timestamp
+  static int turn = 0;
+  turn = (turn + 1) % portNUM_PROCESSORS;
+  for (int n = 0; n < portNUM_PROCESSORS; n++) {
+    int core = (turn + n) % portNUM_PROCESSORS;
+    naos_trace_ring_t *ring = &naos_trace_rings[core];
+    sink->core = core;
+
+    // snapshot head
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t pos = ring->tail;
+
+    // copy records until the sink is exhausted
+    while (pos != head) {
+      // skip padding
+      if (ring->buffer[pos] == 0) {
+        pos = 0;
+        __atomic_store_n(&ring->tail, pos, __ATOMIC_RELEASE);
+        continue;
+      }
+
+      // determine record size
+      uint64_t delta;
+      size_t available = naos_trace_capacity - pos;
+      size_t rec_size = naos_trace_record_size(ring->buffer + pos, available, &delta);
+      if (rec_size == 0) {
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+        break;
+      }
+
+      // copy record relative to the time of the last consumed record
+      sink->time = ring->base;
+      if (!naos_trace_emit(sink, ring->buffer + pos, rec_size)) {
+        return;
+      }
+
+      // advance time and tail
+      ring->base += delta;
+      pos += rec_size;
+      if (pos == naos_trace_capacity) {
+        pos = 0;
+      }
+      __atomic_store_n(&ring->tail, pos, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+static void naos_trace_replay(naos_trace_sink_t *sink) {
+  // must be called with mutex held
+
+  // emit labels and task names, as the records may have been evicted
+  uint8_t rec[2 + 32 + 1];
+  for (int i = 0; i < NAOS_TRACE_MAX_LABELS; i++) {
+    if (naos_trace_labels[i] != NULL) {
+      size_t rec_len = naos_trace_encode(rec, NAOS_TRACE_REC_LABEL, (uint8_t)i, naos_trace_labels[i], 32);
+      naos_trace_emit(sink, rec, rec_len);
+    }
+  }
+  for (int i = 0; i < NAOS_TRACE_MAX_TASKS; i++) {
+    if (naos_trace_names[i][0] != 0) {
+      size_t rec_len = naos_trace_encode(rec, NAOS_TRACE_REC_TASK, (uint8_t)i, naos_trace_names[i], 15);
+      naos_trace_emit(sink, rec, rec_len);
+    }
+  }
+}
+
+static void naos_trace_pump() {
+  // acquire mutex
+  naos_lock(naos_trace_mutex);
+
+  // check subscription and credits
+  if (naos_trace_stream == 0 || naos_trace_credits == 0) {
+    naos_unlock(naos_trace_mutex);
+    return;
+  }
+
+  // check for records
+  uint32_t used = 0;
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    used += naos_trace_used(&naos_trace_rings[i]);
+  }
+  if (used == 0) {
+    naos_unlock(naos_trace_mutex);
+    return;
+  }
+
+  // allocate chunk buffer with framing headroom
+  size_t mtu = naos_msg_get_mtu(naos_trace_stream);
+  uint8_t *buf = malloc(NAOS_MSG_FRAMING + mtu);
+  if (buf == NULL) {
+    naos_unlock(naos_trace_mutex);
+    return;
+  }
+
+  // push records within credits
+  naos_trace_sink_t sink = {
+      .session = naos_trace_stream,
+      .chunk = buf + NAOS_MSG_FRAMING,
+      .mtu = mtu,
+      .limit = naos_trace_credits,
+      .core = -1,
+      .synced = -1,
+  };
+  naos_trace_drain(&sink);
+  naos_trace_flush(&sink);
+  naos_trace_credits -= sink.sent;
+
+  // release mutex
+  naos_unlock(naos_trace_mutex);
+
+  free(buf);
+}
+
+static void naos_trace_subscribe(uint16_t session) {
+  // must be called with mutex held
+
+  // set subscription
+  naos_trace_stream = session;
+  naos_trace_credits = 0;
+
+  // start or stop pump
+  if (session != 0 && naos_trace_timer == NULL) {
+    naos_trace_timer = naos_repeat_defer("naos-trace", NAOS_TRACE_STREAM_PERIOD, naos_trace_pump);
+  } else if (session == 0 && naos_trace_timer != NULL) {
+    naos_cancel(naos_trace_timer);
+    naos_trace_timer = NULL;
   }
-  portEXIT_CRITICAL_ISR(&naos_trace_spinlock);
 }
 
 static naos_msg_reply_t naos_trace_handle_start(naos_msg_t msg) {
+  // command structure:
+  // FLAGS(1)? | MODE(1)?
+
   // check message
-  if (msg.len > 1) {
+  if (msg.len > 2) {
     return NAOS_MSG_INVALID;
   }
 
   // determine feature flags (default to capturing everything)
   uint8_t flags = NAOS_TRACE_FLAG_ALL;
-  if (msg.len == 1) {
+  if (msg.len >= 1) {
     flags = msg.data[0];
   }
 
+  // determine mode
+  naos_trace_mode_t mode = NAOS_TRACE_MODE_BUFFER;
+  if (msg.len >= 2) {
+    mode = msg.data[1];
+  }
+  if (mode > NAOS_TRACE_MODE_RECORDER) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // deactivate and wait for writers to leave their rings
+  __atomic_store_n(&naos_trace_active, false, __ATOMIC_SEQ_CST);
+  naos_trace_settle();
+
+  // acquire mutex
+  naos_lock(naos_trace_mutex);
+
   // reset and activate
-  portENTER_CRITICAL(&naos_trace_spinlock);
-  naos_trace_active = false;
   naos_trace_flags = flags;
-  naos_trace_head = 0;
-  naos_trace_tail = 0;
-  naos_trace_used = 0;
-  naos_trace_dropped = 0;
-  naos_trace_task_count = 0;
-  naos_trace_label_count = 0;
+  naos_trace_mode = mode;
+  naos_trace_frozen = false;
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    naos_trace_rings[i].head = 0;
+    naos_trace_rings[i].tail = 0;
+    naos_trace_rings[i].dropped = 0;
+    naos_trace_rings[i].last = 0;
+    naos_trace_rings[i].base = 0;
+  }
   naos_trace_span_id = 0;
+  naos_trace_trigger = NAOS_TRACE_TRIGGER_NONE;
+  naos_trace_trigger_label = NULL;
   memset(naos_trace_last_task, 0, sizeof(naos_trace_last_task));
   memset(naos_trace_tasks, 0, sizeof(naos_trace_tasks));
   memset(naos_trace_labels, 0, sizeof(naos_trace_labels));
+  memset(naos_trace_names, 0, sizeof(naos_trace_names));
+  naos_trace_subscribe(mode == NAOS_TRACE_MODE_STREAM ? msg.session : 0);
   naos_trace_start_time = esp_timer_get_time();
-  naos_trace_active = true;
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  __atomic_store_n(&naos_trace_active, true, __ATOMIC_SEQ_CST);
+
+  // release mutex
+  naos_unlock(naos_trace_mutex);
 
   return NAOS_MSG_ACK;
 }
@@ -272,9 +769,12 @@ static naos_msg_reply_t naos_trace_handle_stop(naos_msg_t msg) {
   }
 
   // deactivate
-  portENTER_CRITICAL(&naos_trace_spinlock);
-  naos_trace_active = false;
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  __atomic_store_n(&naos_trace_active, false, __ATOMIC_SEQ_CST);
+
+  // stop streaming, pushed chunks precede the acknowledgement
+  naos_lock(naos_trace_mutex);
+  naos_trace_subscribe(0);
+  naos_unlock(naos_trace_mutex);
 
   return NAOS_MSG_ACK;
 }
@@ -285,6 +785,12 @@ static naos_msg_reply_t naos_trace_handle_read(naos_msg_t msg) {
     return NAOS_MSG_INVALID;
   }
 
+  // freeze flight recordings, as the writer would evict records being read
+  if (naos_trace_mode == NAOS_TRACE_MODE_RECORDER) {
+    naos_trace_halt();
+    naos_trace_settle();
+  }
+
   // get MTU
   size_t mtu = naos_msg_get_mtu(msg.session);
 
@@ -293,74 +799,29 @@ static naos_msg_reply_t naos_trace_handle_read(naos_msg_t msg) {
   if (buf == NULL) {
     return NAOS_MSG_ERROR;
   }
-  uint8_t *chunk = buf + NAOS_MSG_FRAMING;
-
-  // snapshot buffer state
-  portENTER_CRITICAL(&naos_trace_spinlock);
-  uint32_t total = naos_trace_used;
-  uint32_t pos = naos_trace_tail;
-  portEXIT_CRITICAL(&naos_trace_spinlock);
-  uint32_t remaining = total;
-
-  // stream records in MTU-sized chunks
-  while (remaining > 0) {
-    size_t chunk_len = 0;
-    uint32_t consumed = 0;
-
-    while (consumed < remaining) {
-      // skip padding
-      if (naos_trace_buffer[pos] == 0) {
-        uint32_t pad = naos_trace_capacity - pos;
-        pos = 0;
-        consumed += pad;
-        continue;
-      }
-
-      // determine record size
-      size_t available = naos_trace_capacity - pos;
-      size_t rec_size = naos_trace_record_size(naos_trace_buffer + pos, available);
-      if (rec_size == 0) {
-        consumed = remaining;
-        break;
-      }
 
-      // stop if record doesn't fit in chunk
-      if (chunk_len + rec_size > mtu) {
-        break;
-      }
-
-      // copy record to chunk
-      memcpy(chunk + chunk_len, naos_trace_buffer + pos, rec_size);
-      chunk_len += rec_size;
-      pos += rec_size;
-      if (pos == naos_trace_capacity) {
-        pos = 0;
-      }
-      consumed += rec_size;
-    }
+  // prepare sink
+  naos_trace_sink_t sink = {
+      .session = msg.session,
+      .chunk = buf + NAOS_MSG_FRAMING,
+      .mtu = mtu,
+      .limit = UINT32_MAX,
+      .core = -1,
+      .synced = -1,
+  };
 
-    remaining -= consumed;
-
-    // advance tail
-    portENTER_CRITICAL(&naos_trace_spinlock);
-    naos_trace_tail = pos;
-    naos_trace_used -= consumed;
-    portEXIT_CRITICAL(&naos_trace_spinlock);
-
-    // send chunk
-    if (chunk_len > 0) {
-      naos_msg_send((naos_msg_t){
-          .session = msg.session,
-          .endpoint = NAOS_TRACE_ENDPOINT,
-          .data = chunk,
-          .len = chunk_len,
-          .framed = true,
-      });
-    }
+  // acquire mutex
+  naos_lock(naos_trace_mutex);
 
-    // yield
-    naos_delay(1);
+  // stream records in MTU-sized chunks
+  if (naos_trace_mode == NAOS_TRACE_MODE_RECORDER) {
+    naos_trace_replay(&sink);
   }
+  naos_trace_drain(&sink);
+  naos_trace_flush(&sink);
+
+  // release mutex
+  naos_unlock(naos_trace_mutex);
 
   free(buf);
 
@@ -374,18 +835,23 @@ static naos_msg_reply_t naos_trace_handle_status(naos_msg_t msg) {
   }
 
   // snapshot state
-  portENTER_CRITICAL(&naos_trace_spinlock);
   bool active = naos_trace_active;
-  uint32_t used = naos_trace_used;
-  uint32_t dropped = naos_trace_dropped;
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  uint32_t size = naos_trace_capacity * portNUM_PROCESSORS;
+  uint32_t used = 0;
+  uint32_t dropped = 0;
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    used += naos_trace_used(&naos_trace_rings[i]);
+    dropped += naos_trace_rings[i].dropped;
+  }
 
-  // send status: ACTIVE(1) | BUF_SIZE(4) | BUF_USED(4) | DROPPED(4)
-  uint8_t buf[13] = {0};
+  // send status: ACTIVE(1) | BUF_SIZE(4) | BUF_USED(4) | DROPPED(4) | MODE(1) | FROZEN(1)
+  uint8_t buf[15] = {0};
   buf[0] = active ? 1 : 0;
-  memcpy(buf + 1, &naos_trace_capacity, 4);
+  memcpy(buf + 1, &size, 4);
   memcpy(buf + 5, &used, 4);
   memcpy(buf + 9, &dropped, 4);
+  buf[13] = (uint8_t)naos_trace_mode;
+  buf[14] = naos_trace_frozen ? 1 : 0;
 
   naos_msg_send((naos_msg_t){
       .session = msg.session,
@@ -397,6 +863,78 @@ static naos_msg_reply_t naos_trace_handle_status(naos_msg_t msg) {
   return NAOS_MSG_OK;
 }
 
+static naos_msg_reply_t naos_trace_handle_credit(naos_msg_t msg) {
+  // command structure:
+  // CHUNKS(2)
+
+  // check message
+  if (msg.len != 2) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get chunks
+  uint16_t chunks;
+  memcpy(&chunks, msg.data, 2);
+
+  // acquire mutex
+  naos_lock(naos_trace_mutex);
+
+  // check subscription
+  if (naos_trace_stream != msg.session) {
+    naos_unlock(naos_trace_mutex);
+    return NAOS_MSG_INVALID;
+  }
+
+  // add credits
+  naos_trace_credits += chunks;
+
+  // release mutex
+  naos_unlock(naos_trace_mutex);
+
+  return NAOS_MSG_OK;
+}
+
+static naos_msg_reply_t naos_trace_handle_trigger(naos_msg_t msg) {
+  // command structure:
+  // KIND(1) | THRESHOLD(4) | NAME(*)
+
+  // check message
+  if (msg.len < 5 || msg.len > 5 + 32 || msg.data[0] > NAOS_TRACE_TRIGGER_BELOW) {
+    return NAOS_MSG_INVALID;
+  }
+
+  // get kind and threshold
+  naos_trace_trigger_t kind = msg.data[0];
+  int32_t threshold;
+  memcpy(&threshold, msg.data + 1, 4);
+
+  // disarm trigger
+  __atomic_store_n(&naos_trace_trigger, NAOS_TRACE_TRIGGER_NONE, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&naos_trace_trigger_label, NULL, __ATOMIC_SEQ_CST);
+  if (kind == NAOS_TRACE_TRIGGER_NONE) {
+    return NAOS_MSG_ACK;
+  }
+
+  // set name and threshold
+  memset(naos_trace_trigger_name, 0, sizeof(naos_trace_trigger_name));
+  memcpy(naos_trace_trigger_name, msg.data + 5, msg.len - 5);
+  naos_trace_trigger_threshold = threshold;
+
+  // arm trigger, labels claimed from now on are resolved by the writers
+  __atomic_store_n(&naos_trace_trigger, kind, __ATOMIC_SEQ_CST);
+
+  // resolve already claimed labels
+  for (int i = 0; i < NAOS_TRACE_MAX_LABELS; i++) {
+    const char *label = __atomic_load_n(&naos_trace_labels[i], __ATOMIC_ACQUIRE);
+    if (label != NULL && strncmp(label, naos_trace_trigger_name, 32) == 0) {
+      __atomic_store_n(&naos_trace_trigger_label, label, __ATOMIC_RELEASE);
+      break;
+    }
+  }
+
+  return NAOS_MSG_ACK;
+}
+
 static naos_msg_reply_t naos_trace_handle(naos_msg_t msg) {
   // check length
   if (msg.len == 0) {
@@ -418,53 +956,114 @@ static naos_msg_reply_t naos_trace_handle(naos_msg_t msg) {
       return naos_trace_handle_read(msg);
     case NAOS_TRACE_CMD_STATUS:
       return naos_trace_handle_status(msg);
+    case NAOS_TRACE_CMD_CREDIT:
+      return naos_trace_handle_credit(msg);
+    case NAOS_TRACE_CMD_TRIGGER:
+      return naos_trace_handle_trigger(msg);
     default:
       return NAOS_MSG_UNKNOWN;
   }
 }
 
+static void naos_trace_cleanup(uint16_t session) {
+  // acquire mutex
+  naos_lock(naos_trace_mutex);
+
+  // stop streaming to closed session
+  if (naos_trace_stream == session) {
+    __atomic_store_n(&naos_trace_active, false, __ATOMIC_SEQ_CST);
+    naos_trace_subscribe(0);
+  }
+
+  // release mutex
+  naos_unlock(naos_trace_mutex);
+}
+
 void naos_trace_install() {
-  // allocate buffer
-  naos_trace_capacity = NAOS_TRACE_BUF_SIZE;
-  naos_trace_buffer = calloc(1, naos_trace_capacity);
-  if (naos_trace_buffer == NULL) {
-    ESP_ERROR_CHECK(ESP_FAIL);
+  // create mutex
+  naos_trace_mutex = naos_mutex();
+
+  // determine capacity, split evenly across cores
+  naos_trace_capacity = NAOS_TRACE_BUF_SIZE / portNUM_PROCESSORS;
+
+#ifdef CONFIG_NAOS_TRACE_PANIC
+  // keep a flight recording that was interrupted by a panic
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool crashed = reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+                 reason == ESP_RST_WDT;
+  if (crashed && naos_trace_magic == NAOS_TRACE_MAGIC && naos_trace_mode == NAOS_TRACE_MODE_RECORDER) {
+    naos_trace_frozen = true;
+  } else {
+    naos_trace_mode = NAOS_TRACE_MODE_BUFFER;
+    naos_trace_frozen = false;
+    memset(naos_trace_rings, 0, sizeof(naos_trace_rings));
+    memset(naos_trace_labels, 0, sizeof(naos_trace_labels));
+    memset(naos_trace_names, 0, sizeof(naos_trace_names));
+    naos_trace_magic = NAOS_TRACE_MAGIC;
+  }
+
+  // assign buffers from retained storage
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    naos_trace_rings[i].buffer = naos_trace_storage + i * naos_trace_capacity;
+    naos_trace_rings[i].busy = false;
+  }
+#else
+  // allocate buffers
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    naos_trace_rings[i].buffer = calloc(1, naos_trace_capacity);
+    if (naos_trace_rings[i].buffer == NULL) {
+      ESP_ERROR_CHECK(ESP_FAIL);
+    }
   }
+#endif
 
   // install endpoint
   naos_msg_install((naos_msg_endpoint_t){
       .ref = NAOS_TRACE_ENDPOINT,
       .name = "trace",
       .handle = naos_trace_handle,
+      .cleanup = naos_trace_cleanup,
   });
 }
 
+void naos_trace_freeze() {
+  // freeze active recording
+  if (naos_trace_active) {
+    naos_trace_halt();
+  }
+}
+
 void naos_trace_event(const char *category, const char *name, uint16_t arg) {
   // check state
   if (!naos_trace_active || !(naos_trace_flags & NAOS_TRACE_FLAG_EVENT)) {
     return;
   }
 
-  // get timestamp
-  uint32_t ts = (uint32_t)(esp_timer_get_time() - naos_trace_start_time);
-
-  portENTER_CRITICAL(&naos_trace_spinlock);
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
 
   // resolve labels
-  int cat_id = naos_trace_find_label(category);
-  int name_id = naos_trace_find_label(name);
+  int cat_id = naos_trace_find_label(ring, category);
+  int name_id = naos_trace_find_label(ring, name);
 
   // write EVENT record
   if (cat_id >= 0 && name_id >= 0) {
-    uint8_t rec[9] = {NAOS_TRACE_REC_EVENT};
-    memcpy(rec + 1, &ts, 4);
-    rec[5] = (uint8_t)cat_id;
-    rec[6] = (uint8_t)name_id;
-    memcpy(rec + 7, &arg, 2);
-    naos_trace_write(rec, 9);
+    uint8_t rec[5] = {(uint8_t)cat_id, (uint8_t)name_id};
+    size_t rec_len = 2 + naos_trace_put_varint(rec + 2, arg);
+    naos_trace_record(ring, NAOS_TRACE_REC_EVENT, rec, rec_len);
+  }
+
+  // check trigger
+  if (name == naos_trace_trigger_label && naos_trace_trigger == NAOS_TRACE_TRIGGER_EVENT) {
+    naos_trace_halt();
   }
 
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  // exit ring
+  naos_trace_exit(ring, state);
 }
 
 void naos_trace_value(const char *category, const char *name, int32_t value) {
@@ -473,26 +1072,34 @@ void naos_trace_value(const char *category, const char *name, int32_t value) {
     return;
   }
 
-  // get timestamp
-  uint32_t ts = (uint32_t)(esp_timer_get_time() - naos_trace_start_time);
-
-  portENTER_CRITICAL(&naos_trace_spinlock);
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
 
   // resolve labels
-  int cat_id = naos_trace_find_label(category);
-  int name_id = naos_trace_find_label(name);
+  int cat_id = naos_trace_find_label(ring, category);
+  int name_id = naos_trace_find_label(ring, name);
 
-  // write VALUE record
+  // write VALUE record with zigzag encoded value
   if (cat_id >= 0 && name_id >= 0) {
-    uint8_t rec[11] = {NAOS_TRACE_REC_VALUE};
-    memcpy(rec + 1, &ts, 4);
-    rec[5] = (uint8_t)cat_id;
-    rec[6] = (uint8_t)name_id;
-    memcpy(rec + 7, &value, 4);
-    naos_trace_write(rec, 11);
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    uint8_t rec[7] = {(uint8_t)cat_id, (uint8_t)name_id};
+    size_t rec_len = 2 + naos_trace_put_varint(rec + 2, zigzag);
+    naos_trace_record(ring, NAOS_TRACE_REC_VALUE, rec, rec_len);
   }
 
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  // check trigger
+  if (name == naos_trace_trigger_label &&
+      ((naos_trace_trigger == NAOS_TRACE_TRIGGER_ABOVE && value >= naos_trace_trigger_threshold) ||
+       (naos_trace_trigger == NAOS_TRACE_TRIGGER_BELOW && value <= naos_trace_trigger_threshold))) {
+    naos_trace_halt();
+  }
+
+  // exit ring
+  naos_trace_exit(ring, state);
 }
 
 int naos_trace_begin(const char *category, const char *name, uint16_t arg) {
@@ -501,29 +1108,29 @@ int naos_trace_begin(const char *category, const char *name, uint16_t arg) {
     return -1;
   }
 
-  // get timestamp
-  uint32_t ts = (uint32_t)(esp_timer_get_time() - naos_trace_start_time);
-
-  portENTER_CRITICAL(&naos_trace_spinlock);
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return -1;
+  }
 
   // resolve labels
-  int cat_id = naos_trace_find_label(category);
-  int name_id = naos_trace_find_label(name);
+  int cat_id = naos_trace_find_label(ring, category);
+  int name_id = naos_trace_find_label(ring, name);
 
   // write BEGIN record with span instance id
   int span_id = -1;
   if (cat_id >= 0 && name_id >= 0) {
-    span_id = naos_trace_span_id++;
-    uint8_t rec[10] = {NAOS_TRACE_REC_BEGIN};
-    memcpy(rec + 1, &ts, 4);
-    rec[5] = (uint8_t)cat_id;
-    rec[6] = (uint8_t)name_id;
-    memcpy(rec + 7, &arg, 2);
-    rec[9] = (uint8_t)span_id;
-    naos_trace_write(rec, 10);
+    span_id = (uint8_t)__atomic_fetch_add(&naos_trace_span_id, 1, __ATOMIC_RELAXED);
+    uint8_t rec[6] = {(uint8_t)cat_id, (uint8_t)name_id};
+    size_t rec_len = 2 + naos_trace_put_varint(rec + 2, arg);
+    rec[rec_len++] = (uint8_t)span_id;
+    naos_trace_record(ring, NAOS_TRACE_REC_BEGIN, rec, rec_len);
   }
 
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  // exit ring
+  naos_trace_exit(ring, state);
 
   return span_id;
 }
@@ -534,16 +1141,101 @@ void naos_trace_end(int id) {
     return;
   }
 
-  // get timestamp
-  uint32_t ts = (uint32_t)(esp_timer_get_time() - naos_trace_start_time);
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
 
-  // prepare record
-  uint8_t rec[6] = {NAOS_TRACE_REC_END};
-  memcpy(rec + 1, &ts, 4);
-  rec[5] = (uint8_t)id;
+  // write END record
+  uint8_t span_id = (uint8_t)id;
+  naos_trace_record(ring, NAOS_TRACE_REC_END, &span_id, 1);
 
-  // write record
-  portENTER_CRITICAL(&naos_trace_spinlock);
-  naos_trace_write(rec, 6);
-  portEXIT_CRITICAL(&naos_trace_spinlock);
+  // exit ring
+  naos_trace_exit(ring, state);
 }
+
+#ifdef CONFIG_NAOS_TRACE_HEAP
+
+static uint32_t IRAM_ATTR naos_trace_caller() {
+#if __XTENSA__
+  // walk up to the first frame outside of IRAM, as the heap functions that
+  // call the hooks are placed in IRAM
+  esp_backtrace_frame_t frame = {0};
+  esp_backtrace_get_start(&frame.pc, &frame.sp, &frame.next_pc);
+  for (int i = 0; i < 8; i++) {
+    uint32_t pc = esp_cpu_process_stack_pc(frame.pc);
+    if (!esp_ptr_in_iram((void *)(uintptr_t)pc)) {
+      return pc;
+    }
+    if (!esp_backtrace_get_next_frame(&frame)) {
+      break;
+    }
+  }
+#endif
+
+  // the caller is unknown on other architectures, as the frame walk is only
+  // available on Xtensa
+  return 0;
+}
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+  // check state
+  if (!naos_trace_active || !(naos_trace_flags & NAOS_TRACE_FLAG_HEAP)) {
+    return;
+  }
+
+  // get caller
+  uint32_t caller = naos_trace_caller();
+
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
+
+  // resolve task, allocations may happen before the scheduler starts
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  uint8_t task_id = task != NULL ? naos_trace_find_task(ring, task) : UINT8_MAX;
+
+  // write ALLOC record
+  uint32_t addr = (uint32_t)(uintptr_t)ptr;
+  uint8_t rec[4 + 5 + 5 + 4 + 1];
+  size_t rec_len = 0;
+  memcpy(rec, &addr, 4);
+  rec_len += 4;
+  rec_len += naos_trace_put_varint(rec + rec_len, size);
+  rec_len += naos_trace_put_varint(rec + rec_len, caps);
+  memcpy(rec + rec_len, &caller, 4);
+  rec_len += 4;
+  rec[rec_len++] = task_id;
+  naos_trace_record(ring, NAOS_TRACE_REC_ALLOC, rec, rec_len);
+
+  // exit ring
+  naos_trace_exit(ring, state);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+  // check state
+  if (!naos_trace_active || !(naos_trace_flags & NAOS_TRACE_FLAG_HEAP)) {
+    return;
+  }
+
+  // enter ring of this core
+  UBaseType_t state;
+  naos_trace_ring_t *ring = naos_trace_enter(&state);
+  if (ring == NULL) {
+    return;
+  }
+
+  // write FREE record
+  uint32_t addr = (uint32_t)(uintptr_t)ptr;
+  naos_trace_record(ring, NAOS_TRACE_REC_FREE, (uint8_t *)&addr, 4);
+
+  // exit ring
+  naos_trace_exit(ring, state);
+}
+
+#endif
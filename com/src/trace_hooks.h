@@ -13,10 +13,14 @@
 #ifndef __ASSEMBLER__
 
 extern void naos_trace_task_switched_in(void *task);
+extern void naos_trace_task_ready(void *task);
 
 #undef traceTASK_SWITCHED_IN
 #define traceTASK_SWITCHED_IN() naos_trace_task_switched_in((void *)pxCurrentTCBs[xPortGetCoreID()])
 
+#undef traceMOVED_TASK_TO_READY_STATE
+#define traceMOVED_TASK_TO_READY_STATE(pxTCB) naos_trace_task_ready((void *)(pxTCB))
+
 #endif /* __ASSEMBLER__ */
 
 #endif /* NAOS_TRACE_HOOKS_H */
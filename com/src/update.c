@@ -3,39 +3,960 @@
 #include <naos/sys.h>
 #include <naos/msg.h>
 
+#include <esp_flash_encrypt.h>
+#include <esp_image_format.h>
 #include <esp_log.h>
 #include <esp_ota_ops.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/sha256.h>
+#include <nvs.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
+#include "com.h"
+#include "system.h"
 #include "utils.h"
 
 #define NAOS_UPDATE_ENDPOINT 0x2
+#define NAOS_UPDATE_HS_WINDOW 11
+#define NAOS_UPDATE_HS_LOOKAHEAD 4
+#define NAOS_UPDATE_HS_SIZE (1 << NAOS_UPDATE_HS_WINDOW)
+#define NAOS_UPDATE_BUFFERS CONFIG_NAOS_UPDATE_BUFFERS
+#define NAOS_UPDATE_BUFFER_SIZE CONFIG_NAOS_UPDATE_BUFFER_SIZE
+#define NAOS_UPDATE_CHECKPOINT CONFIG_NAOS_UPDATE_CHECKPOINT
+#define NAOS_UPDATE_SECTOR_SIZE 4096
+#define NAOS_UPDATE_SYNC 0xFF
+#define NAOS_UPDATE_SIGNAL_SYNC 1
+#define NAOS_UPDATE_NVS_KEY "progress"
+#define NAOS_UPDATE_TOPIC_SIZE 64
+#define NAOS_UPDATE_MAX_RANGES 64
 
 typedef enum {
   NAOS_UPDATE_BEGIN,
   NAOS_UPDATE_WRITE,
   NAOS_UPDATE_ABORT,
   NAOS_UPDATE_FINISH,
+  NAOS_UPDATE_RESUME,
+  NAOS_UPDATE_STATUS,
+  NAOS_UPDATE_MULTICAST,
+  NAOS_UPDATE_MISSING,
+  NAOS_UPDATE_REPAIR,
 } naos_update_cmd_t;
 
+typedef struct {
+  uint8_t window[NAOS_UPDATE_HS_SIZE];
+  uint16_t pos;
+  size_t total;
+  uint32_t bits;
+  uint8_t count;
+} naos_update_hs_t;
+
+typedef struct {
+  uint8_t head[12];
+  uint8_t head_len;
+  uint32_t diff;
+  uint32_t extra;
+  int32_t adjust;
+  int64_t source;
+  bool escape;
+  uint16_t zeros;
+  uint8_t buf[256];
+} naos_update_patch_t;
+
+typedef struct {
+  uint32_t address;
+  uint32_t size;
+  uint8_t encoding;
+  uint8_t hash[32];
+  uint32_t received;
+  uint32_t written;
+  uint32_t crc;
+} naos_update_progress_t;
+
 static naos_mutex_t naos_update_mutex;
 static const esp_partition_t *naos_update_partition = NULL;
 static size_t naos_update_size = 0;
 static size_t naos_update_written = 0;
+static size_t naos_update_received = 0;
 static esp_ota_handle_t naos_update_handle = 0;
 static uint16_t naos_update_session = 0;
 static bool naos_update_block = false;
+static naos_update_hs_t *naos_update_hs = NULL;
+static naos_update_patch_t *naos_update_patch = NULL;
+static const esp_partition_t *naos_update_source = NULL;
+static bool naos_update_verify = false;
+static uint8_t naos_update_hash[32] = {0};
+static mbedtls_sha256_context naos_update_sha;
+static naos_update_encoding_t naos_update_encoding = NAOS_UPDATE_RAW;
+
+// verified updates are resumable, the writer periodically persists the stream
+// offset, the bytes written, a rolling CRC of the written data and the decoder
+// state used by the encoding, after a restore data is written to the partition directly as the
+// OTA handle only supports sequential writes, the image is verified at finish
+static nvs_handle_t naos_update_nvs = 0;
+static bool naos_update_resumable = false;
+static bool naos_update_resumed = false;
+static uint32_t naos_update_crc = 0;
+static size_t naos_update_processed = 0;
+static size_t naos_update_checkpointed = 0;
+
+// multicast updates receive fixed size raw chunks in any order from a shared
+// topic, staged chunks and erased sectors are tracked in bitmaps and chunks
+// are written to the partition at their offset, the image is hashed and
+// verified from flash when finished
+static uint8_t *naos_update_chunks = NULL;
+static uint8_t *naos_update_sectors = NULL;
+static size_t naos_update_chunk = 0;
+static char naos_update_topic[NAOS_UPDATE_TOPIC_SIZE] = {0};
+static char naos_update_stale[NAOS_UPDATE_TOPIC_SIZE] = {0};
+
+// received chunks are staged into a ring of buffers that is drained by the
+// writer task, the stream state above is owned by the writer while buffers
+// are queued and must only be accessed after a sync
+static uint8_t *naos_update_buffers = NULL;
+static size_t naos_update_lengths[NAOS_UPDATE_BUFFERS] = {0};
+static size_t naos_update_offsets[NAOS_UPDATE_BUFFERS] = {0};
+static int naos_update_current = -1;
+static naos_queue_t naos_update_free = NULL;
+static naos_queue_t naos_update_full = NULL;
+static naos_signal_t naos_update_signal = NULL;
+static volatile bool naos_update_failed = false;
+
+static void naos_update_unsubscribe() {
+  // get stale topic
+  char topic[NAOS_UPDATE_TOPIC_SIZE];
+  naos_lock(naos_update_mutex);
+  strcpy(topic, naos_update_stale);
+  naos_update_stale[0] = 0;
+  naos_unlock(naos_update_mutex);
+
+  // unsubscribe topic
+  if (topic[0] != 0) {
+    naos_unsubscribe(topic, NAOS_GLOBAL);
+  }
+}
 
 static void naos_update_reset(bool clear_session) {
   naos_update_partition = NULL;
   naos_update_size = 0;
   naos_update_written = 0;
+  naos_update_received = 0;
   naos_update_handle = 0;
+  if (naos_update_hs != NULL) {
+    free(naos_update_hs);
+    naos_update_hs = NULL;
+  }
+  if (naos_update_patch != NULL) {
+    free(naos_update_patch);
+    naos_update_patch = NULL;
+  }
+  naos_update_source = NULL;
+  if (naos_update_buffers != NULL) {
+    free(naos_update_buffers);
+    naos_update_buffers = NULL;
+  }
+  naos_update_failed = false;
+  naos_update_encoding = NAOS_UPDATE_RAW;
+  naos_update_resumable = false;
+  naos_update_resumed = false;
+  naos_update_crc = 0;
+  naos_update_processed = 0;
+  naos_update_checkpointed = 0;
+  if (naos_update_chunks != NULL) {
+    free(naos_update_chunks);
+    naos_update_chunks = NULL;
+  }
+  if (naos_update_sectors != NULL) {
+    free(naos_update_sectors);
+    naos_update_sectors = NULL;
+  }
+  naos_update_chunk = 0;
+  if (naos_update_topic[0] != 0) {
+    // unsubscribe later as the transport may be dispatching to us
+    strcpy(naos_update_stale, naos_update_topic);
+    naos_update_topic[0] = 0;
+    naos_defer("naos-update", 0, naos_update_unsubscribe);
+  }
+  if (naos_update_verify) {
+    mbedtls_sha256_free(&naos_update_sha);
+    naos_update_verify = false;
+  }
   if (clear_session) {
     naos_update_session = 0;
   }
 }
 
+static bool naos_update_flash(const uint8_t *data, size_t len) {
+  // check length against declared update size
+  if (len > naos_update_size - naos_update_written) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_flash: write exceeds declared update size");
+    return false;
+  }
+
+  // erase sectors ahead of resumed writes
+  if (naos_update_resumed) {
+    size_t start = (naos_update_written + NAOS_UPDATE_SECTOR_SIZE - 1) / NAOS_UPDATE_SECTOR_SIZE * NAOS_UPDATE_SECTOR_SIZE;
+    size_t end = naos_update_written + len;
+    if (start < end) {
+      size_t erase = (end - start + NAOS_UPDATE_SECTOR_SIZE - 1) / NAOS_UPDATE_SECTOR_SIZE * NAOS_UPDATE_SECTOR_SIZE;
+      esp_err_t err = esp_partition_erase_range(naos_update_partition, start, erase);
+      if (err != ESP_OK) {
+        ESP_LOGE(NAOS_LOG_TAG, "naos_update_flash: esp_partition_erase_range failed: %s", esp_err_to_name(err));
+        return false;
+      }
+    }
+  }
+
+  // write data
+  esp_err_t err;
+  if (naos_update_resumed) {
+    err = esp_partition_write(naos_update_partition, naos_update_written, data, len);
+    if (err != ESP_OK) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_flash: esp_partition_write failed: %s", esp_err_to_name(err));
+      return false;
+    }
+  } else {
+    err = esp_ota_write(naos_update_handle, data, len);
+  }
+  if (err == ESP_ERR_OTA_VALIDATE_FAILED || err == ESP_ERR_INVALID_SIZE) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_flash: %s", esp_err_to_name(err));
+    return false;
+  }
+  ESP_ERROR_CHECK(err);
+
+  // update hash and checksum
+  if (naos_update_verify) {
+    ESP_ERROR_CHECK(mbedtls_sha256_update(&naos_update_sha, data, len));
+  }
+  naos_update_crc = esp_rom_crc32_le(naos_update_crc, data, len);
+
+  // track bytes written
+  naos_update_written += len;
+
+  return true;
+}
+
+static bool naos_update_place(size_t offset, const uint8_t *data, size_t len) {
+  // erase sectors on first use
+  for (size_t i = offset / NAOS_UPDATE_SECTOR_SIZE; i <= (offset + len - 1) / NAOS_UPDATE_SECTOR_SIZE; i++) {
+    if (naos_update_sectors[i / 8] & (1 << (i % 8))) {
+      continue;
+    }
+    esp_err_t err =
+        esp_partition_erase_range(naos_update_partition, i * NAOS_UPDATE_SECTOR_SIZE, NAOS_UPDATE_SECTOR_SIZE);
+    if (err != ESP_OK) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_place: esp_partition_erase_range failed: %s", esp_err_to_name(err));
+      return false;
+    }
+    naos_update_sectors[i / 8] |= 1 << (i % 8);
+  }
+
+  // write data
+  esp_err_t err = esp_partition_write(naos_update_partition, offset, data, len);
+  if (err != ESP_OK) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_place: esp_partition_write failed: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  // track bytes written
+  naos_update_written += len;
+
+  return true;
+}
+
+static bool naos_update_apply(const uint8_t *data, size_t len) {
+  // the patch is a sequence of bsdiff style records where diff bytes are added
+  // to the source partition and extra bytes are copied as is, zero diff bytes
+  // are followed by a count and expand to count + 1 zero bytes:
+  // DIFF (4) | EXTRA (4) | ADJUST (4) | DIFF BYTES (*) | EXTRA BYTES (*)
+
+  // get patch
+  naos_update_patch_t *p = naos_update_patch;
+
+  while (len > 0 || (p->head_len == 12 && p->diff > 0 && p->zeros > 0)) {
+    if (p->head_len < 12) {
+      // read header
+      size_t n = MIN(12 - p->head_len, len);
+      memcpy(p->head + p->head_len, data, n);
+      p->head_len += n;
+      data += n;
+      len -= n;
+      if (p->head_len < 12) {
+        break;
+      }
+
+      // parse header
+      memcpy(&p->diff, p->head, 4);
+      memcpy(&p->extra, p->head + 4, 4);
+      memcpy(&p->adjust, p->head + 8, 4);
+
+      // check source range
+      if (p->source < 0 || p->source + p->diff > naos_update_source->size) {
+        ESP_LOGE(NAOS_LOG_TAG, "naos_update_apply: invalid source range");
+        return false;
+      }
+    } else if (p->diff > 0) {
+      // decode diff bytes
+      size_t max = MIN(p->diff, sizeof(p->buf));
+      size_t n = 0;
+      while (n < max && (len > 0 || p->zeros > 0)) {
+        // expand zeros
+        if (p->zeros > 0) {
+          size_t num = MIN(p->zeros, max - n);
+          memset(p->buf + n, 0, num);
+          p->zeros -= num;
+          n += num;
+          continue;
+        }
+
+        // get byte
+        uint8_t b = *data;
+        data++;
+        len--;
+
+        // handle zero run count
+        if (p->escape) {
+          p->escape = false;
+          p->zeros = b + 1;
+          if (p->zeros > p->diff - n) {
+            ESP_LOGE(NAOS_LOG_TAG, "naos_update_apply: invalid zero run");
+            return false;
+          }
+          continue;
+        }
+
+        // handle zero run or diff byte
+        if (b == 0) {
+          p->escape = true;
+        } else {
+          p->buf[n++] = b;
+        }
+      }
+      if (n == 0) {
+        continue;
+      }
+
+      // read source
+      uint8_t source[64];
+      for (size_t i = 0; i < n; i += sizeof(source)) {
+        size_t num = MIN(n - i, sizeof(source));
+        esp_err_t err = esp_partition_read(naos_update_source, p->source + i, source, num);
+        if (err != ESP_OK) {
+          ESP_LOGE(NAOS_LOG_TAG, "naos_update_apply: esp_partition_read failed: %s", esp_err_to_name(err));
+          return false;
+        }
+        for (size_t j = 0; j < num; j++) {
+          p->buf[i + j] += source[j];
+        }
+      }
+
+      // write data
+      if (!naos_update_flash(p->buf, n)) {
+        return false;
+      }
+
+      // advance
+      p->source += n;
+      p->diff -= n;
+    } else if (p->extra > 0) {
+      // write extra bytes
+      size_t n = MIN(p->extra, len);
+      if (!naos_update_flash(data, n)) {
+        return false;
+      }
+
+      // advance
+      p->extra -= n;
+      data += n;
+      len -= n;
+    }
+
+    // complete record
+    if (p->head_len == 12 && p->diff == 0 && p->extra == 0) {
+      p->source += p->adjust;
+      p->head_len = 0;
+    }
+  }
+
+  return true;
+}
+
+static bool naos_update_output(const uint8_t *data, size_t len) {
+  // apply patch or write data
+  if (naos_update_patch != NULL) {
+    return naos_update_apply(data, len);
+  } else {
+    return naos_update_flash(data, len);
+  }
+}
+
+static bool naos_update_emit(uint8_t byte) {
+  // add byte to window
+  naos_update_hs_t *hs = naos_update_hs;
+  hs->window[hs->pos++] = byte;
+  hs->total++;
+
+  // flash window when full
+  if (hs->pos == NAOS_UPDATE_HS_SIZE) {
+    hs->pos = 0;
+    return naos_update_output(hs->window, NAOS_UPDATE_HS_SIZE);
+  }
+
+  return true;
+}
+
+static bool naos_update_inflate(const uint8_t *data, size_t len) {
+  // the stream is a heatshrink (LZSS) bit stream where a set tag bit is
+  // followed by a literal byte and a cleared tag bit by a back reference:
+  // TAG (1) | LITERAL (8) or TAG (1) | DISTANCE - 1 (W) | LENGTH - 1 (L)
+
+  // get decoder
+  naos_update_hs_t *hs = naos_update_hs;
+
+  for (size_t i = 0; i < len; i++) {
+    // append byte
+    hs->bits = (hs->bits << 8) | data[i];
+    hs->count += 8;
+
+    // decode complete tokens
+    while (hs->count > 0) {
+      // determine token size
+      bool literal = (hs->bits >> (hs->count - 1)) & 1;
+      uint8_t need = literal ? 9 : 1 + NAOS_UPDATE_HS_WINDOW + NAOS_UPDATE_HS_LOOKAHEAD;
+      if (hs->count < need) {
+        break;
+      }
+
+      // take token
+      hs->count -= need;
+      uint32_t token = (hs->bits >> hs->count) & ((1 << (need - 1)) - 1);
+
+      // handle literal
+      if (literal) {
+        if (!naos_update_emit(token)) {
+          return false;
+        }
+        continue;
+      }
+
+      // get reference
+      size_t distance = (token >> NAOS_UPDATE_HS_LOOKAHEAD) + 1;
+      size_t length = (token & ((1 << NAOS_UPDATE_HS_LOOKAHEAD) - 1)) + 1;
+      if (distance > hs->total) {
+        ESP_LOGE(NAOS_LOG_TAG, "naos_update_inflate: invalid reference");
+        return false;
+      }
+
+      // copy referenced bytes
+      for (size_t j = 0; j < length; j++) {
+        if (!naos_update_emit(hs->window[(hs->pos - distance) & (NAOS_UPDATE_HS_SIZE - 1)])) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static size_t naos_update_length(uint8_t encoding) {
+  // progress is followed by the decoder state used by the encoding:
+  // PROGRESS | HS (if heatshrink) | PATCH (if delta)
+  size_t length = sizeof(naos_update_progress_t);
+  if (encoding & NAOS_UPDATE_HEATSHRINK) {
+    length += sizeof(naos_update_hs_t);
+  }
+  if (encoding & NAOS_UPDATE_DELTA) {
+    length += sizeof(naos_update_patch_t);
+  }
+
+  return length;
+}
+
+static void naos_update_checkpoint() {
+  // allocate blob
+  size_t length = naos_update_length(naos_update_encoding);
+  uint8_t *blob = calloc(1, length);
+  if (blob == NULL) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_checkpoint: failed to allocate progress");
+    return;
+  }
+
+  // capture progress
+  naos_update_progress_t *progress = (naos_update_progress_t *)blob;
+  progress->address = naos_update_partition->address;
+  progress->size = naos_update_size;
+  progress->encoding = naos_update_encoding;
+  memcpy(progress->hash, naos_update_hash, 32);
+  progress->received = naos_update_processed;
+  progress->written = naos_update_written;
+  progress->crc = naos_update_crc;
+
+  // capture decoder state
+  uint8_t *pos = blob + sizeof(naos_update_progress_t);
+  if (naos_update_encoding & NAOS_UPDATE_HEATSHRINK) {
+    memcpy(pos, naos_update_hs, sizeof(naos_update_hs_t));
+    pos += sizeof(naos_update_hs_t);
+  }
+  if (naos_update_encoding & NAOS_UPDATE_DELTA) {
+    memcpy(pos, naos_update_patch, sizeof(naos_update_patch_t));
+  }
+
+  // persist progress
+  esp_err_t err = nvs_set_blob(naos_update_nvs, NAOS_UPDATE_NVS_KEY, blob, length);
+  if (err == ESP_OK) {
+    err = nvs_commit(naos_update_nvs);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_checkpoint: failed to persist progress: %s", esp_err_to_name(err));
+  }
+
+  // free blob
+  free(blob);
+
+  // set checkpoint
+  naos_update_checkpointed = naos_update_processed;
+}
+
+static uint8_t *naos_update_load() {
+  // get length
+  size_t length = 0;
+  if (nvs_get_blob(naos_update_nvs, NAOS_UPDATE_NVS_KEY, NULL, &length) != ESP_OK ||
+      length < sizeof(naos_update_progress_t)) {
+    return NULL;
+  }
+
+  // read blob
+  uint8_t *blob = malloc(length);
+  if (blob == NULL) {
+    return NULL;
+  }
+  esp_err_t err = nvs_get_blob(naos_update_nvs, NAOS_UPDATE_NVS_KEY, blob, &length);
+
+  // check length against encoding
+  if (err != ESP_OK || length != naos_update_length(((naos_update_progress_t *)blob)->encoding)) {
+    free(blob);
+    return NULL;
+  }
+
+  return blob;
+}
+
+static void naos_update_forget() {
+  // remove persisted progress
+  esp_err_t err = nvs_erase_key(naos_update_nvs, NAOS_UPDATE_NVS_KEY);
+  if (err == ESP_OK) {
+    err = nvs_commit(naos_update_nvs);
+  }
+  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_forget: failed to remove progress: %s", esp_err_to_name(err));
+  }
+}
+
+static void naos_update_writer() {
+  for (;;) {
+    // await buffer
+    uint8_t index;
+    naos_pop(naos_update_full, &index, -1);
+
+    // handle sync
+    if (index == NAOS_UPDATE_SYNC) {
+      naos_trigger(naos_update_signal, NAOS_UPDATE_SIGNAL_SYNC, false);
+      continue;
+    }
+
+    // place multicast chunk, or decode and write buffer unless failed
+    uint8_t *buf = naos_update_buffers + index * NAOS_UPDATE_BUFFER_SIZE;
+    size_t len = naos_update_lengths[index];
+    if (!naos_update_failed && naos_update_chunks != NULL) {
+      if (!naos_update_place(naos_update_offsets[index], buf, len)) {
+        naos_update_failed = true;
+      }
+    } else if (!naos_update_failed) {
+      if (naos_update_hs != NULL ? !naos_update_inflate(buf, len) : !naos_update_output(buf, len)) {
+        naos_update_failed = true;
+      }
+      naos_update_processed += len;
+
+      // persist progress periodically
+      if (!naos_update_failed && naos_update_resumable && naos_update_written > 0 &&
+          naos_update_processed - naos_update_checkpointed >= NAOS_UPDATE_CHECKPOINT) {
+        naos_update_checkpoint();
+      }
+    }
+
+    // release buffer
+    naos_push(naos_update_free, &index, -1);
+  }
+}
+
+static void naos_update_stage(const uint8_t *data, size_t len) {
+  while (len > 0) {
+    // acquire buffer, blocks until the writer releases one
+    if (naos_update_current < 0) {
+      uint8_t index;
+      naos_pop(naos_update_free, &index, -1);
+      naos_update_lengths[index] = 0;
+      naos_update_current = index;
+    }
+
+    // copy data
+    size_t *buf_len = &naos_update_lengths[naos_update_current];
+    size_t n = MIN(NAOS_UPDATE_BUFFER_SIZE - *buf_len, len);
+    memcpy(naos_update_buffers + naos_update_current * NAOS_UPDATE_BUFFER_SIZE + *buf_len, data, n);
+    *buf_len += n;
+    data += n;
+    len -= n;
+
+    // queue full buffer
+    if (*buf_len == NAOS_UPDATE_BUFFER_SIZE) {
+      uint8_t index = naos_update_current;
+      naos_push(naos_update_full, &index, -1);
+      naos_update_current = -1;
+    }
+  }
+}
+
+static bool naos_update_scatter(uint32_t index, const uint8_t *data, size_t len) {
+  // check index and length
+  size_t offset = index * naos_update_chunk;
+  if (offset >= naos_update_size || len != MIN(naos_update_chunk, naos_update_size - offset)) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_scatter: invalid chunk %u", (unsigned int)index);
+    return false;
+  }
+
+  // skip staged chunks
+  if (naos_update_chunks[index / 8] & (1 << (index % 8))) {
+    return true;
+  }
+
+  // acquire buffer, blocks until the writer releases one
+  uint8_t buf;
+  naos_pop(naos_update_free, &buf, -1);
+
+  // copy and queue chunk
+  memcpy(naos_update_buffers + buf * NAOS_UPDATE_BUFFER_SIZE, data, len);
+  naos_update_lengths[buf] = len;
+  naos_update_offsets[buf] = offset;
+  naos_push(naos_update_full, &buf, -1);
+
+  // mark chunk
+  naos_update_chunks[index / 8] |= 1 << (index % 8);
+  naos_update_received += len;
+
+  return true;
+}
+
+static void naos_update_sync() {
+  // queue or release current buffer
+  if (naos_update_current >= 0) {
+    uint8_t index = naos_update_current;
+    if (naos_update_lengths[index] > 0) {
+      naos_push(naos_update_full, &index, -1);
+    } else {
+      naos_push(naos_update_free, &index, -1);
+    }
+    naos_update_current = -1;
+  }
+
+  // queue sync and await writer
+  uint8_t sync = NAOS_UPDATE_SYNC;
+  naos_push(naos_update_full, &sync, -1);
+  naos_await(naos_update_signal, NAOS_UPDATE_SIGNAL_SYNC, true, -1);
+}
+
+static void naos_update_discard() {
+  // skip queued buffers and await writer
+  naos_update_failed = true;
+  naos_update_sync();
+
+  // abort update unless the handle was already released
+  if (naos_update_handle != 0) {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
+  }
+  naos_update_reset(true);
+
+  // remove progress
+  naos_update_forget();
+}
+
+static bool naos_update_receive(uint32_t index, const uint8_t *data, size_t len) {
+  // acquire mutex
+  naos_lock(naos_update_mutex);
+
+  // check multicast
+  if (naos_update_chunks == NULL) {
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
+  // check for a failure of previously staged chunks
+  if (naos_update_failed) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_receive: aborting update...");
+    naos_update_discard();
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
+  // stage chunk
+  bool ok = naos_update_scatter(index, data, len);
+
+  // release mutex
+  naos_unlock(naos_update_mutex);
+
+  return ok;
+}
+
+static bool naos_update_digest(uint8_t *hash) {
+  // hash written image in buffer sized pieces
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  ESP_ERROR_CHECK(mbedtls_sha256_starts(&sha, false));
+  for (size_t pos = 0; pos < naos_update_size; pos += NAOS_UPDATE_BUFFER_SIZE) {
+    size_t len = MIN(NAOS_UPDATE_BUFFER_SIZE, naos_update_size - pos);
+    esp_err_t err = esp_partition_read(naos_update_partition, pos, naos_update_buffers, len);
+    if (err != ESP_OK) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_digest: esp_partition_read failed: %s", esp_err_to_name(err));
+      mbedtls_sha256_free(&sha);
+      return false;
+    }
+    ESP_ERROR_CHECK(mbedtls_sha256_update(&sha, naos_update_buffers, len));
+  }
+  ESP_ERROR_CHECK(mbedtls_sha256_finish(&sha, hash));
+  mbedtls_sha256_free(&sha);
+
+  return true;
+}
+
+static bool naos_update_multicast(size_t size, size_t chunk, const uint8_t *hash, const char *topic) {
+  // begin raw update, the hash is verified from flash
+  if (!naos_update_begin_encoded(size, NAOS_UPDATE_RAW, NULL)) {
+    return false;
+  }
+
+  // acquire mutex
+  naos_lock(naos_update_mutex);
+
+  // allocate bitmaps
+  size_t chunks = (size + chunk - 1) / chunk;
+  size_t sectors = (size + NAOS_UPDATE_SECTOR_SIZE - 1) / NAOS_UPDATE_SECTOR_SIZE;
+  naos_update_chunks = calloc((chunks + 7) / 8, 1);
+  naos_update_sectors = calloc((sectors + 7) / 8, 1);
+  if (naos_update_chunks == NULL || naos_update_sectors == NULL) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_multicast: failed to allocate bitmaps");
+    naos_update_discard();
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
+  // store chunk size, hash and topic
+  naos_update_chunk = chunk;
+  memcpy(naos_update_hash, hash, 32);
+  strcpy(naos_update_topic, topic);
+
+  // release mutex
+  naos_unlock(naos_update_mutex);
+
+  return true;
+}
+
+static void naos_update_handler(naos_scope_t scope, const char *topic, const uint8_t *payload, size_t len, int qos,
+                                bool retained) {
+  // check scope and length
+  if (scope != NAOS_GLOBAL || len <= 4) {
+    return;
+  }
+
+  // check topic
+  naos_lock(naos_update_mutex);
+  bool match = naos_update_topic[0] != 0 && strcmp(topic, naos_update_topic) == 0;
+  naos_unlock(naos_update_mutex);
+  if (!match) {
+    return;
+  }
+
+  // message structure:
+  // INDEX (4) | DATA (*)
+
+  // get index
+  uint32_t index = 0;
+  memcpy(&index, payload, 4);
+
+  // receive chunk
+  naos_update_receive(index, payload + 4, len - 4);
+}
+
+static void naos_update_status(naos_status_t status) {
+  // check status
+  if (status != NAOS_NETWORKED) {
+    return;
+  }
+
+  // get topic
+  char topic[NAOS_UPDATE_TOPIC_SIZE];
+  naos_lock(naos_update_mutex);
+  strcpy(topic, naos_update_topic);
+  naos_unlock(naos_update_mutex);
+
+  // resubscribe topic
+  if (topic[0] != 0) {
+    naos_subscribe(topic, 0, NAOS_GLOBAL);
+  }
+}
+
+static bool naos_update_restore(size_t size, naos_update_encoding_t encoding, const uint8_t *hash) {
+  // load progress
+  uint8_t *blob = naos_update_load();
+  if (blob == NULL) {
+    return false;
+  }
+  naos_update_progress_t *progress = (naos_update_progress_t *)blob;
+
+  // check update and partition
+  naos_update_partition = esp_ota_get_next_update_partition(NULL);
+  if (progress->size != size || progress->encoding != encoding || memcmp(progress->hash, hash, 32) != 0 ||
+      naos_update_partition == NULL || progress->address != naos_update_partition->address ||
+      progress->written == 0 || progress->written > size) {
+    naos_update_partition = NULL;
+    free(blob);
+    return false;
+  }
+
+  // log message
+  ESP_LOGI(NAOS_LOG_TAG, "naos_update_restore: restoring update at %u...", (unsigned int)progress->received);
+
+  // allocate state
+  naos_update_buffers = malloc(NAOS_UPDATE_BUFFERS * NAOS_UPDATE_BUFFER_SIZE);
+  uint8_t *buf = malloc(NAOS_UPDATE_SECTOR_SIZE);
+  if (encoding & NAOS_UPDATE_HEATSHRINK) {
+    naos_update_hs = malloc(sizeof(naos_update_hs_t));
+  }
+  if (encoding & NAOS_UPDATE_DELTA) {
+    naos_update_source = esp_ota_get_running_partition();
+    naos_update_patch = malloc(sizeof(naos_update_patch_t));
+  }
+  if (naos_update_buffers == NULL || buf == NULL || ((encoding & NAOS_UPDATE_HEATSHRINK) && naos_update_hs == NULL) ||
+      ((encoding & NAOS_UPDATE_DELTA) && naos_update_patch == NULL)) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_restore: failed to allocate state");
+    naos_update_reset(false);
+    free(buf);
+    free(blob);
+    return false;
+  }
+
+  // restore decoder state
+  uint8_t *pos = blob + sizeof(naos_update_progress_t);
+  if (naos_update_hs != NULL) {
+    memcpy(naos_update_hs, pos, sizeof(naos_update_hs_t));
+    pos += sizeof(naos_update_hs_t);
+  }
+  if (naos_update_patch != NULL) {
+    memcpy(naos_update_patch, pos, sizeof(naos_update_patch_t));
+  }
+
+  // rehash written data and verify checksum
+  memcpy(naos_update_hash, hash, 32);
+  mbedtls_sha256_init(&naos_update_sha);
+  ESP_ERROR_CHECK(mbedtls_sha256_starts(&naos_update_sha, false));
+  naos_update_verify = true;
+  uint32_t crc = 0;
+  esp_err_t err = ESP_OK;
+  for (size_t off = 0; off < progress->written; off += NAOS_UPDATE_SECTOR_SIZE) {
+    size_t num = MIN(progress->written - off, NAOS_UPDATE_SECTOR_SIZE);
+    err = esp_partition_read(naos_update_partition, off, buf, num);
+    if (err != ESP_OK) {
+      break;
+    }
+    ESP_ERROR_CHECK(mbedtls_sha256_update(&naos_update_sha, buf, num));
+    crc = esp_rom_crc32_le(crc, buf, num);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_restore: esp_partition_read failed: %s", esp_err_to_name(err));
+    naos_update_reset(false);
+    free(buf);
+    free(blob);
+    return false;
+  }
+  if (crc != progress->crc) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_restore: checksum mismatch");
+    naos_update_reset(false);
+    free(buf);
+    free(blob);
+    return false;
+  }
+
+  // begin update (without flash erase), the handle only marks the update as
+  // active and checks the rollback state
+  err = esp_ota_begin(naos_update_partition, OTA_WITH_SEQUENTIAL_WRITES, &naos_update_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_restore: %s", esp_err_to_name(err));
+    naos_update_handle = 0;
+    naos_update_reset(false);
+    free(buf);
+    free(blob);
+    return false;
+  }
+
+  // rewrite the last written sector to clear data written after the
+  // checkpoint, still in "buf"
+  size_t start = (progress->written - 1) / NAOS_UPDATE_SECTOR_SIZE * NAOS_UPDATE_SECTOR_SIZE;
+  err = esp_partition_erase_range(naos_update_partition, start, NAOS_UPDATE_SECTOR_SIZE);
+  if (err == ESP_OK) {
+    err = esp_partition_write(naos_update_partition, start, buf, progress->written - start);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_restore: failed to rewrite sector: %s", esp_err_to_name(err));
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
+    naos_update_reset(false);
+    free(buf);
+    free(blob);
+    return false;
+  }
+
+  // restore state
+  naos_update_size = size;
+  naos_update_encoding = encoding;
+  naos_update_written = progress->written;
+  naos_update_received = progress->received;
+  naos_update_processed = progress->received;
+  naos_update_checkpointed = progress->received;
+  naos_update_crc = progress->crc;
+  naos_update_resumable = true;
+  naos_update_resumed = true;
+
+  // free temporaries
+  free(buf);
+  free(blob);
+
+  // log message
+  ESP_LOGI(NAOS_LOG_TAG, "naos_update_restore: update restored!");
+
+  return true;
+}
+
+static esp_err_t naos_update_end() {
+  // end sequentially written update
+  if (!naos_update_resumed && naos_update_chunks == NULL) {
+    return esp_ota_end(naos_update_handle);
+  }
+
+  // release handle of directly written update
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
+
+  // verify image
+  esp_partition_pos_t pos = {
+      .offset = naos_update_partition->address,
+      .size = naos_update_partition->size,
+  };
+  esp_image_metadata_t data;
+  if (esp_image_verify(ESP_IMAGE_VERIFY, &pos, &data) != ESP_OK) {
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+
+  return ESP_OK;
+}
+
 static naos_msg_reply_t naos_update_process(naos_msg_t msg) {
   // check length
   if (msg.len == 0) {
@@ -53,10 +974,10 @@ static naos_msg_reply_t naos_update_process(naos_msg_t msg) {
   switch (cmd) {
     case NAOS_UPDATE_BEGIN: {
       // command structure:
-      // SIZE (4)
+      // SIZE (4) | ENCODING (1)? | SHA256 (32)?
 
       // check length
-      if (msg.len != 4) {
+      if (msg.len != 4 && msg.len != 37) {
         return NAOS_MSG_INVALID;
       }
 
@@ -64,8 +985,21 @@ static naos_msg_reply_t naos_update_process(naos_msg_t msg) {
       uint32_t size = 0;
       memcpy(&size, msg.data, 4);
 
+      // get encoding and hash
+      naos_update_encoding_t encoding = NAOS_UPDATE_RAW;
+      const uint8_t *hash = NULL;
+      if (msg.len == 37) {
+        encoding = (naos_update_encoding_t)msg.data[4];
+        hash = msg.data + 5;
+      }
+
+      // check encoding
+      if ((encoding & ~(NAOS_UPDATE_HEATSHRINK | NAOS_UPDATE_DELTA)) != 0) {
+        return NAOS_MSG_INVALID;
+      }
+
       // begin update
-      if (!naos_update_begin(size)) {
+      if (!naos_update_begin_encoded(size, encoding, hash)) {
         return NAOS_MSG_ERROR;
       }
 
@@ -75,6 +1009,219 @@ static naos_msg_reply_t naos_update_process(naos_msg_t msg) {
       return NAOS_MSG_ACK;
     }
 
+    case NAOS_UPDATE_RESUME: {
+      // command structure:
+      // SIZE (4) | ENCODING (1) | SHA256 (32)
+
+      // check length
+      if (msg.len != 37) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // get size and encoding
+      uint32_t size = 0;
+      memcpy(&size, msg.data, 4);
+      naos_update_encoding_t encoding = (naos_update_encoding_t)msg.data[4];
+
+      // check encoding
+      if ((encoding & ~(NAOS_UPDATE_HEATSHRINK | NAOS_UPDATE_DELTA)) != 0) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // resume or begin update
+      uint32_t offset = 0;
+      if (!naos_update_resume(size, encoding, msg.data + 5, &offset)) {
+        return NAOS_MSG_ERROR;
+      }
+
+      // set session
+      naos_update_session = msg.session;
+
+      // reply structure:
+      // OFFSET (4)
+
+      // send reply
+      naos_msg_send((naos_msg_t){
+          .session = msg.session,
+          .endpoint = NAOS_UPDATE_ENDPOINT,
+          .data = (uint8_t *)&offset,
+          .len = 4,
+      });
+
+      return NAOS_MSG_OK;
+    }
+
+    case NAOS_UPDATE_STATUS: {
+      // check length
+      if (msg.len != 0) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // reply structure:
+      // SIZE (4) | ENCODING (1) | SHA256 (32) | OFFSET (4) | WRITTEN (4)
+
+      // get status of the active or persisted update
+      uint8_t reply[45] = {0};
+      size_t len = 0;
+      naos_lock(naos_update_mutex);
+      if (naos_update_handle != 0 && naos_update_resumable) {
+        uint32_t size = naos_update_size;
+        uint32_t received = naos_update_received;
+        uint32_t written = naos_update_written;
+        memcpy(reply, &size, 4);
+        reply[4] = naos_update_encoding;
+        memcpy(reply + 5, naos_update_hash, 32);
+        memcpy(reply + 37, &received, 4);
+        memcpy(reply + 41, &written, 4);
+        len = 45;
+      } else if (naos_update_handle == 0) {
+        naos_update_progress_t *progress = (naos_update_progress_t *)naos_update_load();
+        if (progress != NULL) {
+          memcpy(reply, &progress->size, 4);
+          reply[4] = progress->encoding;
+          memcpy(reply + 5, progress->hash, 32);
+          memcpy(reply + 37, &progress->received, 4);
+          memcpy(reply + 41, &progress->written, 4);
+          len = 45;
+        }
+        free(progress);
+      }
+      naos_unlock(naos_update_mutex);
+
+      // send reply
+      naos_msg_send((naos_msg_t){
+          .session = msg.session,
+          .endpoint = NAOS_UPDATE_ENDPOINT,
+          .data = reply,
+          .len = len,
+      });
+
+      return NAOS_MSG_OK;
+    }
+
+    case NAOS_UPDATE_MULTICAST: {
+      // command structure:
+      // SIZE (4) | CHUNK (2) | SHA256 (32) | TOPIC (*)
+
+      // check length
+      if (msg.len <= 38 || msg.len - 38 >= NAOS_UPDATE_TOPIC_SIZE) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // get size and chunk
+      uint32_t size = 0;
+      uint16_t chunk = 0;
+      memcpy(&size, msg.data, 4);
+      memcpy(&chunk, msg.data + 4, 2);
+
+      // chunks must be a power of two to align with sectors and encrypted
+      // flash blocks, and fit into a buffer
+      if (chunk < 16 || (chunk & (chunk - 1)) != 0 || chunk > NAOS_UPDATE_BUFFER_SIZE) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // get topic
+      char topic[NAOS_UPDATE_TOPIC_SIZE] = {0};
+      memcpy(topic, msg.data + 38, msg.len - 38);
+
+      // begin update
+      if (!naos_update_multicast(size, chunk, msg.data + 6, topic)) {
+        return NAOS_MSG_ERROR;
+      }
+
+      // subscribe topic
+      if (!naos_subscribe(topic, 0, NAOS_GLOBAL)) {
+        naos_update_abort();
+        return NAOS_MSG_ERROR;
+      }
+
+      // set session
+      naos_update_session = msg.session;
+
+      return NAOS_MSG_ACK;
+    }
+
+    case NAOS_UPDATE_MISSING: {
+      // check length
+      if (msg.len != 0) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // acquire mutex
+      naos_lock(naos_update_mutex);
+
+      // check multicast
+      if (naos_update_chunks == NULL) {
+        naos_unlock(naos_update_mutex);
+        return NAOS_MSG_ERROR;
+      }
+
+      // claim update
+      naos_update_session = msg.session;
+
+      // reply structure:
+      // (FIRST (4) | COUNT (4))*
+
+      // collect missing chunk ranges
+      uint32_t ranges[NAOS_UPDATE_MAX_RANGES * 2];
+      size_t num = 0;
+      uint32_t count = (naos_update_size + naos_update_chunk - 1) / naos_update_chunk;
+      for (uint32_t i = 0; i < count && num < NAOS_UPDATE_MAX_RANGES; i++) {
+        if (naos_update_chunks[i / 8] & (1 << (i % 8))) {
+          continue;
+        }
+        if (num > 0 && ranges[num * 2 - 2] + ranges[num * 2 - 1] == i) {
+          ranges[num * 2 - 1]++;
+        } else {
+          ranges[num * 2] = i;
+          ranges[num * 2 + 1] = 1;
+          num++;
+        }
+      }
+
+      // release mutex
+      naos_unlock(naos_update_mutex);
+
+      // send reply
+      naos_msg_send((naos_msg_t){
+          .session = msg.session,
+          .endpoint = NAOS_UPDATE_ENDPOINT,
+          .data = (uint8_t *)ranges,
+          .len = num * 8,
+      });
+
+      return NAOS_MSG_OK;
+    }
+
+    case NAOS_UPDATE_REPAIR: {
+      // command structure:
+      // ACKED (1) | INDEX (4) | DATA (*)
+
+      // check length
+      if (msg.len <= 5) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // check session
+      if (naos_update_session != msg.session) {
+        return NAOS_MSG_INVALID;
+      }
+
+      // get acked
+      bool acked = msg.data[0] == 1;
+
+      // get index
+      uint32_t index = 0;
+      memcpy(&index, msg.data + 1, 4);
+
+      // stage chunk
+      if (!naos_update_receive(index, msg.data + 5, msg.len - 5)) {
+        return NAOS_MSG_ERROR;
+      }
+
+      return acked ? NAOS_MSG_ACK : NAOS_MSG_OK;
+    }
+
     case NAOS_UPDATE_WRITE: {
       // command structure:
       // ACKED (1) | OFFSET (4) | DATA (*)
@@ -96,7 +1243,7 @@ static naos_msg_reply_t naos_update_process(naos_msg_t msg) {
       uint32_t offset = 0;
       memcpy(&offset, msg.data + 1, 4);
 
-      // write data
+      // stage data, acks once buffered rather than written
       if (!naos_update_write(offset, msg.data + 5, msg.len - 5)) {
         return NAOS_MSG_ERROR;
       }
@@ -153,9 +1300,55 @@ static naos_msg_reply_t naos_update_process(naos_msg_t msg) {
   }
 }
 
+static void naos_update_release() {
+  // acquire mutex
+  naos_lock(naos_update_mutex);
+
+  // check handle
+  if (naos_update_handle == 0) {
+    naos_unlock(naos_update_mutex);
+    return;
+  }
+
+  // await writer
+  naos_update_sync();
+
+  // discard failed updates
+  if (naos_update_failed) {
+    naos_update_discard();
+    naos_unlock(naos_update_mutex);
+    return;
+  }
+
+  // persist latest progress
+  if (naos_update_written > 0) {
+    naos_update_checkpoint();
+  }
+
+  // release handle and state, the written data and the checkpoint are kept
+  ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
+  naos_update_reset(false);
+
+  // release mutex
+  naos_unlock(naos_update_mutex);
+}
+
 static void naos_update_cleanup(uint16_t session) {
   // check if active session is lost
   if (naos_update_session == session) {
+    // keep multicast updates
+    if (naos_update_chunks != NULL) {
+      naos_update_session = 0;
+      return;
+    }
+
+    // release resumable updates, a later resume restores the checkpoint
+    if (naos_update_resumable) {
+      naos_update_release();
+      naos_update_session = 0;
+      return;
+    }
+
     // abort update
     naos_update_abort();
 
@@ -168,6 +1361,26 @@ void naos_update_init() {
   // create mutex
   naos_update_mutex = naos_mutex();
 
+  // create queues and signal
+  naos_update_free = naos_queue(NAOS_UPDATE_BUFFERS, sizeof(uint8_t));
+  naos_update_full = naos_queue(NAOS_UPDATE_BUFFERS + 1, sizeof(uint8_t));
+  naos_update_signal = naos_signal();
+
+  // fill free queue
+  for (uint8_t i = 0; i < NAOS_UPDATE_BUFFERS; i++) {
+    naos_push(naos_update_free, &i, -1);
+  }
+
+  // open nvs namespace
+  ESP_ERROR_CHECK(nvs_open("naos-update", NVS_READWRITE, &naos_update_nvs));
+
+  // run writer
+  naos_run("naos-update", 4096, naos_config()->msg_core, naos_update_writer);
+
+  // subscribe status and multicast messages
+  naos_system_subscribe(naos_update_status);
+  naos_com_subscribe(naos_update_handler);
+
   // register endpoint
   naos_msg_install((naos_msg_endpoint_t){
       .ref = NAOS_UPDATE_ENDPOINT,
@@ -178,6 +1391,11 @@ void naos_update_init() {
 }
 
 bool naos_update_begin(size_t size) {
+  // begin raw update
+  return naos_update_begin_encoded(size, NAOS_UPDATE_RAW, NULL);
+}
+
+bool naos_update_begin_encoded(size_t size, naos_update_encoding_t encoding, const uint8_t *hash) {
   // acquire mutex
   naos_lock(naos_update_mutex);
 
@@ -191,8 +1409,7 @@ bool naos_update_begin(size_t size) {
   // abort a previous update and discard its result
   if (naos_update_handle != 0) {
     ESP_LOGE(NAOS_LOG_TAG, "naos_update_begin: aborting previous update...");
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
-    naos_update_handle = 0;
+    naos_update_discard();
   }
 
   // get update partition
@@ -223,9 +1440,66 @@ bool naos_update_begin(size_t size) {
     return false;
   }
 
-  // store size
+  // delta updates must be verified
+  if ((encoding & NAOS_UPDATE_DELTA) && hash == NULL) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_begin: delta update without hash");
+    naos_update_partition = NULL;
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
+  // allocate patch using the running partition as the source
+  if (encoding & NAOS_UPDATE_DELTA) {
+    naos_update_source = esp_ota_get_running_partition();
+    naos_update_patch = calloc(1, sizeof(naos_update_patch_t));
+    if (naos_update_patch == NULL) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_begin: failed to allocate patch");
+      naos_update_reset(false);
+      naos_unlock(naos_update_mutex);
+      return false;
+    }
+  }
+
+  // allocate decoder
+  if (encoding & NAOS_UPDATE_HEATSHRINK) {
+    naos_update_hs = calloc(1, sizeof(naos_update_hs_t));
+    if (naos_update_hs == NULL) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_begin: failed to allocate decoder");
+      naos_update_reset(false);
+      naos_unlock(naos_update_mutex);
+      return false;
+    }
+  }
+
+  // allocate buffers
+  naos_update_buffers = malloc(NAOS_UPDATE_BUFFERS * NAOS_UPDATE_BUFFER_SIZE);
+  if (naos_update_buffers == NULL) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_begin: failed to allocate buffers");
+    naos_update_reset(false);
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
+  // prepare verification
+  if (hash != NULL) {
+    memcpy(naos_update_hash, hash, 32);
+    mbedtls_sha256_init(&naos_update_sha);
+    ESP_ERROR_CHECK(mbedtls_sha256_starts(&naos_update_sha, false));
+    naos_update_verify = true;
+  }
+
+  // verified updates are resumable unless flash encryption prevents writes
+  // with explicit offsets
+  naos_update_resumable = hash != NULL && !esp_flash_encryption_enabled();
+
+  // remove previous progress
+  naos_update_forget();
+
+  // store size and encoding
+  naos_update_encoding = encoding;
   naos_update_size = size;
   naos_update_written = 0;
+  naos_update_received = 0;
 
   // begin update (without full flash erase)
   esp_err_t err = esp_ota_begin(naos_update_partition, OTA_WITH_SEQUENTIAL_WRITES, &naos_update_handle);
@@ -246,6 +1520,41 @@ bool naos_update_begin(size_t size) {
   return true;
 }
 
+bool naos_update_resume(size_t size, naos_update_encoding_t encoding, const uint8_t *hash, uint32_t *offset) {
+  // acquire mutex
+  naos_lock(naos_update_mutex);
+
+  // check block
+  if (naos_update_block) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_resume: blocked");
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
+  // continue the active update if it matches
+  if (naos_update_handle != 0 && naos_update_resumable && naos_update_size == size &&
+      naos_update_encoding == encoding && memcmp(naos_update_hash, hash, 32) == 0 && !naos_update_failed) {
+    ESP_LOGI(NAOS_LOG_TAG, "naos_update_resume: continuing update at %u", (unsigned int)naos_update_received);
+    *offset = naos_update_received;
+    naos_unlock(naos_update_mutex);
+    return true;
+  }
+
+  // otherwise, restore a persisted update if it matches
+  if (naos_update_handle == 0 && naos_update_restore(size, encoding, hash)) {
+    *offset = naos_update_received;
+    naos_unlock(naos_update_mutex);
+    return true;
+  }
+
+  // release mutex
+  naos_unlock(naos_update_mutex);
+
+  // begin new update
+  *offset = 0;
+  return naos_update_begin_encoded(size, encoding, hash);
+}
+
 bool naos_update_write(uint32_t offset, const uint8_t *chunk, size_t len) {
   // acquire mutex
   naos_lock(naos_update_mutex);
@@ -264,34 +1573,34 @@ bool naos_update_write(uint32_t offset, const uint8_t *chunk, size_t len) {
     return false;
   }
 
-  // enforce monotonic sequential writes
-  if (offset != naos_update_written) {
-    ESP_LOGE(NAOS_LOG_TAG, "naos_update_write: unexpected offset %u, expected %u", (unsigned int)offset,
-             (unsigned int)naos_update_written);
+  // check multicast
+  if (naos_update_chunks != NULL) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_write: multicast update");
     naos_unlock(naos_update_mutex);
     return false;
   }
 
-  // check length against declared update size
-  if (len > naos_update_size - naos_update_written) {
-    ESP_LOGE(NAOS_LOG_TAG, "naos_update_write: write exceeds declared update size");
+  // enforce monotonic sequential writes
+  if (offset != naos_update_received) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_write: unexpected offset %u, expected %u", (unsigned int)offset,
+             (unsigned int)naos_update_received);
     naos_unlock(naos_update_mutex);
     return false;
   }
 
-  // write chunk
-  esp_err_t err = esp_ota_write(naos_update_handle, chunk, len);
-  if (err == ESP_ERR_OTA_VALIDATE_FAILED || err == ESP_ERR_INVALID_SIZE) {
-    ESP_LOGE(NAOS_LOG_TAG, "naos_update_write: %s", esp_err_to_name(err));
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
-    naos_update_reset(true);
+  // check for a failure of previously staged data
+  if (naos_update_failed) {
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_write: aborting update...");
+    naos_update_discard();
     naos_unlock(naos_update_mutex);
     return false;
   }
-  ESP_ERROR_CHECK(err);
 
-  // track bytes written
-  naos_update_written += len;
+  // stage chunk
+  naos_update_stage(chunk, len);
+
+  // track bytes received
+  naos_update_received += len;
 
   // release mutex
   naos_unlock(naos_update_mutex);
@@ -313,7 +1622,7 @@ bool naos_update_abort() {
   // abort a previous update and discard its result
   if (naos_update_handle != 0) {
     ESP_LOGI(NAOS_LOG_TAG, "naos_update_abort: aborting update...");
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
+    naos_update_discard();
   }
 
   // clear state
@@ -346,36 +1655,72 @@ bool naos_update_finish() {
   // log message
   ESP_LOGI(NAOS_LOG_TAG, "naos_update_finish: finishing update...");
 
+  // await writer
+  naos_update_sync();
+
+  // output remaining decoded data
+  if (naos_update_failed ||
+      (naos_update_hs != NULL && !naos_update_output(naos_update_hs->window, naos_update_hs->pos))) {
+    naos_update_discard();
+    naos_unlock(naos_update_mutex);
+    return false;
+  }
+
   // verify size
   if (naos_update_written != naos_update_size) {
     ESP_LOGE(NAOS_LOG_TAG, "naos_update_finish: incomplete update");
-    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_abort(naos_update_handle));
-    naos_update_reset(true);
+    naos_update_discard();
     naos_unlock(naos_update_mutex);
     return false;
   }
 
-  // end update
-  esp_err_t err = esp_ota_end(naos_update_handle);
+  // verify hash of multicast image from flash
+  if (naos_update_chunks != NULL) {
+    uint8_t hash[32];
+    if (!naos_update_digest(hash) || memcmp(hash, naos_update_hash, 32) != 0) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_finish: hash mismatch");
+      naos_update_discard();
+      naos_unlock(naos_update_mutex);
+      return false;
+    }
+  }
+
+  // verify hash
+  if (naos_update_verify) {
+    uint8_t hash[32];
+    ESP_ERROR_CHECK(mbedtls_sha256_finish(&naos_update_sha, hash));
+    if (memcmp(hash, naos_update_hash, 32) != 0) {
+      ESP_LOGE(NAOS_LOG_TAG, "naos_update_finish: hash mismatch");
+      naos_update_discard();
+      naos_unlock(naos_update_mutex);
+      return false;
+    }
+  }
+
+  // end update, the handle is released in any case
+  esp_err_t err = naos_update_end();
+  naos_update_handle = 0;
   if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
-    ESP_LOGE(NAOS_LOG_TAG, "naos_update_finish: esp_ota_end failed: %s", esp_err_to_name(err));
-    naos_update_reset(true);
+    ESP_LOGE(NAOS_LOG_TAG, "naos_update_finish: naos_update_end failed: %s", esp_err_to_name(err));
+    naos_update_discard();
     naos_unlock(naos_update_mutex);
     return false;
   }
   ESP_ERROR_CHECK(err);
-  naos_update_handle = 0;
 
   // set boot partition
   err = esp_ota_set_boot_partition(naos_update_partition);
   if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
     ESP_LOGE(NAOS_LOG_TAG, "naos_update_finish: esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
-    naos_update_reset(true);
+    naos_update_discard();
     naos_unlock(naos_update_mutex);
     return false;
   }
   ESP_ERROR_CHECK(err);
 
+  // remove progress
+  naos_update_forget();
+
   // log message
   ESP_LOGI(NAOS_LOG_TAG, "naos_update_finish: update finished!");
 
@@ -63,6 +63,7 @@ static bool var_b = true;
 
 static int32_t counter = 0;
 static double gauge[2][2] = {0};
+static naos_metric_histogram_t delay = {0};
 
 static void setup() {
   // log info
@@ -320,6 +321,7 @@ static naos_config_t config = {
     .message_callback = message,
     .loop_callback = loop,
     .loop_interval = 1000,
+    .loop_fixed_rate = true,
     .offline_callback = offline,
     .status_callback = status,
     .battery_callback = battery,
@@ -356,6 +358,14 @@ static naos_metric_t gauge_metric = {
     .data = gauge,
     .keys = {"a", "b"},
     .values = {"a1", "a2", NULL, "b1", "b2"},
+    .history = {{.period = 1000, .samples = 300}, {.period = 60000, .samples = 60}},
+};
+
+static naos_metric_t delay_metric = {
+    .name = "delay",
+    .kind = NAOS_METRIC_HISTOGRAM,
+    .type = NAOS_METRIC_LONG,
+    .data = &delay,
 };
 
 static void trace_deferred() {
@@ -376,8 +386,9 @@ static void trace_task() {
   int32_t sawtooth = 0;
   for (;;) {
     // random delay 1-20ms
-    uint32_t delay = 1 + (esp_random() % 20);
-    naos_delay(delay);
+    int64_t start = naos_micros();
+    naos_delay(1 + (esp_random() % 20));
+    naos_metric_observe(&delay_metric, 0, (int32_t)(naos_micros() - start));
 
     // emit sawtooth value
     sawtooth = (sawtooth + 1) % 100;
@@ -419,10 +430,10 @@ static void gauge_task() {
   for (;;) {
     for (int i = 0; i < 10; i++) {
       // calculate sinuses
-      gauge[0][0] = sin(i * 0.1);
-      gauge[0][1] = cos(i * 0.1);
-      gauge[1][0] = tan(i * 0.1);
-      gauge[1][1] = atan(i * 0.1);
+      naos_metric_set(&gauge_metric, 0, sin(i * 0.1));
+      naos_metric_set(&gauge_metric, 1, cos(i * 0.1));
+      naos_metric_set(&gauge_metric, 2, tan(i * 0.1));
+      naos_metric_set(&gauge_metric, 3, atan(i * 0.1));
 
       // delay
       naos_delay(100);
@@ -453,7 +464,7 @@ void app_main() {
     naos_wifi_init();
   }
   if (HTTP) {
-    naos_http_init((naos_http_config_t){.core = 1});
+    naos_http_init((naos_http_config_t){.core = 1, .metrics = true});
     naos_http_serve_str("/", "text/html", "<h1>Hello world!</h1>");
     naos_http_serve_str("/foo", "text/css", "body { color: red; }");
   }
@@ -517,6 +528,7 @@ void app_main() {
   // add metrics
   naos_metrics_add(&counter_metric);
   naos_metrics_add(&gauge_metric);
+  naos_metrics_add(&delay_metric);
 
   // initialize connect
   if (CONNECT) {
@@ -341,6 +341,39 @@ func (f *Fleet) Update(version, pattern string, firmware []byte, jobs int, callb
 	return nil
 }
 
+// MulticastUpdate will perform a multicast firmware update on all devices
+// matching the supplied pattern that do not run the specified version. See
+// the MulticastUpdate function for details.
+func (f *Fleet) MulticastUpdate(version, pattern string, firmware []byte, jobs int, interval time.Duration, callback func(*Device, UpdateStatus)) error {
+	// get devices
+	list := f.FilterDevices(pattern)
+
+	// filter by version
+	var devices []*Device
+	for _, d := range list {
+		if d.AppVersion != version {
+			devices = append(devices, d)
+		}
+	}
+
+	// update devices
+	_, err := MulticastUpdate(f.Broker, BaseTopics(devices), firmware, jobs, interval, func(baseTopic string, status UpdateStatus) {
+		// get device
+		device := f.FindDevice(baseTopic)
+		if device == nil {
+			return
+		}
+
+		// call callback
+		callback(device, status)
+	})
+	if err != nil {
+		return err
+	}
+
+	return nil
+}
+
 // BaseTopics returns a list of base topics from the provided devices.
 func BaseTopics(devices []*Device) []string {
 	// prepare list
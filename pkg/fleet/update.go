@@ -2,6 +2,8 @@ package fleet
 
 import (
 	"errors"
+	"strconv"
+	"sync"
 	"time"
 
 	"github.com/256dpi/gomqtt/packet"
@@ -47,6 +49,9 @@ func Update(url string, baseTopics []string, firmware []byte, jobs int, callback
 	// prepare statuses
 	statuses := make([]UpdateStatus, len(devices))
 
+	// prepare image once for all devices
+	image := msg.PrepareUpdate(firmware)
+
 	// execute log streaming
 	results := msg.Execute(devices, jobs, func(s *msg.Session) (any, error) {
 		// get index and base topic
@@ -54,7 +59,7 @@ func Update(url string, baseTopics []string, firmware []byte, jobs int, callback
 		baseTopic := baseTopics[index]
 
 		// perform update
-		err := msg.Update(s, firmware, func(progress int) {
+		err := msg.UpdatePrepared(s, image, func(progress int) {
 			// set progress
 			statuses[index].Progress = float64(progress) / float64(len(firmware))
 
@@ -87,3 +92,129 @@ func Update(url string, baseTopics []string, firmware []byte, jobs int, callback
 
 	return statuses, firstErr
 }
+
+// MulticastUpdate will perform a firmware update on the provided devices by
+// publishing the image once to a shared topic. Chunks missed by a device are
+// repaired individually afterward. Devices that do not support multicast
+// updates are updated individually. The interval paces the published chunks.
+// If a callback is provided it will be called with the current status of the
+// update.
+func MulticastUpdate(url string, baseTopics []string, firmware []byte, jobs int, interval time.Duration, callback func(string, UpdateStatus)) ([]UpdateStatus, error) {
+	// check base topics
+	if len(baseTopics) == 0 {
+		return nil, errors.New("zero base topics")
+	}
+
+	// create router
+	router, err := mqtt.Connect(url, "naos-fleet", packet.QOSAtMostOnce)
+	if err != nil {
+		return nil, err
+	}
+	defer router.Close()
+
+	// create devices
+	devices := make([]msg.Device, 0, len(baseTopics))
+	for _, baseTopic := range baseTopics {
+		devices = append(devices, mqtt.NewDevice(router, baseTopic))
+	}
+
+	// prepare statuses
+	statuses := make([]UpdateStatus, len(devices))
+	var mutex sync.Mutex
+	report := func(index int, progress float64, err error) {
+		mutex.Lock()
+		defer mutex.Unlock()
+		statuses[index].Progress = progress
+		statuses[index].Error = err
+		if callback != nil {
+			callback(baseTopics[index], statuses[index])
+		}
+	}
+
+	// generate topic
+	topic := "naos/update/" + strconv.FormatInt(time.Now().UnixNano(), 36)
+
+	// begin multicast updates
+	fallback := make([]bool, len(devices))
+	results := msg.Execute(devices, jobs, func(s *msg.Session) (any, error) {
+		index := lo.IndexOf(devices, s.Channel().Device())
+		err := msg.BeginMulticast(s, firmware, topic, 5*time.Second)
+		if errors.Is(err, msg.ErrSessionUnknownMessage) {
+			fallback[index] = true
+			return nil, nil
+		}
+		return nil, err
+	})
+
+	// collect participating devices
+	var active []msg.Device
+	var multicast []int
+	for i, result := range results {
+		if result.Error != nil {
+			report(i, 0, result.Error)
+		} else {
+			active = append(active, devices[i])
+			if !fallback[i] {
+				multicast = append(multicast, i)
+			}
+		}
+	}
+
+	// publish chunks
+	if len(multicast) > 0 {
+		chunks := msg.MulticastChunks(firmware)
+		for i, chunk := range chunks {
+			err = router.Publish(topic, chunk)
+			if err != nil {
+				return statuses, err
+			}
+
+			// report progress
+			progress := float64(min((i+1)*msg.MulticastChunkSize, len(firmware))) / float64(len(firmware))
+			for _, index := range multicast {
+				report(index, progress, nil)
+			}
+
+			// pace chunks
+			time.Sleep(interval)
+		}
+	}
+
+	// prepare image for fallback devices
+	image := msg.PrepareUpdate(firmware)
+
+	// repair and finish updates
+	results = msg.Execute(active, jobs, func(s *msg.Session) (any, error) {
+		// get index
+		index := lo.IndexOf(devices, s.Channel().Device())
+
+		// prepare reporter
+		progress := func(progress int) {
+			report(index, float64(progress)/float64(len(firmware)), nil)
+		}
+
+		// repair and finish update, or perform update
+		var err error
+		if fallback[index] {
+			err = msg.UpdatePrepared(s, image, progress, 5*time.Second)
+		} else {
+			err = msg.FinishMulticast(s, firmware, progress, 5*time.Second)
+		}
+		if err != nil {
+			report(index, statuses[index].Progress, err)
+		}
+
+		return nil, err
+	})
+
+	// get first error
+	var firstErr error
+	for _, status := range statuses {
+		if status.Error != nil {
+			firstErr = status.Error
+			break
+		}
+	}
+
+	return statuses, firstErr
+}
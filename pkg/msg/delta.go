@@ -0,0 +1,249 @@
+package msg
+
+import (
+	"crypto/sha256"
+	"encoding/binary"
+	"errors"
+)
+
+// ErrInvalidPatch is returned if a patch is malformed or does not match the
+// base image.
+var ErrInvalidPatch = errors.New("invalid patch")
+
+const (
+	deltaKey      = 8
+	deltaMinMatch = 16
+	deltaBuckets  = 20
+	deltaChain    = 32
+)
+
+// Diff computes a patch that transforms the base image into the new image. The
+// patch is a sequence of bsdiff style records that are applied sequentially:
+//
+//	DIFF (4) | EXTRA (4) | ADJUST (4) | DIFF BYTES (DIFF) | EXTRA BYTES (EXTRA)
+//
+// Diff bytes are added to the base image at the current base position, extra
+// bytes are copied as is and the base position is then moved by the signed
+// adjustment. As diff bytes are mostly zero, a zero byte is followed by a count
+// and expands to count + 1 zero bytes. DIFF and EXTRA are decoded lengths.
+// Matches are found using hash chains over eight byte prefixes and extended
+// with the approximate matching of bsdiff.
+func Diff(base, image []byte) []byte {
+	// prepare key
+	key := func(data []byte, i int) int {
+		return int(binary.LittleEndian.Uint64(data[i:]) * 0x9E3779B97F4A7C15 >> (64 - deltaBuckets))
+	}
+
+	// index base
+	head := make([]int32, 1<<deltaBuckets)
+	for i := range head {
+		head[i] = -1
+	}
+	prev := make([]int32, len(base))
+	for i := 0; i+deltaKey <= len(base); i++ {
+		k := key(base, i)
+		prev[i] = head[k]
+		head[k] = int32(i)
+	}
+
+	// prepare match length
+	matchLen := func(pos, scan int) int {
+		l := 0
+		for pos+l < len(base) && scan+l < len(image) && base[pos+l] == image[scan+l] {
+			l++
+		}
+		return l
+	}
+
+	// prepare record writer
+	var patch []byte
+	record := func(diff, extra, adjust int, newPos, oldPos int) {
+		patch = binary.LittleEndian.AppendUint32(patch, uint32(diff))
+		patch = binary.LittleEndian.AppendUint32(patch, uint32(extra))
+		patch = binary.LittleEndian.AppendUint32(patch, uint32(int32(adjust)))
+		for i := 0; i < diff; i++ {
+			// write non-zero byte
+			b := image[newPos+i] - base[oldPos+i]
+			if b != 0 {
+				patch = append(patch, b)
+				continue
+			}
+
+			// write zero run
+			n := 1
+			for n < 256 && i+n < diff && image[newPos+i+n] == base[oldPos+i+n] {
+				n++
+			}
+			patch = append(patch, 0, byte(n-1))
+			i += n - 1
+		}
+		patch = append(patch, image[newPos+diff:newPos+diff+extra]...)
+	}
+
+	// prepare forward extension
+	forward := func(lastScan, lastPos, scan int) int {
+		var s, sf, lenf int
+		for i := 0; lastScan+i < scan && lastPos+i < len(base); i++ {
+			if base[lastPos+i] == image[lastScan+i] {
+				s++
+			}
+			if s*2-(i+1) > sf*2-lenf {
+				sf = s
+				lenf = i + 1
+			}
+		}
+		return lenf
+	}
+
+	// scan image
+	var lastScan, lastPos int
+	for scan := 0; scan < len(image); {
+		// get match along the current alignment
+		pos := scan + lastPos - lastScan
+		length := 0
+		if pos >= 0 && pos < len(base) {
+			length = matchLen(pos, scan)
+		}
+
+		// continue the current record if the alignment still matches
+		if length >= deltaMinMatch {
+			scan += length
+			continue
+		}
+
+		// find longest match elsewhere
+		if scan+deltaKey <= len(image) {
+			for j, n := int(head[key(image, scan)]), 0; j >= 0 && n < deltaChain; j, n = int(prev[j]), n+1 {
+				if l := matchLen(j, scan); l > length {
+					pos, length = j, l
+				}
+			}
+		}
+
+		// skip if no match was found
+		if length < deltaMinMatch {
+			scan++
+			continue
+		}
+
+		// extend previous record forward
+		lenf := forward(lastScan, lastPos, scan)
+
+		// extend match backward
+		var s, sb, lenb int
+		for i := 1; scan-i >= lastScan && pos-i >= 0; i++ {
+			if base[pos-i] == image[scan-i] {
+				s++
+			}
+			if s*2-i > sb*2-lenb {
+				sb = s
+				lenb = i
+			}
+		}
+
+		// resolve overlap
+		if lastScan+lenf > scan-lenb {
+			overlap := lastScan + lenf - (scan - lenb)
+			var s, ss, lens int
+			for i := 0; i < overlap; i++ {
+				if image[lastScan+lenf-overlap+i] == base[lastPos+lenf-overlap+i] {
+					s++
+				}
+				if image[scan-lenb+i] == base[pos-lenb+i] {
+					s--
+				}
+				if s > ss {
+					ss = s
+					lens = i + 1
+				}
+			}
+			lenf += lens - overlap
+			lenb -= lens
+		}
+
+		// write record
+		record(lenf, scan-lenb-lastScan-lenf, pos-lenb-lastPos-lenf, lastScan, lastPos)
+
+		// advance
+		lastScan = scan - lenb
+		lastPos = pos - lenb
+		scan += length
+	}
+
+	// write final record
+	lenf := forward(lastScan, lastPos, len(image))
+	record(lenf, len(image)-lastScan-lenf, 0, lastScan, lastPos)
+
+	return patch
+}
+
+// Patch applies a patch created by Diff to the base image.
+func Patch(base, patch []byte) ([]byte, error) {
+	// apply records
+	var image []byte
+	var pos int
+	for len(patch) > 0 {
+		// get header
+		if len(patch) < 12 {
+			return nil, ErrInvalidPatch
+		}
+		diff := int(binary.LittleEndian.Uint32(patch))
+		extra := int(binary.LittleEndian.Uint32(patch[4:]))
+		adjust := int(int32(binary.LittleEndian.Uint32(patch[8:])))
+		patch = patch[12:]
+
+		// check base range
+		if pos < 0 || diff > len(base)-pos {
+			return nil, ErrInvalidPatch
+		}
+
+		// apply diff bytes
+		for i := 0; i < diff; {
+			// check length
+			if len(patch) == 0 {
+				return nil, ErrInvalidPatch
+			}
+
+			// apply non-zero byte
+			if patch[0] != 0 {
+				image = append(image, base[pos+i]+patch[0])
+				patch = patch[1:]
+				i++
+				continue
+			}
+
+			// apply zero run
+			if len(patch) < 2 || int(patch[1])+1 > diff-i {
+				return nil, ErrInvalidPatch
+			}
+			n := int(patch[1]) + 1
+			image = append(image, base[pos+i:pos+i+n]...)
+			patch = patch[2:]
+			i += n
+		}
+
+		// apply extra bytes
+		if extra > len(patch) {
+			return nil, ErrInvalidPatch
+		}
+		image = append(image, patch[:extra]...)
+		patch = patch[extra:]
+		pos += diff + adjust
+	}
+
+	return image, nil
+}
+
+// PrepareDelta computes, compresses and hashes a patch from the base image to
+// the provided firmware image. The device must run the base image for the
+// update to succeed. Devices that reject the encoded update receive the raw
+// uncompressed image instead.
+func PrepareDelta(base, image []byte) *UpdateImage {
+	return &UpdateImage{
+		Image:      image,
+		Stream:     hsEncode(Diff(base, image)),
+		Compressed: true,
+		Delta:      true,
+		Hash:       sha256.Sum256(image),
+	}
+}
@@ -1,19 +1,48 @@
 package msg
 
 import (
+	"bytes"
+	"crypto/sha256"
+	"encoding/binary"
 	"errors"
 	"fmt"
 	stdpath "path"
+	"sort"
 	"time"
 )
 
 const fsEndpoint = 0x3
 
+// FSError is a POSIX error number reported by the device.
+type FSError uint8
+
+// Error implements the error interface.
+func (e FSError) Error() string {
+	return fmt.Sprintf("posix error: %d", uint8(e))
+}
+
 // FSInfo describes a file system entry.
 type FSInfo struct {
-	Name  string
-	IsDir bool
-	Size  uint32
+	Name    string
+	IsDir   bool
+	Size    uint32
+	ModTime time.Time
+}
+
+// FSListOptions configures a directory listing.
+type FSListOptions struct {
+	// Pattern optionally filters entries by a glob pattern supporting "*" and
+	// "?" wildcards.
+	Pattern string
+
+	// Since optionally filters entries modified before the specified time.
+	Since time.Time
+
+	// Limit optionally limits the number of entries per page.
+	Limit uint16
+
+	// Cursor continues a previous listing.
+	Cursor uint32
 }
 
 // StatPath retrieves information about a file system entry.
@@ -49,8 +78,112 @@ func StatPath(s *Session, path string, timeout time.Duration) (*FSInfo, error) {
 	}, nil
 }
 
-// ListDir retrieves a list of file system entries in a directory.
+// ListDir retrieves a list of file system entries in a directory. Devices
+// that do not support packed listings are handled using the legacy command.
 func ListDir(s *Session, dir string, timeout time.Duration) ([]FSInfo, error) {
+	// list all pages
+	infos, err := ListDirAll(s, dir, FSListOptions{}, timeout)
+	if errors.Is(err, ErrSessionUnknownMessage) {
+		return listDirLegacy(s, dir, timeout)
+	}
+
+	return infos, err
+}
+
+// ListDirAll retrieves all pages of a filtered directory listing.
+func ListDirAll(s *Session, dir string, opts FSListOptions, timeout time.Duration) ([]FSInfo, error) {
+	// prepare infos
+	var infos []FSInfo
+
+	for {
+		// list page
+		page, cursor, err := ListDirPage(s, dir, opts, timeout)
+		if err != nil {
+			return nil, err
+		}
+
+		// add infos
+		infos = append(infos, page...)
+
+		// check cursor
+		if cursor == 0 {
+			return infos, nil
+		}
+
+		// continue listing
+		opts.Cursor = cursor
+	}
+}
+
+// ListDirPage retrieves a page of file system entries in a directory. The
+// returned cursor continues the listing or is zero if the directory has been
+// fully listed.
+func ListDirPage(s *Session, dir string, opts FSListOptions, timeout time.Duration) ([]FSInfo, uint32, error) {
+	// get since
+	var since uint32
+	if !opts.Since.IsZero() {
+		since = uint32(opts.Since.Unix())
+	}
+
+	// send command
+	cmd := Pack("oihis", uint8(12), opts.Cursor, opts.Limit, since, dir)
+	if opts.Pattern != "" {
+		cmd = append(cmd, Pack("os", uint8(0), opts.Pattern)...)
+	}
+	err := fsSend(s, cmd, false, timeout)
+	if err != nil {
+		return nil, 0, err
+	}
+
+	// prepare infos
+	var infos []FSInfo
+	var cursor uint32
+
+	for {
+		// await reply
+		reply, err := fsReceive(s, true, timeout)
+		if errors.Is(err, Ack) {
+			return infos, cursor, nil
+		} else if err != nil {
+			return nil, 0, err
+		}
+
+		// verify "entries" reply
+		if len(reply) < 5 || reply[0] != 5 {
+			return nil, 0, fmt.Errorf("invalid message: list reply")
+		}
+
+		// get cursor
+		cursor = binary.LittleEndian.Uint32(reply[1:])
+
+		// parse entries
+		entries := reply[5:]
+		for len(entries) > 0 {
+			// find name end
+			end := -1
+			if len(entries) >= 10 {
+				end = bytes.IndexByte(entries[9:], 0)
+			}
+			if end < 0 {
+				return nil, 0, fmt.Errorf("invalid message: list entry")
+			}
+			end += 9
+
+			// add info
+			infos = append(infos, FSInfo{
+				Name:    string(entries[9:end]),
+				IsDir:   entries[0] == 1,
+				Size:    binary.LittleEndian.Uint32(entries[1:]),
+				ModTime: time.Unix(int64(binary.LittleEndian.Uint32(entries[5:])), 0),
+			})
+
+			// advance
+			entries = entries[end+1:]
+		}
+	}
+}
+
+func listDirLegacy(s *Session, dir string, timeout time.Duration) ([]FSInfo, error) {
 	// send command
 	cmd := Pack("os", uint8(1), dir)
 	err := fsSend(s, cmd, false, timeout)
@@ -197,73 +330,362 @@ func ReadFileRange(s *Session, file string, offset, length uint32, report func(u
 
 // WriteFile writes data to a file.
 func WriteFile(s *Session, file string, data []byte, report func(uint32), timeout time.Duration) error {
-	// send "create" command
-	cmd := Pack("oos", uint8(2), uint8((1<<0)|(1<<2)), file)
-	err := fsSend(s, cmd, true, timeout)
+	return fsWrite(s, file, (1<<0)|(1<<2), data, report, timeout)
+}
+
+// FSArchiveEntry describes an entry of a file system archive.
+type FSArchiveEntry struct {
+	Path  string
+	IsDir bool
+	Data  []byte
+}
+
+// ArchiveDir retrieves a directory tree as a single archive stream. The
+// archive can be decoded using UnpackArchive.
+func ArchiveDir(s *Session, dir string, report func(uint32), timeout time.Duration) ([]byte, error) {
+	// send "archive" command
+	cmd := Pack("os", uint8(13), dir)
+	err := fsSend(s, cmd, false, timeout)
 	if err != nil {
-		return err
+		return nil, err
+	}
+
+	// prepare data
+	var data []byte
+
+	for {
+		// await reply
+		reply, err := fsReceive(s, true, timeout)
+		if errors.Is(err, Ack) {
+			return data, nil
+		} else if err != nil {
+			return nil, err
+		}
+
+		// verify "chunk" reply
+		if len(reply) < 5 || reply[0] != 2 {
+			return nil, fmt.Errorf("invalid message: archive reply")
+		}
+
+		// verify offset
+		if binary.LittleEndian.Uint32(reply[1:]) != uint32(len(data)) {
+			return nil, fmt.Errorf("invalid offset")
+		}
+
+		// append data
+		data = append(data, reply[5:]...)
+
+		// report length
+		if report != nil {
+			report(uint32(len(data)))
+		}
+	}
+}
+
+// ExtractArchive streams an archive to the device which extracts it into a
+// staging directory and replaces the specified directory once complete. The
+// directory remains unchanged if the transfer fails.
+func ExtractArchive(s *Session, dir string, archive []byte, report func(uint32), timeout time.Duration) error {
+	return fsWrite(s, dir, 1<<4, archive, report, timeout)
+}
+
+// PackArchive encodes the provided entries as an archive. Directories must
+// precede the entries they contain.
+func PackArchive(entries []FSArchiveEntry) []byte {
+	// encode entries
+	var buf []byte
+	for _, entry := range entries {
+		buf = append(buf, Pack("oisob", b2v(entry.IsDir, uint8(1), uint8(0)), uint32(len(entry.Data)), entry.Path, uint8(0), entry.Data)...)
+	}
+
+	return buf
+}
+
+// UnpackArchive decodes the entries of an archive.
+func UnpackArchive(archive []byte) ([]FSArchiveEntry, error) {
+	// decode entries
+	var entries []FSArchiveEntry
+	for len(archive) > 0 {
+		// find name end
+		end := -1
+		if len(archive) >= 6 {
+			end = bytes.IndexByte(archive[5:], 0)
+		}
+		if end < 0 {
+			return nil, fmt.Errorf("invalid archive: truncated header")
+		}
+		end += 5
+
+		// get size
+		size := int(binary.LittleEndian.Uint32(archive[1:]))
+		if len(archive)-end-1 < size {
+			return nil, fmt.Errorf("invalid archive: truncated data")
+		}
+
+		// add entry
+		entries = append(entries, FSArchiveEntry{
+			Path:  string(archive[5:end]),
+			IsDir: archive[0] == 1,
+			Data:  archive[end+1 : end+1+size],
+		})
+
+		// advance
+		archive = archive[end+1+size:]
+	}
+
+	return entries, nil
+}
+
+// FSOpenFlags configures how a file is opened.
+type FSOpenFlags uint8
+
+// The available open flags.
+const (
+	FSCreate    FSOpenFlags = 1 << 0
+	FSAppend    FSOpenFlags = 1 << 1
+	FSTruncate  FSOpenFlags = 1 << 2
+	FSExclusive FSOpenFlags = 1 << 3
+)
+
+// FSFile is a file addressed by handle. Unlike the functions operating on the
+// session's implicit file, several files may be open within one session.
+type FSFile struct {
+	s      *Session
+	handle uint8
+}
+
+// OpenFile opens a file by handle.
+func OpenFile(s *Session, file string, flags FSOpenFlags, timeout time.Duration) (*FSFile, error) {
+	// send "open" command with handle flag
+	cmd := Pack("oos", uint8(2), uint8(flags)|(1<<5), file)
+	err := fsSend(s, cmd, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// await reply
+	reply, err := fsReceive(s, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// verify "handle" reply
+	if len(reply) != 2 || reply[0] != 6 {
+		return nil, fmt.Errorf("invalid message: open reply")
+	}
+
+	return &FSFile{s: s, handle: reply[1]}, nil
+}
+
+// Handle returns the device file handle.
+func (f *FSFile) Handle() uint8 {
+	return f.handle
+}
+
+// Read reads a range of bytes from the file. A zero length reads the
+// remainder of the file.
+func (f *FSFile) Read(offset, length uint32, report func(uint32), timeout time.Duration) ([]byte, error) {
+	// send "read" command
+	cmd := Pack("ooii", uint8(14), f.handle, offset, length)
+	err := fsSend(f.s, cmd, false, timeout)
+	if err != nil {
+		return nil, err
 	}
 
+	return fsReceiveChunks(f.s, offset, report, timeout)
+}
+
+// Write writes data to the file at the specified offset.
+func (f *FSFile) Write(offset uint32, data []byte, report func(uint32), timeout time.Duration) error {
 	// get width
-	width := s.Channel().Width()
+	width := f.s.Channel().Width()
 
-	// get MTU
-	mtu, err := s.GetMTU(time.Second)
+	// get MTU and subtract overhead
+	mtu, err := f.s.GetMTU(time.Second)
 	if err != nil {
 		return err
 	}
-
-	// subtract overhead
-	mtu -= 6
+	mtu -= 7
 
 	// write data in chunks
-	num := 0
-	offset := 0
-	for offset < len(data) {
-		// determine chunk size and chunk data
-		chunkSize := min(int(mtu), len(data)-offset)
-		chunkData := data[offset : offset+chunkSize]
+	for num, pos := 0, 0; pos < len(data); num++ {
+		// determine chunk data
+		chunkData := data[pos:min(pos+int(mtu), len(data))]
+		pos += len(chunkData)
+
+		// send "write" command, the first chunk seeks to the offset
+		acked := num%width == 0 || pos >= len(data)
+		err = fsWriteHandle(f.s, f.handle, acked, num > 0, offset+uint32(pos-len(chunkData)), chunkData, timeout)
+		if err != nil {
+			return err
+		}
 
-		// determine mode
-		acked := num%width == 0 || offset+chunkSize >= len(data)
+		// report position
+		if report != nil {
+			report(uint32(pos))
+		}
+	}
 
-		// prepare "write" command (sequential or silent & sequential)
-		cmd := Pack("ooib", uint8(4), b2v(acked, uint8(1<<1), uint8(1<<0|1<<1)), uint32(offset), chunkData)
+	return nil
+}
 
-		// send "write" command
-		err = fsSend(s, cmd, false, 0)
+// Close closes the file and reports deferred write errors.
+func (f *FSFile) Close(timeout time.Duration) error {
+	// send "close" command
+	cmd := Pack("oo", uint8(16), f.handle)
+	return fsSend(f.s, cmd, true, timeout)
+}
+
+// ReadFiles reads several files within one session. All read commands are
+// sent at once and the replies are received in order.
+func ReadFiles(s *Session, paths []string, report func(uint32), timeout time.Duration) ([][]byte, error) {
+	// open files
+	var files []*FSFile
+	for _, path := range paths {
+		file, err := OpenFile(s, path, 0, timeout)
 		if err != nil {
-			return err
+			fsCloseFiles(files, timeout)
+			return nil, err
 		}
+		files = append(files, file)
+	}
 
-		// receive ack or "error" replies
-		if acked {
-			_, err := fsReceive(s, true, timeout)
-			if err != nil && !errors.Is(err, Ack) {
-				return err
+	// send "read" commands
+	for _, file := range files {
+		err := fsSend(s, Pack("ooii", uint8(14), file.handle, uint32(0), uint32(0)), false, timeout)
+		if err != nil {
+			fsCloseFiles(files, timeout)
+			return nil, err
+		}
+	}
+
+	// receive data, each stream ends with an ack or an error
+	var total uint32
+	var firstErr error
+	data := make([][]byte, len(files))
+	for i := range files {
+		buf, err := fsReceiveChunks(s, 0, func(n uint32) {
+			if report != nil {
+				report(total + n)
 			}
+		}, timeout)
+		var fsErr FSError
+		if err != nil && !errors.As(err, &fsErr) {
+			fsCloseFiles(files, timeout)
+			return nil, err
+		} else if err != nil && firstErr == nil {
+			firstErr = err
 		}
+		data[i] = buf
+		total += uint32(len(buf))
+	}
 
-		// increment offset
-		offset += chunkSize
+	// close files
+	fsCloseFiles(files, timeout)
+	if firstErr != nil {
+		return nil, firstErr
+	}
 
-		// report offset
-		if report != nil {
-			report(uint32(offset))
-		}
+	return data, nil
+}
 
-		// increment count
-		num++
+// WriteFiles creates or replaces several files within one session. The chunks
+// of all files are interleaved and only every channel width chunk is acked.
+func WriteFiles(s *Session, files map[string][]byte, report func(uint32), timeout time.Duration) error {
+	// sort paths
+	paths := make([]string, 0, len(files))
+	for path := range files {
+		paths = append(paths, path)
 	}
+	sort.Strings(paths)
 
-	// send "close" command
-	cmd = Pack("o", uint8(5))
-	err = fsSend(s, cmd, true, timeout)
+	// open files
+	var handles []*FSFile
+	for _, path := range paths {
+		file, err := OpenFile(s, path, FSCreate|FSTruncate, timeout)
+		if err != nil {
+			fsCloseFiles(handles, timeout)
+			return err
+		}
+		handles = append(handles, file)
+	}
+
+	// get width
+	width := s.Channel().Width()
+
+	// get MTU and subtract overhead
+	mtu, err := s.GetMTU(time.Second)
 	if err != nil {
+		fsCloseFiles(handles, timeout)
 		return err
 	}
+	mtu -= 7
 
-	return nil
+	// count chunks
+	var count int
+	for _, path := range paths {
+		count += (len(files[path]) + int(mtu) - 1) / int(mtu)
+	}
+
+	// write chunks of all files round-robin
+	var num int
+	var total uint32
+	for offset := 0; num < count; offset += int(mtu) {
+		for i, path := range paths {
+			// get chunk
+			data := files[path]
+			if offset >= len(data) {
+				continue
+			}
+			chunkData := data[offset:min(offset+int(mtu), len(data))]
+
+			// send "write" command
+			acked := num%width == 0 || num == count-1
+			err = fsWriteHandle(s, handles[i].handle, acked, true, uint32(offset), chunkData, timeout)
+			if err != nil {
+				fsCloseFiles(handles, timeout)
+				return err
+			}
+			num++
+
+			// report total
+			total += uint32(len(chunkData))
+			if report != nil {
+				report(total)
+			}
+		}
+	}
+
+	// close files, which reports deferred write errors
+	var firstErr error
+	for _, file := range handles {
+		err = file.Close(timeout)
+		if err != nil && firstErr == nil {
+			firstErr = err
+		}
+	}
+
+	return firstErr
+}
+
+// FSLogRecord is a record of a device log.
+type FSLogRecord struct {
+	Seq  uint32
+	Time time.Time
+	Data []byte
+}
+
+// ReadLog retrieves the records of a device log with sequence numbers in the
+// inclusive range. Passing the last received sequence number plus one as the
+// start retrieves only new records.
+func ReadLog(s *Session, name string, from, to uint32, timeout time.Duration) ([]FSLogRecord, error) {
+	return fsReadLog(s, name, 0, int64(from), int64(to), timeout)
+}
+
+// ReadLogTime retrieves the records of a device log with timestamps in the
+// inclusive range.
+func ReadLogTime(s *Session, name string, from, to time.Time, timeout time.Duration) ([]FSLogRecord, error) {
+	return fsReadLog(s, name, 1, from.UnixMilli(), to.UnixMilli(), timeout)
 }
 
 // RenamePath renames a file system entry.
@@ -326,8 +748,305 @@ func MakePath(s *Session, path string, timeout time.Duration) error {
 	return nil
 }
 
+// FSBlockHash describes a single block of a file.
+type FSBlockHash struct {
+	Weak   uint32
+	Strong []byte
+}
+
+// HashFileBlocks retrieves the hashes of all blocks of a file. Each block is
+// described by an rsync-style weak checksum and the first 16 bytes of its
+// SHA-256 hash. The last block may be shorter than the block size.
+func HashFileBlocks(s *Session, file string, blockSize uint32, timeout time.Duration) ([]FSBlockHash, error) {
+	// send command
+	cmd := Pack("ois", uint8(10), blockSize, file)
+	err := fsSend(s, cmd, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// prepare hashes
+	var hashes []FSBlockHash
+
+	for {
+		// await reply
+		reply, err := fsReceive(s, true, timeout)
+		if errors.Is(err, Ack) {
+			return hashes, nil
+		} else if err != nil {
+			return nil, err
+		}
+
+		// verify "hashes" reply
+		if len(reply) < 5 || reply[0] != 4 || (len(reply)-5)%20 != 0 {
+			return nil, fmt.Errorf("invalid message: hashes reply")
+		}
+
+		// unpack index
+		args, err := Unpack("i", reply[1:])
+		if err != nil {
+			return nil, err
+		}
+
+		// verify index
+		if args[0].(uint32) != uint32(len(hashes)) {
+			return nil, fmt.Errorf("invalid index")
+		}
+
+		// add hashes
+		for pos := 5; pos < len(reply); pos += 20 {
+			args, err := Unpack("i", reply[pos:])
+			if err != nil {
+				return nil, err
+			}
+			hashes = append(hashes, FSBlockHash{
+				Weak:   args[0].(uint32),
+				Strong: reply[pos+4 : pos+20],
+			})
+		}
+	}
+}
+
+// SyncFile writes data to a file by only transferring the blocks that changed
+// compared to the existing file. Unchanged blocks are copied on the device into
+// a temporary file, that is verified and then renamed over the original file.
+// If the file does not yet exist, it is written in full.
+func SyncFile(s *Session, file string, data []byte, blockSize uint32, report func(uint32), timeout time.Duration) error {
+	// stat file and fall back to a full write if missing
+	info, err := StatPath(s, file, timeout)
+	if err != nil || info.IsDir {
+		return WriteFile(s, file, data, report, timeout)
+	}
+
+	// get block hashes
+	hashes, err := HashFileBlocks(s, file, blockSize, timeout)
+	if err != nil {
+		return err
+	}
+
+	// only match full blocks
+	hashes = hashes[:min(len(hashes), int(info.Size/blockSize))]
+
+	// compute delta
+	ops := fsDelta(data, int(blockSize), hashes)
+
+	// send "create" command for temporary file
+	temp := file + ".sync"
+	cmd := Pack("oos", uint8(2), uint8((1<<0)|(1<<2)), temp)
+	err = fsSend(s, cmd, true, timeout)
+	if err != nil {
+		return err
+	}
+
+	// get width
+	width := s.Channel().Width()
+
+	// get MTU
+	mtu, err := s.GetMTU(time.Second)
+	if err != nil {
+		return err
+	}
+
+	// subtract overhead
+	mtu -= 6
+
+	// prepare sender
+	num := 0
+	send := func(cmd []byte, acked bool) error {
+		// send command
+		err := fsSend(s, cmd, false, 0)
+		if err != nil {
+			return err
+		}
+
+		// receive ack or "error" replies
+		if acked {
+			_, err := fsReceive(s, true, timeout)
+			if err != nil && !errors.Is(err, Ack) {
+				return err
+			}
+		}
+
+		// increment count
+		num++
+
+		return nil
+	}
+
+	// apply delta
+	offset := 0
+	for _, op := range ops {
+		// handle copies
+		if op.Copy {
+			// determine mode
+			acked := num%width == 0 || offset+int(op.Length) >= len(data)
+
+			// send "copy" command (acked or silent)
+			cmd := Pack("ooiiis", uint8(11), b2v(acked, uint8(0), uint8(1<<0)), uint32(offset), op.Offset, op.Length, file)
+			err = send(cmd, acked)
+			if err != nil {
+				return err
+			}
+
+			// increment offset
+			offset += int(op.Length)
+
+			// report offset
+			if report != nil {
+				report(uint32(offset))
+			}
+
+			continue
+		}
+
+		// write literal data in chunks
+		for pos := 0; pos < len(op.Data); {
+			// determine chunk size and chunk data
+			chunkSize := min(int(mtu), len(op.Data)-pos)
+			chunkData := op.Data[pos : pos+chunkSize]
+
+			// determine mode
+			acked := num%width == 0 || offset+chunkSize >= len(data)
+
+			// send "write" command (sequential or silent & sequential)
+			cmd := Pack("ooib", uint8(4), b2v(acked, uint8(1<<1), uint8(1<<0|1<<1)), uint32(offset), chunkData)
+			err = send(cmd, acked)
+			if err != nil {
+				return err
+			}
+
+			// increment offsets
+			pos += chunkSize
+			offset += chunkSize
+
+			// report offset
+			if report != nil {
+				report(uint32(offset))
+			}
+		}
+	}
+
+	// send "close" command
+	cmd = Pack("o", uint8(5))
+	err = fsSend(s, cmd, true, timeout)
+	if err != nil {
+		return err
+	}
+
+	// verify result
+	hash, err := SHA256File(s, temp, timeout)
+	if err != nil {
+		return err
+	}
+	sum := sha256.Sum256(data)
+	if !bytes.Equal(hash, sum[:]) {
+		_ = RemovePath(s, temp, timeout)
+		return fmt.Errorf("hash mismatch")
+	}
+
+	// replace file
+	err = RenamePath(s, temp, file, timeout)
+	if err != nil {
+		return err
+	}
+
+	return nil
+}
+
 /* Helpers */
 
+type fsDeltaOp struct {
+	Copy   bool
+	Offset uint32
+	Length uint32
+	Data   []byte
+}
+
+func fsWeakSum(data []byte) (uint32, uint32) {
+	// compute rsync-style checksum parts
+	var a, b uint32
+	for _, x := range data {
+		a += uint32(x)
+		b += a
+	}
+
+	return a, b
+}
+
+func fsDelta(data []byte, blockSize int, hashes []FSBlockHash) []fsDeltaOp {
+	// index blocks by weak checksum
+	index := map[uint32][]int{}
+	for i, hash := range hashes {
+		index[hash.Weak] = append(index[hash.Weak], i)
+	}
+
+	// prepare operations
+	var ops []fsDeltaOp
+
+	// scan data with a rolling checksum
+	var a, b uint32
+	var rolling bool
+	literal := 0
+	pos := 0
+	for len(hashes) > 0 && pos+blockSize <= len(data) {
+		// compute checksum if not rolling
+		if !rolling {
+			a, b = fsWeakSum(data[pos : pos+blockSize])
+			rolling = true
+		}
+
+		// find matching block
+		match := -1
+		if candidates, ok := index[(a&0xFFFF)|(b<<16)]; ok {
+			sum := sha256.Sum256(data[pos : pos+blockSize])
+			for _, candidate := range candidates {
+				if bytes.Equal(hashes[candidate].Strong, sum[:16]) {
+					match = candidate
+					break
+				}
+			}
+		}
+
+		// handle match
+		if match >= 0 {
+			// add pending literal data
+			if literal < pos {
+				ops = append(ops, fsDeltaOp{Data: data[literal:pos]})
+			}
+
+			// add or extend copy
+			offset := uint32(match * blockSize)
+			if n := len(ops); n > 0 && ops[n-1].Copy && ops[n-1].Offset+ops[n-1].Length == offset {
+				ops[n-1].Length += uint32(blockSize)
+			} else {
+				ops = append(ops, fsDeltaOp{Copy: true, Offset: offset, Length: uint32(blockSize)})
+			}
+
+			// skip block
+			pos += blockSize
+			literal = pos
+			rolling = false
+
+			continue
+		}
+
+		// roll checksum by one byte
+		if pos+blockSize < len(data) {
+			out := uint32(data[pos])
+			a = a - out + uint32(data[pos+blockSize])
+			b = b - uint32(blockSize)*out + a
+		}
+		pos++
+	}
+
+	// add remaining literal data
+	if literal < len(data) {
+		ops = append(ops, fsDeltaOp{Data: data[literal:]})
+	}
+
+	return ops
+}
+
 func fsReceive(s *Session, expectAck bool, timeout time.Duration) ([]byte, error) {
 	// await reply
 	reply, err := s.Receive(fsEndpoint, expectAck, timeout)
@@ -340,12 +1059,200 @@ func fsReceive(s *Session, expectAck bool, timeout time.Duration) ([]byte, error
 		if len(reply) < 2 {
 			return nil, fmt.Errorf("invalid message: fs error reply")
 		}
-		return nil, fmt.Errorf("posix error: %d", reply[1])
+		return nil, FSError(reply[1])
 	}
 
 	return reply, nil
 }
 
+func fsWrite(s *Session, file string, flags uint8, data []byte, report func(uint32), timeout time.Duration) error {
+	// send "open" command
+	cmd := Pack("oos", uint8(2), flags, file)
+	err := fsSend(s, cmd, true, timeout)
+	if err != nil {
+		return err
+	}
+
+	// get width
+	width := s.Channel().Width()
+
+	// get MTU
+	mtu, err := s.GetMTU(time.Second)
+	if err != nil {
+		return err
+	}
+
+	// subtract overhead
+	mtu -= 6
+
+	// write data in chunks
+	num := 0
+	offset := 0
+	for offset < len(data) {
+		// determine chunk size and chunk data
+		chunkSize := min(int(mtu), len(data)-offset)
+		chunkData := data[offset : offset+chunkSize]
+
+		// determine mode
+		acked := num%width == 0 || offset+chunkSize >= len(data)
+
+		// prepare "write" command (sequential or silent & sequential)
+		cmd := Pack("ooib", uint8(4), b2v(acked, uint8(1<<1), uint8(1<<0|1<<1)), uint32(offset), chunkData)
+
+		// send "write" command
+		err = fsSend(s, cmd, false, 0)
+		if err != nil {
+			return err
+		}
+
+		// receive ack or "error" replies
+		if acked {
+			_, err := fsReceive(s, true, timeout)
+			if err != nil && !errors.Is(err, Ack) {
+				return err
+			}
+		}
+
+		// increment offset
+		offset += chunkSize
+
+		// report offset
+		if report != nil {
+			report(uint32(offset))
+		}
+
+		// increment count
+		num++
+	}
+
+	// send "close" command
+	cmd = Pack("o", uint8(5))
+	err = fsSend(s, cmd, true, timeout)
+	if err != nil {
+		return err
+	}
+
+	return nil
+}
+
+func fsReadLog(s *Session, name string, mode uint8, from, to int64, timeout time.Duration) ([]FSLogRecord, error) {
+	// send command
+	cmd := Pack("ooqqs", uint8(17), mode, uint64(from), uint64(to), name)
+	err := fsSend(s, cmd, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// prepare records
+	var records []FSLogRecord
+
+	for {
+		// await reply
+		reply, err := fsReceive(s, true, timeout)
+		if errors.Is(err, Ack) {
+			return records, nil
+		} else if err != nil {
+			return nil, err
+		}
+
+		// verify "records" reply
+		if len(reply) < 1 || reply[0] != 7 {
+			return nil, fmt.Errorf("invalid message: log reply")
+		}
+
+		// parse records
+		data := reply[1:]
+		for len(data) > 0 {
+			// get length
+			if len(data) < 14 {
+				return nil, fmt.Errorf("invalid message: log record")
+			}
+			length := int(binary.LittleEndian.Uint16(data[12:]))
+			if len(data) < 14+length {
+				return nil, fmt.Errorf("invalid message: log record")
+			}
+
+			// add record
+			records = append(records, FSLogRecord{
+				Seq:  binary.LittleEndian.Uint32(data),
+				Time: time.UnixMilli(int64(binary.LittleEndian.Uint64(data[4:]))),
+				Data: data[14 : 14+length],
+			})
+
+			// advance
+			data = data[14+length:]
+		}
+	}
+}
+
+func fsReceiveChunks(s *Session, offset uint32, report func(uint32), timeout time.Duration) ([]byte, error) {
+	// prepare data
+	var data []byte
+
+	for {
+		// await reply
+		reply, err := fsReceive(s, true, timeout)
+		if errors.Is(err, Ack) {
+			return data, nil
+		} else if err != nil {
+			return nil, err
+		}
+
+		// verify "chunk" reply
+		if len(reply) < 5 || reply[0] != 2 {
+			return nil, fmt.Errorf("invalid message: read reply")
+		}
+
+		// verify offset
+		if binary.LittleEndian.Uint32(reply[1:]) != offset+uint32(len(data)) {
+			return nil, fmt.Errorf("invalid offset")
+		}
+
+		// append data
+		data = append(data, reply[5:]...)
+
+		// report length
+		if report != nil {
+			report(uint32(len(data)))
+		}
+	}
+}
+
+func fsWriteHandle(s *Session, handle uint8, acked, sequential bool, offset uint32, data []byte, timeout time.Duration) error {
+	// prepare flags
+	var flags uint8
+	if !acked {
+		flags |= 1 << 0
+	}
+	if sequential {
+		flags |= 1 << 1
+	}
+
+	// send "write" command
+	cmd := Pack("oooib", uint8(15), handle, flags, offset, data)
+	err := fsSend(s, cmd, false, timeout)
+	if err != nil {
+		return err
+	}
+
+	// receive ack or "error" replies
+	if acked {
+		_, err := fsReceive(s, true, timeout)
+		if err != nil && !errors.Is(err, Ack) {
+			return err
+		}
+	}
+
+	return nil
+}
+
+func fsCloseFiles(files []*FSFile, timeout time.Duration) {
+	// close files ignoring errors
+	for _, file := range files {
+		_ = file.Close(timeout)
+	}
+}
+
 func fsSend(s *Session, data []byte, awaitAck bool, timeout time.Duration) error {
 	// send data
 	err := s.Send(fsEndpoint, data, 0)
@@ -2,6 +2,8 @@ package msg
 
 import (
 	"bytes"
+	"crypto/sha256"
+	"math"
 	"testing"
 	"time"
 
@@ -30,6 +32,35 @@ func TestStatPath(t *testing.T) {
 
 func TestListDir(t *testing.T) {
 	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oihis", uint8(12), uint32(0), uint16(0), uint32(0), "/")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oioiisooiiso", uint8(5), uint32(0),
+			uint8(0), uint32(42), uint32(1700000000), "file.txt", uint8(0),
+			uint8(1), uint32(0), uint32(1700000100), "subdir", uint8(0),
+		)}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	infos, err := ListDir(s, "/", time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []FSInfo{
+		{Name: "file.txt", IsDir: false, Size: 42, ModTime: time.Unix(1700000000, 0)},
+		{Name: "subdir", IsDir: true, Size: 0, ModTime: time.Unix(1700000100, 0)},
+	}, infos)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestListDirLegacy(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oihis", uint8(12), uint32(0), uint16(0), uint32(0), "/")}),
+		send(Message{Endpoint: 0xFE, Data: []byte{3}}),
 		receive(Message{Endpoint: fsEndpoint, Data: Pack("os", uint8(1), "/")}),
 		send(Message{Endpoint: fsEndpoint, Data: Pack("oois", uint8(1), uint8(0), uint32(42), "file.txt")}),
 		send(Message{Endpoint: fsEndpoint, Data: Pack("oois", uint8(1), uint8(1), uint32(0), "subdir")}),
@@ -53,6 +84,41 @@ func TestListDir(t *testing.T) {
 	assert.NoError(t, err)
 }
 
+func TestListDirAll(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		// first page
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oihisos", uint8(12), uint32(0), uint16(2), uint32(1700000000), "/logs", uint8(0), "*.log")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oioiiso", uint8(5), uint32(1), uint8(0), uint32(10), uint32(1700000001), "a.log", uint8(0))}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oioiiso", uint8(5), uint32(5), uint8(0), uint32(20), uint32(1700000002), "b.log", uint8(0))}),
+		ack(),
+		// second page
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oihisos", uint8(12), uint32(5), uint16(2), uint32(1700000000), "/logs", uint8(0), "*.log")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oioiiso", uint8(5), uint32(0), uint8(0), uint32(30), uint32(1700000003), "c.log", uint8(0))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	infos, err := ListDirAll(s, "/logs", FSListOptions{
+		Pattern: "*.log",
+		Since:   time.Unix(1700000000, 0),
+		Limit:   2,
+	}, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []FSInfo{
+		{Name: "a.log", Size: 10, ModTime: time.Unix(1700000001, 0)},
+		{Name: "b.log", Size: 20, ModTime: time.Unix(1700000002, 0)},
+		{Name: "c.log", Size: 30, ModTime: time.Unix(1700000003, 0)},
+	}, infos)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
 func TestReadFileRange(t *testing.T) {
 	fileData := []byte("0123456789")
 
@@ -198,3 +264,354 @@ func TestMakePath(t *testing.T) {
 	err = s.End(time.Second)
 	assert.NoError(t, err)
 }
+
+func TestHashFileBlocks(t *testing.T) {
+	strong := bytes.Repeat([]byte{0xAB}, 16)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ois", uint8(10), uint32(1024), "/test.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oiibib", uint8(4), uint32(0), uint32(1), strong, uint32(2), strong)}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oiib", uint8(4), uint32(2), uint32(3), strong)}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	hashes, err := HashFileBlocks(s, "/test.txt", 1024, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []FSBlockHash{
+		{Weak: 1, Strong: strong},
+		{Weak: 2, Strong: strong},
+		{Weak: 3, Strong: strong},
+	}, hashes)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestSyncFile(t *testing.T) {
+	oldData := []byte("AAAABBBB")
+	newData := []byte("AAAAxxBBBB")
+
+	blockHash := func(data []byte) []byte {
+		a, b := fsWeakSum(data)
+		sum := sha256.Sum256(data)
+		return append(Pack("i", (a&0xFFFF)|(b<<16)), sum[:16]...)
+	}
+
+	newHash := sha256.Sum256(newData)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		// stat
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("os", uint8(0), "/test.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("ooi", uint8(1), uint8(0), uint32(len(oldData)))}),
+		// hashes
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ois", uint8(10), uint32(4), "/test.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oibb", uint8(4), uint32(0), blockHash(oldData[:4]), blockHash(oldData[4:]))}),
+		ack(),
+		// create
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8((1<<0)|(1<<2)), "/test.txt.sync")}),
+		ack(),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(30))}),
+		// copy first block (acked)
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooiiis", uint8(11), uint8(0), uint32(0), uint32(0), uint32(4), "/test.txt")}),
+		ack(),
+		// write literal (silent & sequential)
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooib", uint8(4), uint8(3), uint32(4), []byte("xx"))}),
+		// copy second block (acked as last)
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooiiis", uint8(11), uint8(0), uint32(6), uint32(4), uint32(4), "/test.txt")}),
+		ack(),
+		// close
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("o", uint8(5))}),
+		ack(),
+		// verify
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("os", uint8(8), "/test.txt.sync")}),
+		send(Message{Endpoint: fsEndpoint, Data: append([]byte{3}, newHash[:]...)}),
+		// rename
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("osos", uint8(6), "/test.txt.sync", uint8(0), "/test.txt")}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	err = SyncFile(s, "/test.txt", newData, 4, nil, time.Second)
+	assert.NoError(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestArchiveDir(t *testing.T) {
+	archive := PackArchive([]FSArchiveEntry{
+		{Path: "sub", IsDir: true},
+		{Path: "sub/a.txt", Data: []byte("hello")},
+		{Path: "b.txt", Data: []byte("world!")},
+	})
+
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("os", uint8(13), "/data")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oib", uint8(2), uint32(0), archive[:20])}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oib", uint8(2), uint32(20), archive[20:])}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	data, err := ArchiveDir(s, "/data", nil, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, archive, data)
+
+	entries, err := UnpackArchive(data)
+	assert.NoError(t, err)
+	assert.Equal(t, []FSArchiveEntry{
+		{Path: "sub", IsDir: true, Data: []byte{}},
+		{Path: "sub/a.txt", Data: []byte("hello")},
+		{Path: "b.txt", Data: []byte("world!")},
+	}, entries)
+
+	_, err = UnpackArchive(data[:len(data)-1])
+	assert.Error(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestExtractArchive(t *testing.T) {
+	archive := PackArchive([]FSArchiveEntry{
+		{Path: "a.txt", Data: []byte("hello")},
+	})
+
+	dev := newTestDevice(t, 42, []testMessage{
+		// open for extraction
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<4), "/data")}),
+		ack(),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(100))}),
+		// single chunk
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooib", uint8(4), uint8(2), uint32(0), archive)}),
+		ack(),
+		// close and commit
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("o", uint8(5))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	err = ExtractArchive(s, "/data", archive, nil, time.Second)
+	assert.NoError(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestOpenFile(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		// open
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<0|1<<5), "/test.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(3))}),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(17))}),
+		// write, seeking first
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(3), uint8(0), uint32(5), []byte("0123456789"))}),
+		ack(),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(3), uint8(2), uint32(15), []byte("ab"))}),
+		ack(),
+		// read
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooii", uint8(14), uint8(3), uint32(5), uint32(0))}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oib", uint8(2), uint32(5), []byte("0123456789ab"))}),
+		ack(),
+		// close
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(3))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	file, err := OpenFile(s, "/test.txt", FSCreate, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, uint8(3), file.Handle())
+
+	err = file.Write(5, []byte("0123456789ab"), nil, time.Second)
+	assert.NoError(t, err)
+
+	data, err := file.Read(5, 0, nil, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []byte("0123456789ab"), data)
+
+	err = file.Close(time.Second)
+	assert.NoError(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestReadFiles(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		// open
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<5), "/a.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(0))}),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<5), "/b.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(1))}),
+		// pipelined reads
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooii", uint8(14), uint8(0), uint32(0), uint32(0))}),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooii", uint8(14), uint8(1), uint32(0), uint32(0))}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oib", uint8(2), uint32(0), []byte("hello"))}),
+		ack(),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oib", uint8(2), uint32(0), []byte("wor"))}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oib", uint8(2), uint32(3), []byte("ld"))}),
+		ack(),
+		// close
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(0))}),
+		ack(),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(1))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	data, err := ReadFiles(s, []string{"/a.txt", "/b.txt"}, nil, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, [][]byte{[]byte("hello"), []byte("world")}, data)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestWriteFiles(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		// open
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<0|1<<2|1<<5), "/a.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(0))}),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<0|1<<2|1<<5), "/b.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(1))}),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(11))}),
+		// interleaved chunks
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(0), uint8(2), uint32(0), []byte("aaaa"))}),
+		ack(),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(1), uint8(3), uint32(0), []byte("bbbb"))}),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(0), uint8(3), uint32(4), []byte("a"))}),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(1), uint8(2), uint32(4), []byte("b"))}),
+		ack(),
+		// close
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(0))}),
+		ack(),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(1))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	err = WriteFiles(s, map[string][]byte{
+		"/a.txt": []byte("aaaaa"),
+		"/b.txt": []byte("bbbbb"),
+	}, nil, time.Second)
+	assert.NoError(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestWriteFilesError(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		// open
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<0|1<<2|1<<5), "/a.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(0))}),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oos", uint8(2), uint8(1<<0|1<<2|1<<5), "/b.txt")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(6), uint8(1))}),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(11))}),
+		// failed chunk
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oooib", uint8(15), uint8(0), uint8(2), uint32(0), []byte("aaaa"))}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(0), uint8(28))}),
+		// close
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(0))}),
+		ack(),
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("oo", uint8(16), uint8(1))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	err = WriteFiles(s, map[string][]byte{
+		"/a.txt": []byte("aaaaa"),
+		"/b.txt": []byte("bbbbb"),
+	}, nil, time.Second)
+	assert.Error(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestReadLog(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		// by sequence
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooqqs", uint8(17), uint8(0), uint64(5), uint64(math.MaxUint32), "temp")}),
+		send(Message{Endpoint: fsEndpoint, Data: Pack("oiqhbiqhb", uint8(7),
+			uint32(5), uint64(1700000000000), uint16(2), []byte("ab"),
+			uint32(6), uint64(1700000001000), uint16(1), []byte("c"),
+		)}),
+		ack(),
+		// by time
+		receive(Message{Endpoint: fsEndpoint, Data: Pack("ooqqs", uint8(17), uint8(1), uint64(1700000001000), uint64(1700000002000), "temp")}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	records, err := ReadLog(s, "temp", 5, math.MaxUint32, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []FSLogRecord{
+		{Seq: 5, Time: time.UnixMilli(1700000000000), Data: []byte("ab")},
+		{Seq: 6, Time: time.UnixMilli(1700000001000), Data: []byte("c")},
+	}, records)
+
+	records, err = ReadLogTime(s, "temp", time.UnixMilli(1700000001000), time.UnixMilli(1700000002000), time.Second)
+	assert.NoError(t, err)
+	assert.Empty(t, records)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
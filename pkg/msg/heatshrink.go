@@ -0,0 +1,97 @@
+package msg
+
+const (
+	hsWindow    = 11
+	hsLookahead = 4
+)
+
+// hsEncode compresses the provided data into a heatshrink (LZSS) stream with
+// an 11 bit window and a 4 bit lookahead. Back references are searched using
+// hash chains over two byte prefixes.
+func hsEncode(data []byte) []byte {
+	// prepare chains
+	head := make([]int32, 1<<16)
+	for i := range head {
+		head[i] = -1
+	}
+	prev := make([]int32, len(data))
+
+	// prepare insert
+	insert := func(i int) {
+		if i+1 < len(data) {
+			key := int(data[i])<<8 | int(data[i+1])
+			prev[i] = head[key]
+			head[key] = int32(i)
+		}
+	}
+
+	// encode data
+	var w hsWriter
+	for i := 0; i < len(data); {
+		// find longest match
+		var bestLen, bestDist int
+		if i+1 < len(data) {
+			key := int(data[i])<<8 | int(data[i+1])
+			for j, n := int(head[key]), 0; j >= 0 && i-j <= 1<<hsWindow && n < 64; j, n = int(prev[j]), n+1 {
+				l := 0
+				for l < 1<<hsLookahead && i+l < len(data) && data[j+l] == data[i+l] {
+					l++
+				}
+				if l > bestLen {
+					bestLen, bestDist = l, i-j
+					if l == 1<<hsLookahead {
+						break
+					}
+				}
+			}
+		}
+
+		// write literal if no match is worthwhile
+		if bestLen < 2 {
+			w.write(1, 1)
+			w.write(int(data[i]), 8)
+			insert(i)
+			i++
+			continue
+		}
+
+		// write back reference
+		w.write(0, 1)
+		w.write(bestDist-1, hsWindow)
+		w.write(bestLen-1, hsLookahead)
+		for k := 0; k < bestLen; k++ {
+			insert(i + k)
+		}
+		i += bestLen
+	}
+
+	return w.flush()
+}
+
+type hsWriter struct {
+	buf   []byte
+	bits  uint32
+	count int
+}
+
+func (w *hsWriter) write(value, bits int) {
+	// append bits
+	w.bits = w.bits<<bits | uint32(value)&(1<<bits-1)
+	w.count += bits
+
+	// emit full bytes
+	for w.count >= 8 {
+		w.count -= 8
+		w.buf = append(w.buf, byte(w.bits>>w.count))
+	}
+}
+
+func (w *hsWriter) flush() []byte {
+	// pad last byte
+	if w.count > 0 {
+		w.buf = append(w.buf, byte(w.bits<<(8-w.count)))
+		w.count = 0
+	}
+
+	return w.buf
+}
@@ -5,6 +5,7 @@ import (
 	"errors"
 	"fmt"
 	"math"
+	"slices"
 	"time"
 )
 
@@ -17,8 +18,12 @@ type MetricKind uint8
 const (
 	MetricKindCounter MetricKind = iota
 	MetricKindGauge
+	MetricKindHistogram
 )
 
+// MetricBuckets is the number of buckets of a histogram metric.
+const MetricBuckets = 32
+
 // MetricType represents a metric type.
 type MetricType uint8
 
@@ -44,6 +49,58 @@ type MetricLayout struct {
 	Values [][]string
 }
 
+// MetricHistogram holds the buckets of a histogram metric. Bucket 0 counts
+// values below one and bucket i counts values in the range [2^(i-1), 2^i).
+type MetricHistogram struct {
+	Buckets [MetricBuckets]uint32
+	Sum     uint64
+}
+
+// Count returns the number of observed values.
+func (h *MetricHistogram) Count() uint64 {
+	var count uint64
+	for _, n := range h.Buckets {
+		count += uint64(n)
+	}
+	return count
+}
+
+// Mean returns the mean of the observed values.
+func (h *MetricHistogram) Mean() float64 {
+	count := h.Count()
+	if count == 0 {
+		return 0
+	}
+	return float64(h.Sum) / float64(count)
+}
+
+// Quantile estimates the q-quantile (0-1) of the observed values by linear
+// interpolation within the matching bucket.
+func (h *MetricHistogram) Quantile(q float64) float64 {
+	// get count
+	count := h.Count()
+	if count == 0 {
+		return 0
+	}
+
+	// find bucket of rank
+	rank := q * float64(count)
+	var seen float64
+	for i, n := range h.Buckets {
+		if n == 0 || seen+float64(n) < rank {
+			seen += float64(n)
+			continue
+		}
+		if i == 0 {
+			return 0
+		}
+		lower := math.Ldexp(1, i-1)
+		return lower + lower*(rank-seen)/float64(n)
+	}
+
+	return math.Ldexp(1, MetricBuckets-1)
+}
+
 // ListMetrics lists all metrics.
 func ListMetrics(s *Session, timeout time.Duration) ([]MetricInfo, error) {
 	// send command
@@ -168,8 +225,42 @@ func DescribeMetric(s *Session, ref uint8, timeout time.Duration) (*MetricLayout
 	}, nil
 }
 
-// ReadMetrics reads metrics.
+// ReadMetrics reads the raw values of a metric. Large metrics are received in
+// chunks, devices that do not support chunked reads are read using the legacy
+// command.
 func ReadMetrics(s *Session, ref uint8, timeout time.Duration) ([]byte, error) {
+	// send command
+	cmd := Pack("ooo", uint8(2), ref, uint8(1))
+	err := s.Send(metricsEndpoint, cmd, 0)
+	if err != nil {
+		return nil, err
+	}
+
+	// prepare data
+	var data []byte
+
+	for {
+		// receive chunk
+		reply, err := s.Receive(metricsEndpoint, true, timeout)
+		if errors.Is(err, Ack) {
+			return data, nil
+		} else if errors.Is(err, ErrSessionInvalidMessage) {
+			return readMetricsLegacy(s, ref, timeout)
+		} else if err != nil {
+			return nil, err
+		}
+
+		// verify chunk
+		if len(reply) < 2 {
+			return nil, errors.New("invalid reply")
+		}
+
+		// place chunk
+		data = placeMetricChunk(data, int(binary.LittleEndian.Uint16(reply)), reply[2:])
+	}
+}
+
+func readMetricsLegacy(s *Session, ref uint8, timeout time.Duration) ([]byte, error) {
 	// send command
 	cmd := Pack("oo", uint8(2), ref)
 	err := s.Send(metricsEndpoint, cmd, 0)
@@ -186,6 +277,281 @@ func ReadMetrics(s *Session, ref uint8, timeout time.Duration) ([]byte, error) {
 	return reply, nil
 }
 
+// ReadManyMetrics reads the raw values of multiple metrics in one request. If
+// no refs are provided, all metrics are read.
+func ReadManyMetrics(s *Session, refs []uint8, timeout time.Duration) (map[uint8][]byte, error) {
+	// send command
+	cmd := append([]byte{3}, refs...)
+	err := s.Send(metricsEndpoint, cmd, 0)
+	if err != nil {
+		return nil, err
+	}
+
+	// prepare values
+	values := map[uint8][]byte{}
+
+	for {
+		// receive frame
+		reply, err := s.Receive(metricsEndpoint, true, timeout)
+		if errors.Is(err, Ack) {
+			return values, nil
+		} else if err != nil {
+			return nil, err
+		}
+
+		// apply entries
+		_, err = applyMetricEntries(values, reply)
+		if err != nil {
+			return nil, err
+		}
+	}
+}
+
+// StreamMetrics subscribes to the specified metrics, or all if none are
+// provided, and calls fn with the full raw values of the metrics that changed
+// in each push. The device samples the metrics at the specified interval and
+// only pushes the changed values. The stream runs until stop is closed and
+// should use a dedicated session, as pushes are interleaved with replies.
+func StreamMetrics(s *Session, refs []uint8, interval time.Duration, stop chan struct{}, fn func(map[uint8][]byte)) error {
+	// prepare values
+	values := map[uint8][]byte{}
+
+	// subscribe
+	err := subscribeMetrics(s, refs, interval, values, fn)
+	if err != nil {
+		return err
+	}
+
+	// prepare state, the device checks for keepalives only when a push is due
+	// and may therefore stay silent for up to the interval
+	last := time.Now()
+	timeout := max(30*time.Second, 3*interval)
+
+	for {
+		// unsubscribe if requested
+		select {
+		case <-stop:
+			return subscribeMetrics(s, nil, 0, values, fn)
+		default:
+		}
+
+		// receive push
+		frame, err := s.Receive(metricsEndpoint, false, time.Second)
+		if err == nil {
+			err = yieldMetricEntries(values, frame, fn)
+			if err != nil {
+				return err
+			}
+			last = time.Now()
+			continue
+		}
+
+		// stop on any error except timeout
+		if !errors.Is(err, ErrTimeout) {
+			return err
+		}
+
+		// subscribe again if the device stopped sending keepalives
+		if time.Since(last) > timeout {
+			err = subscribeMetrics(s, refs, interval, values, fn)
+			if err != nil {
+				return err
+			}
+			last = time.Now()
+		}
+	}
+}
+
+func subscribeMetrics(s *Session, refs []uint8, interval time.Duration, values map[uint8][]byte, fn func(map[uint8][]byte)) error {
+	// clamp interval
+	ms := min(max(interval.Milliseconds(), 0), math.MaxUint16)
+	if interval > 0 && ms == 0 {
+		ms = 1
+	}
+
+	// send command
+	cmd := append(Pack("oh", uint8(4), uint16(ms)), refs...)
+	err := s.Send(metricsEndpoint, cmd, 0)
+	if err != nil {
+		return err
+	}
+
+	// yield pushes sent before the acknowledgement
+	for {
+		frame, err := s.Receive(metricsEndpoint, true, 5*time.Second)
+		if errors.Is(err, Ack) {
+			return nil
+		} else if err != nil {
+			return err
+		}
+		err = yieldMetricEntries(values, frame, fn)
+		if err != nil {
+			return err
+		}
+	}
+}
+
+func yieldMetricEntries(values map[uint8][]byte, frame []byte, fn func(map[uint8][]byte)) error {
+	// apply entries
+	changed, err := applyMetricEntries(values, frame)
+	if err != nil {
+		return err
+	}
+
+	// yield copies of the changed values, empty frames are keepalives
+	if len(changed) > 0 {
+		update := map[uint8][]byte{}
+		for _, ref := range changed {
+			update[ref] = append([]byte(nil), values[ref]...)
+		}
+		fn(update)
+	}
+
+	return nil
+}
+
+func applyMetricEntries(values map[uint8][]byte, frame []byte) ([]uint8, error) {
+	// parse entries: REF(1) | OFFSET(2) | LENGTH(2) | DATA(LENGTH)
+	var refs []uint8
+	for len(frame) > 0 {
+		if len(frame) < 5 {
+			return nil, errors.New("invalid reply")
+		}
+		ref := frame[0]
+		offset := int(binary.LittleEndian.Uint16(frame[1:]))
+		length := int(binary.LittleEndian.Uint16(frame[3:]))
+		if len(frame) < 5+length {
+			return nil, errors.New("invalid reply")
+		}
+		values[ref] = placeMetricChunk(values[ref], offset, frame[5:5+length])
+		if !slices.Contains(refs, ref) {
+			refs = append(refs, ref)
+		}
+		frame = frame[5+length:]
+	}
+
+	return refs, nil
+}
+
+// MetricTier describes a tier of a metric history.
+type MetricTier struct {
+	Period  time.Duration
+	Samples int // retained samples
+	Stored  int // currently stored samples
+}
+
+// MetricHistory holds a range of samples read from a metric history tier.
+type MetricHistory struct {
+	Period  time.Duration
+	Age     time.Duration // age of the newest sample
+	Samples [][]byte      // raw values, oldest first
+}
+
+// DescribeMetricHistory returns the history tiers of a metric. Metrics
+// without a history have no tiers.
+func DescribeMetricHistory(s *Session, ref uint8, timeout time.Duration) ([]MetricTier, error) {
+	// send command
+	err := s.Send(metricsEndpoint, Pack("oo", uint8(5), ref), 0)
+	if err != nil {
+		return nil, err
+	}
+
+	// receive reply
+	reply, err := s.Receive(metricsEndpoint, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// verify reply
+	if len(reply)%8 != 0 {
+		return nil, errors.New("invalid reply")
+	}
+
+	// parse tiers: PERIOD(4) | SAMPLES(2) | STORED(2)
+	var tiers []MetricTier
+	for i := 0; i < len(reply); i += 8 {
+		tiers = append(tiers, MetricTier{
+			Period:  time.Duration(binary.LittleEndian.Uint32(reply[i:])) * time.Millisecond,
+			Samples: int(binary.LittleEndian.Uint16(reply[i+4:])),
+			Stored:  int(binary.LittleEndian.Uint16(reply[i+6:])),
+		})
+	}
+
+	return tiers, nil
+}
+
+// ReadMetricHistory reads the samples of a metric history tier that are
+// between the specified ages.
+func ReadMetricHistory(s *Session, ref, tier uint8, from, to time.Duration, timeout time.Duration) (*MetricHistory, error) {
+	// clamp ages
+	ms := func(d time.Duration) uint32 {
+		return uint32(min(max(d.Milliseconds(), 0), math.MaxUint32))
+	}
+
+	// send command
+	err := s.Send(metricsEndpoint, Pack("oooii", uint8(6), ref, tier, ms(from), ms(to)), 0)
+	if err != nil {
+		return nil, err
+	}
+
+	// prepare data
+	var data []byte
+
+	for {
+		// receive chunk
+		reply, err := s.Receive(metricsEndpoint, true, timeout)
+		if errors.Is(err, Ack) {
+			break
+		} else if err != nil {
+			return nil, err
+		}
+
+		// verify chunk
+		if len(reply) < 4 {
+			return nil, errors.New("invalid reply")
+		}
+
+		// place chunk
+		data = placeMetricChunk(data, int(binary.LittleEndian.Uint32(reply)), reply[4:])
+	}
+
+	// parse header: PERIOD(4) | AGE(4) | COUNT(2)
+	if len(data) < 10 {
+		return nil, errors.New("invalid reply")
+	}
+	history := &MetricHistory{
+		Period: time.Duration(binary.LittleEndian.Uint32(data)) * time.Millisecond,
+		Age:    time.Duration(binary.LittleEndian.Uint32(data[4:])) * time.Millisecond,
+	}
+	count := int(binary.LittleEndian.Uint16(data[8:]))
+	data = data[10:]
+
+	// split samples
+	if count == 0 {
+		return history, nil
+	} else if len(data)%count != 0 {
+		return nil, errors.New("invalid reply")
+	}
+	size := len(data) / count
+	for i := 0; i < count; i++ {
+		history.Samples = append(history.Samples, data[i*size:(i+1)*size])
+	}
+
+	return history, nil
+}
+
+func placeMetricChunk(data []byte, offset int, chunk []byte) []byte {
+	// grow data
+	if end := offset + len(chunk); end > len(data) {
+		data = append(data, make([]byte, end-len(data))...)
+	}
+
+	// copy chunk
+	copy(data[offset:], chunk)
+
+	return data
+}
+
 // ReadLongMetrics reads long metrics.
 func ReadLongMetrics(s *Session, ref uint8, timeout time.Duration) ([]int32, error) {
 	// read metrics
@@ -193,6 +559,46 @@ func ReadLongMetrics(s *Session, ref uint8, timeout time.Duration) ([]int32, err
 	if err != nil {
 		return nil, err
 	}
+
+	return ParseLongMetrics(data)
+}
+
+// ReadFloatMetrics reads float metrics.
+func ReadFloatMetrics(s *Session, ref uint8, timeout time.Duration) ([]float32, error) {
+	// read metrics
+	data, err := ReadMetrics(s, ref, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	return ParseFloatMetrics(data)
+}
+
+// ReadDoubleMetrics reads double metrics.
+func ReadDoubleMetrics(s *Session, ref uint8, timeout time.Duration) ([]float64, error) {
+	// read metrics
+	data, err := ReadMetrics(s, ref, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	return ParseDoubleMetrics(data)
+}
+
+// ReadHistogramMetrics reads histogram metrics.
+func ReadHistogramMetrics(s *Session, ref uint8, timeout time.Duration) ([]MetricHistogram, error) {
+	// read metrics
+	data, err := ReadMetrics(s, ref, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	return ParseHistogramMetrics(data)
+}
+
+// ParseLongMetrics parses raw long metric values.
+func ParseLongMetrics(data []byte) ([]int32, error) {
+	// verify length
 	if len(data)%4 != 0 {
 		return nil, fmt.Errorf("invalid metric payload length: %d", len(data))
 	}
@@ -206,13 +612,9 @@ func ReadLongMetrics(s *Session, ref uint8, timeout time.Duration) ([]int32, err
 	return metrics, nil
 }
 
-// ReadFloatMetrics reads float metrics.
-func ReadFloatMetrics(s *Session, ref uint8, timeout time.Duration) ([]float32, error) {
-	// read metrics
-	data, err := ReadMetrics(s, ref, timeout)
-	if err != nil {
-		return nil, err
-	}
+// ParseFloatMetrics parses raw float metric values.
+func ParseFloatMetrics(data []byte) ([]float32, error) {
+	// verify length
 	if len(data)%4 != 0 {
 		return nil, fmt.Errorf("invalid metric payload length: %d", len(data))
 	}
@@ -226,13 +628,9 @@ func ReadFloatMetrics(s *Session, ref uint8, timeout time.Duration) ([]float32,
 	return metrics, nil
 }
 
-// ReadDoubleMetrics reads double metrics.
-func ReadDoubleMetrics(s *Session, ref uint8, timeout time.Duration) ([]float64, error) {
-	// read metrics
-	data, err := ReadMetrics(s, ref, timeout)
-	if err != nil {
-		return nil, err
-	}
+// ParseDoubleMetrics parses raw double metric values.
+func ParseDoubleMetrics(data []byte) ([]float64, error) {
+	// verify length
 	if len(data)%8 != 0 {
 		return nil, fmt.Errorf("invalid metric payload length: %d", len(data))
 	}
@@ -245,3 +643,25 @@ func ReadDoubleMetrics(s *Session, ref uint8, timeout time.Duration) ([]float64,
 
 	return metrics, nil
 }
+
+// ParseHistogramMetrics parses raw histogram metric values.
+func ParseHistogramMetrics(data []byte) ([]MetricHistogram, error) {
+	// verify length
+	width := MetricBuckets*4 + 8
+	if len(data)%width != 0 {
+		return nil, fmt.Errorf("invalid metric payload length: %d", len(data))
+	}
+
+	// parse metrics
+	var metrics []MetricHistogram
+	for i := 0; i < len(data); i += width {
+		var histogram MetricHistogram
+		for j := range histogram.Buckets {
+			histogram.Buckets[j] = binary.LittleEndian.Uint32(data[i+j*4:])
+		}
+		histogram.Sum = binary.LittleEndian.Uint64(data[i+MetricBuckets*4:])
+		metrics = append(metrics, histogram)
+	}
+
+	return metrics, nil
+}
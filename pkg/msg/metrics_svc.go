@@ -11,6 +11,12 @@ import (
 
 var ErrMetricNotFound = errors.New("metric not found")
 
+// MetricSample is a sample of a metric history.
+type MetricSample struct {
+	Time   time.Time
+	Values []float64
+}
+
 type MetricsService struct {
 	session *Session
 	infos   []MetricInfo
@@ -82,10 +88,174 @@ func (s *MetricsService) Read(name string) ([]float64, error) {
 		return nil, ErrMetricNotFound
 	}
 
+	// histograms are read using ReadHistograms
+	if metric.Kind == MetricKindHistogram {
+		return nil, fmt.Errorf("histogram metric: %s", name)
+	}
+
 	// read metrics
+	data, err := ReadMetrics(s.session, metric.Ref, 5*time.Second)
+	if err != nil {
+		return nil, err
+	}
+
+	return parseMetricValues(metric, data)
+}
+
+// ReadAll reads the values of all counter and gauge metrics in one request.
+// Devices that do not support batched reads are read metric by metric.
+func (s *MetricsService) ReadAll() (map[string][]float64, error) {
+	// read all metrics
+	raw, err := ReadManyMetrics(s.session, nil, 5*time.Second)
+	if errors.Is(err, ErrSessionUnknownMessage) {
+		raw = map[uint8][]byte{}
+		for _, metric := range s.infos {
+			if metric.Kind != MetricKindHistogram {
+				raw[metric.Ref], err = ReadMetrics(s.session, metric.Ref, 5*time.Second)
+				if err != nil {
+					return nil, err
+				}
+			}
+		}
+	} else if err != nil {
+		return nil, err
+	}
+
+	// parse values
+	values := map[string][]float64{}
+	for ref, data := range raw {
+		metric, ok := s.byRef[ref]
+		if !ok || metric.Kind == MetricKindHistogram {
+			continue
+		}
+		values[metric.Name], err = parseMetricValues(metric, data)
+		if err != nil {
+			return nil, err
+		}
+	}
+
+	return values, nil
+}
+
+func (s *MetricsService) ReadHistograms(name string) ([]MetricHistogram, error) {
+	// get ref
+	metric, ok := s.byName[name]
+	if !ok {
+		return nil, ErrMetricNotFound
+	}
+
+	// check kind
+	if metric.Kind != MetricKindHistogram {
+		return nil, fmt.Errorf("not a histogram metric: %s", name)
+	}
+
+	return ReadHistogramMetrics(s.session, metric.Ref, 5*time.Second)
+}
+
+// Stream pushes the values of all counter and gauge metrics that changed at
+// the specified interval until stop is closed. Devices that do not support
+// subscriptions are polled instead.
+func (s *MetricsService) Stream(interval time.Duration, stop chan struct{}, fn func(name string, values []float64)) error {
+	// collect non-histogram metrics
+	var refs []uint8
+	for _, metric := range s.infos {
+		if metric.Kind != MetricKindHistogram {
+			refs = append(refs, metric.Ref)
+		}
+	}
+	if len(refs) == 0 {
+		return nil
+	}
+
+	// stream metrics
+	var parseErr error
+	err := StreamMetrics(s.session, refs, interval, stop, func(raw map[uint8][]byte) {
+		for ref, data := range raw {
+			metric, ok := s.byRef[ref]
+			if !ok || parseErr != nil {
+				continue
+			}
+			values, err := parseMetricValues(metric, data)
+			if err != nil {
+				parseErr = err
+				continue
+			}
+			fn(metric.Name, values)
+		}
+	})
+	if errors.Is(err, ErrSessionUnknownMessage) {
+		return s.poll(interval, stop, fn)
+	} else if err != nil {
+		return err
+	} else if parseErr != nil {
+		return parseErr
+	}
+
+	return nil
+}
+
+func (s *MetricsService) poll(interval time.Duration, stop chan struct{}, fn func(name string, values []float64)) error {
+	// prepare ticker
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		// read and yield all metrics
+		values, err := s.ReadAll()
+		if err != nil {
+			return err
+		}
+		for name, list := range values {
+			fn(name, list)
+		}
+
+		// await next tick
+		select {
+		case <-stop:
+			return nil
+		case <-ticker.C:
+		}
+	}
+}
+
+// History reads the samples of a metric history tier recorded since the
+// specified time. The sample times are derived from the local clock.
+func (s *MetricsService) History(name string, tier uint8, since time.Time) ([]MetricSample, error) {
+	// get ref
+	metric, ok := s.byName[name]
+	if !ok {
+		return nil, ErrMetricNotFound
+	}
+
+	// read history
+	now := time.Now()
+	history, err := ReadMetricHistory(s.session, metric.Ref, tier, now.Sub(since), 0, 10*time.Second)
+	if err != nil {
+		return nil, err
+	}
+
+	// parse samples
+	samples := make([]MetricSample, 0, len(history.Samples))
+	for i, data := range history.Samples {
+		values, err := parseMetricValues(metric, data)
+		if err != nil {
+			return nil, err
+		}
+		age := history.Age + time.Duration(len(history.Samples)-1-i)*history.Period
+		samples = append(samples, MetricSample{
+			Time:   now.Add(-age),
+			Values: values,
+		})
+	}
+
+	return samples, nil
+}
+
+func parseMetricValues(metric MetricInfo, data []byte) ([]float64, error) {
+	// parse values
 	switch metric.Type {
 	case MetricTypeLong:
-		values, err := ReadLongMetrics(s.session, metric.Ref, 5*time.Second)
+		values, err := ParseLongMetrics(data)
 		if err != nil {
 			return nil, err
 		}
@@ -93,7 +263,7 @@ func (s *MetricsService) Read(name string) ([]float64, error) {
 			return float64(value)
 		}), nil
 	case MetricTypeFloat:
-		values, err := ReadFloatMetrics(s.session, metric.Ref, 5*time.Second)
+		values, err := ParseFloatMetrics(data)
 		if err != nil {
 			return nil, err
 		}
@@ -101,11 +271,7 @@ func (s *MetricsService) Read(name string) ([]float64, error) {
 			return float64(value)
 		}), nil
 	case MetricTypeDouble:
-		values, err := ReadDoubleMetrics(s.session, metric.Ref, 5*time.Second)
-		if err != nil {
-			return nil, err
-		}
-		return values, nil
+		return ParseDoubleMetrics(data)
 	default:
 		return nil, fmt.Errorf("unknown metric type: %d", metric.Type)
 	}
@@ -85,8 +85,9 @@ func TestReadLongMetrics(t *testing.T) {
 	binary.LittleEndian.PutUint32(data[4:], uint32(v))
 
 	dev := newTestDevice(t, 42, []testMessage{
-		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
-		send(Message{Endpoint: metricsEndpoint, Data: data}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: append([]byte{0, 0}, data...)}),
+		ack(),
 	})
 
 	ch, err := dev.Open()
@@ -105,8 +106,9 @@ func TestReadLongMetrics(t *testing.T) {
 
 func TestReadLongMetricsInvalidPayloadLength(t *testing.T) {
 	dev := newTestDevice(t, 42, []testMessage{
-		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
-		send(Message{Endpoint: metricsEndpoint, Data: []byte{1, 2, 3}}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 1, 2, 3}}),
+		ack(),
 	})
 
 	ch, err := dev.Open()
@@ -126,8 +128,9 @@ func TestReadFloatMetrics(t *testing.T) {
 	binary.LittleEndian.PutUint32(data[4:], math.Float32bits(2.5))
 
 	dev := newTestDevice(t, 42, []testMessage{
-		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
-		send(Message{Endpoint: metricsEndpoint, Data: data}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: append([]byte{0, 0}, data...)}),
+		ack(),
 	})
 
 	ch, err := dev.Open()
@@ -146,8 +149,9 @@ func TestReadFloatMetrics(t *testing.T) {
 
 func TestReadFloatMetricsInvalidPayloadLength(t *testing.T) {
 	dev := newTestDevice(t, 42, []testMessage{
-		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
-		send(Message{Endpoint: metricsEndpoint, Data: []byte{1, 2, 3}}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 1, 2, 3}}),
+		ack(),
 	})
 
 	ch, err := dev.Open()
@@ -167,8 +171,9 @@ func TestReadDoubleMetrics(t *testing.T) {
 	binary.LittleEndian.PutUint64(data[8:], math.Float64bits(2.5))
 
 	dev := newTestDevice(t, 42, []testMessage{
-		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
-		send(Message{Endpoint: metricsEndpoint, Data: data}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: append([]byte{0, 0}, data...)}),
+		ack(),
 	})
 
 	ch, err := dev.Open()
@@ -187,8 +192,9 @@ func TestReadDoubleMetrics(t *testing.T) {
 
 func TestReadDoubleMetricsInvalidPayloadLength(t *testing.T) {
 	dev := newTestDevice(t, 42, []testMessage{
-		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
-		send(Message{Endpoint: metricsEndpoint, Data: []byte{1, 2, 3, 4, 5, 6, 7}}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 1, 2, 3, 4, 5, 6, 7}}),
+		ack(),
 	})
 
 	ch, err := dev.Open()
@@ -201,3 +207,195 @@ func TestReadDoubleMetricsInvalidPayloadLength(t *testing.T) {
 	assert.Error(t, err)
 	assert.Nil(t, metrics)
 }
+
+func TestReadHistogramMetrics(t *testing.T) {
+	data := make([]byte, 2*(MetricBuckets*4+8))
+	binary.LittleEndian.PutUint32(data[0*4:], 1)  // 0
+	binary.LittleEndian.PutUint32(data[4*4:], 2)  // 8-15
+	binary.LittleEndian.PutUint32(data[11*4:], 1) // 1024-2047
+	binary.LittleEndian.PutUint64(data[MetricBuckets*4:], 1050)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: append([]byte{0, 0}, data...)}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	metrics, err := ReadHistogramMetrics(s, 1, time.Second)
+	assert.NoError(t, err)
+	assert.Len(t, metrics, 2)
+	assert.Equal(t, uint64(4), metrics[0].Count())
+	assert.Equal(t, uint64(1050), metrics[0].Sum)
+	assert.Equal(t, 262.5, metrics[0].Mean())
+	assert.Equal(t, 12.0, metrics[0].Quantile(0.5))
+	assert.Equal(t, 1024.0+1024*0.96, metrics[0].Quantile(0.99))
+	assert.Equal(t, uint64(0), metrics[1].Count())
+	assert.Equal(t, 0.0, metrics[1].Quantile(0.5))
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestReadMetricsChunked(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 1, 0, 0, 0, 2, 0}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{6, 0, 0, 0, 3, 0, 0, 0}}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	metrics, err := ReadLongMetrics(s, 1, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []int32{1, 2, 3}, metrics)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestReadMetricsLegacy(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("ooo", uint8(2), uint8(1), uint8(1))}),
+		send(Message{Endpoint: 0xFE, Data: []byte{2}}),
+		receive(Message{Endpoint: metricsEndpoint, Data: Pack("oo", uint8(2), uint8(1))}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{7, 0, 0, 0}}),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	metrics, err := ReadLongMetrics(s, 1, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []int32{7}, metrics)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestReadManyMetrics(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: []byte{3, 0, 1}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 0, 4, 0, 7, 0, 0, 0, 1, 0, 0, 2, 0, 1, 0}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{1, 2, 0, 2, 0, 0, 0}}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	values, err := ReadManyMetrics(s, []uint8{0, 1}, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, map[uint8][]byte{
+		0: {7, 0, 0, 0},
+		1: {1, 0, 0, 0},
+	}, values)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestStreamMetrics(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: []byte{4, 100, 0, 0, 1}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 0, 8, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 4, 0, 3, 0, 0, 0}}),
+		ack(),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 4, 0, 4, 0, 9, 0, 0, 0}}),
+		receive(Message{Endpoint: metricsEndpoint, Data: []byte{4, 0, 0}}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	var updates []map[uint8][]byte
+	stop := make(chan struct{})
+	err = StreamMetrics(s, []uint8{0, 1}, 100*time.Millisecond, stop, func(values map[uint8][]byte) {
+		updates = append(updates, values)
+		if len(updates) == 2 {
+			close(stop)
+		}
+	})
+	assert.NoError(t, err)
+	assert.Equal(t, []map[uint8][]byte{
+		{
+			0: {1, 0, 0, 0, 2, 0, 0, 0},
+			1: {3, 0, 0, 0},
+		},
+		{
+			0: {1, 0, 0, 0, 9, 0, 0, 0},
+		},
+	}, updates)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestDescribeMetricHistory(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: []byte{5, 0}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0xE8, 0x03, 0, 0, 0x2C, 0x01, 7, 0, 0x60, 0xEA, 0, 0, 0xA0, 0x05, 0, 0}}),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	tiers, err := DescribeMetricHistory(s, 0, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []MetricTier{
+		{Period: time.Second, Samples: 300, Stored: 7},
+		{Period: time.Minute, Samples: 1440, Stored: 0},
+	}, tiers)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestReadMetricHistory(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: metricsEndpoint, Data: []byte{6, 0, 1, 0xE8, 0x03, 0, 0, 0, 0, 0, 0}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{0, 0, 0, 0, 0x64, 0, 0, 0, 0x32, 0, 0, 0, 2, 0, 1, 0}}),
+		send(Message{Endpoint: metricsEndpoint, Data: []byte{12, 0, 0, 0, 0, 0, 2, 0, 0, 0}}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	history, err := ReadMetricHistory(s, 0, 1, time.Second, 0, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, &MetricHistory{
+		Period:  100 * time.Millisecond,
+		Age:     50 * time.Millisecond,
+		Samples: [][]byte{{1, 0, 0, 0}, {2, 0, 0, 0}},
+	}, history)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
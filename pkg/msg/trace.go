@@ -6,6 +6,7 @@ import (
 	"encoding/json"
 	"errors"
 	"fmt"
+	"sort"
 	"time"
 )
 
@@ -21,8 +22,14 @@ const (
 	TraceBegin      TraceEventType = 3
 	TraceEnd        TraceEventType = 4
 	TraceValue      TraceEventType = 5
+	TraceAlloc      TraceEventType = 6
+	TraceFree       TraceEventType = 7
+	TraceReady      TraceEventType = 8
 )
 
+// traceCompactOffset maps the compact record types to the event types.
+const traceCompactOffset = 8
+
 // TraceTask describes a task in the trace task table.
 type TraceTask struct {
 	ID   uint8
@@ -37,15 +44,19 @@ type TraceLabel struct {
 
 // TraceEvent represents a single trace event.
 type TraceEvent struct {
-	Timestamp uint32         // microseconds since trace start
+	Timestamp uint64         // microseconds since trace start
 	Type      TraceEventType // event type
 	Core      uint8          // CPU core (SWITCH only)
-	Task      uint8          // task ID (SWITCH only)
+	Task      uint8          // task ID (SWITCH/READY/ALLOC only, 255 if none)
 	Cat       uint8          // category label ID (INSTANT/BEGIN only)
 	Name      uint8          // name label ID (INSTANT/BEGIN/VALUE only)
 	Arg       uint16         // user argument (INSTANT/BEGIN only)
 	Span      uint8          // span instance ID (BEGIN/END only)
 	Value     int32          // counter/gauge value (VALUE only)
+	Ptr       uint32         // heap block address (ALLOC/FREE only)
+	Size      uint32         // allocated bytes (ALLOC only)
+	Caps      uint32         // heap capabilities (ALLOC only)
+	Caller    uint32         // allocation site (ALLOC only, 0 if unknown)
 }
 
 // TraceStatus represents the trace buffer status.
@@ -54,6 +65,8 @@ type TraceStatus struct {
 	BufSize uint32
 	BufUsed uint32
 	Dropped uint32
+	Mode    TraceMode
+	Frozen  bool
 }
 
 // TraceData holds the result of a trace read operation.
@@ -75,9 +88,35 @@ const (
 	TraceEvents TraceFlags = 1 << 4 // instant events
 	TraceValues TraceFlags = 1 << 5 // counter values
 	TraceSpans  TraceFlags = 1 << 6 // begin/end spans
+	TraceHeap   TraceFlags = 1 << 7 // heap allocations (if enabled in firmware)
 	TraceAll    TraceFlags = 0xFF   // capture everything
 )
 
+// TraceMode selects how the device buffers trace records.
+type TraceMode uint8
+
+// The available trace modes.
+const (
+	TraceBuffer   TraceMode = 0 // drop new records when full
+	TraceStream   TraceMode = 1 // push records to the session
+	TraceRecorder TraceMode = 2 // overwrite the oldest records until frozen
+)
+
+// TraceTrigger selects the condition that freezes a recording.
+type TraceTrigger uint8
+
+// The available trace triggers.
+const (
+	TraceTriggerNone  TraceTrigger = 0 // disarm trigger
+	TraceTriggerEvent TraceTrigger = 1 // named event is recorded
+	TraceTriggerAbove TraceTrigger = 2 // named value reaches threshold
+	TraceTriggerBelow TraceTrigger = 3 // named value falls to threshold
+)
+
+// traceStreamCredits is the number of chunks a streaming device may send
+// ahead of the client.
+const traceStreamCredits = 16
+
 // StartTrace begins trace recording. The flags select which records are
 // captured; pass TraceAll to capture everything.
 func StartTrace(s *Session, flags TraceFlags, timeout time.Duration) error {
@@ -90,12 +129,128 @@ func StartTrace(s *Session, flags TraceFlags, timeout time.Duration) error {
 	return s.Send(traceEndpoint, cmd, timeout)
 }
 
+// StartTraceMode begins trace recording in the specified mode. Use
+// StreamTrace to receive a streaming trace.
+func StartTraceMode(s *Session, flags TraceFlags, mode TraceMode, timeout time.Duration) error {
+	// use plain start for the default mode
+	if mode == TraceBuffer {
+		return StartTrace(s, flags, timeout)
+	}
+	return s.Send(traceEndpoint, []byte{0, byte(flags), byte(mode)}, timeout)
+}
+
+// SetTraceTrigger arms a trigger that freezes the recording when the named
+// event is recorded or the named value crosses the threshold. The trigger must
+// be set after the trace has been started.
+func SetTraceTrigger(s *Session, trigger TraceTrigger, name string, threshold int32, timeout time.Duration) error {
+	return s.Send(traceEndpoint, Pack("oois", uint8(5), uint8(trigger), uint32(threshold), name), timeout)
+}
+
+// StreamTrace starts a streaming trace and yields received records until the
+// stop channel is closed. The device pushes records as they are recorded and
+// is granted chunks as they are received. Each chunk holds the records of a
+// single core, the events of a chunk are ordered by timestamp.
+func StreamTrace(s *Session, flags TraceFlags, stop chan struct{}, fn func(*TraceData)) error {
+	// start stream
+	err := StartTraceMode(s, flags, TraceStream, 5*time.Second)
+	if err != nil {
+		return err
+	}
+
+	// grant initial credits
+	err = s.Send(traceEndpoint, Pack("oh", uint8(4), uint16(traceStreamCredits)), 0)
+	if err != nil {
+		return err
+	}
+
+	// prepare state
+	received := 0
+	last := time.Now()
+
+	for {
+		// stop trace if requested
+		select {
+		case <-stop:
+			return stopTraceStream(s, fn)
+		default:
+		}
+
+		// receive chunk
+		chunk, err := s.Receive(traceEndpoint, false, time.Second)
+		if err == nil {
+			// parse and yield records
+			data := &TraceData{}
+			err = parseTraceRecords(chunk, data)
+			if err != nil {
+				return err
+			}
+			sortTraceEvents(data.Events)
+			fn(data)
+
+			// replenish credits once half are used
+			received++
+			last = time.Now()
+			if received >= traceStreamCredits/2 {
+				err = s.Send(traceEndpoint, Pack("oh", uint8(4), uint16(received)), 0)
+				if err != nil {
+					return err
+				}
+				received = 0
+			}
+
+			continue
+		}
+
+		// stop on any error except timeout
+		if !errors.Is(err, ErrTimeout) {
+			return err
+		}
+
+		// keep the session alive with an empty grant
+		if time.Since(last) > 10*time.Second {
+			err = s.Send(traceEndpoint, Pack("oh", uint8(4), uint16(0)), 0)
+			if err != nil {
+				return err
+			}
+			last = time.Now()
+		}
+	}
+}
+
+func stopTraceStream(s *Session, fn func(*TraceData)) error {
+	// send STOP command
+	err := s.Send(traceEndpoint, []byte{1}, 0)
+	if err != nil {
+		return err
+	}
+
+	// yield chunks pushed before the acknowledgement
+	for {
+		chunk, err := s.Receive(traceEndpoint, true, 5*time.Second)
+		if errors.Is(err, Ack) {
+			return nil
+		} else if err != nil {
+			return err
+		}
+		data := &TraceData{}
+		err = parseTraceRecords(chunk, data)
+		if err != nil {
+			return err
+		}
+		sortTraceEvents(data.Events)
+		fn(data)
+	}
+}
+
 // StopTrace stops trace recording.
 func StopTrace(s *Session, timeout time.Duration) error {
 	return s.Send(traceEndpoint, []byte{1}, timeout)
 }
 
-// ReadTrace reads buffered trace events and any new task/label mappings.
+// ReadTrace reads buffered trace events and any new task/label mappings. The
+// device streams the buffers of its cores one after another, the events are
+// merged by timestamp. Reading a flight recording freezes it and includes all
+// known task/label mappings.
 func ReadTrace(s *Session, timeout time.Duration) (*TraceData, error) {
 	// send READ command
 	err := s.Send(traceEndpoint, []byte{2}, 0)
@@ -123,20 +278,45 @@ func ReadTrace(s *Session, timeout time.Duration) (*TraceData, error) {
 		}
 	}
 
+	// merge events by timestamp
+	sortTraceEvents(data.Events)
+
 	return data, nil
 }
 
+func sortTraceEvents(events []TraceEvent) {
+	// sort stable to keep the order of events within a core
+	sort.SliceStable(events, func(i, j int) bool {
+		return events[i].Timestamp < events[j].Timestamp
+	})
+}
+
 func parseTraceRecords(buf []byte, data *TraceData) error {
+	// prepare state of compact records
+	var core uint8
+	var now uint64
+	synced := false
+
+	// prepare varint reader
+	varint := func(pos int) (uint64, int) {
+		value, n := binary.Uvarint(buf[pos:])
+		if n <= 0 {
+			return 0, 0
+		}
+		return value, n
+	}
+
 	pos := 0
 	for pos < len(buf) {
 		remaining := len(buf) - pos
 		switch buf[pos] {
+		// fixed-size records with absolute timestamps of older firmware
 		case 1: // SWITCH: TYPE(1) TS(4) CORE(1) ID(1) = 7
 			if remaining < 7 {
 				return fmt.Errorf("truncated SWITCH record")
 			}
 			data.Events = append(data.Events, TraceEvent{
-				Timestamp: binary.LittleEndian.Uint32(buf[pos+1:]),
+				Timestamp: uint64(binary.LittleEndian.Uint32(buf[pos+1:])),
 				Type:      TraceTaskSwitch,
 				Core:      buf[pos+5],
 				Task:      buf[pos+6],
@@ -148,7 +328,7 @@ func parseTraceRecords(buf []byte, data *TraceData) error {
 				return fmt.Errorf("truncated EVENT record")
 			}
 			data.Events = append(data.Events, TraceEvent{
-				Timestamp: binary.LittleEndian.Uint32(buf[pos+1:]),
+				Timestamp: uint64(binary.LittleEndian.Uint32(buf[pos+1:])),
 				Type:      TraceInstant,
 				Cat:       buf[pos+5],
 				Name:      buf[pos+6],
@@ -161,7 +341,7 @@ func parseTraceRecords(buf []byte, data *TraceData) error {
 				return fmt.Errorf("truncated BEGIN record")
 			}
 			data.Events = append(data.Events, TraceEvent{
-				Timestamp: binary.LittleEndian.Uint32(buf[pos+1:]),
+				Timestamp: uint64(binary.LittleEndian.Uint32(buf[pos+1:])),
 				Type:      TraceBegin,
 				Cat:       buf[pos+5],
 				Name:      buf[pos+6],
@@ -175,7 +355,7 @@ func parseTraceRecords(buf []byte, data *TraceData) error {
 				return fmt.Errorf("truncated END record")
 			}
 			data.Events = append(data.Events, TraceEvent{
-				Timestamp: binary.LittleEndian.Uint32(buf[pos+1:]),
+				Timestamp: uint64(binary.LittleEndian.Uint32(buf[pos+1:])),
 				Type:      TraceEnd,
 				Span:      buf[pos+5],
 			})
@@ -186,7 +366,7 @@ func parseTraceRecords(buf []byte, data *TraceData) error {
 				return fmt.Errorf("truncated VALUE record")
 			}
 			data.Events = append(data.Events, TraceEvent{
-				Timestamp: binary.LittleEndian.Uint32(buf[pos+1:]),
+				Timestamp: uint64(binary.LittleEndian.Uint32(buf[pos+1:])),
 				Type:      TraceValue,
 				Cat:       buf[pos+5],
 				Name:      buf[pos+6],
@@ -222,6 +402,104 @@ func parseTraceRecords(buf []byte, data *TraceData) error {
 			})
 			pos += 2 + nulIdx + 1
 
+		case 8: // SYNC: TYPE(1) CORE(1) TIME(8) = 10
+			if remaining < 10 {
+				return fmt.Errorf("truncated SYNC record")
+			}
+			core = buf[pos+1]
+			now = binary.LittleEndian.Uint64(buf[pos+2:])
+			synced = true
+			pos += 10
+
+		case 9, 10, 11, 12, 13, 14, 15, 16: // SWITCH, EVENT, BEGIN, END, VALUE, ALLOC, FREE, READY: TYPE(1) DELTA(v) ...
+			if !synced {
+				return fmt.Errorf("missing SYNC record at offset %d", pos)
+			}
+
+			// read delta
+			typ := TraceEventType(buf[pos] - traceCompactOffset)
+			delta, n := varint(pos + 1)
+			if n == 0 {
+				return fmt.Errorf("truncated record at offset %d", pos)
+			}
+			now += delta
+			end := pos + 1 + n
+
+			// read fields
+			event := TraceEvent{Timestamp: now, Type: typ}
+			switch typ {
+			case TraceTaskSwitch: // ID(1)
+				if end+1 > len(buf) {
+					return fmt.Errorf("truncated SWITCH record")
+				}
+				event.Core = core
+				event.Task = buf[end]
+				end++
+			case TraceReady: // ID(1)
+				if end+1 > len(buf) {
+					return fmt.Errorf("truncated READY record")
+				}
+				event.Task = buf[end]
+				end++
+			case TraceEnd: // ID(1)
+				if end+1 > len(buf) {
+					return fmt.Errorf("truncated END record")
+				}
+				event.Span = buf[end]
+				end++
+			case TraceAlloc: // PTR(4) SIZE(v) CAPS(v) CALLER(4) TASK(1)
+				if end+4 > len(buf) {
+					return fmt.Errorf("truncated ALLOC record")
+				}
+				event.Ptr = binary.LittleEndian.Uint32(buf[end:])
+				size, n := varint(end + 4)
+				if n == 0 {
+					return fmt.Errorf("truncated ALLOC record")
+				}
+				end += 4 + n
+				caps, n := varint(end)
+				if n == 0 || end+n+5 > len(buf) {
+					return fmt.Errorf("truncated ALLOC record")
+				}
+				end += n
+				event.Size = uint32(size)
+				event.Caps = uint32(caps)
+				event.Caller = binary.LittleEndian.Uint32(buf[end:])
+				event.Task = buf[end+4]
+				end += 5
+			case TraceFree: // PTR(4)
+				if end+4 > len(buf) {
+					return fmt.Errorf("truncated FREE record")
+				}
+				event.Ptr = binary.LittleEndian.Uint32(buf[end:])
+				end += 4
+			default: // CAT(1) NAME(1) ARG(v)/VAL(zv) ID(1)?
+				if end+2 > len(buf) {
+					return fmt.Errorf("truncated record at offset %d", pos)
+				}
+				event.Cat = buf[end]
+				event.Name = buf[end+1]
+				value, n := varint(end + 2)
+				if n == 0 {
+					return fmt.Errorf("truncated record at offset %d", pos)
+				}
+				end += 2 + n
+				if typ == TraceValue {
+					event.Value = int32(uint32(value>>1) ^ -uint32(value&1))
+				} else {
+					event.Arg = uint16(value)
+				}
+				if typ == TraceBegin {
+					if end+1 > len(buf) {
+						return fmt.Errorf("truncated BEGIN record")
+					}
+					event.Span = buf[end]
+					end++
+				}
+			}
+			data.Events = append(data.Events, event)
+			pos = end
+
 		default:
 			return fmt.Errorf("unknown record type: %d at offset %d", buf[pos], pos)
 		}
@@ -229,6 +507,97 @@ func parseTraceRecords(buf []byte, data *TraceData) error {
 	return nil
 }
 
+// EncodeTrace encodes trace data into the compact record format sent by
+// devices. The result can be stored as a trace file that loads without any
+// conversion using DecodeTrace.
+func EncodeTrace(tasks map[uint8]string, labels map[uint8]string, events []TraceEvent) []byte {
+	var buf []byte
+
+	// merge events by timestamp
+	events = append([]TraceEvent(nil), events...)
+	sortTraceEvents(events)
+
+	// write tables ordered by ID
+	for _, table := range []struct {
+		typ   byte
+		names map[uint8]string
+	}{{7, tasks}, {6, labels}} {
+		for id := 0; id < 256; id++ {
+			if name, ok := table.names[uint8(id)]; ok {
+				buf = append(buf, table.typ, uint8(id))
+				buf = append(append(buf, name...), 0)
+			}
+		}
+	}
+
+	// prepare state of compact records
+	var core uint8
+	var now uint64
+	synced := false
+
+	// write records
+	for _, e := range events {
+		// write SYNC record on first record and core changes
+		if !synced || e.Type == TraceTaskSwitch && e.Core != core {
+			if e.Type == TraceTaskSwitch {
+				core = e.Core
+			}
+			buf = append(buf, 8, core)
+			buf = binary.LittleEndian.AppendUint64(buf, e.Timestamp)
+			now = e.Timestamp
+			synced = true
+		}
+
+		// write type and delta
+		buf = append(buf, byte(e.Type)+traceCompactOffset)
+		buf = binary.AppendUvarint(buf, e.Timestamp-now)
+		now = e.Timestamp
+
+		// write fields
+		switch e.Type {
+		case TraceTaskSwitch, TraceReady:
+			buf = append(buf, e.Task)
+		case TraceEnd:
+			buf = append(buf, e.Span)
+		case TraceAlloc:
+			buf = binary.LittleEndian.AppendUint32(buf, e.Ptr)
+			buf = binary.AppendUvarint(buf, uint64(e.Size))
+			buf = binary.AppendUvarint(buf, uint64(e.Caps))
+			buf = binary.LittleEndian.AppendUint32(buf, e.Caller)
+			buf = append(buf, e.Task)
+		case TraceFree:
+			buf = binary.LittleEndian.AppendUint32(buf, e.Ptr)
+		case TraceValue:
+			buf = append(buf, e.Cat, e.Name)
+			buf = binary.AppendUvarint(buf, uint64(uint32(e.Value<<1)^uint32(e.Value>>31)))
+		default:
+			buf = append(buf, e.Cat, e.Name)
+			buf = binary.AppendUvarint(buf, uint64(e.Arg))
+			if e.Type == TraceBegin {
+				buf = append(buf, e.Span)
+			}
+		}
+	}
+
+	return buf
+}
+
+// DecodeTrace decodes a trace file written by EncodeTrace or the concatenated
+// chunks of a device read. The events are merged by timestamp.
+func DecodeTrace(buf []byte) (*TraceData, error) {
+	// parse records
+	data := &TraceData{}
+	err := parseTraceRecords(buf, data)
+	if err != nil {
+		return nil, err
+	}
+
+	// merge events by timestamp
+	sortTraceEvents(data.Events)
+
+	return data, nil
+}
+
 // GetTraceStatus returns the current trace buffer status.
 func GetTraceStatus(s *Session, timeout time.Duration) (*TraceStatus, error) {
 	// send STATUS command
@@ -243,25 +612,85 @@ func GetTraceStatus(s *Session, timeout time.Duration) (*TraceStatus, error) {
 		return nil, err
 	}
 
-	// verify reply: ACTIVE(1) | BUF_SIZE(4) | BUF_USED(4) | DROPPED(4)
-	if len(reply) != 13 {
+	// verify reply: ACTIVE(1) | BUF_SIZE(4) | BUF_USED(4) | DROPPED(4) | MODE(1)? | FROZEN(1)?
+	if len(reply) != 13 && len(reply) != 15 {
 		return nil, fmt.Errorf("invalid status reply length: %d", len(reply))
 	}
 
-	return &TraceStatus{
+	// parse status
+	status := &TraceStatus{
 		Active:  reply[0] != 0,
 		BufSize: binary.LittleEndian.Uint32(reply[1:]),
 		BufUsed: binary.LittleEndian.Uint32(reply[5:]),
 		Dropped: binary.LittleEndian.Uint32(reply[9:]),
-	}, nil
+	}
+	if len(reply) == 15 {
+		status.Mode = TraceMode(reply[13])
+		status.Frozen = reply[14] != 0
+	}
+
+	return status, nil
+}
+
+// TraceHotspot summarizes the allocations of a single call site.
+type TraceHotspot struct {
+	Caller uint32 // allocation site (0 if unknown)
+	Count  int    // number of allocations
+	Bytes  uint64 // allocated bytes
+	Live   int64  // bytes still allocated at the end of the trace
+}
+
+// TraceHeapHotspots aggregates the allocation events by call site, ordered by
+// allocated bytes. Frees of blocks allocated before the trace are ignored.
+func TraceHeapHotspots(events []TraceEvent) []TraceHotspot {
+	// merge events by timestamp
+	events = append([]TraceEvent(nil), events...)
+	sortTraceEvents(events)
+
+	// aggregate by caller
+	spots := map[uint32]*TraceHotspot{}
+	blocks := map[uint32]TraceEvent{}
+	for _, e := range events {
+		switch e.Type {
+		case TraceAlloc:
+			spot := spots[e.Caller]
+			if spot == nil {
+				spot = &TraceHotspot{Caller: e.Caller}
+				spots[e.Caller] = spot
+			}
+			spot.Count++
+			spot.Bytes += uint64(e.Size)
+			spot.Live += int64(e.Size)
+			blocks[e.Ptr] = e
+		case TraceFree:
+			if block, ok := blocks[e.Ptr]; ok {
+				delete(blocks, e.Ptr)
+				spots[block.Caller].Live -= int64(block.Size)
+			}
+		}
+	}
+
+	// sort by allocated bytes
+	list := make([]TraceHotspot, 0, len(spots))
+	for _, spot := range spots {
+		list = append(list, *spot)
+	}
+	sort.Slice(list, func(i, j int) bool {
+		if list[i].Bytes != list[j].Bytes {
+			return list[i].Bytes > list[j].Bytes
+		}
+		return list[i].Caller < list[j].Caller
+	})
+
+	return list
 }
 
 type perfettoEvent struct {
 	Name string         `json:"name"`
 	Cat  string         `json:"cat,omitempty"`
 	Ph   string         `json:"ph"`
-	Ts   uint32         `json:"ts"`
-	Dur  uint32         `json:"dur,omitempty"`
+	Ts   uint64         `json:"ts"`
+	Dur  uint64         `json:"dur,omitempty"`
 	Pid  uint32         `json:"pid"`
 	Tid  uint32         `json:"tid,omitempty"`
 	Args map[string]any `json:"args,omitempty"`
@@ -269,10 +698,15 @@ type perfettoEvent struct {
 
 // GeneratePerfetto converts trace data into the Chrome Trace Event Format
 // (compatible with Perfetto). Task names and labels are provided as maps
-// built from accumulated reads during the trace recording.
+// built from accumulated reads during the trace recording. Events are merged
+// by timestamp as consecutive reads may overlap across cores.
 func GeneratePerfetto(tasks map[uint8]string, labels map[uint8]string, events []TraceEvent) ([]byte, error) {
 	var out []perfettoEvent
 
+	// merge events by timestamp
+	events = append([]TraceEvent(nil), events...)
+	sortTraceEvents(events)
+
 	// make tid unique per core so Perfetto doesn't merge threads
 	// across processes (it keys thread_name by tid alone)
 	makeTid := func(core uint8, task uint8) uint32 {
@@ -373,6 +807,51 @@ func GeneratePerfetto(tasks map[uint8]string, labels map[uint8]string, events []
 		})
 	}
 
+	// add process and thread metadata for heap tracks and allocation sites
+	callers := map[uint32]bool{}
+	for _, e := range events {
+		if e.Type == TraceAlloc && !callers[e.Caller] {
+			if len(callers) == 0 {
+				out = append(out, perfettoEvent{
+					Name: "process_name",
+					Ph:   "M",
+					Pid:  8,
+					Args: map[string]any{"name": "Heap"},
+				}, perfettoEvent{
+					Name: "process_name",
+					Ph:   "M",
+					Pid:  9,
+					Args: map[string]any{"name": "Allocations"},
+				})
+			}
+			callers[e.Caller] = true
+			out = append(out, perfettoEvent{
+				Name: "thread_name",
+				Ph:   "M",
+				Pid:  9,
+				Tid:  e.Caller,
+				Args: map[string]any{"name": fmt.Sprintf("0x%08x", e.Caller)},
+			})
+		}
+	}
+
+	// track live heap blocks and bytes per allocating task
+	type heapBlock struct {
+		size uint32
+		task uint8
+	}
+	blocks := map[uint32]heapBlock{}
+	live := map[uint8]int64{}
+	var liveTotal int64
+	heapName := func(task uint8) string {
+		if task == 255 {
+			return "none"
+		} else if name := tasks[task]; name != "" {
+			return name
+		}
+		return fmt.Sprintf("task-%d", task)
+	}
+
 	// track open spans for END matching
 	type spanInfo struct {
 		cat  uint8
@@ -382,7 +861,7 @@ func GeneratePerfetto(tasks map[uint8]string, labels map[uint8]string, events []
 
 	// convert events to Perfetto spans and markers
 	type pending struct {
-		ts   uint32
+		ts   uint64
 		task uint8
 	}
 	last := map[uint8]*pending{}
@@ -477,6 +956,56 @@ func GeneratePerfetto(tasks map[uint8]string, labels map[uint8]string, events []
 					name: e.Value,
 				},
 			})
+
+		case TraceAlloc, TraceFree:
+			// update live bytes, frees of blocks allocated before the trace are
+			// ignored
+			var task uint8
+			if e.Type == TraceAlloc {
+				blocks[e.Ptr] = heapBlock{size: e.Size, task: e.Task}
+				live[e.Task] += int64(e.Size)
+				liveTotal += int64(e.Size)
+				task = e.Task
+			} else if block, ok := blocks[e.Ptr]; ok {
+				delete(blocks, e.Ptr)
+				live[block.task] -= int64(block.size)
+				liveTotal -= int64(block.size)
+				task = block.task
+			} else {
+				continue
+			}
+
+			// add live heap counters
+			out = append(out, perfettoEvent{
+				Name: heapName(task),
+				Ph:   "C",
+				Ts:   e.Timestamp,
+				Pid:  8,
+				Args: map[string]any{"bytes": live[task]},
+			}, perfettoEvent{
+				Name: "total",
+				Ph:   "C",
+				Ts:   e.Timestamp,
+				Pid:  8,
+				Args: map[string]any{"bytes": liveTotal},
+			})
+
+			// add allocation marker on the track of its call site
+			if e.Type == TraceAlloc {
+				out = append(out, perfettoEvent{
+					Name: "alloc",
+					Cat:  "heap",
+					Ph:   "i",
+					Ts:   e.Timestamp,
+					Pid:  9,
+					Tid:  e.Caller,
+					Args: map[string]any{
+						"size": e.Size,
+						"caps": fmt.Sprintf("0x%x", e.Caps),
+						"task": heapName(e.Task),
+					},
+				})
+			}
 		}
 	}
 
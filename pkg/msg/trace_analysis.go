@@ -0,0 +1,303 @@
+package msg
+
+import (
+	"fmt"
+	"math"
+	"math/bits"
+	"sort"
+)
+
+// TraceTaskCPU summarizes the execution of a task on a core.
+type TraceTaskCPU struct {
+	Core     uint8
+	Task     uint8
+	Name     string
+	Time     uint64  // microseconds running
+	Share    float64 // fraction of the traced core time
+	Switches int     // number of times switched in
+}
+
+// TraceLatency summarizes the scheduling latencies of a task, measured from
+// the task becoming ready to running on a core.
+type TraceLatency struct {
+	Task  uint8
+	Name  string
+	Count int
+	P50   uint64
+	P90   uint64
+	P99   uint64
+	Max   uint64
+}
+
+// TraceSpanStats summarizes the durations of the spans with the same category
+// and name.
+type TraceSpanStats struct {
+	Category string
+	Name     string
+	Count    int
+	Total    uint64
+	Min      uint64
+	P50      uint64
+	P90      uint64
+	P99      uint64
+	Max      uint64
+
+	// Histogram counts the durations in power-of-two buckets. Bucket 0 holds
+	// zero durations and bucket i durations in [2^(i-1), 2^i) microseconds.
+	Histogram []int
+}
+
+// TraceCounterStats summarizes the values of a counter.
+type TraceCounterStats struct {
+	Category string
+	Name     string
+	Count    int
+	Min      int32
+	Max      int32
+	Mean     float64
+	Last     int32
+}
+
+// TraceAnalysis holds the analyses computed from trace events.
+type TraceAnalysis struct {
+	Start    uint64 // first timestamp
+	End      uint64 // last timestamp
+	CPU      []TraceTaskCPU
+	Latency  []TraceLatency
+	Spans    []TraceSpanStats
+	Counters []TraceCounterStats
+	Hotspots []TraceHotspot
+}
+
+// AnalyzeTrace computes the per-task CPU time per core, the scheduling
+// latencies, the span durations, the counter statistics and the heap hotspots
+// of the provided events. Task names and labels are resolved using the
+// provided maps. Scheduling latencies require the READY records of newer
+// firmware.
+func AnalyzeTrace(tasks map[uint8]string, labels map[uint8]string, events []TraceEvent) *TraceAnalysis {
+	// prepare analysis
+	analysis := &TraceAnalysis{}
+	if len(events) == 0 {
+		return analysis
+	}
+
+	// merge events by timestamp
+	events = append([]TraceEvent(nil), events...)
+	sortTraceEvents(events)
+	analysis.Start = events[0].Timestamp
+	analysis.End = events[len(events)-1].Timestamp
+
+	// prepare name helpers
+	taskName := func(task uint8) string {
+		if name := tasks[task]; name != "" {
+			return name
+		}
+		return fmt.Sprintf("task-%d", task)
+	}
+	labelName := func(label uint8) string {
+		if name := labels[label]; name != "" {
+			return name
+		}
+		return fmt.Sprintf("label-%d", label)
+	}
+
+	// prepare state
+	type coreTask struct {
+		core uint8
+		task uint8
+	}
+	type running struct {
+		task  uint8
+		since uint64
+	}
+	type catName struct {
+		cat  uint8
+		name uint8
+	}
+	type openSpan struct {
+		key   catName
+		begin uint64
+	}
+	cpu := map[coreTask]*TraceTaskCPU{}
+	cores := map[uint8]running{}
+	coreStart := map[uint8]uint64{}
+	ready := map[uint8]uint64{}
+	latencies := map[uint8][]uint64{}
+	spans := map[uint8]openSpan{}
+	durations := map[catName][]uint64{}
+	counters := map[catName]*TraceCounterStats{}
+	sums := map[catName]float64{}
+
+	// prepare CPU accounting
+	account := func(core uint8, until uint64) {
+		if prev, ok := cores[core]; ok {
+			key := coreTask{core, prev.task}
+			if cpu[key] == nil {
+				cpu[key] = &TraceTaskCPU{Core: core, Task: prev.task, Name: taskName(prev.task)}
+			}
+			cpu[key].Time += until - prev.since
+		}
+	}
+
+	// process events
+	for _, e := range events {
+		switch e.Type {
+		case TraceTaskSwitch:
+			// account previous task
+			account(e.Core, e.Timestamp)
+			if _, ok := coreStart[e.Core]; !ok {
+				coreStart[e.Core] = e.Timestamp
+			}
+
+			// count switch
+			key := coreTask{e.Core, e.Task}
+			if cpu[key] == nil {
+				cpu[key] = &TraceTaskCPU{Core: e.Core, Task: e.Task, Name: taskName(e.Task)}
+			}
+			cpu[key].Switches++
+			cores[e.Core] = running{task: e.Task, since: e.Timestamp}
+
+			// measure latency since the task became ready
+			if since, ok := ready[e.Task]; ok {
+				delete(ready, e.Task)
+				latencies[e.Task] = append(latencies[e.Task], e.Timestamp-since)
+			}
+
+		case TraceReady:
+			// keep the earliest ready time until the task runs
+			if _, ok := ready[e.Task]; !ok {
+				ready[e.Task] = e.Timestamp
+			}
+
+		case TraceBegin:
+			spans[e.Span] = openSpan{key: catName{e.Cat, e.Name}, begin: e.Timestamp}
+
+		case TraceEnd:
+			// spans begun before the trace are ignored
+			if span, ok := spans[e.Span]; ok {
+				delete(spans, e.Span)
+				durations[span.key] = append(durations[span.key], e.Timestamp-span.begin)
+			}
+
+		case TraceValue:
+			key := catName{e.Cat, e.Name}
+			stats := counters[key]
+			if stats == nil {
+				stats = &TraceCounterStats{
+					Category: labelName(e.Cat),
+					Name:     labelName(e.Name),
+					Min:      e.Value,
+					Max:      e.Value,
+				}
+				counters[key] = stats
+			}
+			stats.Count++
+			stats.Min = min(stats.Min, e.Value)
+			stats.Max = max(stats.Max, e.Value)
+			stats.Last = e.Value
+			sums[key] += float64(e.Value)
+		}
+	}
+
+	// account running tasks until the end of the trace
+	for core := range cores {
+		account(core, analysis.End)
+	}
+
+	// compute CPU shares
+	for _, stats := range cpu {
+		if total := analysis.End - coreStart[stats.Core]; total > 0 {
+			stats.Share = float64(stats.Time) / float64(total)
+		}
+		analysis.CPU = append(analysis.CPU, *stats)
+	}
+	sort.Slice(analysis.CPU, func(i, j int) bool {
+		a, b := analysis.CPU[i], analysis.CPU[j]
+		if a.Core != b.Core {
+			return a.Core < b.Core
+		}
+		if a.Time != b.Time {
+			return a.Time > b.Time
+		}
+		return a.Task < b.Task
+	})
+
+	// compute latency percentiles
+	for task, list := range latencies {
+		sortTraceDurations(list)
+		analysis.Latency = append(analysis.Latency, TraceLatency{
+			Task:  task,
+			Name:  taskName(task),
+			Count: len(list),
+			P50:   tracePercentile(list, 0.5),
+			P90:   tracePercentile(list, 0.9),
+			P99:   tracePercentile(list, 0.99),
+			Max:   list[len(list)-1],
+		})
+	}
+	sort.Slice(analysis.Latency, func(i, j int) bool {
+		a, b := analysis.Latency[i], analysis.Latency[j]
+		if a.P99 != b.P99 {
+			return a.P99 > b.P99
+		}
+		return a.Task < b.Task
+	})
+
+	// compute span statistics and histograms
+	for key, list := range durations {
+		sortTraceDurations(list)
+		stats := TraceSpanStats{
+			Category: labelName(key.cat),
+			Name:     labelName(key.name),
+			Count:    len(list),
+			Min:      list[0],
+			P50:      tracePercentile(list, 0.5),
+			P90:      tracePercentile(list, 0.9),
+			P99:      tracePercentile(list, 0.99),
+			Max:      list[len(list)-1],
+		}
+		stats.Histogram = make([]int, bits.Len64(stats.Max)+1)
+		for _, d := range list {
+			stats.Total += d
+			stats.Histogram[bits.Len64(d)]++
+		}
+		analysis.Spans = append(analysis.Spans, stats)
+	}
+	sort.Slice(analysis.Spans, func(i, j int) bool {
+		a, b := analysis.Spans[i], analysis.Spans[j]
+		if a.Total != b.Total {
+			return a.Total > b.Total
+		}
+		return a.Category+a.Name < b.Category+b.Name
+	})
+
+	// compute counter means
+	for key, stats := range counters {
+		stats.Mean = sums[key] / float64(stats.Count)
+		analysis.Counters = append(analysis.Counters, *stats)
+	}
+	sort.Slice(analysis.Counters, func(i, j int) bool {
+		a, b := analysis.Counters[i], analysis.Counters[j]
+		if a.Category != b.Category {
+			return a.Category < b.Category
+		}
+		return a.Name < b.Name
+	})
+
+	// aggregate heap hotspots
+	analysis.Hotspots = TraceHeapHotspots(events)
+
+	return analysis
+}
+
+func sortTraceDurations(list []uint64) {
+	sort.Slice(list, func(i, j int) bool {
+		return list[i] < list[j]
+	})
+}
+
+func tracePercentile(sorted []uint64, p float64) uint64 {
+	// use the nearest rank
+	rank := int(math.Ceil(p*float64(len(sorted)))) - 1
+	return sorted[max(rank, 0)]
+}
@@ -0,0 +1,400 @@
+package msg
+
+import (
+	"bufio"
+	"encoding/binary"
+	"fmt"
+	"io"
+)
+
+// The used Perfetto protobuf field numbers (see perfetto/protos/perfetto/trace).
+const (
+	pbTracePacket = 1
+
+	pbPacketTimestamp        = 8
+	pbPacketSequenceID       = 10
+	pbPacketTrackEvent       = 11
+	pbPacketTrackDescriptor  = 60
+	pbDescriptorUUID         = 1
+	pbDescriptorName         = 2
+	pbDescriptorProcess      = 3
+	pbDescriptorThread       = 4
+	pbDescriptorParentUUID   = 5
+	pbDescriptorCounter      = 8
+	pbProcessPID             = 1
+	pbProcessName            = 6
+	pbThreadPID              = 1
+	pbThreadTID              = 2
+	pbThreadName             = 5
+	pbEventAnnotations       = 4
+	pbEventType              = 9
+	pbEventTrackUUID         = 11
+	pbEventCategories        = 22
+	pbEventName              = 23
+	pbEventCounterValue      = 30
+	pbAnnotationName         = 10
+	pbAnnotationUintValue    = 3
+	pbAnnotationStringValue  = 6
+	pbEventTypeSliceBegin    = 1
+	pbEventTypeSliceEnd      = 2
+	pbEventTypeInstant       = 3
+	pbEventTypeCounter       = 4
+	pbTrustedSequenceDefault = 1
+)
+
+// The track UUID namespaces, the low bits hold the track specific IDs.
+const (
+	perfettoCoreTrack    = 1 << 56
+	perfettoTaskTrack    = 2 << 56
+	perfettoCatTrack     = 3 << 56
+	perfettoNameTrack    = 4 << 56
+	perfettoValueTrack   = 5 << 56
+	perfettoHeapTrack    = 6 << 56
+	perfettoLiveTrack    = 7 << 56
+	perfettoAllocTrack   = 8 << 56
+	perfettoCallerTrack  = 9 << 56
+	perfettoHeapTotalTag = 0x100
+)
+
+func pbVarint(b []byte, field int, value uint64) []byte {
+	b = binary.AppendUvarint(b, uint64(field)<<3)
+	return binary.AppendUvarint(b, value)
+}
+
+func pbBytes(b []byte, field int, value []byte) []byte {
+	b = binary.AppendUvarint(b, uint64(field)<<3|2)
+	b = binary.AppendUvarint(b, uint64(len(value)))
+	return append(b, value...)
+}
+
+func pbString(b []byte, field int, value string) []byte {
+	return pbBytes(b, field, []byte(value))
+}
+
+type perfettoWriter struct {
+	out    *bufio.Writer
+	tracks map[uint64]bool
+	buf    []byte
+}
+
+func (w *perfettoWriter) packet(body []byte) error {
+	// append sequence and write packet as a repeated trace field
+	body = pbVarint(body, pbPacketSequenceID, pbTrustedSequenceDefault)
+	w.buf = pbBytes(w.buf[:0], pbTracePacket, body)
+	_, err := w.out.Write(w.buf)
+	return err
+}
+
+func (w *perfettoWriter) track(uuid uint64, desc func([]byte) []byte) error {
+	// check track
+	if w.tracks[uuid] {
+		return nil
+	}
+	w.tracks[uuid] = true
+
+	// write descriptor
+	body := pbVarint(nil, pbDescriptorUUID, uuid)
+	body = desc(body)
+	return w.packet(pbBytes(nil, pbPacketTrackDescriptor, body))
+}
+
+func (w *perfettoWriter) event(ts uint64, uuid uint64, typ uint64, fields func([]byte) []byte) error {
+	// prepare event
+	body := pbVarint(nil, pbEventType, typ)
+	body = pbVarint(body, pbEventTrackUUID, uuid)
+	if fields != nil {
+		body = fields(body)
+	}
+
+	// write packet with nanosecond timestamp
+	pkt := pbVarint(nil, pbPacketTimestamp, ts*1000)
+	return w.packet(pbBytes(pkt, pbPacketTrackEvent, body))
+}
+
+// WritePerfetto streams trace data as a native Perfetto protobuf trace. Task
+// names and labels are provided as maps built from accumulated reads during
+// the trace recording. Unlike GeneratePerfetto, counters are written to
+// dedicated counter tracks and the output can be loaded directly by the
+// Perfetto UI and trace processor.
+func WritePerfetto(w io.Writer, tasks map[uint8]string, labels map[uint8]string, events []TraceEvent) error {
+	// prepare writer
+	pw := &perfettoWriter{
+		out:    bufio.NewWriter(w),
+		tracks: map[uint64]bool{},
+	}
+
+	// merge events by timestamp
+	events = append([]TraceEvent(nil), events...)
+	sortTraceEvents(events)
+
+	// prepare name helpers
+	taskName := func(task uint8) string {
+		if task == 255 {
+			return "none"
+		} else if name := tasks[task]; name != "" {
+			return name
+		}
+		return fmt.Sprintf("task-%d", task)
+	}
+	labelName := func(label uint8) string {
+		if name := labels[label]; name != "" {
+			return name
+		}
+		return fmt.Sprintf("label-%d", label)
+	}
+
+	// prepare track helpers
+	taskTrack := func(core, task uint8) (uint64, error) {
+		// ensure core process
+		coreUUID := perfettoCoreTrack | uint64(core)
+		err := pw.track(coreUUID, func(b []byte) []byte {
+			proc := pbVarint(nil, pbProcessPID, uint64(core)+1)
+			proc = pbString(proc, pbProcessName, fmt.Sprintf("Core %d", core))
+			return pbBytes(b, pbDescriptorProcess, proc)
+		})
+		if err != nil {
+			return 0, err
+		}
+
+		// ensure task thread, keep tid unique across cores
+		uuid := perfettoTaskTrack | uint64(core)<<8 | uint64(task)
+		return uuid, pw.track(uuid, func(b []byte) []byte {
+			thread := pbVarint(nil, pbThreadPID, uint64(core)+1)
+			thread = pbVarint(thread, pbThreadTID, (uint64(core)+1)*1000+uint64(task)+1)
+			thread = pbString(thread, pbThreadName, taskName(task))
+			return pbBytes(b, pbDescriptorThread, thread)
+		})
+	}
+	labelTrack := func(cat, name uint8, counter bool) (uint64, error) {
+		// ensure category track
+		catUUID := perfettoCatTrack | uint64(cat)
+		err := pw.track(catUUID, func(b []byte) []byte {
+			return pbString(b, pbDescriptorName, labelName(cat))
+		})
+		if err != nil {
+			return 0, err
+		}
+
+		// ensure name track
+		uuid := perfettoNameTrack | uint64(cat)<<8 | uint64(name)
+		if counter {
+			uuid = perfettoValueTrack | uint64(cat)<<8 | uint64(name)
+		}
+		return uuid, pw.track(uuid, func(b []byte) []byte {
+			b = pbVarint(b, pbDescriptorParentUUID, catUUID)
+			b = pbString(b, pbDescriptorName, labelName(name))
+			if counter {
+				b = pbBytes(b, pbDescriptorCounter, nil)
+			}
+			return b
+		})
+	}
+	heapTrack := func(task uint8, total bool) (uint64, error) {
+		// ensure heap track
+		err := pw.track(perfettoHeapTrack, func(b []byte) []byte {
+			return pbString(b, pbDescriptorName, "Heap")
+		})
+		if err != nil {
+			return 0, err
+		}
+
+		// ensure counter track of task or total
+		uuid := perfettoLiveTrack | uint64(task)
+		name := taskName(task)
+		if total {
+			uuid = perfettoLiveTrack | perfettoHeapTotalTag
+			name = "total"
+		}
+		return uuid, pw.track(uuid, func(b []byte) []byte {
+			b = pbVarint(b, pbDescriptorParentUUID, perfettoHeapTrack)
+			b = pbString(b, pbDescriptorName, name)
+			return pbBytes(b, pbDescriptorCounter, nil)
+		})
+	}
+	callerTrack := func(caller uint32) (uint64, error) {
+		// ensure allocations track
+		err := pw.track(perfettoAllocTrack, func(b []byte) []byte {
+			return pbString(b, pbDescriptorName, "Allocations")
+		})
+		if err != nil {
+			return 0, err
+		}
+
+		// ensure call site track
+		uuid := perfettoCallerTrack | uint64(caller)
+		return uuid, pw.track(uuid, func(b []byte) []byte {
+			b = pbVarint(b, pbDescriptorParentUUID, perfettoAllocTrack)
+			return pbString(b, pbDescriptorName, fmt.Sprintf("0x%08x", caller))
+		})
+	}
+
+	// prepare field helpers
+	named := func(cat string, name string, arg uint16) func([]byte) []byte {
+		return func(b []byte) []byte {
+			b = pbString(b, pbEventCategories, cat)
+			b = pbString(b, pbEventName, name)
+			if arg != 0 {
+				ann := pbString(nil, pbAnnotationName, "arg")
+				ann = pbVarint(ann, pbAnnotationUintValue, uint64(arg))
+				b = pbBytes(b, pbEventAnnotations, ann)
+			}
+			return b
+		}
+	}
+	counter := func(value int64) func([]byte) []byte {
+		return func(b []byte) []byte {
+			return pbVarint(b, pbEventCounterValue, uint64(value))
+		}
+	}
+
+	// track running tasks per core
+	type running struct {
+		task  uint8
+		track uint64
+	}
+	cores := map[uint8]running{}
+
+	// track open spans for END matching
+	spans := map[uint8]uint64{}
+
+	// track live heap blocks and bytes per allocating task
+	type heapBlock struct {
+		size uint32
+		task uint8
+	}
+	blocks := map[uint32]heapBlock{}
+	live := map[uint8]int64{}
+	var liveTotal int64
+
+	// convert events
+	var now uint64
+	for _, e := range events {
+		now = e.Timestamp
+		var err error
+		switch e.Type {
+		case TraceTaskSwitch:
+			// end slice of previous task on this core
+			if prev, ok := cores[e.Core]; ok {
+				err = pw.event(e.Timestamp, prev.track, pbEventTypeSliceEnd, nil)
+				if err != nil {
+					return err
+				}
+			}
+
+			// begin slice of next task
+			var uuid uint64
+			uuid, err = taskTrack(e.Core, e.Task)
+			if err != nil {
+				return err
+			}
+			cores[e.Core] = running{task: e.Task, track: uuid}
+			err = pw.event(e.Timestamp, uuid, pbEventTypeSliceBegin, named("task", taskName(e.Task), 0))
+
+		case TraceBegin:
+			var uuid uint64
+			uuid, err = labelTrack(e.Cat, e.Name, false)
+			if err != nil {
+				return err
+			}
+			spans[e.Span] = uuid
+			err = pw.event(e.Timestamp, uuid, pbEventTypeSliceBegin, named(labelName(e.Cat), labelName(e.Name), e.Arg))
+
+		case TraceEnd:
+			// spans begun before the trace are ignored
+			if uuid, ok := spans[e.Span]; ok {
+				delete(spans, e.Span)
+				err = pw.event(e.Timestamp, uuid, pbEventTypeSliceEnd, nil)
+			}
+
+		case TraceInstant:
+			var uuid uint64
+			uuid, err = labelTrack(e.Cat, e.Name, false)
+			if err != nil {
+				return err
+			}
+			err = pw.event(e.Timestamp, uuid, pbEventTypeInstant, named(labelName(e.Cat), labelName(e.Name), e.Arg))
+
+		case TraceValue:
+			var uuid uint64
+			uuid, err = labelTrack(e.Cat, e.Name, true)
+			if err != nil {
+				return err
+			}
+			err = pw.event(e.Timestamp, uuid, pbEventTypeCounter, counter(int64(e.Value)))
+
+		case TraceAlloc, TraceFree:
+			// update live bytes, frees of blocks allocated before the trace are
+			// ignored
+			var task uint8
+			if e.Type == TraceAlloc {
+				blocks[e.Ptr] = heapBlock{size: e.Size, task: e.Task}
+				live[e.Task] += int64(e.Size)
+				liveTotal += int64(e.Size)
+				task = e.Task
+			} else if block, ok := blocks[e.Ptr]; ok {
+				delete(blocks, e.Ptr)
+				live[block.task] -= int64(block.size)
+				liveTotal -= int64(block.size)
+				task = block.task
+			} else {
+				continue
+			}
+
+			// write live heap counters
+			var uuid uint64
+			uuid, err = heapTrack(task, false)
+			if err != nil {
+				return err
+			}
+			err = pw.event(e.Timestamp, uuid, pbEventTypeCounter, counter(live[task]))
+			if err != nil {
+				return err
+			}
+			uuid, err = heapTrack(0, true)
+			if err != nil {
+				return err
+			}
+			err = pw.event(e.Timestamp, uuid, pbEventTypeCounter, counter(liveTotal))
+			if err != nil {
+				return err
+			}
+
+			// write allocation marker on the track of its call site
+			if e.Type == TraceAlloc {
+				uuid, err = callerTrack(e.Caller)
+				if err != nil {
+					return err
+				}
+				err = pw.event(e.Timestamp, uuid, pbEventTypeInstant, func(b []byte) []byte {
+					b = pbString(b, pbEventCategories, "heap")
+					b = pbString(b, pbEventName, "alloc")
+					ann := pbString(nil, pbAnnotationName, "size")
+					ann = pbVarint(ann, pbAnnotationUintValue, uint64(e.Size))
+					b = pbBytes(b, pbEventAnnotations, ann)
+					ann = pbString(nil, pbAnnotationName, "caps")
+					ann = pbString(ann, pbAnnotationStringValue, fmt.Sprintf("0x%x", e.Caps))
+					b = pbBytes(b, pbEventAnnotations, ann)
+					ann = pbString(nil, pbAnnotationName, "task")
+					ann = pbString(ann, pbAnnotationStringValue, taskName(e.Task))
+					return pbBytes(b, pbEventAnnotations, ann)
+				})
+			}
+		}
+		if err != nil {
+			return err
+		}
+	}
+
+	// end running tasks at the end of the trace
+	for core := uint8(0); len(cores) > 0; core++ {
+		if prev, ok := cores[core]; ok {
+			delete(cores, core)
+			err := pw.event(now, prev.track, pbEventTypeSliceEnd, nil)
+			if err != nil {
+				return err
+			}
+		}
+	}
+
+	return pw.out.Flush()
+}
@@ -1,6 +1,7 @@
 package msg
 
 import (
+	"bytes"
 	"encoding/binary"
 	"testing"
 	"time"
@@ -46,6 +47,76 @@ func TestStartTraceFlags(t *testing.T) {
 	assert.NoError(t, err)
 }
 
+func TestStartTraceMode(t *testing.T) {
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{0, 0xFF, 2}}),
+		ack(),
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{5, 2, 0x10, 0x27, 0, 0, 'h', 'e', 'a', 'p'}}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	err = StartTraceMode(s, TraceAll, TraceRecorder, time.Second)
+	assert.NoError(t, err)
+
+	err = SetTraceTrigger(s, TraceTriggerAbove, "heap", 10000, time.Second)
+	assert.NoError(t, err)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestStreamTrace(t *testing.T) {
+	// SYNC(8): TYPE(1) CORE(1) TIME(8) = 10
+	sync := func(core uint8, time uint64) []byte {
+		return Pack("ooq", uint8(8), core, time)
+	}
+
+	// SWITCH(9): TYPE(1) DELTA(v) ID(1) = 3+
+	record := func(delta uint8) []byte {
+		return []byte{9, delta, 0}
+	}
+
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{0, 0xFF, 1}}),
+		ack(),
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{4, 16, 0}}),
+		send(Message{Endpoint: traceEndpoint, Data: bytes.Join([][]byte{sync(0, 50), record(50), record(100)}, nil)}),
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{1}}),
+		send(Message{Endpoint: traceEndpoint, Data: bytes.Join([][]byte{sync(1, 0), record(127)}, nil)}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	var events []TraceEvent
+	stop := make(chan struct{})
+	err = StreamTrace(s, TraceAll, stop, func(data *TraceData) {
+		events = append(events, data.Events...)
+		if len(events) == 2 {
+			close(stop)
+		}
+	})
+	assert.NoError(t, err)
+	assert.Equal(t, []TraceEvent{
+		{Timestamp: 100, Type: TraceTaskSwitch, Core: 0},
+		{Timestamp: 200, Type: TraceTaskSwitch, Core: 0},
+		{Timestamp: 127, Type: TraceTaskSwitch, Core: 1},
+	}, events)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
 func TestStopTrace(t *testing.T) {
 	dev := newTestDevice(t, 42, []testMessage{
 		receive(Message{Endpoint: traceEndpoint, Data: []byte{1}}),
@@ -66,6 +137,7 @@ func TestStopTrace(t *testing.T) {
 }
 
 func TestReadTrace(t *testing.T) {
+	// fixed-size records of older firmware
 	var chunk []byte
 
 	// TASK(7): TYPE(1) ID(1) NAME(*) NUL(1)
@@ -158,32 +230,32 @@ func TestReadTrace(t *testing.T) {
 
 	// SWITCH
 	assert.Equal(t, TraceTaskSwitch, data.Events[0].Type)
-	assert.Equal(t, uint32(1000), data.Events[0].Timestamp)
+	assert.Equal(t, uint64(1000), data.Events[0].Timestamp)
 	assert.Equal(t, uint8(1), data.Events[0].Core)
 	assert.Equal(t, uint8(2), data.Events[0].Task)
 
 	// EVENT
 	assert.Equal(t, TraceInstant, data.Events[1].Type)
-	assert.Equal(t, uint32(2000), data.Events[1].Timestamp)
+	assert.Equal(t, uint64(2000), data.Events[1].Timestamp)
 	assert.Equal(t, uint8(0), data.Events[1].Cat)
 	assert.Equal(t, uint8(1), data.Events[1].Name)
 	assert.Equal(t, uint16(42), data.Events[1].Arg)
 
 	// BEGIN
 	assert.Equal(t, TraceBegin, data.Events[2].Type)
-	assert.Equal(t, uint32(3000), data.Events[2].Timestamp)
+	assert.Equal(t, uint64(3000), data.Events[2].Timestamp)
 	assert.Equal(t, uint8(0), data.Events[2].Cat)
 	assert.Equal(t, uint8(1), data.Events[2].Name)
 	assert.Equal(t, uint8(7), data.Events[2].Span)
 
 	// END
 	assert.Equal(t, TraceEnd, data.Events[3].Type)
-	assert.Equal(t, uint32(4000), data.Events[3].Timestamp)
+	assert.Equal(t, uint64(4000), data.Events[3].Timestamp)
 	assert.Equal(t, uint8(7), data.Events[3].Span)
 
 	// VALUE
 	assert.Equal(t, TraceValue, data.Events[4].Type)
-	assert.Equal(t, uint32(5000), data.Events[4].Timestamp)
+	assert.Equal(t, uint64(5000), data.Events[4].Timestamp)
 	assert.Equal(t, uint8(0), data.Events[4].Cat)
 	assert.Equal(t, uint8(1), data.Events[4].Name)
 	assert.Equal(t, int32(-100), data.Events[4].Value)
@@ -192,6 +264,149 @@ func TestReadTrace(t *testing.T) {
 	assert.NoError(t, err)
 }
 
+func TestReadTraceCompact(t *testing.T) {
+	var chunk []byte
+
+	// LABEL(6): TYPE(1) ID(1) TEXT(*) NUL(1)
+	chunk = append(chunk, 6, 0)
+	chunk = append(chunk, []byte("app")...)
+	chunk = append(chunk, 0)
+
+	// SYNC(8): TYPE(1) CORE(1) TIME(8) = 10
+	chunk = append(chunk, Pack("ooq", uint8(8), uint8(1), uint64(1<<32))...)
+
+	// SWITCH(9): TYPE(1) DELTA(v) ID(1)
+	chunk = append(chunk, 9, 0xE8, 0x07, 2) // delta 1000
+
+	// EVENT(10): TYPE(1) DELTA(v) CAT(1) NAME(1) ARG(v)
+	chunk = append(chunk, 10, 0x01, 0, 0, 0xAC, 0x02) // delta 1, arg 300
+
+	// BEGIN(11): TYPE(1) DELTA(v) CAT(1) NAME(1) ARG(v) ID(1)
+	chunk = append(chunk, 11, 0x00, 0, 0, 0x00, 7)
+
+	// END(12): TYPE(1) DELTA(v) ID(1)
+	chunk = append(chunk, 12, 0x02, 7)
+
+	// VALUE(13): TYPE(1) DELTA(v) CAT(1) NAME(1) VAL(zv)
+	chunk = append(chunk, 13, 0x03, 0, 0, 0xC7, 0x01) // value -100
+
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{2}}),
+		send(Message{Endpoint: traceEndpoint, Data: chunk}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	data, err := ReadTrace(s, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []TraceLabel{{ID: 0, Text: "app"}}, data.Labels)
+	assert.Equal(t, []TraceEvent{
+		{Timestamp: 1<<32 + 1000, Type: TraceTaskSwitch, Core: 1, Task: 2},
+		{Timestamp: 1<<32 + 1001, Type: TraceInstant, Arg: 300},
+		{Timestamp: 1<<32 + 1001, Type: TraceBegin, Span: 7},
+		{Timestamp: 1<<32 + 1003, Type: TraceEnd, Span: 7},
+		{Timestamp: 1<<32 + 1006, Type: TraceValue, Value: -100},
+	}, data.Events)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestTraceHeap(t *testing.T) {
+	var chunk []byte
+
+	// SYNC(8): TYPE(1) CORE(1) TIME(8) = 10
+	chunk = append(chunk, Pack("ooq", uint8(8), uint8(0), uint64(0))...)
+
+	// ALLOC(14): TYPE(1) DELTA(v) PTR(4) SIZE(v) CAPS(v) CALLER(4) TASK(1)
+	chunk = append(chunk, 14, 10)
+	chunk = append(chunk, Pack("i", uint32(0x3FFB0000))...)
+	chunk = append(chunk, 0x80, 0x02, 0x04) // size 256, caps 4
+	chunk = append(chunk, Pack("io", uint32(0x400D1000), uint8(2))...)
+	chunk = append(chunk, 14, 10)
+	chunk = append(chunk, Pack("i", uint32(0x3FFB1000))...)
+	chunk = append(chunk, 0x10, 0x04) // size 16, caps 4
+	chunk = append(chunk, Pack("io", uint32(0x400D2000), uint8(255))...)
+
+	// FREE(15): TYPE(1) DELTA(v) PTR(4)
+	chunk = append(chunk, 15, 10)
+	chunk = append(chunk, Pack("i", uint32(0x3FFB0000))...)
+	chunk = append(chunk, 15, 10)
+	chunk = append(chunk, Pack("i", uint32(0x3FFC0000))...)
+
+	data := &TraceData{}
+	err := parseTraceRecords(chunk, data)
+	assert.NoError(t, err)
+	assert.Equal(t, []TraceEvent{
+		{Timestamp: 10, Type: TraceAlloc, Task: 2, Ptr: 0x3FFB0000, Size: 256, Caps: 4, Caller: 0x400D1000},
+		{Timestamp: 20, Type: TraceAlloc, Task: 255, Ptr: 0x3FFB1000, Size: 16, Caps: 4, Caller: 0x400D2000},
+		{Timestamp: 30, Type: TraceFree, Ptr: 0x3FFB0000},
+		{Timestamp: 40, Type: TraceFree, Ptr: 0x3FFC0000},
+	}, data.Events)
+
+	assert.Equal(t, []TraceHotspot{
+		{Caller: 0x400D1000, Count: 1, Bytes: 256, Live: 0},
+		{Caller: 0x400D2000, Count: 1, Bytes: 16, Live: 16},
+	}, TraceHeapHotspots(data.Events))
+
+	out, err := GeneratePerfetto(map[uint8]string{2: "app"}, nil, data.Events)
+	assert.NoError(t, err)
+	assert.Contains(t, string(out), `"name": "Heap"`)
+	assert.Contains(t, string(out), `"name": "0x400d1000"`)
+}
+
+func TestReadTraceMerge(t *testing.T) {
+	// SYNC(8): TYPE(1) CORE(1) TIME(8) = 10
+	sync := func(core uint8, time uint64) []byte {
+		return Pack("ooq", uint8(8), core, time)
+	}
+
+	// SWITCH(9): TYPE(1) DELTA(v) ID(1) = 3+
+	record := func(delta uint8) []byte {
+		return []byte{9, delta, 0}
+	}
+
+	// core 0 and core 1 buffers are streamed one after another, a chunk may
+	// hold both cores
+	chunk1 := bytes.Join([][]byte{sync(0, 0), record(100), record(100)}, nil)
+	chunk1 = append(chunk1, bytes.Join([][]byte{sync(0, 200), record(100), sync(1, 0), record(100)}, nil)...)
+	chunk2 := bytes.Join([][]byte{sync(1, 100), record(100), record(100)}, nil)
+	chunk2 = append(chunk2, record(100)...)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		receive(Message{Endpoint: traceEndpoint, Data: []byte{2}}),
+		send(Message{Endpoint: traceEndpoint, Data: chunk1}),
+		send(Message{Endpoint: traceEndpoint, Data: chunk2}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	data, err := ReadTrace(s, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []TraceEvent{
+		{Timestamp: 100, Type: TraceTaskSwitch, Core: 0},
+		{Timestamp: 100, Type: TraceTaskSwitch, Core: 1},
+		{Timestamp: 200, Type: TraceTaskSwitch, Core: 0},
+		{Timestamp: 200, Type: TraceTaskSwitch, Core: 1},
+		{Timestamp: 300, Type: TraceTaskSwitch, Core: 0},
+		{Timestamp: 300, Type: TraceTaskSwitch, Core: 1},
+		{Timestamp: 400, Type: TraceTaskSwitch, Core: 1},
+	}, data.Events)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
 func TestReadTraceEmpty(t *testing.T) {
 	dev := newTestDevice(t, 42, []testMessage{
 		receive(Message{Endpoint: traceEndpoint, Data: []byte{2}}),
@@ -215,12 +430,13 @@ func TestReadTraceEmpty(t *testing.T) {
 }
 
 func TestGetTraceStatus(t *testing.T) {
-	// build status reply: ACTIVE(1) | BUF_SIZE(4) | BUF_USED(4) | DROPPED(4)
-	status := make([]byte, 13)
+	// build status reply: ACTIVE(1) | BUF_SIZE(4) | BUF_USED(4) | DROPPED(4) | MODE(1) | FROZEN(1)
+	status := make([]byte, 15)
 	status[0] = 1 // active
 	binary.LittleEndian.PutUint32(status[1:], 16384)
 	binary.LittleEndian.PutUint32(status[5:], 100)
 	binary.LittleEndian.PutUint32(status[9:], 3)
+	status[13] = byte(TraceRecorder)
 
 	dev := newTestDevice(t, 42, []testMessage{
 		receive(Message{Endpoint: traceEndpoint, Data: []byte{3}}),
@@ -239,7 +455,119 @@ func TestGetTraceStatus(t *testing.T) {
 	assert.Equal(t, uint32(16384), st.BufSize)
 	assert.Equal(t, uint32(100), st.BufUsed)
 	assert.Equal(t, uint32(3), st.Dropped)
+	assert.Equal(t, TraceRecorder, st.Mode)
+	assert.False(t, st.Frozen)
 
 	err = s.End(time.Second)
 	assert.NoError(t, err)
 }
+
+func TestEncodeTrace(t *testing.T) {
+	tasks := map[uint8]string{0: "IDLE0", 2: "app"}
+	labels := map[uint8]string{0: "net", 1: "rx", 2: "queue"}
+	events := []TraceEvent{
+		{Timestamp: 0, Type: TraceTaskSwitch, Core: 0, Task: 0},
+		{Timestamp: 10, Type: TraceReady, Task: 2},
+		{Timestamp: 25, Type: TraceTaskSwitch, Core: 1, Task: 2},
+		{Timestamp: 30, Type: TraceBegin, Cat: 0, Name: 1, Arg: 300, Span: 4},
+		{Timestamp: 40, Type: TraceValue, Cat: 0, Name: 2, Value: -5},
+		{Timestamp: 50, Type: TraceInstant, Cat: 0, Name: 1, Arg: 1},
+		{Timestamp: 1000, Type: TraceEnd, Span: 4},
+		{Timestamp: 1200, Type: TraceAlloc, Task: 2, Ptr: 0x3FFB0000, Size: 64, Caps: 4, Caller: 0x400D1000},
+		{Timestamp: 1300, Type: TraceFree, Ptr: 0x3FFB0000},
+		{Timestamp: 70000, Type: TraceTaskSwitch, Core: 0, Task: 2},
+	}
+
+	buf := EncodeTrace(tasks, labels, events)
+
+	data, err := DecodeTrace(buf)
+	assert.NoError(t, err)
+	assert.Equal(t, []TraceTask{{ID: 0, Name: "IDLE0"}, {ID: 2, Name: "app"}}, data.Tasks)
+	assert.Equal(t, []TraceLabel{{ID: 0, Text: "net"}, {ID: 1, Text: "rx"}, {ID: 2, Text: "queue"}}, data.Labels)
+	assert.Equal(t, events, data.Events)
+}
+
+func TestAnalyzeTrace(t *testing.T) {
+	tasks := map[uint8]string{0: "IDLE0", 2: "app"}
+	labels := map[uint8]string{0: "net", 1: "rx", 2: "queue"}
+	events := []TraceEvent{
+		{Timestamp: 0, Type: TraceTaskSwitch, Core: 0, Task: 0},
+		{Timestamp: 100, Type: TraceReady, Task: 2},
+		{Timestamp: 110, Type: TraceReady, Task: 2},
+		{Timestamp: 150, Type: TraceTaskSwitch, Core: 0, Task: 2},
+		{Timestamp: 160, Type: TraceBegin, Cat: 0, Name: 1, Span: 1},
+		{Timestamp: 163, Type: TraceEnd, Span: 1},
+		{Timestamp: 170, Type: TraceBegin, Cat: 0, Name: 1, Span: 1},
+		{Timestamp: 190, Type: TraceEnd, Span: 1},
+		{Timestamp: 195, Type: TraceEnd, Span: 9},
+		{Timestamp: 200, Type: TraceTaskSwitch, Core: 0, Task: 0},
+		{Timestamp: 210, Type: TraceValue, Cat: 0, Name: 2, Value: 4},
+		{Timestamp: 220, Type: TraceValue, Cat: 0, Name: 2, Value: -2},
+		{Timestamp: 300, Type: TraceReady, Task: 2},
+		{Timestamp: 310, Type: TraceTaskSwitch, Core: 0, Task: 2},
+		{Timestamp: 400, Type: TraceTaskSwitch, Core: 0, Task: 0},
+	}
+
+	analysis := AnalyzeTrace(tasks, labels, events)
+	assert.Equal(t, uint64(0), analysis.Start)
+	assert.Equal(t, uint64(400), analysis.End)
+	assert.Equal(t, []TraceTaskCPU{
+		{Core: 0, Task: 0, Name: "IDLE0", Time: 260, Share: 0.65, Switches: 3},
+		{Core: 0, Task: 2, Name: "app", Time: 140, Share: 0.35, Switches: 2},
+	}, analysis.CPU)
+	assert.Equal(t, []TraceLatency{
+		{Task: 2, Name: "app", Count: 2, P50: 10, P90: 50, P99: 50, Max: 50},
+	}, analysis.Latency)
+	assert.Equal(t, []TraceSpanStats{
+		{Category: "net", Name: "rx", Count: 2, Total: 23, Min: 3, P50: 3, P90: 20, P99: 20, Max: 20, Histogram: []int{0, 0, 1, 0, 0, 1}},
+	}, analysis.Spans)
+	assert.Equal(t, []TraceCounterStats{
+		{Category: "net", Name: "queue", Count: 2, Min: -2, Max: 4, Mean: 1, Last: -2},
+	}, analysis.Counters)
+	assert.Empty(t, analysis.Hotspots)
+}
+
+func TestWritePerfetto(t *testing.T) {
+	events := []TraceEvent{
+		{Timestamp: 0, Type: TraceTaskSwitch, Core: 0, Task: 2},
+		{Timestamp: 10, Type: TraceBegin, Cat: 0, Name: 1, Span: 1},
+		{Timestamp: 20, Type: TraceValue, Cat: 0, Name: 2, Value: -1},
+		{Timestamp: 30, Type: TraceEnd, Span: 1},
+		{Timestamp: 40, Type: TraceAlloc, Task: 2, Ptr: 0x3FFB0000, Size: 64, Caps: 4, Caller: 0x400D1000},
+		{Timestamp: 50, Type: TraceTaskSwitch, Core: 0, Task: 0},
+	}
+
+	var buf bytes.Buffer
+	err := WritePerfetto(&buf, map[uint8]string{2: "app"}, map[uint8]string{1: "rx"}, events)
+	assert.NoError(t, err)
+
+	// walk trace packets
+	var descriptors, trackEvents int
+	out := buf.Bytes()
+	for len(out) > 0 {
+		// read packet field
+		tag, n := binary.Uvarint(out)
+		assert.Equal(t, uint64(pbTracePacket<<3|2), tag)
+		size, m := binary.Uvarint(out[n:])
+		packet := out[n+m : n+m+int(size)]
+		out = out[n+m+int(size):]
+
+		// count packet kinds
+		if bytes.HasPrefix(packet, []byte{0xe2, 0x03}) { // descriptor (60)
+			descriptors++
+		} else if packet[0] == pbPacketTimestamp<<3 { // timestamp (8)
+			trackEvents++
+		}
+	}
+
+	// core, 2 threads, category, name, counter, heap, 2 heap counters,
+	// allocations and caller
+	assert.Equal(t, 11, descriptors)
+
+	// 2 slices with end, begin/end, counter, 2 heap counters, alloc and final
+	// end
+	assert.Equal(t, 10, trackEvents)
+	assert.Contains(t, buf.String(), "Core 0")
+	assert.Contains(t, buf.String(), "app")
+	assert.Contains(t, buf.String(), "0x400d1000")
+}
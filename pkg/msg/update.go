@@ -1,18 +1,124 @@
 package msg
 
-import "time"
+import (
+	"crypto/sha256"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"time"
+)
 
 const updateEndpoint = 0x2
 
-// Update performs a firmware update.
+// UpdateImage is a firmware image prepared for transfer.
+type UpdateImage struct {
+	Image      []byte
+	Stream     []byte
+	Compressed bool
+	Delta      bool
+	Hash       [32]byte
+}
+
+// PrepareUpdate compresses and hashes the provided firmware image. The result
+// may be used to update multiple devices.
+func PrepareUpdate(image []byte) *UpdateImage {
+	// compress image
+	stream := hsEncode(image)
+	compressed := len(stream) < len(image)
+	if !compressed {
+		stream = image
+	}
+
+	return &UpdateImage{
+		Image:      image,
+		Stream:     stream,
+		Compressed: compressed,
+		Hash:       sha256.Sum256(image),
+	}
+}
+
+// UpdateState describes a resumable update on a device.
+type UpdateState struct {
+	Size     int
+	Encoding uint8
+	Hash     [32]byte
+	Offset   int
+	Written  int
+}
+
+// GetUpdateState returns the state of the active or persisted resumable update
+// on the device, or nil if there is none.
+func GetUpdateState(s *Session, timeout time.Duration) (*UpdateState, error) {
+	// send "status" command
+	err := s.Send(updateEndpoint, Pack("o", uint8(5)), 0)
+	if err != nil {
+		return nil, err
+	}
+
+	// await reply
+	reply, err := s.Receive(updateEndpoint, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// handle no update
+	if len(reply) == 0 {
+		return nil, nil
+	}
+
+	// verify reply
+	if len(reply) != 45 {
+		return nil, fmt.Errorf("invalid reply")
+	}
+
+	// parse reply
+	state := &UpdateState{
+		Size:     int(binary.LittleEndian.Uint32(reply)),
+		Encoding: reply[4],
+		Offset:   int(binary.LittleEndian.Uint32(reply[37:])),
+		Written:  int(binary.LittleEndian.Uint32(reply[41:])),
+	}
+	copy(state.Hash[:], reply[5:37])
+
+	return state, nil
+}
+
+// Update performs a firmware update. The image is transferred as a compressed
+// stream and verified by the device before it is activated. An interrupted
+// update of the same image is resumed where it left off. Devices that do not
+// support compressed updates receive the raw image.
 func Update(s *Session, image []byte, report func(int), timeout time.Duration) error {
-	// send "begin" command
-	cmd := Pack("oi", uint8(0), uint32(len(image)))
-	err := s.Send(updateEndpoint, cmd, timeout)
+	return UpdatePrepared(s, PrepareUpdate(image), report, timeout)
+}
+
+// UpdatePrepared performs a firmware update using a prepared image. The
+// reported progress is scaled to the size of the raw image.
+func UpdatePrepared(s *Session, image *UpdateImage, report func(int), timeout time.Duration) error {
+	// send "resume" command
+	stream := image.Stream
+	encoding := b2u(image.Compressed) | b2u(image.Delta)<<1
+	offset, err := updateResume(s, image, encoding, timeout)
+	if errors.Is(err, ErrSessionUnknownMessage) {
+		// send "begin" command
+		offset = 0
+		cmd := Pack("oiob", uint8(0), uint32(len(image.Image)), encoding, image.Hash[:])
+		err = s.Send(updateEndpoint, cmd, timeout)
+		if errors.Is(err, ErrSessionInvalidMessage) {
+			// fall back to raw image
+			stream = image.Image
+			cmd = Pack("oi", uint8(0), uint32(len(image.Image)))
+			err = s.Send(updateEndpoint, cmd, timeout)
+		}
+	}
 	if err != nil {
 		return err
 	}
 
+	// check offset
+	if offset > len(stream) {
+		return fmt.Errorf("invalid resume offset")
+	}
+
 	// get width
 	width := s.Channel().Width()
 
@@ -27,17 +133,16 @@ func Update(s *Session, image []byte, report func(int), timeout time.Duration) e
 
 	// write data in chunks
 	num := 0
-	offset := 0
-	for offset < len(image) {
+	for offset < len(stream) {
 		// determine chunk size and chunk data
-		chunkSize := min(int(mtu), len(image)-offset)
-		chunkData := image[offset : offset+chunkSize]
+		chunkSize := min(int(mtu), len(stream)-offset)
+		chunkData := stream[offset : offset+chunkSize]
 
 		// determine acked
 		acked := num%width == 0
 
 		// send "write" command
-		cmd = Pack("ooib", uint8(1), b2u(acked), uint32(offset), chunkData)
+		cmd := Pack("ooib", uint8(1), b2u(acked), uint32(offset), chunkData)
 		err = s.Send(updateEndpoint, cmd, b2v(acked, timeout, 0))
 		if err != nil {
 			return err
@@ -46,9 +151,9 @@ func Update(s *Session, image []byte, report func(int), timeout time.Duration) e
 		// increment offset
 		offset += chunkSize
 
-		// report offset
+		// report progress
 		if report != nil {
-			report(offset)
+			report(int(int64(offset) * int64(len(image.Image)) / int64(len(stream))))
 		}
 
 		// increment count
@@ -56,11 +161,170 @@ func Update(s *Session, image []byte, report func(int), timeout time.Duration) e
 	}
 
 	// send "finish" command
-	cmd = Pack("o", uint8(3))
-	err = s.Send(updateEndpoint, cmd, timeout)
+	err = s.Send(updateEndpoint, Pack("o", uint8(3)), timeout)
+	if err != nil {
+		return err
+	}
+
+	return nil
+}
+
+func updateResume(s *Session, image *UpdateImage, encoding uint8, timeout time.Duration) (int, error) {
+	// send "resume" command
+	cmd := Pack("oiob", uint8(4), uint32(len(image.Image)), encoding, image.Hash[:])
+	err := s.Send(updateEndpoint, cmd, 0)
+	if err != nil {
+		return 0, err
+	}
+
+	// await reply
+	reply, err := s.Receive(updateEndpoint, false, timeout)
+	if err != nil {
+		return 0, err
+	}
+
+	// verify reply
+	if len(reply) != 4 {
+		return 0, fmt.Errorf("invalid reply")
+	}
+
+	return int(binary.LittleEndian.Uint32(reply)), nil
+}
+
+// MulticastChunkSize is the size of the chunks transferred during multicast
+// updates. It must be a power of two and fit into a message of the channel.
+const MulticastChunkSize = 2048
+
+// BeginMulticast begins a multicast update of the image on the device. The
+// device subscribes the provided topic and writes the chunks published as
+// produced by MulticastChunks in any order. The update is completed using
+// FinishMulticast.
+func BeginMulticast(s *Session, image []byte, topic string, timeout time.Duration) error {
+	// send "multicast" command
+	hash := sha256.Sum256(image)
+	cmd := Pack("oihbs", uint8(6), uint32(len(image)), uint16(MulticastChunkSize), hash[:], topic)
+	err := s.Send(updateEndpoint, cmd, timeout)
+	if err != nil {
+		return err
+	}
+
+	return nil
+}
+
+// MulticastChunks returns the numbered chunk messages of the image that are
+// published to the topic of a multicast update.
+func MulticastChunks(image []byte) [][]byte {
+	// prepare chunks
+	var chunks [][]byte
+	for i := 0; i*MulticastChunkSize < len(image); i++ {
+		data := image[i*MulticastChunkSize : min((i+1)*MulticastChunkSize, len(image))]
+		chunks = append(chunks, Pack("ib", uint32(i), data))
+	}
+
+	return chunks
+}
+
+// FinishMulticast repairs the chunks of a multicast update missed by the
+// device and finishes the update. If a callback is provided it will be called
+// with the number of bytes the device has received.
+func FinishMulticast(s *Session, image []byte, report func(int), timeout time.Duration) error {
+	// get width
+	width := s.Channel().Width()
+
+	for {
+		// get missing chunks
+		ranges, err := updateMissing(s, timeout)
+		if err != nil {
+			return err
+		}
+
+		// stop if complete
+		if len(ranges) == 0 {
+			break
+		}
+
+		// count received bytes
+		received := len(image)
+		for _, r := range ranges {
+			for i := r[0]; i < r[0]+r[1]; i++ {
+				received -= min(MulticastChunkSize, len(image)-i*MulticastChunkSize)
+			}
+		}
+
+		// repair missing chunks
+		num := 0
+		for _, r := range ranges {
+			for i := r[0]; i < r[0]+r[1]; i++ {
+				// check index
+				if i*MulticastChunkSize >= len(image) {
+					return fmt.Errorf("invalid chunk index")
+				}
+
+				// get chunk data
+				data := image[i*MulticastChunkSize : min((i+1)*MulticastChunkSize, len(image))]
+
+				// determine acked
+				acked := num%width == 0
+
+				// send "repair" command
+				cmd := Pack("ooib", uint8(8), b2u(acked), uint32(i), data)
+				err = s.Send(updateEndpoint, cmd, b2v(acked, timeout, 0))
+				if err != nil {
+					return err
+				}
+
+				// report progress
+				received += len(data)
+				if report != nil {
+					report(received)
+				}
+
+				// increment count
+				num += 1
+			}
+		}
+	}
+
+	// report progress
+	if report != nil {
+		report(len(image))
+	}
+
+	// send "finish" command
+	err := s.Send(updateEndpoint, Pack("o", uint8(3)), timeout)
 	if err != nil {
 		return err
 	}
 
 	return nil
 }
+
+func updateMissing(s *Session, timeout time.Duration) ([][2]int, error) {
+	// send "missing" command
+	err := s.Send(updateEndpoint, Pack("o", uint8(7)), 0)
+	if err != nil {
+		return nil, err
+	}
+
+	// await reply
+	reply, err := s.Receive(updateEndpoint, false, timeout)
+	if err != nil {
+		return nil, err
+	}
+
+	// verify reply
+	if len(reply)%8 != 0 {
+		return nil, fmt.Errorf("invalid reply")
+	}
+
+	// parse ranges
+	ranges := make([][2]int, 0, len(reply)/8)
+	for i := 0; i < len(reply); i += 8 {
+		ranges = append(ranges, [2]int{
+			int(binary.LittleEndian.Uint32(reply[i:])),
+			int(binary.LittleEndian.Uint32(reply[i+4:])),
+		})
+	}
+
+	return ranges, nil
+}
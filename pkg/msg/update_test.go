@@ -2,16 +2,118 @@ package msg
 
 import (
 	"bytes"
+	"crypto/sha256"
+	"math/rand"
 	"testing"
 	"time"
 
 	"github.com/stretchr/testify/assert"
 )
 
+func hsDecode(data []byte) []byte {
+	var out []byte
+	var bits uint32
+	var count int
+	for _, b := range data {
+		bits = bits<<8 | uint32(b)
+		count += 8
+		for count > 0 {
+			literal := bits>>(count-1)&1 == 1
+			need := 1 + hsWindow + hsLookahead
+			if literal {
+				need = 9
+			}
+			if count < need {
+				break
+			}
+			count -= need
+			token := int(bits>>count) & (1<<(need-1) - 1)
+			if literal {
+				out = append(out, byte(token))
+				continue
+			}
+			dist := token>>hsLookahead + 1
+			length := token&(1<<hsLookahead-1) + 1
+			for i := 0; i < length; i++ {
+				out = append(out, out[len(out)-dist])
+			}
+		}
+	}
+	return out
+}
+
+func TestHeatshrink(t *testing.T) {
+	rng := rand.New(rand.NewSource(1))
+
+	var data []byte
+	for len(data) < 100_000 {
+		if rng.Intn(2) == 0 {
+			chunk := make([]byte, rng.Intn(64))
+			rng.Read(chunk)
+			data = append(data, chunk...)
+		} else {
+			data = append(data, bytes.Repeat([]byte{byte(rng.Intn(4))}, rng.Intn(100))...)
+		}
+	}
+
+	stream := hsEncode(data)
+	assert.True(t, len(stream) < len(data))
+	assert.Equal(t, data, hsDecode(stream))
+
+	assert.Empty(t, hsEncode(nil))
+	assert.Equal(t, []byte("a"), hsDecode(hsEncode([]byte("a"))))
+}
+
 func TestUpdate(t *testing.T) {
 	imageData := bytes.Repeat([]byte{0xBB}, 50)
+	imageHash := sha256.Sum256(imageData)
+	stream := hsEncode(imageData)
+	assert.Equal(t, imageData, hsDecode(stream))
+	assert.Len(t, stream, 9)
 
 	dev := newTestDevice(t, 42, []testMessage{
+		// resume
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("oiob", uint8(4), uint32(50), uint8(1), imageHash[:])}),
+		send(Message{Endpoint: updateEndpoint, Data: Pack("i", uint32(0))}),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(30))}),
+		// chunk 0: full stream, acked
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("ooib", uint8(1), uint8(1), uint32(0), stream)}),
+		ack(),
+		// finish
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("o", uint8(3))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	var progress []int
+	err = Update(s, imageData, func(pos int) {
+		progress = append(progress, pos)
+	}, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []int{50}, progress)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestUpdateLegacy(t *testing.T) {
+	imageData := bytes.Repeat([]byte{0xBB}, 50)
+	imageHash := sha256.Sum256(imageData)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		// resume (unknown)
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("oiob", uint8(4), uint32(50), uint8(1), imageHash[:])}),
+		send(Message{Endpoint: 0xFE, Data: []byte{3}}),
+		// begin (rejected)
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("oiob", uint8(0), uint32(50), uint8(1), imageHash[:])}),
+		send(Message{Endpoint: 0xFE, Data: []byte{2}}),
 		// begin
 		receive(Message{Endpoint: updateEndpoint, Data: Pack("oi", uint8(0), uint32(50))}),
 		ack(),
@@ -46,3 +148,146 @@ func TestUpdate(t *testing.T) {
 	err = s.End(time.Second)
 	assert.NoError(t, err)
 }
+
+func TestUpdateResume(t *testing.T) {
+	imageData := make([]byte, 50)
+	rand.New(rand.NewSource(1)).Read(imageData)
+	imageHash := sha256.Sum256(imageData)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		// resume at 24
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("oiob", uint8(4), uint32(50), uint8(0), imageHash[:])}),
+		send(Message{Endpoint: updateEndpoint, Data: Pack("i", uint32(24))}),
+		// GetMTU
+		receive(Message{Endpoint: SystemEndpoint, Data: Pack("o", uint8(2))}),
+		send(Message{Endpoint: SystemEndpoint, Data: Pack("h", uint16(30))}),
+		// chunk 1: 24 bytes, acked
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("ooib", uint8(1), uint8(1), uint32(24), imageData[24:48])}),
+		ack(),
+		// chunk 2: 2 bytes, not acked
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("ooib", uint8(1), uint8(0), uint32(48), imageData[48:50])}),
+		// finish
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("o", uint8(3))}),
+		ack(),
+		// status
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("o", uint8(5))}),
+		send(Message{Endpoint: updateEndpoint, Data: Pack("iobii", uint32(50), uint8(0), imageHash[:], uint32(24), uint32(24))}),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	var progress []int
+	err = Update(s, imageData, func(pos int) {
+		progress = append(progress, pos)
+	}, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []int{48, 50}, progress)
+
+	state, err := GetUpdateState(s, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, &UpdateState{
+		Size:    50,
+		Hash:    imageHash,
+		Offset:  24,
+		Written: 24,
+	}, state)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestUpdateMulticast(t *testing.T) {
+	imageData := make([]byte, 5000)
+	rand.New(rand.NewSource(1)).Read(imageData)
+	imageHash := sha256.Sum256(imageData)
+
+	chunks := MulticastChunks(imageData)
+	assert.Equal(t, [][]byte{
+		Pack("ib", uint32(0), imageData[:2048]),
+		Pack("ib", uint32(1), imageData[2048:4096]),
+		Pack("ib", uint32(2), imageData[4096:]),
+	}, chunks)
+
+	dev := newTestDevice(t, 42, []testMessage{
+		// multicast
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("oihbs", uint8(6), uint32(5000), uint16(2048), imageHash[:], "naos/update/foo")}),
+		ack(),
+		// missing: chunk 1
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("o", uint8(7))}),
+		send(Message{Endpoint: updateEndpoint, Data: Pack("ii", uint32(1), uint32(1))}),
+		// repair chunk 1, acked
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("ooib", uint8(8), uint8(1), uint32(1), imageData[2048:4096])}),
+		ack(),
+		// missing: none
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("o", uint8(7))}),
+		send(Message{Endpoint: updateEndpoint, Data: []byte{}}),
+		// finish
+		receive(Message{Endpoint: updateEndpoint, Data: Pack("o", uint8(3))}),
+		ack(),
+	})
+
+	ch, err := dev.Open()
+	assert.NoError(t, err)
+
+	s, err := OpenSession(ch, time.Second)
+	assert.NoError(t, err)
+
+	err = BeginMulticast(s, imageData, "naos/update/foo", time.Second)
+	assert.NoError(t, err)
+
+	var progress []int
+	err = FinishMulticast(s, imageData, func(pos int) {
+		progress = append(progress, pos)
+	}, time.Second)
+	assert.NoError(t, err)
+	assert.Equal(t, []int{5000, 5000}, progress)
+
+	err = s.End(time.Second)
+	assert.NoError(t, err)
+}
+
+func TestDiff(t *testing.T) {
+	rng := rand.New(rand.NewSource(3))
+
+	base := make([]byte, 200_000)
+	for i := range base {
+		base[i] = byte(rng.Intn(16))
+	}
+
+	// modify, insert and remove data
+	image := append([]byte{}, base[:50_000]...)
+	for i := 0; i < 100; i++ {
+		image[rng.Intn(len(image))] = 0xFF
+	}
+	image = append(image, bytes.Repeat([]byte{0xAA}, 1000)...)
+	image = append(image, base[52_000:150_000]...)
+	image = append(image, base[10_000:20_000]...)
+	image = append(image, []byte("hello world")...)
+
+	patch := Diff(base, image)
+	assert.True(t, len(hsEncode(patch)) < len(image)/10)
+
+	result, err := Patch(base, patch)
+	assert.NoError(t, err)
+	assert.Equal(t, image, result)
+
+	result, err = Patch(nil, Diff(nil, image))
+	assert.NoError(t, err)
+	assert.Equal(t, image, result)
+
+	result, err = Patch(base, Diff(base, nil))
+	assert.NoError(t, err)
+	assert.Empty(t, result)
+
+	_, err = Patch(nil, patch)
+	assert.Equal(t, ErrInvalidPatch, err)
+
+	delta := PrepareDelta(base, image)
+	assert.True(t, delta.Compressed && delta.Delta)
+	assert.Equal(t, patch, hsDecode(delta.Stream))
+	assert.Equal(t, sha256.Sum256(image), delta.Hash)
+}
@@ -310,9 +310,10 @@ func (p *Project) LoadCoredump(elf, device string) ([]byte, error) {
 	return tree.LoadCoredump(p.Tree(), p.Manifest.Name, elf, device)
 }
 
-// Bundle will create a bundle of the project.
-func (p *Project) Bundle(file string, addDebug bool, out io.Writer) error {
-	return tree.Bundle(p.Tree(), file, addDebug, out)
+// Bundle will create a bundle of the project. If a base bundle is provided, a
+// delta update patch against its application is added.
+func (p *Project) Bundle(file string, addDebug bool, base string, out io.Writer) error {
+	return tree.Bundle(p.Tree(), file, addDebug, base, out)
 }
 
 // ensureDevice will return the provided device or find an attached one.
@@ -2,6 +2,8 @@ package tree
 
 import (
 	"archive/zip"
+	"crypto/sha256"
+	"encoding/hex"
 	"encoding/json"
 	"fmt"
 	"io"
@@ -10,6 +12,7 @@ import (
 	"strconv"
 	"strings"
 
+	"github.com/256dpi/naos/pkg/msg"
 	"github.com/256dpi/naos/pkg/utils"
 )
 
@@ -22,6 +25,7 @@ type bundleManifest struct {
 	FlashFreq string         `json:"flashFreq"`
 	Regions   []bundleRegion `json:"regions"`
 	DebugFile string         `json:"debugFile,omitempty"`
+	Patch     *bundlePatch   `json:"patch,omitempty"`
 }
 
 type bundleRegion struct {
@@ -32,6 +36,13 @@ type bundleRegion struct {
 	Fill   uint8  `json:"fill,omitempty"`
 }
 
+type bundlePatch struct {
+	File        string `json:"file"`
+	BaseVersion string `json:"baseVersion"`
+	BaseHash    string `json:"baseHash"`
+	Hash        string `json:"hash"`
+}
+
 type projectDescription struct {
 	Name    string `json:"project_name"`
 	Version string `json:"project_version"`
@@ -81,7 +92,54 @@ func readFlasherArgs(naosPath string) (*flasherArgs, error) {
 	return &args, nil
 }
 
-func Bundle(naosPath, file string, addDebug bool, out io.Writer) error {
+// readBundleApp will read the manifest and application binary of a bundle.
+func readBundleApp(file string) (*bundleManifest, []byte, error) {
+	// open archive
+	r, err := zip.OpenReader(file)
+	if err != nil {
+		return nil, nil, fmt.Errorf("failed to open bundle: %w", err)
+	}
+	defer r.Close()
+
+	// prepare reader
+	read := func(name string) ([]byte, error) {
+		f, err := r.Open(name)
+		if err != nil {
+			return nil, err
+		}
+		defer f.Close()
+		return io.ReadAll(f)
+	}
+
+	// read manifest
+	data, err := read("manifest.json")
+	if err != nil {
+		return nil, nil, fmt.Errorf("failed to read bundle manifest: %w", err)
+	}
+	var manifest bundleManifest
+	err = json.Unmarshal(data, &manifest)
+	if err != nil {
+		return nil, nil, fmt.Errorf("failed to decode bundle manifest: %w", err)
+	}
+
+	// read application
+	for _, region := range manifest.Regions {
+		if region.Name == "application" {
+			app, err := read(region.File)
+			if err != nil {
+				return nil, nil, fmt.Errorf("failed to read bundle application: %w", err)
+			}
+			return &manifest, app, nil
+		}
+	}
+
+	return nil, nil, fmt.Errorf("missing bundle application")
+}
+
+// Bundle will create a bundle of the project. If a base bundle is provided, a
+// patch that transforms its application into the current one is added for
+// delta updates.
+func Bundle(naosPath, file string, addDebug bool, base string, out io.Writer) error {
 	// read project description
 	descFile := filepath.Join(Directory(naosPath), "build", "project_description.json")
 	data, err := os.ReadFile(descFile)
@@ -188,6 +246,34 @@ func Bundle(naosPath, file string, addDebug bool, out io.Writer) error {
 		})
 	}
 
+	// prepare patch if requested
+	var patchData []byte
+	if base != "" {
+		// read base application
+		utils.Log(out, fmt.Sprintf("Computing patch against %s...", base))
+		baseManifest, baseApp, err := readBundleApp(base)
+		if err != nil {
+			return err
+		}
+
+		// read application
+		app, err := os.ReadFile(projectBinary)
+		if err != nil {
+			return err
+		}
+
+		// compute patch
+		patchData = msg.Diff(baseApp, app)
+		baseHash := sha256.Sum256(baseApp)
+		appHash := sha256.Sum256(app)
+		manifest.Patch = &bundlePatch{
+			File:        desc.Name + "-" + baseManifest.Version + ".patch",
+			BaseVersion: baseManifest.Version,
+			BaseHash:    hex.EncodeToString(baseHash[:]),
+			Hash:        hex.EncodeToString(appHash[:]),
+		}
+	}
+
 	// ensure file name
 	if file == "" {
 		file = manifest.Name + "-" + manifest.Version + ".zip"
@@ -233,6 +319,18 @@ func Bundle(naosPath, file string, addDebug bool, out io.Writer) error {
 		}
 	}
 
+	// write patch
+	if manifest.Patch != nil {
+		zw, err := w.Create(manifest.Patch.File)
+		if err != nil {
+			return err
+		}
+		_, err = zw.Write(patchData)
+		if err != nil {
+			return err
+		}
+	}
+
 	// write manifest
 	manifestData, err := json.MarshalIndent(manifest, "", "  ")
 	if err != nil {
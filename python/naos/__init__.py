@@ -1,17 +1,25 @@
 from .device import Channel, Device, Message, Queue, Transport, read
 from .fs import (
+    FSArchiveEntry,
     FSInfo,
+    archive_dir,
+    extract_archive,
     list_dir,
+    list_dir_page,
     make_path,
+    pack_archive,
     read_file,
     read_file_range,
     remove_path,
     rename_path,
     sha256_file,
     stat_path,
+    unpack_archive,
     write_file,
 )
 from .metrics import (
+    METRIC_BUCKETS,
+    MetricHistogram,
     MetricInfo,
     MetricKind,
     MetricLayout,
@@ -20,6 +28,7 @@ from .metrics import (
     list_metrics,
     read_double_metrics,
     read_float_metrics,
+    read_histogram_metrics,
     read_long_metrics,
     read_metrics,
 )
@@ -43,8 +52,11 @@ from .utils import pack, random_handle, unpack
 __all__ = [
     "Channel",
     "Device",
+    "FSArchiveEntry",
     "FSInfo",
+    "METRIC_BUCKETS",
     "Message",
+    "MetricHistogram",
     "MetricInfo",
     "MetricKind",
     "MetricLayout",
@@ -57,23 +69,28 @@ __all__ = [
     "Session",
     "Status",
     "Transport",
+    "archive_dir",
     "clear_param",
     "collect_params",
     "describe_metric",
+    "extract_archive",
     "get_param",
     "get_time",
     "get_time_info",
     "list_dir",
+    "list_dir_page",
     "list_metrics",
     "list_params",
     "make_path",
     "pack",
+    "pack_archive",
     "random_handle",
     "read",
     "read_double_metrics",
     "read_file",
     "read_file_range",
     "read_float_metrics",
+    "read_histogram_metrics",
     "read_long_metrics",
     "read_metrics",
     "read_param",
@@ -84,6 +101,7 @@ __all__ = [
     "sha256_file",
     "stat_path",
     "unpack",
+    "unpack_archive",
     "write_file",
     "write_param",
 ]
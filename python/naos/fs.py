@@ -1,7 +1,7 @@
 from __future__ import annotations
 
 from dataclasses import dataclass
-from typing import Callable, List, Optional
+from typing import Callable, List, Optional, Tuple
 
 from .session import Session
 from .utils import pack, unpack
@@ -14,6 +14,14 @@ class FSInfo:
     name: str
     is_dir: bool
     size: int
+    mtime: int = 0
+
+
+@dataclass
+class FSArchiveEntry:
+    path: str
+    is_dir: bool = False
+    data: bytes = b""
 
 
 async def stat_path(session: Session, path: str, timeout: float = 5.0) -> FSInfo:
@@ -36,9 +44,97 @@ async def stat_path(session: Session, path: str, timeout: float = 5.0) -> FSInfo
     return FSInfo(path.rsplit("/", 1)[-1], is_dir == 1, size)
 
 
-async def list_dir(session: Session, dir: str, timeout: float = 5.0) -> List[FSInfo]:
-    """Return a list of entries in the given directory."""
+async def list_dir(
+    session: Session,
+    dir: str,
+    pattern: Optional[str] = None,
+    since: int = 0,
+    limit: int = 0,
+    timeout: float = 5.0,
+) -> List[FSInfo]:
+    """Return a list of entries in the given directory, optionally filtered by
+    a glob pattern and a minimum modification time (unix seconds). Unfiltered
+    listings fall back to the legacy command on older devices."""
+
+    # prepare infos
+    infos = []
+    cursor = 0
+
+    while True:
+        # list page
+        try:
+            page, cursor = await list_dir_page(
+                session, dir, pattern, since, limit, cursor, timeout
+            )
+        except RuntimeError as err:
+            if str(err) == "unknown" and not pattern and not since and not infos:
+                return await _list_dir_legacy(session, dir, timeout)
+            raise
+
+        # add infos
+        infos.extend(page)
+
+        # check cursor
+        if cursor == 0:
+            return infos
+
+
+async def list_dir_page(
+    session: Session,
+    dir: str,
+    pattern: Optional[str] = None,
+    since: int = 0,
+    limit: int = 0,
+    cursor: int = 0,
+    timeout: float = 5.0,
+) -> Tuple[List[FSInfo], int]:
+    """Return a page of entries in the given directory and the cursor to
+    continue the listing, which is zero if the directory has been fully
+    listed."""
 
+    # send command
+    cmd = pack("oihis", 12, cursor, limit, since, dir)
+    if pattern:
+        cmd += pack("os", 0, pattern)
+    await _send(session, cmd, False, timeout)
+
+    # prepare infos
+    infos = []
+    cursor = 0
+
+    while True:
+        # await reply
+        reply = await _receive(session, True, timeout)
+        if reply is None:
+            return infos, cursor
+
+        # verify "entries" reply
+        if len(reply) < 5 or reply[0] != 5:
+            raise RuntimeError("invalid reply")
+
+        # get cursor
+        (cursor,) = unpack("i", reply[1:5])
+
+        # parse entries
+        pos = 5
+        while pos < len(reply):
+            # find name end
+            end = reply.find(b"\x00", pos + 9)
+            if end < 0:
+                raise RuntimeError("invalid entry")
+
+            # add info
+            is_dir, size, mtime = unpack("oii", reply[pos : pos + 9])
+            name = reply[pos + 9 : end].decode()
+            infos.append(FSInfo(name, is_dir == 1, size, mtime))
+
+            # advance
+            pos = end + 1
+
+
+async def _list_dir_legacy(
+    session: Session, dir: str, timeout: float = 5.0
+) -> List[FSInfo]:
     # send command
     cmd = pack("os", 1, dir)
     await _send(session, cmd, False, timeout)
@@ -158,49 +254,98 @@ async def write_file(
 ):
     """Write the given data to the given file."""
 
-    # send "create" command (create & truncate)
-    cmd = pack("oos", 2, (1 << 0) | (1 << 2), file)
-    await _send(session, cmd, True, timeout)
+    # write file (create & truncate)
+    await _write(session, file, (1 << 0) | (1 << 2), data, report, timeout)
 
-    # get width
-    width = session.channel().width()
 
-    # get MTU and subtract overhead
-    mtu = await session.get_mtu(timeout) - 6
+async def archive_dir(
+    session: Session,
+    dir: str,
+    report: Optional[Callable[[int], None]] = None,
+    timeout: float = 5.0,
+) -> bytes:
+    """Return the given directory tree as a single archive."""
 
-    # write data in chunks
-    num = 0
-    offset = 0
-    while offset < len(data):
-        # determine chunk
-        chunk = data[offset : offset + mtu]
+    # send "archive" command
+    cmd = pack("os", 13, dir)
+    await _send(session, cmd, False, timeout)
 
-        # determine mode
-        acked = num % width == 0 or offset + len(chunk) >= len(data)
+    # prepare data
+    data = bytearray()
 
-        # prepare "write" command (sequential or silent & sequential)
-        cmd = pack("ooib", 4, 1 << 1 if acked else (1 << 0) | (1 << 1), offset, chunk)
+    while True:
+        # await reply
+        reply = await _receive(session, True, timeout)
+        if reply is None:
+            return bytes(data)
 
-        # send "write" command
-        await _send(session, cmd, False, timeout)
+        # verify "chunk" reply
+        if len(reply) < 5 or reply[0] != 2:
+            raise RuntimeError("invalid reply")
 
-        # receive ack or "error" replies
-        if acked:
-            await _receive(session, True, timeout)
+        # verify offset
+        (offset,) = unpack("i", reply[1:5])
+        if offset != len(data):
+            raise RuntimeError("invalid offset")
 
-        # increment offset
-        offset += len(chunk)
+        # append data
+        data.extend(reply[5:])
 
-        # report offset
+        # report length
         if report:
-            report(offset)
+            report(len(data))
 
-        # increment count
-        num += 1
 
-    # send "close" command
-    cmd = pack("o", 5)
-    await _send(session, cmd, True, timeout)
+async def extract_archive(
+    session: Session,
+    dir: str,
+    archive: bytes,
+    report: Optional[Callable[[int], None]] = None,
+    timeout: float = 5.0,
+):
+    """Extract the given archive and replace the given directory once
+    complete. The directory remains unchanged if the transfer fails."""
+
+    # write archive (extract)
+    await _write(session, dir, 1 << 4, archive, report, timeout)
+
+
+def pack_archive(entries: List[FSArchiveEntry]) -> bytes:
+    """Encode the given entries as an archive. Directories must precede the
+    entries they contain."""
+
+    return b"".join(
+        pack("oisob", 1 if e.is_dir else 0, len(e.data), e.path, 0, e.data)
+        for e in entries
+    )
+
+
+def unpack_archive(archive: bytes) -> List[FSArchiveEntry]:
+    """Decode the entries of the given archive."""
+
+    # decode entries
+    entries = []
+    pos = 0
+    while pos < len(archive):
+        # find name end
+        end = archive.find(b"\x00", pos + 5)
+        if len(archive) - pos < 6 or end < 0:
+            raise RuntimeError("invalid archive")
+
+        # get size
+        is_dir, size = unpack("oi", archive[pos : pos + 5])
+        if len(archive) - end - 1 < size:
+            raise RuntimeError("invalid archive")
+
+        # add entry
+        path = archive[pos + 5 : end].decode()
+        data = archive[end + 1 : end + 1 + size]
+        entries.append(FSArchiveEntry(path, is_dir == 1, data))
+
+        # advance
+        pos = end + 1 + size
+
+    return entries
 
 
 async def rename_path(session: Session, from_: str, to: str, timeout: float = 5.0):
@@ -263,6 +408,59 @@ async def _receive(
     return data
 
 
+async def _write(
+    session: Session,
+    file: str,
+    flags: int,
+    data: bytes,
+    report: Optional[Callable[[int], None]] = None,
+    timeout: float = 5.0,
+):
+    # send "open" command
+    cmd = pack("oos", 2, flags, file)
+    await _send(session, cmd, True, timeout)
+
+    # get width
+    width = session.channel().width()
+
+    # get MTU and subtract overhead
+    mtu = await session.get_mtu(timeout) - 6
+
+    # write data in chunks
+    num = 0
+    offset = 0
+    while offset < len(data):
+        # determine chunk
+        chunk = data[offset : offset + mtu]
+
+        # determine mode
+        acked = num % width == 0 or offset + len(chunk) >= len(data)
+
+        # prepare "write" command (sequential or silent & sequential)
+        cmd = pack("ooib", 4, 1 << 1 if acked else (1 << 0) | (1 << 1), offset, chunk)
+
+        # send "write" command
+        await _send(session, cmd, False, timeout)
+
+        # receive ack or "error" replies
+        if acked:
+            await _receive(session, True, timeout)
+
+        # increment offset
+        offset += len(chunk)
+
+        # report offset
+        if report:
+            report(offset)
+
+        # increment count
+        num += 1
+
+    # send "close" command
+    cmd = pack("o", 5)
+    await _send(session, cmd, True, timeout)
+
+
 async def _send(session: Session, data: bytes, await_ack: bool, timeout: float = 5.0):
     # send command
     await session.send(_fs_endpoint, data, 0)
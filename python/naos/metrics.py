@@ -14,6 +14,10 @@ _metrics_endpoint = 0x05
 class MetricKind(IntEnum):
     COUNTER = 0
     GAUGE = 1
+    HISTOGRAM = 2
+
+
+METRIC_BUCKETS = 32
 
 
 class MetricType(IntEnum):
@@ -37,6 +41,41 @@ class MetricLayout:
     values: List[List[str]]
 
 
+@dataclass
+class MetricHistogram:
+    """Bucket 0 counts values below one and bucket i counts values in the range
+    [2^(i-1), 2^i)."""
+
+    buckets: List[int]
+    sum: int
+
+    @property
+    def count(self) -> int:
+        return sum(self.buckets)
+
+    @property
+    def mean(self) -> float:
+        return self.sum / self.count if self.count else 0.0
+
+    def quantile(self, q: float) -> float:
+        """Estimate the q-quantile (0-1) by linear interpolation within the
+        matching bucket."""
+
+        # find bucket of rank
+        rank = q * self.count
+        seen = 0
+        for i, n in enumerate(self.buckets):
+            if n == 0 or seen + n < rank:
+                seen += n
+                continue
+            if i == 0:
+                return 0.0
+            lower = float(2 ** (i - 1))
+            return lower + lower * (rank - seen) / n
+
+        return float(2 ** (METRIC_BUCKETS - 1)) if self.count else 0.0
+
+
 async def list_metrics(s: Session, timeout: float = 5.0) -> List[MetricInfo]:
     """Return a list of all metrics."""
 
@@ -155,6 +194,26 @@ async def read_double_metrics(
     return _convert(await read_metrics(s, ref, timeout), "d", 8)
 
 
+async def read_histogram_metrics(
+    s: Session, ref: int, timeout: float = 5.0
+) -> List[MetricHistogram]:
+    """Return the histograms of the referenced histogram metric."""
+
+    # verify length
+    data = await read_metrics(s, ref, timeout)
+    width = METRIC_BUCKETS * 4 + 8
+    if len(data) % width != 0:
+        raise RuntimeError(f"invalid metric payload length: {len(data)}")
+
+    # parse histograms
+    result = []
+    for i in range(0, len(data), width):
+        fields = struct.unpack(f"<{METRIC_BUCKETS}IQ", data[i : i + width])
+        result.append(MetricHistogram(list(fields[:-1]), fields[-1]))
+
+    return result
+
+
 def _convert(data: bytes, code: str, width: int) -> list:
     # verify length
     if len(data) % width != 0:
@@ -1,8 +1,9 @@
 import asyncio
+import fnmatch
 import hashlib
 import struct
 
-from naos import Message, Transport
+from naos import FSArchiveEntry, Message, Transport, pack_archive, unpack_archive
 
 
 class FakeDeviceTransport(Transport):
@@ -22,7 +23,10 @@ class FakeDeviceTransport(Transport):
         }
         self.files = {"/data/test.txt": b"hello world"}
         self.dirs = {"/data"}
+        self.mtimes = {}
+        self.legacy_list = False
         self.open_file = None
+        self.extract_dir = None
         self.read_chunk_size = 40
         self.metrics = {
             0: {
@@ -39,6 +43,15 @@ class FakeDeviceTransport(Transport):
                 "layout": [],
                 "values": struct.pack("<1i", 4711),
             },
+            2: {
+                "name": "latency",
+                "kind": 2,
+                "type": 0,
+                "layout": [],
+                "values": struct.pack(
+                    "<32IQ", *([1, 0, 0, 0, 2] + [0] * 6 + [1] + [0] * 20), 1050
+                ),
+            },
         }
         self.time_ms = 1700000000000
         self.time_offset = 3600
@@ -134,6 +147,10 @@ class FakeDeviceTransport(Transport):
             return replies + [ack]
         if cmd == 2:  # open
             flags, path = msg.data[1], msg.data[2:].decode()
+            if flags & (1 << 4):  # extract
+                self.extract_dir = path
+                path += ".extract"
+                self.files[path] = b""
             if flags & (1 << 0):  # create
                 self.files.setdefault(path, b"")
             if flags & (1 << 2):  # truncate
@@ -161,6 +178,15 @@ class FakeDeviceTransport(Transport):
             self.files[self.open_file] = data[:offset] + msg.data[6:]
             return [] if flags & (1 << 0) else [ack]  # silent
         if cmd == 5:  # close
+            if self.extract_dir is not None:
+                archive = self.files.pop(self.open_file)
+                prefix = self.extract_dir + "/"
+                for path in [p for p in self.files if p.startswith(prefix)]:
+                    del self.files[path]
+                for entry in unpack_archive(archive):
+                    if not entry.is_dir:
+                        self.files[self.extract_dir + "/" + entry.path] = entry.data
+                self.extract_dir = None
             self.open_file = None
             return [ack]
         if cmd == 6:  # rename
@@ -176,6 +202,54 @@ class FakeDeviceTransport(Transport):
         if cmd == 9:  # mkdir
             self.dirs.add(msg.data[1:].decode())
             return [ack]
+        if cmd == 13:  # archive
+            dir_ = msg.data[1:].decode()
+            archive = pack_archive(
+                [
+                    FSArchiveEntry(path[len(dir_) + 1 :], False, data)
+                    for path, data in sorted(self.files.items())
+                    if path.startswith(dir_ + "/")
+                ]
+            )
+            replies = [
+                Message(
+                    msg.session,
+                    0x03,
+                    struct.pack("<BI", 2, pos)
+                    + archive[pos : pos + self.read_chunk_size],
+                )
+                for pos in range(0, len(archive), self.read_chunk_size)
+            ]
+            return replies + [ack]
+        if cmd == 12 and not self.legacy_list:  # scan dir
+            cursor, limit, since = struct.unpack_from("<IHI", msg.data, 1)
+            dir_, _, pattern = msg.data[11:].decode().partition("\x00")
+            names = [
+                path[len(dir_) :].lstrip("/")
+                for path in sorted(self.files)
+                if path.startswith(dir_ + "/")
+            ]
+            entries = b""
+            count = 0
+            next_ = 0
+            for index, name in enumerate(names):
+                if index < cursor:
+                    continue
+                if limit and count >= limit:
+                    next_ = index
+                    break
+                mtime = self.mtimes.get(dir_ + "/" + name, 0)
+                if pattern and not fnmatch.fnmatchcase(name, pattern):
+                    continue
+                if since and mtime < since:
+                    continue
+                size = len(self.files[dir_ + "/" + name])
+                entries += struct.pack("<BII", 0, size, mtime) + name.encode() + b"\x00"
+                count += 1
+            reply = struct.pack("<BI", 5, next_) + entries
+            return [Message(msg.session, 0x03, reply), ack]
+        if cmd == 12:  # unknown
+            return [Message(msg.session, 0xFE, bytes([3]))]
 
         return [Message(msg.session, 0xFE, bytes([2]))]
 
@@ -4,8 +4,13 @@ import pytest
 
 from naos import (
     Channel,
+    FSArchiveEntry,
     Session,
+    archive_dir,
+    extract_archive,
     list_dir,
+    list_dir_page,
+    pack_archive,
     make_path,
     read_file,
     read_file_range,
@@ -13,6 +18,7 @@ from naos import (
     rename_path,
     sha256_file,
     stat_path,
+    unpack_archive,
     write_file,
 )
 
@@ -51,6 +57,29 @@ async def test_fs_list():
     assert infos[0].name == "test.txt"
     assert infos[0].size == 11
 
+    # filtered and paged listing
+    transport.files["/data/a.log"] = b"a"
+    transport.files["/data/b.log"] = b"bb"
+    transport.files["/data/c.log"] = b"ccc"
+    transport.mtimes["/data/a.log"] = 100
+    transport.mtimes["/data/b.log"] = 200
+    transport.mtimes["/data/c.log"] = 300
+
+    infos, cursor = await list_dir_page(session, "/data", "*.log", limit=2)
+    assert [i.name for i in infos] == ["a.log", "b.log"]
+    assert cursor == 2
+
+    infos = await list_dir(session, "/data", "*.log", since=200, limit=1)
+    assert [(i.name, i.size, i.mtime) for i in infos] == [
+        ("b.log", 2, 200),
+        ("c.log", 3, 300),
+    ]
+
+    # legacy fallback
+    transport.legacy_list = True
+    infos = await list_dir(session, "/data")
+    assert len(infos) == 4
+
     await channel.close()
 
 
@@ -101,3 +130,33 @@ async def test_fs_manage():
     assert (await stat_path(session, "/stuff")).is_dir
 
     await channel.close()
+
+
+async def test_fs_archive():
+    transport, channel, session = await open_session()
+
+    # archive directory (chunk size 40)
+    transport.files["/data/big.bin"] = bytes(range(100))
+    reports = []
+    archive = await archive_dir(session, "/data", reports.append)
+    assert reports[-1] == len(archive)
+    assert unpack_archive(archive) == [
+        FSArchiveEntry("big.bin", False, bytes(range(100))),
+        FSArchiveEntry("test.txt", False, b"hello world"),
+    ]
+
+    # extract archive replacing the directory
+    archive = pack_archive(
+        [
+            FSArchiveEntry("sub", True),
+            FSArchiveEntry("sub/new.txt", False, b"new"),
+        ]
+    )
+    await extract_archive(session, "/data", archive)
+    assert transport.files == {"/data/sub/new.txt": b"new"}
+
+    # reject truncated archives
+    with pytest.raises(RuntimeError, match="invalid archive"):
+        unpack_archive(archive[:-1])
+
+    await channel.close()
@@ -6,6 +6,7 @@ from naos import (
     describe_metric,
     list_metrics,
     read_double_metrics,
+    read_histogram_metrics,
     read_long_metrics,
 )
 
@@ -23,7 +24,7 @@ async def test_metrics_list():
     transport, channel, session = await open_session()
 
     metrics = await list_metrics(session)
-    assert len(metrics) == 2
+    assert len(metrics) == 3
     assert metrics[0].ref == 0
     assert metrics[0].kind == MetricKind.GAUGE
     assert metrics[0].type == MetricType.DOUBLE
@@ -32,6 +33,8 @@ async def test_metrics_list():
     assert metrics[1].name == "uptime"
     assert metrics[1].kind == MetricKind.COUNTER
     assert metrics[1].type == MetricType.LONG
+    assert metrics[2].name == "latency"
+    assert metrics[2].kind == MetricKind.HISTOGRAM
 
     await channel.close()
 
@@ -57,3 +60,16 @@ async def test_metrics_read():
     assert await read_long_metrics(session, 1) == [4711]
 
     await channel.close()
+
+
+async def test_metrics_read_histogram():
+    transport, channel, session = await open_session()
+
+    histograms = await read_histogram_metrics(session, 2)
+    assert len(histograms) == 1
+    assert histograms[0].count == 4
+    assert histograms[0].sum == 1050
+    assert histograms[0].mean == 262.5
+    assert histograms[0].quantile(0.5) == 12.0
+
+    await channel.close()
@@ -1,5 +1,5 @@
 import { Session } from "./session";
-import { pack, unpack } from "./utils";
+import { concat, pack, toView, unpack } from "./utils";
 
 const fsEndpoint = 0x3;
 
@@ -7,6 +7,14 @@ export interface FSInfo {
   name: string;
   isDir: boolean;
   size: number;
+  mtime?: number;
+}
+
+export interface FSListOptions {
+  pattern?: string;
+  since?: number;
+  limit?: number;
+  cursor?: number;
 }
 
 export async function statPath(
@@ -36,6 +44,105 @@ export async function statPath(
 }
 
 export async function listDir(
+  session: Session,
+  dir: string,
+  options: FSListOptions = {}
+): Promise<FSInfo[]> {
+  // prepare infos
+  const infos: FSInfo[] = [];
+  let cursor = options.cursor ?? 0;
+
+  while (true) {
+    // list page
+    let page: FSInfo[];
+    try {
+      [page, cursor] = await listDirPage(session, dir, { ...options, cursor });
+    } catch (err) {
+      if (
+        err instanceof Error &&
+        err.message === "unknown" &&
+        !options.pattern &&
+        !options.since &&
+        infos.length === 0
+      ) {
+        return await listDirLegacy(session, dir);
+      }
+      throw err;
+    }
+
+    // add infos
+    infos.push(...page);
+
+    // check cursor
+    if (cursor === 0) {
+      return infos;
+    }
+  }
+}
+
+export async function listDirPage(
+  session: Session,
+  dir: string,
+  options: FSListOptions = {}
+): Promise<[FSInfo[], number]> {
+  // send command
+  let cmd = pack(
+    "oihis",
+    12,
+    options.cursor ?? 0,
+    options.limit ?? 0,
+    options.since ?? 0,
+    dir
+  );
+  if (options.pattern) {
+    cmd = concat(cmd, pack("os", 0, options.pattern));
+  }
+  await send(session, cmd, false);
+
+  // prepare infos
+  const infos: FSInfo[] = [];
+  let cursor = 0;
+
+  while (true) {
+    // await reply
+    const reply = await receive(session, true);
+    if (!reply) {
+      return [infos, cursor];
+    }
+
+    // verify "entries" reply
+    if (reply.byteLength < 5 || reply[0] !== 5) {
+      throw new Error("invalid reply");
+    }
+
+    // get cursor
+    const view = toView(reply);
+    cursor = view.getUint32(1, true);
+
+    // parse entries
+    let pos = 5;
+    while (pos < reply.byteLength) {
+      // find name end
+      const end = reply.indexOf(0, pos + 9);
+      if (end < 0) {
+        throw new Error("invalid entry");
+      }
+
+      // add info
+      infos.push({
+        name: new TextDecoder().decode(reply.slice(pos + 9, end)),
+        isDir: reply[pos] === 1,
+        size: view.getUint32(pos + 1, true),
+        mtime: view.getUint32(pos + 5, true),
+      });
+
+      // advance
+      pos = end + 1;
+    }
+  }
+}
+
+async function listDirLegacy(
   session: Session,
   dir: string
 ): Promise<FSInfo[]> {
@@ -44,7 +151,7 @@ export async function listDir(
   await send(session, cmd, false);
 
   // prepare infos
-  const infos = [];
+  const infos: FSInfo[] = [];
 
   while (true) {
     // await reply
@@ -177,56 +284,59 @@ export async function writeFile(
   data: Uint8Array,
   report?: (count: number) => void
 ) {
-  // send "create" command (create & truncate)
-  let cmd = pack("oos", 2, (1 << 0) | (1 << 2), file);
-  await send(session, cmd, true);
-
-  // get width
-  const width = session.channel().width();
-
-  // get MTU
-  let mtu = await session.getMTU();
-
-  // subtract overhead
-  mtu -= 6;
+  // write file (create & truncate)
+  await write(session, file, (1 << 0) | (1 << 2), data, report);
+}
 
-  // write data in chunks
-  let num = 0;
-  let offset = 0;
-  while (offset < data.byteLength) {
-    // determine chunk size and chunk data
-    let chunkSize = Math.min(mtu, data.byteLength - offset);
-    let chunkData = data.slice(offset, offset + chunkSize);
+export async function archiveDir(
+  session: Session,
+  dir: string,
+  report?: (count: number) => void
+): Promise<Uint8Array> {
+  // send "archive" command
+  const cmd = pack("os", 13, dir);
+  await send(session, cmd, false);
 
-    // determine mode
-    let acked = num % width === 0 || offset + chunkSize >= data.byteLength;
+  // prepare chunks
+  const chunks: Uint8Array[] = [];
+  let total = 0;
 
-    // prepare "write" command (sequential or silent & sequential)
-    cmd = pack("ooib", 4, acked ? 1 << 1 : (1 << 0) | (1 << 1), offset, chunkData);
+  while (true) {
+    // await reply
+    const reply = await receive(session, true);
+    if (!reply) {
+      return concat(...chunks);
+    }
 
-    // send "write" command
-    await send(session, cmd, false);
+    // verify "chunk" reply
+    if (reply.byteLength < 5 || reply[0] !== 2) {
+      throw new Error("invalid reply");
+    }
 
-    // receive ack or "error" replies
-    if (acked) {
-      await receive(session, true);
+    // verify offset
+    if (toView(reply).getUint32(1, true) !== total) {
+      throw new Error("invalid offset");
     }
 
-    // increment offset
-    offset += chunkSize;
+    // append chunk
+    chunks.push(reply.slice(5));
+    total += reply.byteLength - 5;
 
-    // report offset
+    // report length
     if (report) {
-      report(offset);
+      report(total);
     }
-
-    // increment count
-    num += 1;
   }
+}
 
-  // send "close" command
-  cmd = pack("o", 5);
-  await send(session, cmd, true);
+export async function extractArchive(
+  session: Session,
+  dir: string,
+  archive: Uint8Array,
+  report?: (count: number) => void
+) {
+  // write archive (extract)
+  await write(session, dir, 1 << 4, archive, report);
 }
 
 export async function renamePath(session: Session, from: string, to: string) {
@@ -266,6 +376,65 @@ export async function makePath(session: Session, path: string) {
 
 /* Helpers */
 
+async function write(
+  session: Session,
+  file: string,
+  flags: number,
+  data: Uint8Array,
+  report?: (count: number) => void
+) {
+  // send "open" command
+  let cmd = pack("oos", 2, flags, file);
+  await send(session, cmd, true);
+
+  // get width
+  const width = session.channel().width();
+
+  // get MTU
+  let mtu = await session.getMTU();
+
+  // subtract overhead
+  mtu -= 6;
+
+  // write data in chunks
+  let num = 0;
+  let offset = 0;
+  while (offset < data.byteLength) {
+    // determine chunk size and chunk data
+    let chunkSize = Math.min(mtu, data.byteLength - offset);
+    let chunkData = data.slice(offset, offset + chunkSize);
+
+    // determine mode
+    let acked = num % width === 0 || offset + chunkSize >= data.byteLength;
+
+    // prepare "write" command (sequential or silent & sequential)
+    cmd = pack("ooib", 4, acked ? 1 << 1 : (1 << 0) | (1 << 1), offset, chunkData);
+
+    // send "write" command
+    await send(session, cmd, false);
+
+    // receive ack or "error" replies
+    if (acked) {
+      await receive(session, true);
+    }
+
+    // increment offset
+    offset += chunkSize;
+
+    // report offset
+    if (report) {
+      report(offset);
+    }
+
+    // increment count
+    num += 1;
+  }
+
+  // send "close" command
+  cmd = pack("o", 5);
+  await send(session, cmd, true);
+}
+
 async function receive(
   session: Session,
   expectAck: boolean,
@@ -1,11 +1,12 @@
 import { Session } from "./session";
-import { pack, toString, toView } from "./utils";
+import { concat, pack, toString, toView } from "./utils";
 
 const metricsEndpoint = 0x05;
 
 export enum MetricKind {
   counter,
   gauge,
+  histogram,
 }
 
 export enum MetricType {
@@ -211,3 +212,91 @@ export async function readDoubleMetrics(
 
   return list;
 }
+
+export async function streamMetrics(
+  s: Session,
+  refs: number[],
+  interval: number,
+  signal: AbortSignal,
+  fn: (values: Map<number, Uint8Array>) => void
+): Promise<void> {
+  // prepare command
+  const ms = Math.min(Math.max(Math.round(interval), 1), 0xffff);
+  const cmd = concat(pack("oh", 4, ms), new Uint8Array(refs));
+
+  // subscribe without checking ack, pushes may precede it
+  await s.send(metricsEndpoint, cmd, 0);
+
+  // prepare state, the device checks for keepalives only when a push is due
+  const values = new Map<number, Uint8Array>();
+  const timeout = Math.max(30000, 3 * ms);
+  let last = Date.now();
+
+  for (;;) {
+    // unsubscribe if requested
+    if (signal.aborted) {
+      await s.send(metricsEndpoint, pack("oh", 4, 0), 0);
+      for (;;) {
+        const [, ack] = await s.receive(metricsEndpoint, true, 5000);
+        if (ack) {
+          return;
+        }
+      }
+    }
+
+    // receive push
+    try {
+      const [frame, ack] = await s.receive(metricsEndpoint, true, 1000);
+      last = Date.now();
+
+      // handle ack and keepalive
+      if (ack || frame.length === 0) {
+        continue;
+      }
+
+      // apply entries: REF(1) | OFFSET(2) | LENGTH(2) | DATA(LENGTH)
+      const changed = new Map<number, Uint8Array>();
+      const view = toView(frame);
+      for (let pos = 0; pos < frame.length; ) {
+        if (frame.length - pos < 5) {
+          throw new Error("Invalid reply");
+        }
+        const ref = frame[pos];
+        const offset = view.getUint16(pos + 1, true);
+        const length = view.getUint16(pos + 3, true);
+        if (frame.length - pos < 5 + length) {
+          throw new Error("Invalid reply");
+        }
+        let data = values.get(ref) || new Uint8Array(0);
+        if (data.length < offset + length) {
+          const grown = new Uint8Array(offset + length);
+          grown.set(data);
+          data = grown;
+        }
+        data.set(frame.slice(pos + 5, pos + 5 + length), offset);
+        values.set(ref, data);
+        changed.set(ref, data.slice());
+        pos += 5 + length;
+      }
+
+      // yield changed values
+      fn(changed);
+    } catch (e) {
+      // stop on any error except timeout
+      if (e.message !== "timeout") {
+        throw e;
+      }
+
+      // continue if a push was received recently
+      if (Date.now() - last < timeout) {
+        continue;
+      }
+
+      // otherwise, subscribe again without checking ack
+      await s.send(metricsEndpoint, cmd, 0);
+
+      // update last push time
+      last = Date.now();
+    }
+  }
+}
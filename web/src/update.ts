@@ -1,5 +1,5 @@
 import { Session } from "./session";
-import { pack } from "./utils";
+import { pack, toView } from "./utils";
 
 const updateEndpoint = 0x2;
 
@@ -9,9 +9,27 @@ export async function update(
   report?: (count: number) => void,
   timeout: number = 30000
 ) {
-  // send "begin" command
-  let cmd = pack("oi", 0, data.length);
-  await session.send(updateEndpoint, cmd, timeout);
+  // hash image
+  const hash = new Uint8Array(await crypto.subtle.digest("SHA-256", data));
+
+  // send "resume" command, fall back to "begin" command
+  let offset: number;
+  let cmd: Uint8Array;
+  try {
+    offset = await resume(session, data.length, hash, timeout);
+  } catch (err) {
+    if (!(err instanceof Error) || err.message !== "unknown") {
+      throw err;
+    }
+    offset = 0;
+    cmd = pack("oi", 0, data.length);
+    await session.send(updateEndpoint, cmd, timeout);
+  }
+
+  // check offset
+  if (offset > data.length) {
+    throw new Error("invalid resume offset");
+  }
 
   // get width
   const width = session.channel().width();
@@ -24,7 +42,6 @@ export async function update(
 
   // write data in chunks
   let num = 0;
-  let offset = 0;
   while (offset < data.length) {
     // determine chunks size
     let chunkSize = Math.min(mtu, data.length - offset);
@@ -53,3 +70,24 @@ export async function update(
   cmd = pack("o", 3);
   await session.send(updateEndpoint, cmd, timeout);
 }
+
+async function resume(
+  session: Session,
+  size: number,
+  hash: Uint8Array,
+  timeout: number
+): Promise<number> {
+  // send "resume" command
+  const cmd = pack("oiob", 4, size, 0, hash);
+  await session.send(updateEndpoint, cmd, 0);
+
+  // await reply
+  const [reply] = await session.receive(updateEndpoint, false, timeout);
+
+  // verify reply
+  if (!reply || reply.length !== 4) {
+    throw new Error("invalid reply");
+  }
+
+  return toView(reply).getUint32(0, true);
+}